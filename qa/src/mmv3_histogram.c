@@ -0,0 +1,118 @@
+/*
+ * Exercise MMV v3 value handles and histograms - updates through
+ * handles looked up once, from several threads.
+ *
+ * Copyright (c) 2017 Red Hat.
+ */
+#include <pcp/pmapi.h>
+#include <pcp/mmv_stats.h>
+#include <pthread.h>
+
+static mmv_instances2_t bounds[] = {
+    {	.internal = 10, .external = "le10" },
+    {	.internal = 100, .external = "le100" },
+    {	.internal = 1000, .external = "le1000" },
+    {	.internal = 0x7fffffff, .external = "inf" },
+};
+
+static mmv_indom2_t indoms[] = {
+    {	.serial = 1,
+	.count = 4,
+	.instances = bounds,
+    },
+};
+
+static mmv_metric2_t metrics[] = {
+    {	.name = "latency",
+	.item = 1,
+	.type = MMV_TYPE_HISTOGRAM,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+	.indom = 1,
+    },
+    {	.name = "ops",
+	.item = 2,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+    },
+    {	.name = "last",
+	.item = 3,
+	.type = MMV_TYPE_I64,
+	.semantics = MMV_SEM_INSTANT,
+	.dimension = MMV_UNITS(0,0,0,0,0,0),
+    },
+};
+
+static void *addr;
+static int loops;
+static pthread_barrier_t barrier;
+
+static void *
+worker(void *arg)
+{
+    mmv_handle_t latency, ops, last;
+    int i;
+
+    if (mmv_lookup_handle(addr, "latency", NULL, &latency) < 0 ||
+	mmv_lookup_handle(addr, "ops", NULL, &ops) < 0 ||
+	mmv_lookup_handle(addr, "last", NULL, &last) < 0) {
+	fprintf(stderr, "mmv_lookup_handle: %s\n", strerror(errno));
+	return NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+	mmv_handle_record(&latency, i % 2000);
+	mmv_handle_add(&ops, 1);
+	mmv_handle_set(&last, i);
+	/* every thread takes its stripe before any can exit */
+	if (i == 0)
+	    pthread_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    mmv_handle_t handle;
+    pthread_t *tids;
+    char *file;
+    int i, threads, stripes;
+
+    if (argc != 5) {
+	fprintf(stderr, "Usage: %s file threads stripes loops\n", argv[0]);
+	return 1;
+    }
+    file = argv[1];
+    threads = atoi(argv[2]);
+    stripes = atoi(argv[3]);
+    loops = atoi(argv[4]);
+
+    addr = mmv_stats3_init(file, 0, 0, stripes, metrics,
+			sizeof(metrics) / sizeof(metrics[0]), indoms, 1);
+    if (!addr) {
+	fprintf(stderr, "mmv_stats3_init: %s - %s\n", file, strerror(errno));
+	return 1;
+    }
+
+    if ((tids = calloc(threads, sizeof(pthread_t))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", argv[0]);
+	return 1;
+    }
+    pthread_barrier_init(&barrier, NULL, threads);
+    for (i = 0; i < threads; i++)
+	pthread_create(&tids[i], NULL, worker, NULL);
+    for (i = 0; i < threads; i++)
+	pthread_join(tids[i], NULL);
+
+    /* samples through the name-based interface land in buckets too */
+    mmv_stats_add(addr, "latency", NULL, -5);
+    mmv_stats_add(addr, "latency", NULL, 5000000000.0);
+
+    if (mmv_lookup_handle(addr, "missing", NULL, &handle) < 0)
+	printf("missing: %s\n", strerror(errno));
+
+    mmv_stats_stop(file, addr);
+    return 0;
+}
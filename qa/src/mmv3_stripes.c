@@ -0,0 +1,131 @@
+/*
+ * Exercise MMV v3 striped values - concurrent updates from several
+ * threads, which may outnumber the stripes (atomic updates), and from
+ * successive waves of threads, reusing the stripes of exited threads.
+ *
+ * Copyright (c) 2017 Red Hat.
+ */
+#include <pcp/pmapi.h>
+#include <pcp/mmv_stats.h>
+#include <pthread.h>
+
+static mmv_instances2_t sides[] = {
+    {	.internal = 0, .external = "left" },
+    {	.internal = 1, .external = "right" },
+};
+
+static mmv_indom2_t indoms[] = {
+    {	.serial = 1,
+	.count = 2,
+	.instances = sides,
+    },
+};
+
+static mmv_metric2_t metrics[] = {
+    {	.name = "counter",
+	.item = 1,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+    },
+    {	.name = "total",
+	.item = 2,
+	.type = MMV_TYPE_DOUBLE,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+    },
+    {	.name = "sides",
+	.item = 3,
+	.type = MMV_TYPE_I32,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+	.indom = 1,
+    },
+    {	.name = "gauge",
+	.item = 4,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+    },
+    {	.name = "label",
+	.item = 5,
+	.type = MMV_TYPE_STRING,
+	.semantics = MMV_SEM_INSTANT,
+	.dimension = MMV_UNITS(0,0,0,0,0,0),
+    },
+};
+
+static void *addr;
+static int loops;
+static pthread_barrier_t barrier;
+
+static void *
+worker(void *arg)
+{
+    pmAtomValue *counter, *total, *left, *right, *gauge;
+    int i;
+
+    counter = mmv_lookup_value_desc(addr, "counter", NULL);
+    total = mmv_lookup_value_desc(addr, "total", NULL);
+    left = mmv_lookup_value_desc(addr, "sides", "left");
+    right = mmv_lookup_value_desc(addr, "sides", "right");
+    gauge = mmv_lookup_value_desc(addr, "gauge", NULL);
+
+    for (i = 0; i < loops; i++) {
+	mmv_inc_value(addr, counter, 1);
+	mmv_inc_value(addr, total, 0.5);
+	mmv_inc_value(addr, left, 1);
+	mmv_inc_value(addr, right, 2);
+	mmv_inc_value(addr, gauge, 1);
+	/* every thread of a wave takes its stripe before any can exit */
+	if (i == 0)
+	    pthread_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    pthread_t *tids;
+    char *file;
+    int i, w, threads, stripes, waves = 1;
+
+    if (argc != 5 && argc != 6) {
+	fprintf(stderr, "Usage: %s file threads stripes loops [waves]\n",
+		argv[0]);
+	return 1;
+    }
+    file = argv[1];
+    threads = atoi(argv[2]);
+    stripes = atoi(argv[3]);
+    loops = atoi(argv[4]);
+    if (argc == 6)
+	waves = atoi(argv[5]);
+
+    addr = mmv_stats3_init(file, 0, 0, stripes, metrics,
+			sizeof(metrics) / sizeof(metrics[0]), indoms, 1);
+    if (!addr) {
+	fprintf(stderr, "mmv_stats3_init: %s - %s\n", file, strerror(errno));
+	return 1;
+    }
+
+    if ((tids = calloc(threads, sizeof(pthread_t))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", argv[0]);
+	return 1;
+    }
+    pthread_barrier_init(&barrier, NULL, threads);
+    for (w = 0; w < waves; w++) {
+	for (i = 0; i < threads; i++)
+	    pthread_create(&tids[i], NULL, worker, NULL);
+	for (i = 0; i < threads; i++)
+	    pthread_join(tids[i], NULL);
+    }
+
+    /* an explicit set replaces the value in every stripe */
+    mmv_set_value(addr, mmv_lookup_value_desc(addr, "gauge", NULL), 42);
+    mmv_stats_set_string(addr, "label", NULL, "striped");
+
+    mmv_stats_stop(file, addr);
+    return 0;
+}
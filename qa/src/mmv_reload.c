@@ -0,0 +1,235 @@
+/*
+ * Add, rewrite and remove MMV client files between fetches, with two
+ * clients exporting the same metrics in the same cluster - the client
+ * that appeared first provides the values both export, and instances
+ * of the indom they share are listed once.
+ *
+ * Run in a local context with the mmv DSO PMDA, e.g.
+ *	mmv_reload -L -Kclear -Kadd,70,.../pmda_mmv,mmv_init
+ *
+ * Copyright (c) 2017 Red Hat.
+ */
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/mmv_stats.h>
+
+#define CLUSTER	321
+
+static mmv_instances2_t first_insts[] = {
+    {	.internal = 1, .external = "a" },
+    {	.internal = 2, .external = "b" },
+};
+
+static mmv_instances2_t second_insts[] = {
+    {	.internal = 2, .external = "b" },
+    {	.internal = 3, .external = "c" },
+};
+
+static mmv_indom2_t first_indoms[] = {
+    {	.serial = 1, .count = 2, .instances = first_insts },
+};
+
+static mmv_indom2_t second_indoms[] = {
+    {	.serial = 1, .count = 2, .instances = second_insts },
+};
+
+static mmv_metric2_t metrics[] = {
+    {	.name = "reload.owner",
+	.item = 1,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+	.dimension = MMV_UNITS(0,0,0,0,0,0),
+    },
+    {	.name = "reload.value",
+	.item = 2,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+	.dimension = MMV_UNITS(0,0,0,0,0,0),
+	.indom = 1,
+    },
+};
+
+static char *names[] = { "mmv.reload.owner", "mmv.reload.value" };
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_SPECLOCAL,
+    PMOPT_LOCALPMDA,
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "D:K:L?",
+    .long_options = longopts,
+};
+
+/*
+ * Write a client file; owner identifies the client and its rewrites,
+ * and each value is owner * 100 plus the instance identifier.
+ */
+static void
+client(const char *file, unsigned int owner, mmv_indom2_t *indom)
+{
+    void *addr;
+    int i;
+
+    addr = mmv_stats2_init(file, CLUSTER, MMV_FLAG_NOPREFIX,
+		metrics, sizeof(metrics) / sizeof(metrics[0]), indom, 1);
+    if (!addr) {
+	fprintf(stderr, "mmv_stats2_init: %s - %s\n", file, strerror(errno));
+	exit(1);
+    }
+    mmv_stats_set(addr, "reload.owner", NULL, owner);
+    for (i = 0; i < indom->count; i++)
+	mmv_stats_set(addr, "reload.value", indom->instances[i].external,
+			owner * 100 + indom->instances[i].internal);
+    /* the file stays behind, mapped by the PMDA */
+    mmv_stats_stop(file, addr);
+}
+
+static void
+unclient(const char *file)
+{
+    char path[MAXPATHLEN];
+
+    snprintf(path, sizeof(path), "%s%cmmv%c%s", pmGetConfig("PCP_TMP_DIR"),
+		__pmPathSeparator(), __pmPathSeparator(), file);
+    if (unlink(path) < 0) {
+	fprintf(stderr, "unlink: %s - %s\n", file, strerror(errno));
+	exit(1);
+    }
+}
+
+static void
+reload(void)
+{
+    static pmID pmid = PM_ID_NULL;
+    static char *name = "mmv.control.reload";
+    pmResult *result;
+    pmAtomValue atom;
+    int sts;
+
+    if (pmid == PM_ID_NULL && (sts = pmLookupName(1, &name, &pmid)) < 0) {
+	fprintf(stderr, "pmLookupName: %s: %s\n", name, pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmFetch(1, &pmid, &result)) < 0) {
+	fprintf(stderr, "pmFetch: %s: %s\n", name, pmErrStr(sts));
+	exit(1);
+    }
+    atom.l = 1;
+    __pmStuffValue(&atom, &result->vset[0]->vlist[0], PM_TYPE_32);
+    result->vset[0]->valfmt = PM_VAL_INSITU;
+    if ((sts = pmStore(result)) < 0) {
+	fprintf(stderr, "pmStore: %s: %s\n", name, pmErrStr(sts));
+	exit(1);
+    }
+    pmFreeResult(result);
+}
+
+static void
+fetch(const char *step)
+{
+    pmValueSet *vsp;
+    pmResult *result;
+    pmDesc desc;
+    pmID pmid;
+    char **instnames;
+    int *instlist;
+    int i, j, n, sts;
+
+    reload();
+    printf("\n=== %s ===\n", step);
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+	printf("%s:", names[i]);
+	if ((sts = pmLookupName(1, &names[i], &pmid)) < 0) {
+	    printf(" %s\n", pmErrStr(sts));
+	    continue;
+	}
+	if ((sts = pmLookupDesc(pmid, &desc)) < 0) {
+	    printf(" pmLookupDesc: %s\n", pmErrStr(sts));
+	    continue;
+	}
+	if (desc.indom != PM_INDOM_NULL) {
+	    if ((n = pmGetInDom(desc.indom, &instlist, &instnames)) < 0) {
+		printf(" pmGetInDom: %s\n", pmErrStr(n));
+		continue;
+	    }
+	    printf(" %d instances", n);
+	    for (j = 0; j < n; j++)
+		printf(" [%d \"%s\"]", instlist[j], instnames[j]);
+	    printf("\n   ");
+	    if (n > 0) {
+		free(instlist);
+		free(instnames);
+	    }
+	}
+	if ((sts = pmFetch(1, &pmid, &result)) < 0) {
+	    printf(" pmFetch: %s\n", pmErrStr(sts));
+	    continue;
+	}
+	vsp = result->vset[0];
+	if (vsp->numval < 0)
+	    printf(" %s", pmErrStr(vsp->numval));
+	else if (vsp->numval == 0)
+	    printf(" no values");
+	for (j = 0; j < vsp->numval; j++) {
+	    if (vsp->vlist[j].inst != PM_IN_NULL)
+		printf(" [%d]", vsp->vlist[j].inst);
+	    printf(" %d", vsp->vlist[j].value.lval);
+	}
+	putchar('\n');
+	pmFreeResult(result);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int c, sts;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind != argc || opts.context != PM_CONTEXT_LOCAL) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+    if ((sts = pmNewContext(PM_CONTEXT_LOCAL, NULL)) < 0) {
+	fprintf(stderr, "pmNewContext: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+
+    client("first", 1, first_indoms);
+    fetch("first client");
+
+    client("second", 2, second_indoms);
+    fetch("second client added, sharing cluster and indom");
+
+    client("first", 11, first_indoms);
+    fetch("first client rewritten");
+
+    unclient("second");
+    fetch("second client removed");
+
+    client("second", 22, second_indoms);
+    fetch("second client added again");
+
+    unclient("first");
+    fetch("first client removed");
+
+    client("first", 111, first_indoms);
+    fetch("first client added after second");
+
+    unclient("first");
+    unclient("second");
+    fetch("all clients removed");
+
+    exit(0);
+}
@@ -0,0 +1,540 @@
+/*
+ * Exercise the libpcp_pmda batched fetch callback, and the fallback
+ * to the per-value fetch callback for metrics the batch callback
+ * declines with PMDA_FETCH_UNBATCHED.
+ *
+ * Every value says which callback produced it - batch values are
+ * below 1000, per-value callback values are 1000 and above.
+ *
+ * With -r the PMDA runs under pmdaMain in a child process, so that its
+ * pmResult values are recycled between fetches rather than freed, and
+ * the parent sends the fetch PDUs - the values of every fetch are
+ * checked, over an instance domain that changes size from one fetch to
+ * the next, and the PMDA's memory use must not grow once warmed up.
+ *
+ * Copyright (c) 2017 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/pmda.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define NSIZES		64	/* most instances in the "sizes" indom */
+#define NFIXED		5	/* metrics fetched without -r */
+#define STRLEN		40	/* longest string value is STRLEN-1 */
+
+static pmdaInstid colours[] = {
+    { 0, "red" }, { 1, "green" }, { 2, "blue" }, { 3, "black" }
+};
+
+static pmdaInstid sizes[NSIZES];
+
+static pmdaIndom indomtab[] = {
+    { 0, 4, colours },
+    { 1, NSIZES, sizes },
+};
+
+static pmdaMetric metrictab[] = {
+/* 0: values for all instances in one call, some missing or in error */
+    { NULL, { PMDA_PMID(0,0), PM_TYPE_U32, 0, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* 1: singular string value, from the batch callback */
+    { NULL, { PMDA_PMID(0,1), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* 2: declined by the batch callback, so fetched value by value */
+    { NULL, { PMDA_PMID(0,2), PM_TYPE_U32, 0, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* 3: batch callback error for every instance */
+    { NULL, { PMDA_PMID(0,3), PM_TYPE_U32, 0, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* 4: batch callback returns PMDA_FETCH_STATIC - success, not a fallback */
+    { NULL, { PMDA_PMID(0,4), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER,
+	PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+/* 5: varying number of instances, from the batch callback */
+    { NULL, { PMDA_PMID(0,5), PM_TYPE_U32, 1, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* 6: strings of varying length, from the batch callback */
+    { NULL, { PMDA_PMID(0,6), PM_TYPE_STRING, 1, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* 7: 64-bit values, declined by the batch callback */
+    { NULL, { PMDA_PMID(0,7), PM_TYPE_U64, 1, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* 8: maximum resident set size of the PMDA, from getrusage */
+    { NULL, { PMDA_PMID(0,8), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+};
+#define NMETRICS	(sizeof(metrictab)/sizeof(metrictab[0]))
+
+static int	nbatch;
+static int	nsingle;
+static char	label[] = "batched";
+static int	nfetch;		/* fetch number, sets the size of indom 1 */
+static char	strings[NSIZES][STRLEN];
+
+/* instances in indom 1 for fetch number n, in a different order each time */
+static int
+numsizes(int n)
+{
+    return (n * 37) % NSIZES + 1;
+}
+
+static unsigned int
+sizes_u32(int n, int inst)
+{
+    return n * 1000 + inst;
+}
+
+static void
+sizes_string(int n, int inst, char *buf)
+{
+    int		len = (n + inst) % STRLEN;
+
+    memset(buf, 'a' + inst % 26, len);
+    buf[len] = '\0';
+}
+
+static __uint64_t
+sizes_u64(int n, int inst)
+{
+    return ((__uint64_t)n << 32) | inst;
+}
+
+static int
+batch_fetchCallBack(pmdaMetric *mdesc, int numinst, const unsigned int *instlist,
+		pmAtomValue *avlist, int *stslist)
+{
+    int		i;
+
+    nbatch++;
+    switch (pmid_item(mdesc->m_desc.pmid)) {
+    case 0:
+	for (i = 0; i < numinst; i++) {
+	    if (instlist[i] == 2)
+		continue;	/* stays PMDA_FETCH_NOVALUES */
+	    if (instlist[i] == 3) {
+		stslist[i] = PM_ERR_AGAIN;
+		continue;
+	    }
+	    avlist[i].ul = 100 + instlist[i];
+	    stslist[i] = PMDA_FETCH_STATIC;
+	}
+	return 0;
+    case 1:
+	avlist[0].cp = label;
+	stslist[0] = PMDA_FETCH_STATIC;
+	return 0;
+    case 2:
+	return PMDA_FETCH_UNBATCHED;
+    case 3:
+	return PM_ERR_APPVERSION;
+    case 4:
+	avlist[0].ull = 400;
+	stslist[0] = PMDA_FETCH_STATIC;
+	return PMDA_FETCH_STATIC;
+    case 5:
+	for (i = 0; i < numinst; i++) {
+	    avlist[i].ul = sizes_u32(nfetch, instlist[i]);
+	    stslist[i] = PMDA_FETCH_STATIC;
+	}
+	return 0;
+    case 6:
+	/* values are copied after the call, so one buffer per instance */
+	for (i = 0; i < numinst; i++) {
+	    sizes_string(nfetch, instlist[i], strings[instlist[i]]);
+	    avlist[i].cp = strings[instlist[i]];
+	    stslist[i] = PMDA_FETCH_STATIC;
+	}
+	return 0;
+    case 7:
+    case 8:
+	return PMDA_FETCH_UNBATCHED;
+    }
+    return PM_ERR_PMID;
+}
+
+static int
+single_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
+{
+    nsingle++;
+    switch (pmid_item(mdesc->m_desc.pmid)) {
+    case 0:
+    case 2:
+    case 3:
+	atom->ul = 1000 + inst;
+	return PMDA_FETCH_STATIC;
+    case 1:
+	atom->cp = "unbatched";
+	return PMDA_FETCH_STATIC;
+    case 4:
+	atom->ull = 4000;
+	return PMDA_FETCH_STATIC;
+    case 5:
+	atom->ul = sizes_u32(nfetch, inst) + 1000000;
+	return PMDA_FETCH_STATIC;
+    case 6:
+	sizes_string(nfetch, inst, strings[0]);
+	atom->cp = strings[0];
+	return PMDA_FETCH_STATIC;
+    case 7:
+	atom->ull = sizes_u64(nfetch, inst);
+	return PMDA_FETCH_STATIC;
+    case 8: {
+	struct rusage	usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+	    return -oserror();
+	atom->ull = usage.ru_maxrss;
+	return PMDA_FETCH_STATIC;
+	}
+    }
+    return PM_ERR_PMID;
+}
+
+/*
+ * Each fetch PDU sees a different number of instances in indom 1
+ */
+static int
+batch_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
+{
+    int		sts;
+
+    indomtab[1].it_numinst = numsizes(nfetch);
+    sts = pmdaFetch(numpmid, pmidlist, resp, pmda);
+    nfetch++;
+    return sts;
+}
+
+static void
+dump_result(pmResult *result, pmdaExt *pmda)
+{
+    pmValueSet	*vsp;
+    pmAtomValue	atom;
+    pmDesc	desc;
+    char	strbuf[20];
+    int		i, j;
+
+    for (i = 0; i < result->numpmid; i++) {
+	vsp = result->vset[i];
+	printf("%s:", pmIDStr_r(vsp->pmid, strbuf, sizeof(strbuf)));
+	if (vsp->numval < 0) {
+	    printf(" %s\n", pmErrStr(vsp->numval));
+	    continue;
+	}
+	if (vsp->numval == 0) {
+	    printf(" no values\n");
+	    continue;
+	}
+	pmdaDesc(vsp->pmid, &desc, pmda);
+	for (j = 0; j < vsp->numval; j++) {
+	    if (vsp->vlist[j].inst == PM_IN_NULL)
+		printf(" ");
+	    else
+		printf(" [%d]", vsp->vlist[j].inst);
+	    pmExtractValue(vsp->valfmt, &vsp->vlist[j], desc.type,
+			    &atom, desc.type);
+	    switch (desc.type) {
+	    case PM_TYPE_U32:
+		printf("%u", atom.ul);
+		break;
+	    case PM_TYPE_U64:
+		printf("%llu", (unsigned long long)atom.ull);
+		break;
+	    case PM_TYPE_STRING:
+		printf("\"%s\"", atom.cp);
+		free(atom.cp);
+		break;
+	    }
+	}
+	putchar('\n');
+    }
+}
+
+/*
+ * Check the values of the indom 1 metrics from fetch number n, returns
+ * the number of wrong or missing values
+ */
+static int
+check_result(pmResult *result, int n)
+{
+    pmValueSet	*vsp;
+    pmAtomValue	atom;
+    char	buf[STRLEN];
+    int		i, j, inst, wrong = 0;
+
+    for (i = 0; i < result->numpmid; i++) {
+	vsp = result->vset[i];
+	switch (pmid_item(vsp->pmid)) {
+	case 5:
+	case 6:
+	case 7:
+	    break;
+	default:
+	    continue;
+	}
+	if (vsp->numval != numsizes(n)) {
+	    fprintf(stderr, "fetch %d: %s: %d values, expected %d\n", n,
+		    pmIDStr(vsp->pmid), vsp->numval, numsizes(n));
+	    wrong++;
+	    continue;
+	}
+	for (j = 0; j < vsp->numval; j++) {
+	    inst = vsp->vlist[j].inst;
+	    switch (pmid_item(vsp->pmid)) {
+	    case 5:
+		if (pmExtractValue(vsp->valfmt, &vsp->vlist[j], PM_TYPE_U32,
+			&atom, PM_TYPE_U32) < 0 || atom.ul != sizes_u32(n, inst))
+		    wrong++;
+		break;
+	    case 6:
+		sizes_string(n, inst, buf);
+		if (pmExtractValue(vsp->valfmt, &vsp->vlist[j], PM_TYPE_STRING,
+			&atom, PM_TYPE_STRING) < 0)
+		    wrong++;
+		else {
+		    if (strcmp(atom.cp, buf) != 0)
+			wrong++;
+		    free(atom.cp);
+		}
+		break;
+	    case 7:
+		if (pmExtractValue(vsp->valfmt, &vsp->vlist[j], PM_TYPE_U64,
+			&atom, PM_TYPE_U64) < 0 || atom.ull != sizes_u64(n, inst))
+		    wrong++;
+		break;
+	    }
+	}
+    }
+    return wrong;
+}
+
+static pmResult *
+recycle_fetch(int infd, int outfd, int numpmid, pmID *pmidlist)
+{
+    __pmPDU	*pb;
+    pmResult	*result;
+    int		sts;
+
+    if ((sts = __pmSendFetch(outfd, FROM_ANON, 0, NULL, numpmid, pmidlist)) < 0 ||
+	(sts = __pmGetPDU(infd, ANY_SIZE, TIMEOUT_NEVER, &pb)) != PDU_RESULT) {
+	fprintf(stderr, "%s: fetch PDU: %s\n", pmProgname,
+		sts < 0 ? pmErrStr(sts) : "unexpected PDU");
+	exit(1);
+    }
+    sts = __pmDecodeResult(pb, &result);
+    __pmUnpinPDUBuf(pb);
+    if (sts < 0) {
+	fprintf(stderr, "%s: __pmDecodeResult: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    return result;
+}
+
+/*
+ * Run the PMDA under pmdaMain in a child, talking PDUs to it over
+ * pipes, so the pmResult from each fetch is recycled rather than freed
+ */
+static void
+recycle(pmdaInterface *dispatch, int iterations)
+{
+    pmID	pmidlist[NMETRICS];
+    pmID	maxrss = PMDA_PMID(0,8);
+    pmResult	*result;
+    __pmPDU	*pb;
+    __pmCred	handshake;
+    __uint64_t	warm = 0;
+    pmAtomValue	atom = { 0 };
+    pid_t	pid;
+    int		in[2], out[2];
+    int		i, n, sts, wrong = 0;
+
+    if (iterations <= 2 * NSIZES) {
+	fprintf(stderr, "%s: -r needs more than %d iterations\n",
+		pmProgname, 2 * NSIZES);
+	exit(1);
+    }
+    for (i = 0; i < NMETRICS - 1; i++)
+	pmidlist[i] = metrictab[i].m_desc.pmid;
+
+    if (pipe(in) < 0 || pipe(out) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    if ((pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (pid == 0) {
+	dup2(out[0], fileno(stdin));
+	dup2(in[1], fileno(stdout));
+	close(in[0]); close(in[1]);
+	close(out[0]); close(out[1]);
+	dispatch->version.any.fetch = batch_fetch;
+	pmdaConnect(dispatch);
+	if (dispatch->status != 0)
+	    exit(1);
+	pmdaMain(dispatch);
+	exit(0);
+    }
+    close(in[1]);
+    close(out[0]);
+
+    /* credentials exchange, as pmcd would */
+    if ((sts = __pmGetPDU(in[0], ANY_SIZE, TIMEOUT_DEFAULT, &pb)) != PDU_CREDS) {
+	fprintf(stderr, "%s: no credentials from PMDA: %d\n", pmProgname, sts);
+	exit(1);
+    }
+    __pmUnpinPDUBuf(pb);
+    __pmSetVersionIPC(in[0], PDU_VERSION);
+    __pmSetVersionIPC(out[1], PDU_VERSION);
+    memset(&handshake, 0, sizeof(handshake));
+    handshake.c_type = CVERSION;
+    handshake.c_vala = PDU_VERSION;
+    __pmSendCreds(out[1], getpid(), 1, &handshake);
+
+    /* the values of the fixed metrics match the unrecycled fetches */
+    for (n = 0; n < 2; n++) {
+	result = recycle_fetch(in[0], out[1], NFIXED, pmidlist);
+	printf("fetch %d:\n", n);
+	dump_result(result, dispatch->version.any.ext);
+	pmFreeResult(result);
+    }
+
+    /* two passes over every size, then measure, then the rest */
+    for (i = 0; i < iterations; i++, n++) {
+	result = recycle_fetch(in[0], out[1], NMETRICS - 1, pmidlist);
+	wrong += check_result(result, n);
+	pmFreeResult(result);
+	if (i == 2 * NSIZES || i == iterations - 1) {
+	    result = recycle_fetch(in[0], out[1], 1, &maxrss);
+	    n++;
+	    if (result->vset[0]->numval != 1 ||
+		pmExtractValue(result->vset[0]->valfmt,
+			&result->vset[0]->vlist[0], PM_TYPE_U64,
+			&atom, PM_TYPE_U64) < 0) {
+		fprintf(stderr, "%s: no maxrss value\n", pmProgname);
+		exit(1);
+	    }
+	    pmFreeResult(result);
+	    if (i == 2 * NSIZES)
+		warm = atom.ull;
+	}
+    }
+    printf("%d fetches of 1 to %d instances: %d values wrong\n",
+		iterations, NSIZES, wrong);
+    printf("maximum resident set size %s after warm-up\n",
+		atom.ull > warm ? "grew" : "unchanged");
+
+    close(out[1]);
+    waitpid(pid, &sts, 0);
+    close(in[0]);
+}
+
+int
+main(int argc, char **argv)
+{
+    int			c;
+    int			sts;
+    int			errflag = 0;
+    int			batch = 1;
+    int			single = 1;
+    int			recycled = 0;
+    int			iterations = 1;
+    int			i;
+    pmID		pmidlist[NFIXED];
+    pmResult		*result;
+    pmdaInterface	dispatch;
+    pmdaExt		*pmda;
+    char		*endnum;
+    static char		*usage = "[-D debug] [-b] [-i iterations] [-r] [-s]";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "bD:i:rs")) != EOF) {
+	switch (c) {
+
+	case 'b':	/* batch callback only */
+	    single = 0;
+	    break;
+
+	case 'D':	/* debug flag */
+	    sts = __pmParseDebug(optarg);
+	    if (sts < 0) {
+		fprintf(stderr, "%s: unrecognized debug flag specification (%s)\n",
+		    pmProgname, optarg);
+		errflag++;
+	    }
+	    else
+		pmDebug |= sts;
+	    break;
+
+	case 'i':
+	    iterations = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || iterations < 1) {
+		fprintf(stderr, "%s: -i requires iteration count\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+
+	case 'r':	/* recycled results, from pmdaMain */
+	    recycled = 1;
+	    break;
+
+	case 's':	/* per-value callback only */
+	    batch = 0;
+	    break;
+
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+
+    if (errflag || optind != argc || (!batch && !single)) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    for (i = 0; i < NSIZES; i++) {
+	/* most recent first, so the instance order differs from the ids */
+	sizes[i].i_inst = NSIZES - 1 - i;
+	sizes[i].i_name = "size";
+    }
+
+    pmdaDaemon(&dispatch, PMDA_INTERFACE_5, pmProgname, 250, NULL, NULL);
+    if (batch)
+	pmdaSetBatchFetchCallBack(&dispatch, batch_fetchCallBack);
+    if (single)
+	pmdaSetFetchCallBack(&dispatch, single_fetchCallBack);
+    pmdaInit(&dispatch, indomtab, sizeof(indomtab)/sizeof(indomtab[0]),
+		metrictab, sizeof(metrictab)/sizeof(metrictab[0]));
+    if (dispatch.status != 0) {
+	fprintf(stderr, "%s: pmdaInit: %s\n", pmProgname, pmErrStr(dispatch.status));
+	exit(1);
+    }
+    pmda = dispatch.version.any.ext;
+
+    if (recycled) {
+	recycle(&dispatch, iterations);
+	exit(0);
+    }
+
+    for (i = 0; i < NFIXED; i++)
+	pmidlist[i] = metrictab[i].m_desc.pmid;
+
+    for (i = 0; i < iterations; i++) {
+	nbatch = nsingle = 0;
+	if ((sts = pmdaFetch(NFIXED, pmidlist, &result, pmda)) < 0) {
+	    fprintf(stderr, "%s: pmdaFetch: %s\n", pmProgname, pmErrStr(sts));
+	    exit(1);
+	}
+	printf("fetch %d: %d batch calls, %d per-value calls\n",
+		i, nbatch, nsingle);
+	dump_result(result, pmda);
+	__pmFreeResultValues(result);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,202 @@
+/*
+ * Microbenchmark for libpcp_pmda metric table lookups, as done by
+ * pmdaDesc and pmdaFetch for each requested PMID.
+ *
+ * Builds a metric table spread over several clusters (so it cannot be
+ * direct mapped), and times pmdaDesc and pmdaFetch across all of the
+ * metrics.  The -l option also times the linear table scan that was
+ * used before the PMID hash was built automatically, for comparison.
+ *
+ * Copyright (c) 2017 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/pmda.h>
+
+static int
+fetch_callback(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
+{
+    atom->ul = pmid_item(mdesc->m_desc.pmid);
+    return PMDA_FETCH_STATIC;
+}
+
+static pmdaMetric *
+linear_search(pmID pmid, pmdaExt *pmda)
+{
+    int		i;
+
+    for (i = 0; i < pmda->e_nmetrics; i++)
+	if (pmda->e_metrics[i].m_desc.pmid == pmid)
+	    return &pmda->e_metrics[i];
+    return NULL;
+}
+
+static double
+elapsed(struct timeval *start)
+{
+    struct timeval	now;
+
+    gettimeofday(&now, NULL);
+    return __pmtimevalSub(&now, start);
+}
+
+int
+main(int argc, char **argv)
+{
+    int			c;
+    int			sts;
+    int			errflag = 0;
+    int			clusters = 16;
+    int			nmetrics = 4096;
+    int			iterations = 100;
+    int			linear = 0;
+    int			timing = 0;
+    int			found;
+    int			i, m;
+    pmID		*pmidlist;
+    pmDesc		desc;
+    pmResult		*result;
+    pmdaMetric		*metrics;
+    pmdaInterface	dispatch;
+    pmdaExt		*pmda;
+    struct timeval	start;
+    double		delta;
+    char		*endnum;
+    static char		*usage = "[-D debug] [-c clusters] [-n metrics] [-i iterations] [-l] [-t]";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "c:D:i:ln:t")) != EOF) {
+	switch (c) {
+
+	case 'c':
+	    clusters = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || clusters < 1 || clusters > 4095) {
+		fprintf(stderr, "%s: -c requires cluster count (1-4095)\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+
+	case 'D':	/* debug flag */
+	    sts = __pmParseDebug(optarg);
+	    if (sts < 0) {
+		fprintf(stderr, "%s: unrecognized debug flag specification (%s)\n",
+		    pmProgname, optarg);
+		errflag++;
+	    }
+	    else
+		pmDebug |= sts;
+	    break;
+
+	case 'i':
+	    iterations = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || iterations < 1) {
+		fprintf(stderr, "%s: -i requires iteration count\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+
+	case 'l':
+	    linear = 1;
+	    break;
+
+	case 'n':
+	    nmetrics = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || nmetrics < 1) {
+		fprintf(stderr, "%s: -n requires metric count\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+
+	case 't':
+	    timing = 1;
+	    break;
+
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+
+    if (errflag || optind != argc || nmetrics / clusters > 1024) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    metrics = (pmdaMetric *)calloc(nmetrics, sizeof(pmdaMetric));
+    pmidlist = (pmID *)calloc(nmetrics, sizeof(pmID));
+    if (metrics == NULL || pmidlist == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmProgname);
+	exit(1);
+    }
+    for (m = 0; m < nmetrics; m++) {
+	metrics[m].m_desc.pmid = PMDA_PMID(m % clusters, m / clusters);
+	metrics[m].m_desc.type = PM_TYPE_U32;
+	metrics[m].m_desc.indom = PM_INDOM_NULL;
+	metrics[m].m_desc.sem = PM_SEM_INSTANT;
+    }
+
+    pmdaDaemon(&dispatch, PMDA_INTERFACE_5, pmProgname, 250, NULL, NULL);
+    pmdaSetFetchCallBack(&dispatch, fetch_callback);
+    pmdaInit(&dispatch, NULL, 0, metrics, nmetrics);
+    if (dispatch.status != 0) {
+	fprintf(stderr, "%s: pmdaInit: %s\n", pmProgname, pmErrStr(dispatch.status));
+	exit(1);
+    }
+    pmda = dispatch.version.any.ext;
+    for (m = 0; m < nmetrics; m++)
+	pmidlist[m] = metrics[m].m_desc.pmid;
+
+    printf("metrics: %d in %d clusters\n", nmetrics, clusters);
+    printf("metric map: %s\n",
+	    (pmda->e_flags & PMDA_EXT_FLAG_HASHED) ? "hashed" :
+	    (pmda->e_direct ? "direct" : "linear"));
+
+    found = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++)
+	for (m = 0; m < nmetrics; m++)
+	    if (pmdaDesc(pmidlist[m], &desc, pmda) == 0)
+		found++;
+    delta = elapsed(&start);
+    printf("pmdaDesc: %d of %d found\n", found, nmetrics * iterations);
+    if (timing)
+	printf("pmdaDesc: %.1f nsec/lookup\n",
+		delta * 1e9 / ((double)nmetrics * iterations));
+
+    found = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++) {
+	if ((sts = pmdaFetch(nmetrics, pmidlist, &result, pmda)) < 0) {
+	    fprintf(stderr, "%s: pmdaFetch: %s\n", pmProgname, pmErrStr(sts));
+	    exit(1);
+	}
+	for (m = 0; m < result->numpmid; m++)
+	    if (result->vset[m]->numval == 1)
+		found++;
+	__pmFreeResultValues(result);
+    }
+    delta = elapsed(&start);
+    printf("pmdaFetch: %d of %d values\n", found, nmetrics * iterations);
+    if (timing)
+	printf("pmdaFetch: %.1f nsec/metric\n",
+		delta * 1e9 / ((double)nmetrics * iterations));
+
+    if (linear) {
+	found = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++)
+	    for (m = 0; m < nmetrics; m++)
+		if (linear_search(pmidlist[m], pmda) != NULL)
+		    found++;
+	delta = elapsed(&start);
+	printf("linear: %d of %d found\n", found, nmetrics * iterations);
+	if (timing)
+	    printf("linear: %.1f nsec/lookup\n",
+		    delta * 1e9 / ((double)nmetrics * iterations));
+    }
+
+    exit(0);
+}
@@ -92,13 +92,14 @@ main(int argc, char **argv)
     int context, queueid;
     size_t size;
     size_t filter_size;
+    size_t *filterp;
     struct timeval tv;
     char *s, *name;
     void *event;
 
     __pmSetProgname(argv[0]);
 
-    while ((c = getopt(argc, argv, "A:a:C:c:D:E:e:F:f:q:s:S:")) != EOF) {
+    while ((c = getopt(argc, argv, "A:a:C:c:D:E:e:F:f:g:q:s:S:")) != EOF) {
 	switch (c) {
 
 	case 'a':	/* disallow a clients queue access */
@@ -210,6 +211,7 @@ main(int argc, char **argv)
 	    break;
 
 	case 'f':	/* create client filter, limits size */
+	case 'g':	/* as above, with filter data of its own */
 	    s = optarg;
 	    name = strsep(&s, ",");
 	    if (!s) {
@@ -227,11 +229,16 @@ main(int argc, char **argv)
 		break;
 	    }
 	    queueid = pmdaEventQueueHandle(name);
-	    filter_size = atoi(s);
-	    sts = pmdaEventSetFilter(context, queueid, (void *)&filter_size,
+	    filterp = &filter_size;
+	    if (c == 'g' && (filterp = malloc(sizeof(size_t))) == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pmProgname);
+		exit(1);
+	    }
+	    *filterp = atoi(s);
+	    sts = pmdaEventSetFilter(context, queueid, (void *)filterp,
 				     apply_filter, release_filter);
 	    fprintf(stderr, "client#%d set filter(sz<%d) on queue#%d-> %d",
-		    context, (int)filter_size, queueid, sts);
+		    context, (int)*filterp, queueid, sts);
 	    if (sts < 0) fprintf(stderr, " %s", pmErrStr(sts));
 	    fputc('\n', stderr);
 	    break;
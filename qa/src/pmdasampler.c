@@ -0,0 +1,301 @@
+/*
+ * Exercise the libpcp_pmda sampler thread and pmdaSamplerSnapshot,
+ * with a refresh callback that blocks until released by a store.
+ *
+ * Every refresh after the first waits at a gate, so fetches must be
+ * answered from the previous snapshot while it is blocked.  Storing to
+ * sampler.overlap makes the next fetch of sampler.values release a
+ * refresh part way through and meet it at a barrier once complete, so
+ * the sampler swaps snapshots while the fetch still holds the old one -
+ * which must not change, even on a single CPU.
+ *
+ * Snapshot n has sequence number n and values n*10 + instance.
+ *
+ * Copyright (c) 2017 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/pmda.h>
+#include <pthread.h>
+
+#ifndef HAVE_PTHREAD_BARRIER_T
+#include "pthread_barrier.h"
+#endif
+
+#define NINST		4
+#define GATE_TIMEOUT	10	/* seconds, so a broken sampler cannot hang QA */
+
+static pmdaInstid instances[NINST] = {
+    { 0, "zero" }, { 1, "one" }, { 2, "two" }, { 3, "three" }
+};
+
+static pmdaIndom indomtab[] = {
+    { 0, NINST, instances },
+};
+
+static pmdaMetric metrictab[] = {
+/* sampler.seq */
+    { NULL, { PMDA_PMID(0,0), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* sampler.values */
+    { NULL, { PMDA_PMID(0,1), PM_TYPE_U32, 0, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* sampler.stalled - waits for a refresh to block at the gate */
+    { NULL, { PMDA_PMID(0,2), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* sampler.clobbered */
+    { NULL, { PMDA_PMID(0,3), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER,
+	PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+/* sampler.timeouts */
+    { NULL, { PMDA_PMID(0,4), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER,
+	PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+/* sampler.overlap */
+    { NULL, { PMDA_PMID(0,5), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+/* sampler.release */
+    { NULL, { PMDA_PMID(0,6), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+};
+
+typedef struct {
+    unsigned int	seq;
+    unsigned int	values[NINST];
+} snapshot_t;
+
+static pmdaExt		*ext;
+static int		overlap;	/* PDU thread only */
+
+/* shared by the PDU and sampler threads */
+static pthread_mutex_t	lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	cond = PTHREAD_COND_INITIALIZER;
+static pthread_barrier_t swap;
+static int		permits;	/* refreshes allowed through the gate */
+static int		stalled;	/* =1 while a refresh waits at the gate */
+static int		timeouts;	/* gate waits that timed out */
+static int		clobbered;	/* refreshes into the held snapshot */
+static const void	*held;		/* snapshot of an overlapping fetch */
+static int		rendezvous;	/* refreshes to meet it at the barrier */
+
+static void
+deadline(struct timespec *ts)
+{
+    struct timeval	now;
+
+    __pmtimevalNow(&now);
+    ts->tv_sec = now.tv_sec + GATE_TIMEOUT;
+    ts->tv_nsec = now.tv_usec * 1000;
+}
+
+static int
+sampler_refresh(void *next, const void *prev)
+{
+    snapshot_t		*sp = (snapshot_t *)next;
+    unsigned int	seq = prev ? ((const snapshot_t *)prev)->seq + 1 : 1;
+    struct timespec	ts;
+    int			sync = 0;
+    int			i;
+
+    if (seq > 1) {
+	pthread_mutex_lock(&lock);
+	stalled = 1;
+	pthread_cond_broadcast(&cond);
+	deadline(&ts);
+	while (permits == 0) {
+	    if (pthread_cond_timedwait(&cond, &lock, &ts) == ETIMEDOUT) {
+		timeouts++;
+		break;
+	    }
+	}
+	if (permits > 0)
+	    permits--;
+	stalled = 0;
+	if (next == held)
+	    clobbered++;
+	if (rendezvous > 0) {
+	    rendezvous--;
+	    sync = 1;
+	}
+	pthread_mutex_unlock(&lock);
+    }
+
+    sp->seq = seq;
+    for (i = 0; i < NINST; i++)
+	sp->values[i] = seq * 10 + i;
+
+    if (sync)
+	pthread_barrier_wait(&swap);
+    return 0;
+}
+
+/*
+ * Release two refreshes while the fetch holds snapshot sp, and wait for
+ * the first to complete - the second could only refresh sp, so must not
+ * start until this PDU has been answered.
+ */
+static void
+sampler_overlap(const snapshot_t *sp)
+{
+    pthread_mutex_lock(&lock);
+    held = sp;
+    rendezvous = 1;
+    permits += 2;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+
+    pthread_barrier_wait(&swap);
+
+    /* time for the sampler to swap, and to (wrongly) refresh sp again */
+    usleep(300000);
+}
+
+static int
+sampler_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
+{
+    snapshot_t		*sp = (snapshot_t *)pmdaSamplerSnapshot(ext, NULL);
+    struct timespec	ts;
+
+    if (sp == NULL)
+	return PM_ERR_AGAIN;
+
+    switch (pmid_item(mdesc->m_desc.pmid)) {
+    case 0:
+	atom->ul = sp->seq;
+	break;
+    case 1:
+	if (inst >= NINST)
+	    return PM_ERR_INST;
+	if (overlap) {
+	    overlap = 0;
+	    sampler_overlap(sp);
+	}
+	atom->ul = sp->values[inst];
+	break;
+    case 2:
+	pthread_mutex_lock(&lock);
+	deadline(&ts);
+	while (!stalled) {
+	    if (pthread_cond_timedwait(&cond, &lock, &ts) == ETIMEDOUT)
+		break;
+	}
+	atom->ul = stalled;
+	pthread_mutex_unlock(&lock);
+	break;
+    case 3:
+	pthread_mutex_lock(&lock);
+	atom->ul = clobbered;
+	pthread_mutex_unlock(&lock);
+	break;
+    case 4:
+	pthread_mutex_lock(&lock);
+	atom->ul = timeouts;
+	pthread_mutex_unlock(&lock);
+	break;
+    case 5:
+	atom->ul = overlap;
+	break;
+    case 6:
+	pthread_mutex_lock(&lock);
+	atom->ul = permits;
+	pthread_mutex_unlock(&lock);
+	break;
+    default:
+	return PM_ERR_PMID;
+    }
+    return PMDA_FETCH_STATIC;
+}
+
+static int
+sampler_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
+{
+    int		sts;
+
+    sts = pmdaFetch(numpmid, pmidlist, resp, pmda);
+
+    /* the held snapshot may be refreshed once this PDU is answered */
+    pthread_mutex_lock(&lock);
+    held = NULL;
+    pthread_mutex_unlock(&lock);
+    return sts;
+}
+
+static int
+sampler_store(pmResult *result, pmdaExt *pmda)
+{
+    pmValueSet	*vsp;
+    int		i;
+
+    for (i = 0; i < result->numpmid; i++) {
+	vsp = result->vset[i];
+	if (vsp->numval != 1 || vsp->valfmt != PM_VAL_INSITU)
+	    return PM_ERR_BADSTORE;
+	switch (pmid_item(vsp->pmid)) {
+	case 5:
+	    overlap = vsp->vlist[0].value.lval != 0;
+	    break;
+	case 6:
+	    pthread_mutex_lock(&lock);
+	    permits += vsp->vlist[0].value.lval;
+	    pthread_cond_broadcast(&cond);
+	    pthread_mutex_unlock(&lock);
+	    break;
+	default:
+	    return PM_ERR_PERMISSION;
+	}
+    }
+    return 0;
+}
+
+static pmLongOptions	longopts[] = {
+    PMDA_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMDAOPT_DOMAIN,
+    PMDAOPT_LOGFILE,
+    PMOPT_HELP,
+    PMDA_OPTIONS_END
+};
+
+static pmdaOptions	opts = {
+    .short_options = "D:d:l:?",
+    .long_options = longopts,
+};
+
+int
+main(int argc, char **argv)
+{
+    pmdaInterface	dispatch;
+    struct timeval	interval = { 0, 100000 };
+
+    __pmSetProgname(argv[0]);
+    pmdaDaemon(&dispatch, PMDA_INTERFACE_5, pmProgname, 251,
+		"pmdasampler.log", NULL);
+
+    pmdaGetOptions(argc, argv, &opts, &dispatch);
+    if (opts.errors) {
+	pmdaUsageMessage(&opts);
+	exit(1);
+    }
+
+    pmdaOpenLog(&dispatch);
+    pthread_barrier_init(&swap, NULL, 2);
+    dispatch.version.any.fetch = sampler_fetch;
+    dispatch.version.any.store = sampler_store;
+    pmdaSetFetchCallBack(&dispatch, sampler_fetchCallBack);
+    pmdaSetSamplerCallBack(&dispatch, sampler_refresh, sizeof(snapshot_t),
+			    &interval);
+    pmdaInit(&dispatch, indomtab, sizeof(indomtab)/sizeof(indomtab[0]),
+		metrictab, sizeof(metrictab)/sizeof(metrictab[0]));
+    if (dispatch.status != 0) {
+	fprintf(stderr, "%s: pmdaInit: %s\n", pmProgname, pmErrStr(dispatch.status));
+	exit(1);
+    }
+    ext = dispatch.version.any.ext;
+
+    /* snapshot 1, taken here before the sampler thread starts */
+    pmdaSamplerSnapshot(ext, NULL);
+
+    pmdaConnect(&dispatch);
+    pmdaMain(&dispatch);
+
+    exit(0);
+}
@@ -0,0 +1,314 @@
+/*
+ * Follow processes and threads of our own making through fork, exec
+ * and exit in the proc PMDA instance domain, and check the scheduler
+ * statistics reported for them against /proc/<pid>/schedstat, for
+ * more processes than fit in one batched taskstats request.
+ *
+ * Run in a local context with the proc DSO PMDA, e.g.
+ *	PROC_THREADS=1 procnetlink -L -Kclear -Kadd,3,.../pmda_proc.so,proc_init
+ * The output is the same whether the PMDA uses netlink or /proc.
+ *
+ * Copyright (c) 2017 Red Hat.
+ */
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#define NCHILDREN	150	/* more than two taskstats batches */
+
+static char *names[] = {
+    "proc.psinfo.pid",
+    "proc.schedstat.cpu_time",
+    "proc.schedstat.run_delay",
+    "proc.schedstat.pcount",
+};
+#define NMETRICS	(sizeof(names) / sizeof(names[0]))
+
+static pmID pmids[NMETRICS];
+static pmResult *result;
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_SPECLOCAL,
+    PMOPT_LOCALPMDA,
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "D:K:L?",
+    .long_options = longopts,
+};
+
+static void
+fetch(void)
+{
+    int sts;
+
+    if (result)
+	pmFreeResult(result);
+    if ((sts = pmFetch(NMETRICS, pmids, &result)) < 0) {
+	fprintf(stderr, "pmFetch: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+}
+
+/* value of metric m for instance id from the last fetch, or -1 */
+static long long
+value(int m, int id)
+{
+    pmValueSet *vsp = result->vset[m];
+    pmAtomValue atom;
+    int i, type = m == 0 ? PM_TYPE_32 : PM_TYPE_U64;
+
+    for (i = 0; i < vsp->numval; i++) {
+	if (vsp->vlist[i].inst != id)
+	    continue;
+	if (m == 3 && vsp->valfmt == PM_VAL_INSITU)
+	    type = PM_TYPE_U32;		/* 32-bit kernel unsigned long */
+	if (pmExtractValue(vsp->valfmt, &vsp->vlist[i], type, &atom, PM_TYPE_U64) < 0)
+	    return -1;
+	return (long long)atom.ull;
+    }
+    return -1;
+}
+
+static const char *
+present(int id)
+{
+    return value(0, id) == id ? "present" : "absent";
+}
+
+/* the three /proc/<pid>/schedstat fields, or -1 if the task is gone */
+static int
+schedstat(int id, unsigned long long *fields)
+{
+    char path[MAXPATHLEN];
+    FILE *fp;
+    int n;
+
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", id);
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    n = fscanf(fp, "%llu %llu %llu", &fields[0], &fields[1], &fields[2]);
+    fclose(fp);
+    return n == 3 ? 0 : -1;
+}
+
+/*
+ * Fetched schedstat values match /proc for a task that is not running,
+ * so read /proc before and after the fetch - if the two differ the task
+ * was still settling down, and the comparison is retried.
+ */
+static int
+matches(int id)
+{
+    unsigned long long before[3], after[3];
+    int i, tries;
+
+    for (tries = 0; tries < 20; tries++) {
+	if (schedstat(id, before) < 0)
+	    return 0;
+	fetch();
+	if (schedstat(id, after) < 0)
+	    return 0;
+	if (memcmp(before, after, sizeof(before)) != 0) {
+	    usleep(50000);
+	    continue;
+	}
+	for (i = 0; i < 3; i++) {
+	    if (value(i + 1, id) != (long long)after[i]) {
+		fprintf(stderr, "task %d %s: fetched %lld, /proc %llu\n",
+			id, names[i + 1], value(i + 1, id), after[i]);
+		return 0;
+	    }
+	}
+	return 1;
+    }
+    fprintf(stderr, "task %d: /proc/%d/schedstat keeps changing\n", id, id);
+    return 0;
+}
+
+/* wait until the task is sleeping, past any exec or startup work */
+static void
+settle(int id)
+{
+    char path[MAXPATHLEN], state = '?';
+    FILE *fp;
+    int tries;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", id);
+    for (tries = 0; tries < 100 && state != 'S'; tries++) {
+	if ((fp = fopen(path, "r")) != NULL) {
+	    if (fscanf(fp, "%*d (%*[^)]) %c", &state) != 1)
+		state = '?';
+	    fclose(fp);
+	}
+	if (state != 'S')
+	    usleep(20000);
+    }
+}
+
+/* wait until the task has gone, e.g. a thread ended by an exec */
+static void
+vanish(int id)
+{
+    char path[MAXPATHLEN];
+    int tries;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", id);
+    for (tries = 0; tries < 100 && access(path, F_OK) == 0; tries++)
+	usleep(20000);
+}
+
+static int go[2];		/* thread waits to exec until parent writes */
+static int tid[2];		/* thread reports its tid to the parent */
+
+static void *
+thread(void *arg)
+{
+    int me = (int)syscall(SYS_gettid);
+    char c;
+
+    if (write(tid[1], &me, sizeof(me)) != sizeof(me) ||
+	read(go[0], &c, 1) != 1)
+	_exit(1);
+    /* an exec from a thread other than the leader ends that thread */
+    execlp("sleep", "sleep", "60", NULL);
+    _exit(1);
+}
+
+/*
+ * Child with a second thread - which execs on request, so the child
+ * pid remains but the thread id goes away, without any exit event.
+ */
+static pid_t
+spawn(int *thread_id)
+{
+    pthread_t tp;
+    pid_t pid;
+
+    if (pipe(go) < 0 || pipe(tid) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    if ((pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (pid == 0) {
+	close(go[1]);
+	close(tid[0]);
+	if (pthread_create(&tp, NULL, thread, NULL) != 0)
+	    _exit(1);
+	for (;;)
+	    pause();
+    }
+    close(go[0]);
+    close(tid[1]);
+    if (read(tid[0], thread_id, sizeof(*thread_id)) != sizeof(*thread_id)) {
+	fprintf(stderr, "child %d: no thread id\n", (int)pid);
+	exit(1);
+    }
+    close(tid[0]);
+    return pid;
+}
+
+int
+main(int argc, char **argv)
+{
+    pid_t children[NCHILDREN], pid;
+    int block[2], thread_id, i, n, c, sts;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind != argc || opts.context != PM_CONTEXT_LOCAL) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+    if ((sts = pmNewContext(PM_CONTEXT_LOCAL, NULL)) < 0) {
+	fprintf(stderr, "pmNewContext: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmLookupName(NMETRICS, names, pmids)) < 0) {
+	fprintf(stderr, "pmLookupName: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    /* the first fetch seeds the PMDA from /proc, before any children */
+    fetch();
+
+    printf("== fork\n");
+    pid = spawn(&thread_id);
+    fetch();
+    printf("child %s, thread %s\n", present(pid), present(thread_id));
+
+    printf("== exec from the second thread\n");
+    if (write(go[1], "x", 1) != 1) {
+	perror("write");
+	exit(1);
+    }
+    close(go[1]);
+    vanish(thread_id);
+    settle(pid);
+    fetch();
+    printf("child %s, thread %s\n", present(pid), present(thread_id));
+
+    printf("== schedstat for the child\n");
+    printf("child values %s /proc\n", matches(pid) ? "match" : "differ from");
+
+    printf("== exit\n");
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    fetch();
+    printf("child %s\n", present(pid));
+
+    printf("== fork %d children\n", NCHILDREN);
+    if (pipe(block) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    for (i = 0; i < NCHILDREN; i++) {
+	if ((children[i] = fork()) < 0) {
+	    perror("fork");
+	    exit(1);
+	}
+	if (children[i] == 0) {
+	    char ch;
+	    close(block[1]);
+	    /* block until the parent closes the pipe */
+	    if (read(block[0], &ch, 1) < 0)
+		_exit(1);
+	    _exit(0);
+	}
+    }
+    close(block[0]);
+    for (i = 0; i < NCHILDREN; i++)
+	settle(children[i]);
+    fetch();
+    for (n = i = 0; i < NCHILDREN; i++)
+	n += (value(0, children[i]) == children[i]);
+    printf("%d children present\n", n);
+    for (n = i = 0; i < NCHILDREN; i++)
+	n += matches(children[i]);
+    printf("%d children with schedstat values matching /proc\n", n);
+
+    printf("== exit %d children\n", NCHILDREN);
+    close(block[1]);
+    for (i = 0; i < NCHILDREN; i++)
+	waitpid(children[i], NULL, 0);
+    fetch();
+    for (n = i = 0; i < NCHILDREN; i++)
+	n += (value(0, children[i]) == children[i]);
+    printf("%d children present\n", n);
+
+    pmFreeResult(result);
+    exit(0);
+}
@@ -0,0 +1,18 @@
+/*
+ * Fail every inotify watch other than those on directories, as when
+ * the inotify watch limit is reached between watching a directory and
+ * watching the files in it.  For use with LD_PRELOAD.
+ */
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+
+int inotify_add_watch(int fd, const char *pathname, uint32_t mask)
+{
+    if ((mask & IN_ONLYDIR) == 0) {
+	errno = ENOSPC;
+	return -1;
+    }
+    return syscall(SYS_inotify_add_watch, fd, pathname, mask);
+}
@@ -0,0 +1,274 @@
+/*
+ * Compare the TCP and UDP socket state counts of the linux PMDA, which
+ * come from the sock_diag netlink interface, with counts made here from
+ * the /proc/net files - with a listening socket, many connected TCP
+ * pairs (more than one netlink dump message) and UDP sockets of our
+ * own making.
+ *
+ * Run in a local context with the linux DSO PMDA, e.g.
+ *	sockdiag -L -Kclear -Kadd,60,.../pmda_linux.so,linux_init
+ *
+ * Copyright (c) 2017 Red Hat.
+ */
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NPAIRS		200	/* connected TCP pairs */
+#define NSTATES		12	/* TCP states in /proc/net/tcp, from 1 */
+
+static const char *tcpstates[NSTATES] = {
+    NULL, "established", "syn_sent", "syn_recv", "fin_wait1", "fin_wait2",
+    "time_wait", "close", "close_wait", "last_ack", "listen", "closing",
+};
+
+static const struct {
+    const char	*file;		/* in /proc/net */
+    const char	*metric;	/* network.<metric>.<state> */
+    int		udp;		/* only established and listen (close) */
+} sockets[] = {
+    { "tcp", "tcpconn", 0 },
+    { "tcp6", "tcp6conn", 0 },
+    { "udp", "udpconn", 1 },
+    { "udp6", "udp6conn", 1 },
+};
+#define NSOCKETS	(sizeof(sockets) / sizeof(sockets[0]))
+
+static pmID pmids[NSOCKETS][NSTATES];
+static int port;		/* of our listening socket */
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_SPECLOCAL,
+    PMOPT_LOCALPMDA,
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "D:K:L?",
+    .long_options = longopts,
+};
+
+static int
+udpstate(int state)
+{
+    return state == 1 || state == 7;	/* established, listen */
+}
+
+static void
+lookup(void)
+{
+    char name[64], *np = name;
+    int i, state, sts;
+
+    for (i = 0; i < NSOCKETS; i++) {
+	for (state = 1; state < NSTATES; state++) {
+	    if (sockets[i].udp && !udpstate(state))
+		continue;
+	    snprintf(name, sizeof(name), "network.%s.%s", sockets[i].metric,
+		    sockets[i].udp && state == 7 ? "listen" : tcpstates[state]);
+	    if ((sts = pmLookupName(1, &np, &pmids[i][state])) < 0) {
+		fprintf(stderr, "pmLookupName(%s): %s\n", name, pmErrStr(sts));
+		exit(1);
+	    }
+	}
+    }
+}
+
+/* socket counts of every state from the PMDA */
+static void
+fetch(int i, unsigned int *counts)
+{
+    pmResult *rp;
+    pmAtomValue atom;
+    pmDesc desc;
+    int state, sts;
+
+    memset(counts, 0, NSTATES * sizeof(*counts));
+    for (state = 1; state < NSTATES; state++) {
+	if (sockets[i].udp && !udpstate(state))
+	    continue;
+	if ((sts = pmLookupDesc(pmids[i][state], &desc)) < 0 ||
+	    (sts = pmFetch(1, &pmids[i][state], &rp)) < 0) {
+	    fprintf(stderr, "%s: %s\n", pmIDStr(pmids[i][state]), pmErrStr(sts));
+	    exit(1);
+	}
+	if (rp->vset[0]->numval == 1 &&
+	    pmExtractValue(rp->vset[0]->valfmt, &rp->vset[0]->vlist[0],
+			desc.type, &atom, PM_TYPE_U32) >= 0)
+	    counts[state] = atom.ul;
+	pmFreeResult(rp);
+    }
+}
+
+/*
+ * socket counts of every state from the /proc/net file, and of those
+ * with our listening port at either end; -1 if there is no such file
+ */
+static int
+parse(int i, unsigned int *counts, unsigned int *ours)
+{
+    char path[MAXPATHLEN], line[512];
+    unsigned int local, remote, state;
+    FILE *fp;
+
+    memset(counts, 0, NSTATES * sizeof(*counts));
+    if (ours)
+	memset(ours, 0, NSTATES * sizeof(*ours));
+    snprintf(path, sizeof(path), "/proc/net/%s", sockets[i].file);
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, " %*s %*[^:]:%x %*[^:]:%x %x",
+			&local, &remote, &state) != 3 || state >= NSTATES)
+	    continue;
+	if (sockets[i].udp && !udpstate(state))
+	    continue;
+	counts[state]++;
+	if (ours && (local == port || remote == port))
+	    ours[state]++;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void
+report(const char *file, unsigned int *fetched, unsigned int *parsed)
+{
+    int state;
+
+    for (state = 1; state < NSTATES; state++)
+	if (fetched[state] != parsed[state])
+	    fprintf(stderr, "/proc/net/%s state %d: fetched %u, parsed %u\n",
+		    file, state, fetched[state], parsed[state]);
+}
+
+/*
+ * Socket counts change as other processes come and go, so parse the
+ * /proc file before and after the fetch - if the two differ, the
+ * comparison is retried.
+ */
+static int
+matches(int i)
+{
+    unsigned int before[NSTATES], after[NSTATES], fetched[NSTATES];
+    int tries;
+
+    for (tries = 0; tries < 20; tries++) {
+	if (parse(i, before, NULL) < 0)
+	    return -1;
+	fetch(i, fetched);
+	if (parse(i, after, NULL) < 0)
+	    return -1;
+	if (memcmp(before, after, sizeof(before)) != 0) {
+	    usleep(100000);
+	    continue;
+	}
+	if (memcmp(fetched, after, sizeof(after)) == 0)
+	    return 1;
+	report(sockets[i].file, fetched, after);
+	return 0;
+    }
+    fprintf(stderr, "/proc/net/%s keeps changing\n", sockets[i].file);
+    return 0;
+}
+
+static int
+tcp_socket(void)
+{
+    int fd;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+	perror("socket");
+	exit(1);
+    }
+    return fd;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    unsigned int counts[NSTATES], ours[NSTATES];
+    int listener, udp[2], fd, i, c, sts;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind != argc || opts.context != PM_CONTEXT_LOCAL) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+    if ((sts = pmNewContext(PM_CONTEXT_LOCAL, NULL)) < 0) {
+	fprintf(stderr, "pmNewContext: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    lookup();
+
+    /* a listening socket on the loopback address, any port */
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listener = tcp_socket();
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	listen(listener, NPAIRS) < 0 ||
+	getsockname(listener, (struct sockaddr *)&addr, &addrlen) < 0) {
+	perror("listener");
+	exit(1);
+    }
+    port = ntohs(addr.sin_port);
+
+    /* connected pairs, both ends established */
+    for (i = 0; i < NPAIRS; i++) {
+	fd = tcp_socket();
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    accept(listener, NULL, NULL) < 0) {
+	    perror("connect");
+	    exit(1);
+	}
+    }
+
+    /* UDP sockets on the same port, one bound and one connected */
+    for (i = 0; i < 2; i++) {
+	if ((udp[i] = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	    perror("socket");
+	    exit(1);
+	}
+    }
+    if (bind(udp[0], (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	connect(udp[1], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	perror("udp");
+	exit(1);
+    }
+
+    parse(0, counts, ours);
+    printf("tcp: ours %u listening, %u established\n", ours[10], ours[1]);
+    parse(2, counts, ours);
+    printf("udp: ours %u listening, %u established\n", ours[7], ours[1]);
+
+    for (i = 0; i < NSOCKETS; i++) {
+	switch (matches(i)) {
+	case -1:
+	    printf("%s: no /proc/net/%s\n", sockets[i].metric, sockets[i].file);
+	    break;
+	case 0:
+	    printf("%s: sock_diag counts differ from /proc/net/%s\n",
+		    sockets[i].metric, sockets[i].file);
+	    break;
+	default:
+	    printf("%s: sock_diag counts match /proc/net/%s\n",
+		    sockets[i].metric, sockets[i].file);
+	    break;
+	}
+    }
+    exit(0);
+}
@@ -583,6 +583,153 @@ _j(void)
     fprintf(stderr, "Sync -> %d\n", sts);
 }
 
+static void
+_k_report(char *op, int sts)
+{
+    fprintf(stderr, "%s -> %d", op, sts);
+    if (sts < 0) fprintf(stderr, ": %s", pmErrStr(sts));
+    fputc('\n', stderr);
+}
+
+/*
+ * big enough cache for saves to be journalled
+ */
+static void
+_k(void)
+{
+    int		inst;
+    int		i;
+
+    indomp->domain = FORQA;
+    indomp->serial = 21;
+
+    fprintf(stderr, "Populate the instance domain ...\n");
+    for (i = 0; i < 1000; i++) {
+	sprintf(nbuf, "journal-instance-%04d", i);
+	inst = pmdaCacheStore(indom, PMDA_CACHE_ADD, nbuf, NULL);
+	if (inst < 0)
+	    fprintf(stderr, "PMDA_CACHE_ADD failed for \"%s\": %s\n", nbuf, pmErrStr(inst));
+    }
+    _k_report("Save (compact)", pmdaCacheOp(indom, PMDA_CACHE_SAVE));
+
+    fprintf(stderr, "Cull 100 and add 50 ...\n");
+    for (i = 0; i < 1000; i += 10) {
+	sprintf(nbuf, "journal-instance-%04d", i);
+	inst = pmdaCacheStore(indom, PMDA_CACHE_CULL, nbuf, NULL);
+	if (inst < 0)
+	    fprintf(stderr, "PMDA_CACHE_CULL failed for \"%s\": %s\n", nbuf, pmErrStr(inst));
+    }
+    for (i = 1000; i < 1050; i++) {
+	sprintf(nbuf, "journal-instance-%04d", i);
+	inst = pmdaCacheStore(indom, PMDA_CACHE_ADD, nbuf, NULL);
+	if (inst < 0)
+	    fprintf(stderr, "PMDA_CACHE_ADD failed for \"%s\": %s\n", nbuf, pmErrStr(inst));
+    }
+    _k_report("Save (journal)", pmdaCacheOp(indom, PMDA_CACHE_SAVE));
+    _k_report("Save (clean)", pmdaCacheOp(indom, PMDA_CACHE_SAVE));
+
+    fprintf(stderr, "Reactivate 20 ...\n");
+    for (i = 1; i < 40; i += 2) {
+	sprintf(nbuf, "journal-instance-%04d", i);
+	pmdaCacheStore(indom, PMDA_CACHE_HIDE, nbuf, NULL);
+	inst = pmdaCacheStore(indom, PMDA_CACHE_ADD, nbuf, NULL);
+	if (inst < 0)
+	    fprintf(stderr, "PMDA_CACHE_ADD failed for \"%s\": %s\n", nbuf, pmErrStr(inst));
+    }
+    _k_report("Save (stamps only)", pmdaCacheOp(indom, PMDA_CACHE_SAVE));
+    _k_report("Sync (journal)", pmdaCacheOp(indom, PMDA_CACHE_SYNC));
+
+    _k_report("Reorg", pmdaCacheOp(indom, PMDA_CACHE_REORG));
+    _k_report("Size", pmdaCacheOp(indom, PMDA_CACHE_SIZE));
+}
+
+/*
+ * reload journalled cache from _k, then churn until compacted
+ */
+static void
+_l(void)
+{
+    int		inst;
+    int		sts;
+    int		i;
+    char	*name;
+
+    indomp->domain = FORQA;
+    indomp->serial = 21;
+
+    _k_report("Load", pmdaCacheOp(indom, PMDA_CACHE_LOAD));
+    _k_report("Size", pmdaCacheOp(indom, PMDA_CACHE_SIZE));
+    _k_report("Size (inactive)", pmdaCacheOp(indom, PMDA_CACHE_SIZE_INACTIVE));
+    for (i = 0; i < 1050; i += 5) {
+	sprintf(nbuf, "journal-instance-%04d", i);
+	sts = pmdaCacheLookupName(indom, nbuf, &inst, NULL);
+	if (i < 1000 && i % 10 == 0) {
+	    if (sts != PM_ERR_INST)
+		fprintf(stderr, "Botch: culled \"%s\" -> %d\n", nbuf, sts);
+	}
+	else if (sts < 0)
+	    fprintf(stderr, "Botch: \"%s\" -> %s\n", nbuf, pmErrStr(sts));
+	else if (pmdaCacheLookup(indom, inst, &name, NULL) < 0 ||
+		 strcmp(name, nbuf) != 0)
+	    fprintf(stderr, "Botch: \"%s\" inst %d mismatch\n", nbuf, inst);
+    }
+
+    fprintf(stderr, "Churn ...\n");
+    for (i = 1050; i < 1700; i++) {
+	sprintf(nbuf, "journal-instance-%04d", i);
+	inst = pmdaCacheStore(indom, PMDA_CACHE_ADD, nbuf, NULL);
+	if (inst < 0)
+	    fprintf(stderr, "PMDA_CACHE_ADD failed for \"%s\": %s\n", nbuf, pmErrStr(inst));
+	sprintf(nbuf, "journal-instance-%04d", i - 1000);
+	pmdaCacheStore(indom, PMDA_CACHE_CULL, nbuf, NULL);
+	if (i % 100 == 99) {
+	    sts = pmdaCacheOp(indom, PMDA_CACHE_SAVE);
+	    fprintf(stderr, "Save @ %d -> %d\n", i, sts);
+	}
+    }
+    _k_report("Size", pmdaCacheOp(indom, PMDA_CACHE_SIZE));
+    _k_report("Size (active)", pmdaCacheOp(indom, PMDA_CACHE_SIZE_ACTIVE));
+    _k_report("Size (inactive)", pmdaCacheOp(indom, PMDA_CACHE_SIZE_INACTIVE));
+}
+
+/*
+ * keys changed by a later add without a key must be saved, for both
+ * rewritten (small) and journalled (large) caches
+ */
+static void
+_m(void)
+{
+    int		inst;
+    int		serial;
+    int		n;
+    int		i;
+    char	kbuf[32];
+
+    indomp->domain = FORQA;
+    for (serial = 22; serial <= 23; serial++) {
+	indomp->serial = serial;
+	n = serial == 22 ? 10 : 200;
+	fprintf(stderr, "Populate %d keyed instances ...\n", n);
+	for (i = 0; i < n; i++) {
+	    sprintf(nbuf, "keyed-instance-%04d", i);
+	    sprintf(kbuf, "key-%04d", i);
+	    inst = pmdaCacheStoreKey(indom, PMDA_CACHE_ADD, nbuf, strlen(kbuf), kbuf, NULL);
+	    if (inst < 0)
+		fprintf(stderr, "PMDA_CACHE_ADD failed for \"%s\": %s\n", nbuf, pmErrStr(inst));
+	}
+	_k_report("Save", pmdaCacheOp(indom, PMDA_CACHE_SAVE));
+	fprintf(stderr, "Drop 5 keys ...\n");
+	for (i = 0; i < 5; i++) {
+	    sprintf(nbuf, "keyed-instance-%04d", i);
+	    inst = pmdaCacheStore(indom, PMDA_CACHE_ADD, nbuf, NULL);
+	    if (inst < 0)
+		fprintf(stderr, "PMDA_CACHE_ADD failed for \"%s\": %s\n", nbuf, pmErrStr(inst));
+	}
+	_k_report("Save (keys)", pmdaCacheOp(indom, PMDA_CACHE_SAVE));
+	_k_report("Save (clean)", pmdaCacheOp(indom, PMDA_CACHE_SAVE));
+    }
+}
+
 int
 main(int argc, char **argv)
 {
@@ -618,7 +765,7 @@ main(int argc, char **argv)
     }
 
     if (errflag) {
-	fprintf(stderr, "Usage: %s [-D...] [a|b|c|d|...|i 1|2|3}\n", pmProgname);
+	fprintf(stderr, "Usage: %s [-D...] [a|b|c|d|...|i 1|2|3|...|m}\n", pmProgname);
 	exit(1);
     }
 
@@ -636,6 +783,9 @@ main(int argc, char **argv)
 	    _i(atoi(argv[optind]));
 	}
 	else if (strcmp(argv[optind], "j") == 0) _j();
+	else if (strcmp(argv[optind], "k") == 0) _k();
+	else if (strcmp(argv[optind], "l") == 0) _l();
+	else if (strcmp(argv[optind], "m") == 0) _m();
 	else
 	    fprintf(stderr, "torture_cache: no idea what to do with option \"%s\"\n", argv[optind]);
 	optind++;
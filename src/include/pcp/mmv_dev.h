@@ -1,7 +1,7 @@
 /*
  * Copyright (C) 2001,2009 Silicon Graphics, Inc.  All Rights Reserved.
  * Copyright (C) 2009 Aconex.  All Rights Reserved.
- * Copyright (C) 2016 Red Hat.
+ * Copyright (C) 2016,2017 Red Hat.
  *
  * This library is free software; you can redistribute it and/or modify it
  * under the terms of the GNU Lesser General Public License as published
@@ -18,6 +18,7 @@
 
 #define MMV_VERSION1	1	/* original on-disk format */
 #define MMV_VERSION2	2	/* + mmv_disk_{metric2,instance2}_t */
+#define MMV_VERSION3	3	/* + value stripes, histogram buckets */
 #define MMV_VERSION	1	/* default, upgrading to v2 only if needed */
 
 typedef enum mmv_toc_type {
@@ -26,8 +27,40 @@ typedef enum mmv_toc_type {
     MMV_TOC_METRICS	= 3,	/* mmv_disk_{metric,metric2}_t */
     MMV_TOC_VALUES	= 4,	/* mmv_disk_value_t */
     MMV_TOC_STRINGS	= 5,	/* mmv_disk_string_t */
+    MMV_TOC_STRIPES	= 6,	/* pmAtomValue per value, per stripe (v3) */
+    MMV_TOC_BUCKETS	= 7,	/* bounds and counts per histogram (v3) */
 } mmv_toc_type_t;
 
+/*
+ * Striped values (v3) - the STRIPES section count is the number of
+ * stripes, and its offset that of the first stripe.  Each stripe is
+ * one pmAtomValue slot for every entry of the values section, in the
+ * same order, padded to a whole number of cache lines so that threads
+ * updating different stripes never share a line.  The value of an
+ * integer or floating point metric is its value entry plus its slot
+ * in each stripe.
+ */
+#define MMV_CACHELINE	64
+#define MMV_STRIPE_SIZE(nvalues) \
+	(((nvalues) * sizeof(pmAtomValue) + MMV_CACHELINE - 1) & \
+	 ~(__uint64_t)(MMV_CACHELINE - 1))
+
+/*
+ * Histogram values (v3) - the instance field of a histogram value is
+ * the offset of the first instance of its indom, one instance for each
+ * bucket, and the extra field the offset of its buckets in the BUCKETS
+ * section.  These are an array of bucket upper bounds (__int64_t, from
+ * the internal instance identifiers, ascending) then arrays of bucket
+ * counts (__uint64_t) - one updated atomically by threads without a
+ * stripe, then one for each stripe.  Each array is padded to a whole
+ * number of cache lines.
+ */
+#define MMV_BUCKETS_SIZE(nbuckets) \
+	(((nbuckets) * sizeof(__uint64_t) + MMV_CACHELINE - 1) & \
+	 ~(__uint64_t)(MMV_CACHELINE - 1))
+#define MMV_HISTOGRAM_SIZE(nbuckets, stripes) \
+	(MMV_BUCKETS_SIZE(nbuckets) * (2 + (stripes)))
+
 /* The way the Table Of Contents is written into the file */
 typedef struct mmv_disk_toc {
     mmv_toc_type_t	type;		/* What is it? */
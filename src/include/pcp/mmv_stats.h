@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2013,2016 Red Hat.
+ * Copyright (C) 2013,2016,2017 Red Hat.
  * Copyright (C) 2009 Aconex.  All Rights Reserved.
  * Copyright (C) 2001,2009 Silicon Graphics, Inc.  All Rights Reserved.
  *
@@ -22,6 +22,7 @@ extern "C" {
 
 #define MMV_NAMEMAX	64
 #define MMV_STRINGMAX	256
+#define MMV_STRIPEMAX	1024	/* per-thread value stripes (v3) */
 
 typedef enum mmv_metric_type {
     MMV_TYPE_NOSUPPORT = PM_TYPE_NOSUPPORT,
@@ -33,6 +34,7 @@ typedef enum mmv_metric_type {
     MMV_TYPE_DOUBLE    = PM_TYPE_DOUBLE,/* 64-bit floating point */
     MMV_TYPE_STRING    = PM_TYPE_STRING,/* NULL-terminate string */
     MMV_TYPE_ELAPSED   = 9,		/* 64-bit elapsed time */
+    MMV_TYPE_HISTOGRAM = 10,		/* 64-bit counts per bucket (v3) */
 } mmv_metric_type_t;
 
 typedef enum mmv_metric_sem {
@@ -95,6 +97,24 @@ typedef struct mmv_metric2 {
 #define MMV_UNITS(a,b,c,d,e,f)	{0,f,e,d,c,b,a}
 #endif
 
+/*
+ * Handle for the repeated update of one value, found once by name.
+ * value points directly at the value in the mapping; the rest is
+ * for the update of striped values and histogram buckets.
+ */
+typedef struct mmv_handle {
+    void *		addr;		/* mapping from mmv_stats*_init */
+    pmAtomValue *	value;		/* value in the mapping */
+    pmAtomValue *	slot;		/* first stripe slot, if striped */
+    __int64_t *		bounds;		/* histogram bucket upper bounds */
+    __uint64_t *	buckets;	/* shared histogram bucket counts */
+    __uint64_t		stride;		/* bytes from one stripe to the next */
+    __int32_t		stripes;	/* number of value stripes */
+    __int32_t		nbuckets;	/* number of histogram buckets */
+    mmv_metric_type_t	type;		/* value type of the metric */
+    __uint32_t		padding;	/* zero filled, alignment bits */
+} mmv_handle_t;
+
 typedef enum mmv_stats_flags {
     MMV_FLAG_NOPREFIX	= 0x1,	/* Don't prefix metric names by filename */
     MMV_FLAG_PROCESS	= 0x2,	/* Indicates process check on PID needed */
@@ -107,6 +127,9 @@ extern void * mmv_stats_init(const char *, int, mmv_stats_flags_t,
 extern void * mmv_stats2_init(const char *, int, mmv_stats_flags_t,
 				const mmv_metric2_t *, int,
 				const mmv_indom2_t *, int);
+extern void * mmv_stats3_init(const char *, int, mmv_stats_flags_t, int,
+				const mmv_metric2_t *, int,
+				const mmv_indom2_t *, int);
 extern void mmv_stats_stop(const char *, void *);
 
 extern pmAtomValue * mmv_lookup_value_desc(void *, const char *, const char *);
@@ -114,6 +137,12 @@ extern void mmv_inc_value(void *, pmAtomValue *, double);
 extern void mmv_set_value(void *, pmAtomValue *, double);
 extern void mmv_set_string(void *, pmAtomValue *, const char *, int);
 
+extern int mmv_lookup_handle(void *, const char *, const char *,
+				mmv_handle_t *);
+extern void mmv_handle_add(mmv_handle_t *, double);
+extern void mmv_handle_set(mmv_handle_t *, double);
+extern void mmv_handle_record(mmv_handle_t *, __int64_t);
+
 extern void mmv_stats_add(void *, const char *, const char *, double);
 extern void mmv_stats_inc(void *, const char *, const char *);
 extern void mmv_stats_set(void *, const char *, const char *, double);
@@ -85,6 +85,21 @@ typedef int (*pmdaFetchCallBack)(pmdaMetric *, unsigned int, pmAtomValue *);
 #define PMDA_FETCH_STATIC	1
 #define PMDA_FETCH_DYNAMIC	2	/* free avp->vp after __pmStuffValue */
 
+/*
+ * Type of function call back used by pmdaFetch to fill in the values for
+ * every requested instance of one metric in a single call.  The metric,
+ * count and list of instances (from the profile) are passed in, and the
+ * callback fills in one pmAtomValue and one status (using the return
+ * values of a pmdaFetchCallBack) per instance.  The callback returns 0
+ * on success, a negative error code that applies to all instances, or
+ * PMDA_FETCH_UNBATCHED to have pmdaFetch use the pmdaFetchCallBack for
+ * this metric instead.
+ */
+typedef int (*pmdaBatchFetchCallBack)(pmdaMetric *, int, const unsigned int *,
+				      pmAtomValue *, int *);
+
+#define PMDA_FETCH_UNBATCHED	3	/* use per-value pmdaFetchCallBack */
+
 /*
  * Type of function call back used by pmdaMain to clean up a pmResult structure
  * after a fetch.
@@ -109,6 +124,14 @@ typedef void (*pmdaDoneCallBack)(void);
  */
 typedef void (*pmdaEndContextCallBack)(int);
 
+/*
+ * Type of function call back used by the pmdaMain sampler thread to refresh
+ * the next snapshot (first argument) of the PMDA's data.  The most recent
+ * snapshot (second argument, may be NULL) is read-only.  A negative result
+ * discards the new snapshot and the previous one continues to be used.
+ */
+typedef int (*pmdaSamplerCallBack)(void *, const void *);
+
 /*
  */
 
@@ -406,6 +429,11 @@ typedef struct pmdaOptions {
  *      pmAtom structure with a metrics value. This must be set if pmdaFetch is
  *      used as the fetch callback.
  *
+ * pmdaSetBatchFetchCallBack
+ *      Allows an application specific routine to be specified for completing
+ *      the pmAtom structures for all instances of a metric in one call.  If
+ *      set, this is used by pmdaFetch in preference to the fetch callback.
+ *
  * pmdaSetCheckCallBack
  *      Allows an application specific routine to be called upon receipt of any
  *      PDU. For all PDUs except PDU_PROFILE, a result less than zero
@@ -422,6 +450,19 @@ typedef struct pmdaOptions {
  *      PMCD context is closed, so any per-context state can be cleaned
  *      up.  If set to zero (which is also the default), the callback
  *      is ignored.
+ *
+ * pmdaSetSamplerCallBack
+ *      Allows an application specific routine to refresh the PMDA data
+ *      into one of two snapshot buffers of the given size, from a thread
+ *      started by pmdaMain, at most once per interval.  PDUs are then
+ *      answered from the latest complete snapshot without waiting for a
+ *      refresh that may block.
+ *
+ * pmdaSamplerSnapshot
+ *      Returns the latest snapshot from the sampler callback (or NULL if
+ *      none is available yet) and optionally its age in seconds.  The
+ *      snapshot is not modified until the current PDU has been processed.
+ *      For DSO PMDAs the refresh is done in the calling thread.
  */
 
 PMDA_CALL extern int pmdaGetOpt(int, char *const *, const char *, pmdaInterface *, int *);
@@ -438,9 +479,12 @@ PMDA_CALL extern void pmdaMain(pmdaInterface *);
 
 PMDA_CALL extern void pmdaSetResultCallBack(pmdaInterface *, pmdaResultCallBack);
 PMDA_CALL extern void pmdaSetFetchCallBack(pmdaInterface *, pmdaFetchCallBack);
+PMDA_CALL extern void pmdaSetBatchFetchCallBack(pmdaInterface *, pmdaBatchFetchCallBack);
 PMDA_CALL extern void pmdaSetCheckCallBack(pmdaInterface *, pmdaCheckCallBack);
 PMDA_CALL extern void pmdaSetDoneCallBack(pmdaInterface *, pmdaDoneCallBack);
 PMDA_CALL extern void pmdaSetEndContextCallBack(pmdaInterface *, pmdaEndContextCallBack);
+PMDA_CALL extern void pmdaSetSamplerCallBack(pmdaInterface *, pmdaSamplerCallBack, size_t, const struct timeval *);
+PMDA_CALL extern void *pmdaSamplerSnapshot(pmdaExt *, double *);
 
 /*
  * Callbacks to PMCD which should be adequate for most PMDAs.
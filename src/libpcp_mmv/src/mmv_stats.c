@@ -3,7 +3,7 @@
  *
  * Copyright (C) 2001,2009 Silicon Graphics, Inc.  All rights reserved.
  * Copyright (C) 2009 Aconex.  All rights reserved.
- * Copyright (C) 2013,2016 Red Hat.
+ * Copyright (C) 2013,2016,2017 Red Hat.
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU Lesser General Public License as published by
@@ -109,7 +109,7 @@ mmv_generation(void)
 }
 
 static void * 
-mmv_init(const char *fname, int version,
+mmv_init(const char *fname, int version, int stripes,
 		int cluster, mmv_stats_flags_t fl,
 		const mmv_metric_t *st1, int nmetric1,
 		const mmv_indom_t *in1, int nindom1,
@@ -131,6 +131,8 @@ mmv_init(const char *fname, int version,
     __uint64_t instances_offset;	/* anchor start of instances section */
     __uint64_t metrics_offset;		/* anchor start of metrics section */
     __uint64_t values_offset;		/* anchor start of values section */
+    __uint64_t stripes_offset;		/* anchor start of value stripes */
+    __uint64_t buckets_offset;		/* anchor start of histogram buckets */
     __uint64_t strings_offset;		/* anchor start of any/all strings */
     void *addr;
     size_t size;
@@ -139,6 +141,8 @@ mmv_init(const char *fname, int version,
     int ninstances = 0;
     int nstrings = 0;
     int nvalues = 0;
+    int nhistograms = 0;
+    size_t nbuckets = 0;		/* bytes of histogram buckets */
 
     for (i = 0; i < nindom1; i++) {
 	ninstances += in1[i].count;
@@ -149,7 +153,7 @@ mmv_init(const char *fname, int version,
     }
     for (i = 0; i < nindom2; i++) {
 	ninstances += in2[i].count;
-	if (version == MMV_VERSION2)
+	if (version >= MMV_VERSION2)
 	    nstrings += in2[i].count;	/* instance names */
 	if (in2[i].shorttext)
 	    nstrings++;
@@ -175,14 +179,19 @@ mmv_init(const char *fname, int version,
 	}
     }
     for (i = 0; i < nmetric2; i++) {
-	if (version == MMV_VERSION2)
+	if (version >= MMV_VERSION2)
 	    nstrings++;		/* metric name */
 	if (st2[i].helptext)
 	    nstrings++;
 	if (st2[i].shorttext)
 	    nstrings++;
 
-	if (!mmv_singular(st2[i].indom)) {
+	if (st2[i].type == MMV_TYPE_HISTOGRAM) {
+	    mi2 = mmv_lookup_indom2(st2[i].indom, in2, nindom2);
+	    nbuckets += MMV_HISTOGRAM_SIZE(mi2->count, stripes);
+	    nhistograms++;
+	    nvalues++;
+	} else if (!mmv_singular(st2[i].indom)) {
 	    mi2 = mmv_lookup_indom2(st2[i].indom, in2, nindom2);
 	    if (st2[i].type == MMV_TYPE_STRING)
 		nstrings += mi2->count;
@@ -195,10 +204,14 @@ mmv_init(const char *fname, int version,
     }
 
     /* TOC follows header, with enough entries to hold */
-    /* indoms, instances, metrics, values, and strings */
+    /* indoms, instances, metrics, values, stripes, buckets and strings */
     size = sizeof(mmv_disk_toc_t) * 2;
     if (nindom1 || nindom2)
 	size += sizeof(mmv_disk_toc_t) * 2;
+    if (stripes)
+	size += sizeof(mmv_disk_toc_t) * 1;
+    if (nhistograms)
+	size += sizeof(mmv_disk_toc_t) * 1;
     if (nstrings)
 	size += sizeof(mmv_disk_toc_t) * 1;
     indoms_offset = sizeof(mmv_disk_header_t) + size;
@@ -237,9 +250,28 @@ mmv_init(const char *fname, int version,
     }
     values_offset = metrics_offset + size;
 
-    /* Following the values are the string values and/or help text */
+    /* Following the values are any per-thread value stripes, */
+    /* starting on a cache line boundary in the mapping */
     size = nvalues * sizeof(mmv_disk_value_t);
-    strings_offset = values_offset + size;
+    stripes_offset = values_offset + size;
+    size = 0;
+    if (stripes) {
+	stripes_offset += MMV_CACHELINE - 1;
+	stripes_offset &= ~(__uint64_t)(MMV_CACHELINE - 1);
+	size = stripes * MMV_STRIPE_SIZE(nvalues);
+    }
+
+    /* Following the stripes are any histogram buckets, likewise aligned */
+    buckets_offset = stripes_offset + size;
+    size = 0;
+    if (nhistograms) {
+	buckets_offset += MMV_CACHELINE - 1;
+	buckets_offset &= ~(__uint64_t)(MMV_CACHELINE - 1);
+	size = nbuckets;
+    }
+
+    /* Following the buckets are the string values and/or help text */
+    strings_offset = buckets_offset + size;
 
     /* End of file follows all of the actual strings */
     size = strings_offset + nstrings * sizeof(mmv_disk_string_t);
@@ -266,6 +298,10 @@ mmv_init(const char *fname, int version,
     hdr->tocs = 2;
     if (nindom1 || nindom2)
 	hdr->tocs += 2;
+    if (stripes)
+	hdr->tocs += 1;
+    if (nhistograms)
+	hdr->tocs += 1;
     if (nstrings)
 	hdr->tocs += 1;
     hdr->flags = fl;
@@ -293,6 +329,18 @@ mmv_init(const char *fname, int version,
     toc[tocidx].count = nvalues;
     toc[tocidx].offset = values_offset;
     tocidx++;
+    if (stripes) {
+	toc[tocidx].type = MMV_TOC_STRIPES;
+	toc[tocidx].count = stripes;
+	toc[tocidx].offset = stripes_offset;
+	tocidx++;
+    }
+    if (nhistograms) {
+	toc[tocidx].type = MMV_TOC_BUCKETS;
+	toc[tocidx].count = nhistograms;
+	toc[tocidx].offset = buckets_offset;
+	tocidx++;
+    }
     if (nstrings) {
 	toc[tocidx].type = MMV_TOC_STRINGS;
 	toc[tocidx].count = nstrings;
@@ -425,7 +473,23 @@ mmv_init(const char *fname, int version,
 	else
 	    offset = metrics_offset + i * sizeof(mmv_disk_metric2_t);
 
-	if (mmv_singular(st2[i].indom)) {
+	if (st2[i].type == MMV_TYPE_HISTOGRAM) {
+	    mmv_disk_indom_t *indom;
+	    mmv_disk_instance2_t *insts;
+	    __int64_t *bounds;
+
+	    indom = mmv_lookup_disk_indom(st2[i].indom, domlist, nindom2);
+	    insts = (mmv_disk_instance2_t *)((char *)addr + indom->offset);
+	    bounds = (__int64_t *)((char *)addr + buckets_offset);
+	    for (k = 0; k < indom->count; k++)
+		bounds[k] = insts[k].internal;
+	    memset(&vlist[j], 0, sizeof(mmv_disk_value_t));
+	    vlist[j].metric = offset;
+	    vlist[j].instance = indom->offset;
+	    vlist[j].extra = buckets_offset;
+	    buckets_offset += MMV_HISTOGRAM_SIZE(indom->count, stripes);
+	    j++;
+	} else if (mmv_singular(st2[i].indom)) {
 	    memset(&vlist[j], 0, sizeof(mmv_disk_value_t));
 	    vlist[j].metric = offset;
 	    j++;
@@ -455,7 +519,7 @@ mmv_init(const char *fname, int version,
      * 5 phases: v2 instance names, v2 metric names, all string values,
      *           any metric help, any indom help.
      */
-    if (version == MMV_VERSION2) {
+    if (version >= MMV_VERSION2) {
 	inlist2 = (mmv_disk_instance2_t *)((char *)addr + instances_offset);
 	for (i = 0; i < nindom2; i++) {
 	    mmv_instances2_t *insts = in2[i].instances;
@@ -487,7 +551,7 @@ mmv_init(const char *fname, int version,
 	    mmv_disk_metric_t *m1 = (mmv_disk_metric_t *)
 			((char *)(addr + vlist[i].metric));
 	    type = m1->type;
-	} else if (version == MMV_VERSION2) {
+	} else {
 	    mmv_disk_metric2_t *m2 = (mmv_disk_metric2_t *)
 			((char *)(addr + vlist[i].metric));
 	    type = m2->type;
@@ -639,7 +703,7 @@ mmv_stats_init(const char *fname,
     if ((version = mmv_check(st, nmetrics, in, nindoms)) < 0)
 	return NULL;
 
-    return mmv_init(fname, version, cluster, flags,
+    return mmv_init(fname, version, 0, cluster, flags,
 				st, nmetrics, in, nindoms, NULL, 0, NULL, 0);
 }
 
@@ -651,7 +715,7 @@ mmv_check2(const mmv_metric2_t *st, int nmetrics,
     const mmv_metric2_t *metric;
     const mmv_indom2_t *indom;
     size_t size;
-    int i, j, version = MMV_VERSION1;
+    int i, j, version = MMV_VERSION1, histograms = 0;
 
     for (i = 0; i < nindoms; i++) {
 	indom = &in[i];
@@ -693,7 +757,7 @@ mmv_check2(const mmv_metric2_t *st, int nmetrics,
 	metric = &st[i];
 	size = strlen(metric->name);
 	if (metric->type < MMV_TYPE_NOSUPPORT ||
-	    metric->type > MMV_TYPE_ELAPSED || size == 0) {
+	    metric->type > MMV_TYPE_HISTOGRAM || size == 0) {
 	    setoserror(EINVAL);
 	    return -1;
 	}
@@ -704,12 +768,27 @@ mmv_check2(const mmv_metric2_t *st, int nmetrics,
 	if (size >= MMV_NAMEMAX)
 	    version = MMV_VERSION2;
 	if (!mmv_singular(metric->indom) &&
-	    !mmv_lookup_indom2(metric->indom, in, nindoms)) {
+	    !(indom = mmv_lookup_indom2(metric->indom, in, nindoms))) {
 	    setoserror(ESRCH);
 	    return -1;
 	}
+	if (metric->type == MMV_TYPE_HISTOGRAM) {
+	    /* buckets are the instances, by ascending upper bound */
+	    if (mmv_singular(metric->indom) || indom->count == 0) {
+		setoserror(EINVAL);
+		return -1;
+	    }
+	    for (j = 1; j < indom->count; j++) {
+		if (indom->instances[j].internal <=
+		    indom->instances[j-1].internal) {
+		    setoserror(EINVAL);
+		    return -1;
+		}
+	    }
+	    histograms++;
+	}
     }
-    return version;
+    return histograms ? MMV_VERSION3 : version;
 }
 
 void * 
@@ -722,8 +801,33 @@ mmv_stats2_init(const char *fname,
 
     if ((version = mmv_check2(st, nmetrics, in, nindoms)) < 0)
 	return NULL;
+    if (version == MMV_VERSION3) {	/* histograms need mmv_stats3_init */
+	setoserror(EINVAL);
+	return NULL;
+    }
+
+    return mmv_init(fname, version, 0, cluster, flags,
+			    NULL, 0, NULL, 0, st, nmetrics, in, nindoms);
+}
+
+void * 
+mmv_stats3_init(const char *fname,
+		int cluster, mmv_stats_flags_t flags, int stripes,
+		const mmv_metric2_t *st, int nmetrics,
+		const mmv_indom2_t *in, int nindoms)
+{
+    int	version;
+
+    if (stripes < 0 || stripes > MMV_STRIPEMAX) {
+	setoserror(EINVAL);
+	return NULL;
+    }
+    if ((version = mmv_check2(st, nmetrics, in, nindoms)) < 0)
+	return NULL;
+    if (stripes)
+	version = MMV_VERSION3;
 
-    return mmv_init(fname, version, cluster, flags,
+    return mmv_init(fname, version, stripes, cluster, flags,
 			    NULL, 0, NULL, 0, st, nmetrics, in, nindoms);
 }
 
@@ -787,7 +891,8 @@ mmv_lookup_value_desc2(void *addr, const char *metric, const char *inst,
 	mmv_disk_string_t *s = (mmv_disk_string_t *)
 					((char *)addr + m->name);
 	if (strcmp(s->payload, metric) == 0) {
-	    if (mmv_singular(m->indom)) {  /* Singular metric */
+	    if (mmv_singular(m->indom) ||	/* Singular metric */
+		m->type == MMV_TYPE_HISTOGRAM) {	/* or all buckets */
 		return &v[j].value;
 	    } else {
 		if (inst == NULL) {
@@ -830,52 +935,291 @@ mmv_lookup_value_desc(void *addr, const char *metric, const char *inst)
     return NULL;
 }
 
+/*
+ * Threads are given a stripe number on their first update of a striped
+ * (v3) value, the lowest not held by another thread, and hand it back
+ * when they exit.  A thread owns its stripe in every mapping with more
+ * stripes than that, and is the only writer of its slots there, so
+ * updates them without atomics.  Threads without a stripe in a mapping
+ * (more threads than stripes) add to the value itself, atomically;
+ * in v3 files nothing else updates a striped value but mmv_set_value.
+ */
+#if defined(HAVE___THREAD) && defined(PM_MULTI_THREAD)
+#define MMV_STRIPE_WORDS	(MMV_STRIPEMAX / 64)
+static __thread int	mmv_thread_stripe = -1;
+static __uint64_t	mmv_stripes_held[MMV_STRIPE_WORDS];
+static pthread_mutex_t	mmv_stripe_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t	mmv_stripe_once = PTHREAD_ONCE_INIT;
+static pthread_key_t	mmv_stripe_key;
+static int		mmv_stripe_keyed;
+
+/* thread exit, make its stripe number available to new threads */
+static void
+mmv_stripe_release(void *arg)
+{
+    int stripe = (int)((intptr_t)arg - 1);
+
+    pthread_mutex_lock(&mmv_stripe_lock);
+    mmv_stripes_held[stripe / 64] &= ~((__uint64_t)1 << (stripe % 64));
+    pthread_mutex_unlock(&mmv_stripe_lock);
+}
+
+static void
+mmv_stripe_key_init(void)
+{
+    if (pthread_key_create(&mmv_stripe_key, mmv_stripe_release) == 0)
+	mmv_stripe_keyed = 1;
+}
+
+static int
+mmv_stripe_assign(void)
+{
+    int i, j, stripe = MMV_STRIPEMAX;	/* no stripe in any mapping */
+
+    pthread_once(&mmv_stripe_once, mmv_stripe_key_init);
+    pthread_mutex_lock(&mmv_stripe_lock);
+    for (i = 0; i < MMV_STRIPE_WORDS && stripe == MMV_STRIPEMAX; i++) {
+	if (mmv_stripes_held[i] == ~(__uint64_t)0)
+	    continue;
+	for (j = 0; j < 64; j++) {
+	    if (!(mmv_stripes_held[i] & ((__uint64_t)1 << j))) {
+		mmv_stripes_held[i] |= ((__uint64_t)1 << j);
+		stripe = i * 64 + j;
+		break;
+	    }
+	}
+    }
+    pthread_mutex_unlock(&mmv_stripe_lock);
+
+    /* without a key the stripe is never released, still owned though */
+    if (stripe < MMV_STRIPEMAX && mmv_stripe_keyed)
+	pthread_setspecific(mmv_stripe_key, (void *)(intptr_t)(stripe + 1));
+    return stripe;
+}
+#endif
+
+static int
+mmv_striped(int type)
+{
+    return (type >= MMV_TYPE_I32 && type <= MMV_TYPE_DOUBLE);
+}
+
+/*
+ * Find the stripe 0 slot of a value, and the distance between stripes;
+ * returns the number of stripes, zero if the value is not striped.
+ */
+static int
+mmv_lookup_stripes(void *addr, mmv_disk_value_t *v,
+			pmAtomValue **slot, __uint64_t *stride)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+    mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
+			((char *)addr + sizeof(mmv_disk_header_t));
+    mmv_disk_toc_t *values = NULL, *stripes = NULL;
+    __uint64_t index;
+    int i;
+
+    if (hdr->version < MMV_VERSION3)
+	return 0;
+    for (i = 0; i < hdr->tocs; i++) {
+	if (toc[i].type == MMV_TOC_VALUES)
+	    values = &toc[i];
+	else if (toc[i].type == MMV_TOC_STRIPES)
+	    stripes = &toc[i];
+    }
+    if (values == NULL || stripes == NULL || stripes->count <= 0)
+	return 0;
+
+    index = ((char *)v - ((char *)addr + values->offset)) /
+		sizeof(mmv_disk_value_t);
+    *stride = MMV_STRIPE_SIZE(values->count);
+    *slot = (pmAtomValue *)((char *)addr + stripes->offset +
+		index * sizeof(pmAtomValue));
+    return stripes->count;
+}
+
+static void
+mmv_stripe_add(pmAtomValue *slot, int type, double inc, int shared)
+{
+    pmAtomValue old, new;
+
+    switch (type) {
+    case MMV_TYPE_I32:
+	if (shared)
+	    __sync_fetch_and_add(&slot->l, (__int32_t)inc);
+	else
+	    slot->l += (__int32_t)inc;
+	break;
+    case MMV_TYPE_U32:
+	if (shared)
+	    __sync_fetch_and_add(&slot->ul, (__uint32_t)inc);
+	else
+	    slot->ul += (__uint32_t)inc;
+	break;
+    case MMV_TYPE_I64:
+	if (shared)
+	    __sync_fetch_and_add(&slot->ll, (__int64_t)inc);
+	else
+	    slot->ll += (__int64_t)inc;
+	break;
+    case MMV_TYPE_U64:
+	if (shared)
+	    __sync_fetch_and_add(&slot->ull, (__uint64_t)inc);
+	else
+	    slot->ull += (__uint64_t)inc;
+	break;
+    case MMV_TYPE_FLOAT:
+	if (!shared) {
+	    slot->f += (float)inc;
+	    break;
+	}
+	do {
+	    old.ul = slot->ul;
+	    new.f = old.f + (float)inc;
+	} while (!__sync_bool_compare_and_swap(&slot->ul, old.ul, new.ul));
+	break;
+    case MMV_TYPE_DOUBLE:
+	if (!shared) {
+	    slot->d += inc;
+	    break;
+	}
+	do {
+	    old.ull = slot->ull;
+	    new.d = old.d + inc;
+	} while (!__sync_bool_compare_and_swap(&slot->ull, old.ull, new.ull));
+	break;
+    default:
+	break;
+    }
+}
+
+/*
+ * Stripe owned by the calling thread in a mapping with the given number
+ * of stripes, or -1 if it has none there and must update atomically.
+ */
+static int
+mmv_stripe(int stripes)
+{
+#if defined(HAVE___THREAD) && defined(PM_MULTI_THREAD)
+    if (mmv_thread_stripe < 0)
+	mmv_thread_stripe = mmv_stripe_assign();
+    if (mmv_thread_stripe < stripes)
+	return mmv_thread_stripe;
+#endif
+    return -1;
+}
+
+static int
+mmv_value_type(void *addr, mmv_disk_value_t *v)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+
+    if (hdr->version == MMV_VERSION1)
+	return ((mmv_disk_metric_t *)((char *)addr + v->metric))->type;
+    return ((mmv_disk_metric2_t *)((char *)addr + v->metric))->type;
+}
+
+static void
+mmv_fill_handle(void *addr, mmv_disk_value_t *v, int type, mmv_handle_t *h)
+{
+    mmv_disk_instance2_t *in;
+    mmv_disk_indom_t *indom;
+    pmAtomValue *slot;
+    __uint64_t stride;
+
+    memset(h, 0, sizeof(*h));
+    h->addr = addr;
+    h->value = &v->value;
+    h->type = type;
+
+    if (type == MMV_TYPE_HISTOGRAM) {
+	in = (mmv_disk_instance2_t *)((char *)addr + v->instance);
+	indom = (mmv_disk_indom_t *)((char *)addr + in->indom);
+	h->nbuckets = indom->count;
+	h->bounds = (__int64_t *)((char *)addr + v->extra);
+	h->stride = MMV_BUCKETS_SIZE(h->nbuckets);
+	h->buckets = (__uint64_t *)((char *)h->bounds + h->stride);
+	h->stripes = mmv_lookup_stripes(addr, v, &slot, &stride);
+    } else if (mmv_striped(type)) {
+	h->stripes = mmv_lookup_stripes(addr, v, &h->slot, &h->stride);
+    }
+}
+
+static void
+mmv_value_add(mmv_disk_value_t *v, int type, double inc)
+{
+    switch (type) {
+    case MMV_TYPE_I32:
+	v->value.l += (__int32_t)inc;
+	break;
+    case MMV_TYPE_U32:
+	v->value.ul += (__uint32_t)inc;
+	break;
+    case MMV_TYPE_I64:
+	v->value.ll += (__int64_t)inc;
+	break;
+    case MMV_TYPE_U64:
+	v->value.ull += (__uint64_t)inc;
+	break;
+    case MMV_TYPE_FLOAT:
+	v->value.f += (float)inc;
+	break;
+    case MMV_TYPE_DOUBLE:
+	v->value.d += inc;
+	break;
+    case MMV_TYPE_ELAPSED:
+	if (inc < 0)
+	    v->extra = (__int64_t)inc;
+	else {
+	    v->value.ll += v->extra + (__int64_t)inc;
+	    v->extra = 0;
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+static void
+mmv_clear_stripes(void *addr, mmv_disk_value_t *v)
+{
+    pmAtomValue *slot;
+    __uint64_t stride;
+    int i, stripes;
+
+    stripes = mmv_lookup_stripes(addr, v, &slot, &stride);
+    for (i = 0; i < stripes; i++) {
+	memset(slot, 0, sizeof(*slot));
+	slot = (pmAtomValue *)((char *)slot + stride);
+    }
+}
+
+static void
+mmv_clear_buckets(void *addr, mmv_disk_value_t *v)
+{
+    mmv_handle_t h;
+    int stripes;
+
+    mmv_fill_handle(addr, v, MMV_TYPE_HISTOGRAM, &h);
+    stripes = h.stripes + 1;	/* and the shared counts */
+    memset(h.buckets, 0, stripes * h.stride);
+}
+
 void
 mmv_inc_value(void *addr, pmAtomValue *av, double inc)
 {
     if (av != NULL && addr != NULL) {
 	mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
 	mmv_disk_value_t *v = (mmv_disk_value_t *)av;
-	int type;
+	mmv_handle_t handle;
+	int type = mmv_value_type(addr, v);
 
-	if (hdr->version == MMV_VERSION1) {
-	    mmv_disk_metric_t *m = (mmv_disk_metric_t *)
-					((char *)addr + v->metric);
-	    type = m->type;
+	if (hdr->version >= MMV_VERSION3 &&
+	    (mmv_striped(type) || type == MMV_TYPE_HISTOGRAM)) {
+	    mmv_fill_handle(addr, v, type, &handle);
+	    mmv_handle_add(&handle, inc);
 	} else {
-	    mmv_disk_metric2_t *m = (mmv_disk_metric2_t *)
-					((char *)addr + v->metric);
-	    type = m->type;
-	}
-	switch (type) {
-	case MMV_TYPE_I32:
-	    v->value.l += (__int32_t)inc;
-	    break;
-	case MMV_TYPE_U32:
-	    v->value.ul += (__uint32_t)inc;
-	    break;
-	case MMV_TYPE_I64:
-	    v->value.ll += (__int64_t)inc;
-	    break;
-	case MMV_TYPE_U64:
-	    v->value.ull += (__uint64_t)inc;
-	    break;
-	case MMV_TYPE_FLOAT:
-	    v->value.f += (float)inc;
-	    break;
-	case MMV_TYPE_DOUBLE:
-	    v->value.d += inc;
-	    break;
-	case MMV_TYPE_ELAPSED:
-	    if (inc < 0)
-		v->extra = (__int64_t)inc;
-	    else {
-		v->value.ll += v->extra + (__int64_t)inc;
-		v->extra = 0;
-	    }
-	    break;
-	default:
-	    break;
+	    mmv_value_add(v, type, inc);
 	}
     }
 }
@@ -897,6 +1241,10 @@ mmv_set_value(void *addr, pmAtomValue *av, double val)
 					((char *)addr + v->metric);
 	    type = m->type;
 	}
+	if (mmv_striped(type))
+	    mmv_clear_stripes(addr, v);
+	else if (type == MMV_TYPE_HISTOGRAM)
+	    mmv_clear_buckets(addr, v);
 	switch (type) {
 	case MMV_TYPE_I32:
 	    v->value.l = (__int32_t)val;
@@ -960,6 +1308,92 @@ mmv_set_string(void *addr, pmAtomValue *av, const char *string, int size)
     }
 }
 
+/*
+ * Value handles - the name lookup, metric type and any stripe or bucket
+ * layout of a value are resolved once, so that later updates go to the
+ * value (or this thread's stripe of it) directly.
+ */
+
+int
+mmv_lookup_handle(void *addr,
+	const char *metric, const char *instance, mmv_handle_t *h)
+{
+    mmv_disk_value_t *v;
+
+    if (h == NULL) {
+	setoserror(EINVAL);
+	return -1;
+    }
+    v = (mmv_disk_value_t *)mmv_lookup_value_desc(addr, metric, instance);
+    if (v == NULL) {
+	setoserror(ESRCH);
+	return -1;
+    }
+    mmv_fill_handle(addr, v, mmv_value_type(addr, v), h);
+    return 0;
+}
+
+void
+mmv_handle_add(mmv_handle_t *h, double inc)
+{
+    pmAtomValue *slot;
+    int stripe;
+
+    if (h == NULL || h->value == NULL)
+	return;
+    if (h->type == MMV_TYPE_HISTOGRAM) {
+	mmv_handle_record(h, (__int64_t)inc);
+    } else if (h->stripes > 0) {
+	if ((stripe = mmv_stripe(h->stripes)) >= 0) {
+	    slot = (pmAtomValue *)((char *)h->slot + stripe * h->stride);
+	    mmv_stripe_add(slot, h->type, inc, 0);
+	} else {
+	    mmv_stripe_add(h->value, h->type, inc, 1);
+	}
+    } else if (mmv_striped(h->type)) {
+	/* a handle may be shared by threads, so update atomically */
+	mmv_stripe_add(h->value, h->type, inc, 1);
+    } else {
+	mmv_value_add((mmv_disk_value_t *)h->value, h->type, inc);
+    }
+}
+
+void
+mmv_handle_set(mmv_handle_t *h, double val)
+{
+    if (h != NULL)
+	mmv_set_value(h->addr, h->value, val);
+}
+
+void
+mmv_handle_record(mmv_handle_t *h, __int64_t sample)
+{
+    __uint64_t *counts;
+    int lo, hi, mid, stripe = -1;
+
+    if (h == NULL || h->type != MMV_TYPE_HISTOGRAM || h->nbuckets <= 0)
+	return;
+
+    /* first bucket bounding the sample, the last catches all above */
+    lo = 0;
+    hi = h->nbuckets - 1;
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (sample <= h->bounds[mid])
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+
+    counts = h->buckets;
+    if (h->stripes > 0 && (stripe = mmv_stripe(h->stripes)) >= 0)
+	counts = (__uint64_t *)((char *)counts + (stripe + 1) * h->stride);
+    if (stripe < 0)
+	__sync_fetch_and_add(&counts[lo], 1);
+    else
+	counts[lo]++;
+}
+
 /*
  * Simple wrapper routines
  */
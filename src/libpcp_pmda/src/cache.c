@@ -1,12 +1,12 @@
 /*
  * Copyright (c) 2013,2015-2017 Red Hat.
  * Copyright (c) 2005 Silicon Graphics, Inc.  All Rights Reserved.
- * 
+ *
  * This library is free software; you can redistribute it and/or modify it
  * under the terms of the GNU Lesser General Public License as published
  * by the Free Software Foundation; either version 2.1 of the License, or
  * (at your option) any later version.
- * 
+ *
  * This library is distributed in the hope that it will be useful, but
  * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
  * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
@@ -22,53 +22,80 @@
 #include <sys/stat.h>
 
 /*
- * simple linked list for each cache at this stage
+ * Each cache is a contiguous array of entries, kept in inst order
+ * (see sort_cache()), with open-addressed (linear probing) hash
+ * indexes by inst and by name holding positions in the array.
  */
 typedef struct entry {
-    struct entry	*next;		/* in inst identifier order */
-    struct entry	*h_inst;	/* inst hash chain */
-    struct entry	*h_name;	/* name hash chain */
     int			inst;
+    int			state;
     char		*name;
     int			hashlen;	/* smaller of strlen(name) and chars to first space */
+    unsigned int	hash;		/* hash of first hashlen chars of name */
     int			keylen;		/* > 0 if have key from pmdaCacheStoreKey() */
     void		*key;		/* != NULL if have key from pmdaCacheStoreKey() */
-    int			state;
     void		*private;
     time_t		stamp;
+    int			flags;		/* external file state, see below */
 } entry_t;
 
 #define CACHE_VERSION1	1
 #define CACHE_VERSION2	2
-#define CACHE_VERSION	CACHE_VERSION2	/* version of external file format */
+#define CACHE_VERSION3	3	/* version 2 plus journal records */
+#define CACHE_VERSION	CACHE_VERSION3	/* version of external file format */
 #define MAX_HASH_TRY	10
 
+/*
+ * Saves are appended to the external file as a journal of changed
+ * entries once the cache has at least CACHE_JOURNAL_MIN entries, and
+ * the file is compacted (rewritten) when the journal grows larger
+ * than the number of entries in the cache.  Small caches are always
+ * rewritten in the version 2 format.
+ */
+#define CACHE_JOURNAL_MIN	128
+
+#define NO_ENTRY	-1	/* unused hash index slot */
+
 /*
  * linked list of cache headers
  */
 typedef struct hdr {
     struct hdr		*next;		/* linked list of indoms */
-    entry_t		*first;		/* in inst order */
-    entry_t		*last;		/* in inst order */
-    entry_t		*save;		/* used in cache_walk() */
-    entry_t		**ctl_inst;	/* hash by inst chains */
-    entry_t		**ctl_name;	/* hash by name chains */
+    entry_t		*ent;		/* entries, in inst order if sorted */
+    int			nalloc;		/* allocated size of ent[] */
+    int			nentry;		/* number of entries */
+    int			sorted;		/* 0 if ent[] needs sort_cache() */
+    int			save;		/* used in cache_walk() */
+    int			*ctl_inst;	/* hash by inst, index into ent[] */
+    int			*ctl_name;	/* hash by name, index into ent[] */
     pmInDom		indom;
     int			hsize;
     int			hbits;
-    int			nentry;		/* number of entries */
     int			ins_mode;	/* see insert_cache() */
     int			hstate;		/* dirty/clean/string state */
     int			keyhash_cnt[MAX_HASH_TRY];
     int			maxinst;	/* maximum inst */
+    int			lastinst;	/* highest inst allocated, -1 if none */
+    int			gap;		/* all inst below this are in use */
+    int			jvalid;		/* external file may be appended to */
+    int			jversion;	/* version in external file header */
+    int			jrecords;	/* redundant records in external file */
+    int			jins_mode;	/* ins_mode in external file header */
+    int			jmaxinst;	/* maxinst in external file header */
+    off_t		jsize;		/* expected size of external file */
+    int			*tomb;		/* reclaimed entries still in the file */
+    int			ntomb;
+    int			maxtomb;
 } hdr_t;
 
 #define DEFAULT_MAXINST 0x7fffffff
 
-/* bitfields for hstate */
+/* bitfields for hstate, and entry flags */
 #define DIRTY_INSTANCE	0x1
 #define DIRTY_STAMP	0x2
 #define CACHE_STRINGS	0x4
+#define ENTRY_SAVED	0x8	/* entry flags only, in external file */
+#define DIRTY_KEY	0x10	/* entry flags only, key changed since saved */
 
 static hdr_t	*base;		/* start of cache headers */
 static char 	filename[MAXPATHLEN];
@@ -160,6 +187,91 @@ key_eq(entry_t *e, int keylen, const char *key)
     return 1;
 }
 
+static int
+inst_cmp(const void *a, const void *b)
+{
+    const entry_t	*ea = *(const entry_t **)a;
+    const entry_t	*eb = *(const entry_t **)b;
+
+    if (ea->inst != eb->inst)
+	return ea->inst < eb->inst ? -1 : 1;
+    /* culled entries after the live entry for the same inst */
+    return (ea->state == PMDA_CACHE_EMPTY) - (eb->state == PMDA_CACHE_EMPTY);
+}
+
+static int
+entry_cmp(const void *a, const void *b)
+{
+    const entry_t	*ea = (const entry_t *)a;
+    const entry_t	*eb = (const entry_t *)b;
+
+    return inst_cmp(&ea, &eb);
+}
+
+/*
+ * (re)build both hash indexes with hsize slots ... active entries
+ * are added first so they are closest to their home slot.
+ * If dosort is set, ent[] is restored to inst order first.
+ * Returns 0 on success, else -1 if the indexes cannot be grown (only
+ * possible if hsize is changing) and the old indexes are retained.
+ */
+static int
+build_index(hdr_t *h, int hsize, int dosort)
+{
+    int		*ctl_inst;
+    int		*ctl_name;
+    int		hbits = hsize - 1;
+    int		pass;
+    int		i;
+    int		j;
+    entry_t	*e;
+
+    if (hsize == h->hsize && h->ctl_inst != NULL) {
+	/* same size, rebuild in place */
+	ctl_inst = h->ctl_inst;
+	ctl_name = h->ctl_name;
+    }
+    else {
+	if ((ctl_inst = (int *)malloc(hsize * sizeof(int))) == NULL)
+	    return -1;
+	if ((ctl_name = (int *)malloc(hsize * sizeof(int))) == NULL) {
+	    free(ctl_inst);
+	    return -1;
+	}
+    }
+    for (i = 0; i < hsize; i++) {
+	ctl_inst[i] = NO_ENTRY;
+	ctl_name[i] = NO_ENTRY;
+    }
+    if (dosort) {
+	qsort(h->ent, h->nentry, sizeof(entry_t), entry_cmp);
+	h->sorted = 1;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+	for (i = 0, e = h->ent; i < h->nentry; i++, e++) {
+	    if ((e->state == PMDA_CACHE_ACTIVE) != (pass == 0))
+		continue;
+	    for (j = e->inst & hbits; ctl_inst[j] != NO_ENTRY; j = (j + 1) & hbits)
+		;
+	    ctl_inst[j] = i;
+	    for (j = e->hash & hbits; ctl_name[j] != NO_ENTRY; j = (j + 1) & hbits)
+		;
+	    ctl_name[j] = i;
+	}
+    }
+
+    if (h->ctl_inst != NULL && h->ctl_inst != ctl_inst) {
+	free(h->ctl_inst);
+	free(h->ctl_name);
+    }
+    h->ctl_inst = ctl_inst;
+    h->ctl_name = ctl_name;
+    h->hsize = hsize;
+    h->hbits = hbits;
+    return 0;
+}
+
 static hdr_t *
 find_cache(pmInDom indom, int *sts)
 {
@@ -171,79 +283,107 @@ find_cache(pmInDom indom, int *sts)
 	    return h;
     }
 
-    if ((h = (hdr_t *)malloc(sizeof(hdr_t))) == NULL) {
+    if ((h = (hdr_t *)calloc(1, sizeof(hdr_t))) == NULL ||
+	build_index(h, 16, 0) < 0) {
 	char	strbuf[20];
-	__pmNotifyErr(LOG_ERR, 
+	__pmNotifyErr(LOG_ERR,
 	     "find_cache: indom %s: unable to allocate memory for hdr_t",
 	     pmInDomStr_r(indom, strbuf, sizeof(strbuf)));
+	if (h != NULL)
+	    free(h);
 	*sts = PM_ERR_GENERIC;
 	return NULL;
     }
     h->next = base;
     base = h;
-    h->first = NULL;
-    h->last = NULL;
-    h->hsize = 16;
-    h->hbits = 0xf;
-    h->ctl_inst = (entry_t **)calloc(h->hsize, sizeof(entry_t *));
-    h->ctl_name = (entry_t **)calloc(h->hsize, sizeof(entry_t *));
-    h->indom = indom;
+    h->ent = NULL;
+    h->nalloc = 0;
     h->nentry = 0;
+    h->sorted = 1;
+    h->save = 0;
+    h->indom = indom;
     h->ins_mode = 0;
     h->hstate = 0;
     for (i = 0; i < MAX_HASH_TRY; i++)
 	h->keyhash_cnt[i] = 0;
     h->maxinst = DEFAULT_MAXINST;
+    h->lastinst = -1;
+    h->gap = 0;
+    h->jvalid = 0;
     return h;
 }
 
+/*
+ * Restore ent[] to inst order after out of order insertions, and
+ * rebuild the hash indexes to match.
+ */
+static void
+sort_cache(hdr_t *h)
+{
+    if (!h->sorted)
+	build_index(h, h->hsize, 1);
+}
+
+/*
+ * Entries in inst order, without moving any entries (so safe while
+ * a cache walk is in progress).  Returns NULL if ent[] is already in
+ * order, else a malloc'd array the caller must free.
+ */
+static entry_t **
+inst_order(hdr_t *h, int *sts)
+{
+    entry_t	**order;
+    int		i;
+
+    *sts = 0;
+    if (h->sorted || h->nentry == 0)
+	return NULL;
+    if ((order = (entry_t **)malloc(h->nentry * sizeof(entry_t *))) == NULL) {
+	*sts = PM_ERR_GENERIC;
+	return NULL;
+    }
+    for (i = 0; i < h->nentry; i++)
+	order[i] = &h->ent[i];
+    qsort(order, h->nentry, sizeof(entry_t *), inst_cmp);
+    return order;
+}
+
 /*
  * Traverse the cache in ascending inst order
  */
 static entry_t *
 walk_cache(hdr_t *h, int op)
 {
-    entry_t	*e;
-
     if (op == PMDA_CACHE_WALK_REWIND) {
-	h->save = h->first;
+	sort_cache(h);
+	h->save = 0;
 	return NULL;
     }
-    e = h->save;
-    if (e != NULL)
-	h->save = e->next;
-    return e;
+    if (h->save < h->nentry)
+	return &h->ent[h->save++];
+    return NULL;
 }
 
 /*
- * inst_or_name is 0 for inst hash list, 1 for name hash list
+ * inst_or_name is 0 for inst hash index, 1 for name hash index
  */
 static void
 dump_hash_list(FILE *fp, hdr_t *h, int inst_or_name, int i)
 {
     entry_t	*e;
+    int		pos;
 
     fprintf(fp, " [%03d]", i);
-    if (inst_or_name == 1) {
-	for (e = h->ctl_name[i]; e != NULL; e = e->h_name) {
-	    fprintf(fp, " -> %d", e->inst);
-	    if (e->state == PMDA_CACHE_EMPTY)
-		fputc('E', fp);
-	    else if (e->state == PMDA_CACHE_INACTIVE)
-		fputc('I', fp);
-	}
-	fputc('\n', fp);
-    }
-    else {
-	for (e = h->ctl_inst[i]; e != NULL; e = e->h_inst) {
-	    fprintf(fp, " -> %d", e->inst);
-	    if (e->state == PMDA_CACHE_EMPTY)
-		fputc('E', fp);
-	    else if (e->state == PMDA_CACHE_INACTIVE)
-		fputc('I', fp);
-	}
-	fputc('\n', fp);
+    pos = inst_or_name == 1 ? h->ctl_name[i] : h->ctl_inst[i];
+    if (pos != NO_ENTRY) {
+	e = &h->ent[pos];
+	fprintf(fp, " -> %d", e->inst);
+	if (e->state == PMDA_CACHE_EMPTY)
+	    fputc('E', fp);
+	else if (e->state == PMDA_CACHE_INACTIVE)
+	    fputc('I', fp);
     }
+    fputc('\n', fp);
 }
 
 static void
@@ -251,11 +391,15 @@ dump(FILE *fp, hdr_t *h, int do_hash)
 {
     entry_t	*e;
     char	strbuf[20];
+    entry_t	**order;
+    int		sts;
     int		i;
 
     fprintf(fp, "pmdaCacheDump: indom %s: nentry=%d ins_mode=%d hstate=%d hsize=%d\n",
 	pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)), h->nentry, h->ins_mode, h->hstate, h->hsize);
-    for (e = h->first; e != NULL; e = e->next) {
+    order = inst_order(h, &sts);
+    for (i = 0; i < h->nentry; i++) {
+	e = order == NULL ? &h->ent[i] : order[i];
 	if (e->state == PMDA_CACHE_EMPTY) {
 	    fprintf(fp, "(%10d) %8s\n", e->inst, "empty");
 	}
@@ -272,6 +416,8 @@ dump(FILE *fp, hdr_t *h, int do_hash)
 	    fputc('\n', fp);
 	}
     }
+    if (order != NULL)
+	free(order);
 
     if (do_hash == 0)
 	return;
@@ -293,48 +439,30 @@ dump(FILE *fp, hdr_t *h, int do_hash)
 	}
     }
 
-    if (h->ctl_inst != NULL) {
-	int	i;
-	fprintf(fp, "inst hash\n");
-	for (i = 0; i < h->hsize; i++) {
-	    dump_hash_list(fp, h, 0, i);
-	}
-    }
-    if (h->ctl_name != NULL) {
-	int	i;
-	fprintf(fp, "name hash\n");
-	for (i = 0; i < h->hsize; i++) {
-	    dump_hash_list(fp, h, 1, i);
-	}
-    }
+    fprintf(fp, "inst hash\n");
+    for (i = 0; i < h->hsize; i++)
+	dump_hash_list(fp, h, 0, i);
+    fprintf(fp, "name hash\n");
+    for (i = 0; i < h->hsize; i++)
+	dump_hash_list(fp, h, 1, i);
 }
 
+/*
+ * any entry with this inst, including culled entries (which keep
+ * their inst allocated until the cache is reorganized)
+ */
 static entry_t *
-find_name(hdr_t *h, const char *name, int *sts)
-{
-    entry_t	*e;
-    int		hashlen = get_hashlen(h, name);
-
-    *sts = 0;
-    for (e = h->first; e != NULL; e = e->next) {
-	if (e->state != PMDA_CACHE_EMPTY) {
-	    if ((*sts = name_eq(e, name, hashlen)))
-		break;
-	}
-    }
-    return e;
-}
-
-static entry_t *
-find_inst(hdr_t *h, int inst)
+find_inst_any(hdr_t *h, int inst)
 {
     entry_t	*e;
+    int		i;
 
-    for (e = h->first; e != NULL; e = e->next) {
-	if (e->inst == inst && e->state != PMDA_CACHE_EMPTY)
-	    break;
+    for (i = inst & h->hbits; h->ctl_inst[i] != NO_ENTRY; i = (i + 1) & h->hbits) {
+	e = &h->ent[h->ctl_inst[i]];
+	if (e->inst == inst)
+	    return e;
     }
-    return e;
+    return NULL;
 }
 
 /*
@@ -345,16 +473,15 @@ static entry_t *
 find_entry(hdr_t *h, const char *name, int inst, int *sts)
 {
     entry_t	*e;
+    int		i;
 
     *sts = 0;
     if (name == NULL) {
 	/*
 	 * search by instance identifier (inst)
 	 */
-	if (h->ctl_inst == NULL)
-	    /* no hash, use linear search */
-	    return find_inst(h, inst);
-	for (e = h->ctl_inst[inst & h->hbits]; e != NULL; e = e->h_inst) {
+	for (i = inst & h->hbits; h->ctl_inst[i] != NO_ENTRY; i = (i + 1) & h->hbits) {
+	    e = &h->ent[h->ctl_inst[i]];
 	    if (e->inst == inst && e->state != PMDA_CACHE_EMPTY)
 		return e;
 	}
@@ -363,13 +490,12 @@ find_entry(hdr_t *h, const char *name, int inst, int *sts)
 	/*
 	 * search by instance name
 	 */
-	int	hashlen = get_hashlen(h, name);
+	int		hashlen = get_hashlen(h, name);
+	unsigned int	hv = hash_str((const signed char *)name, hashlen);
 
-	if (h->ctl_name == NULL)
-	    /* no hash, use linear search */
-	    return find_name(h, name, sts);
-	for (e = h->ctl_name[hash_str((const signed char *)name, hashlen) & h->hbits]; e != NULL; e = e->h_name) {
-	    if (e->state != PMDA_CACHE_EMPTY) {
+	for (i = hv & h->hbits; h->ctl_name[i] != NO_ENTRY; i = (i + 1) & h->hbits) {
+	    e = &h->ent[h->ctl_name[i]];
+	    if (e->hash == hv && e->state != PMDA_CACHE_EMPTY) {
 		if ((*sts = name_eq(e, name, hashlen)))
 		    return e;
 	    }
@@ -380,182 +506,87 @@ find_entry(hdr_t *h, const char *name, int inst, int *sts)
 }
 
 /*
- * optionally resize the hash table first (if resize == 1)
- *
- * then re-order each hash chain so that active entires are
- * before inactive entries, and culled entries dropped
- *
- * applies to _both_ the inst and name hashes
+ * Reclaim culled entries, keeping the remaining entries in the same
+ * order (and any cache walk in progress at the same place).  Returns
+ * the number of entries reclaimed, the caller must rebuild the hash
+ * indexes if this is not zero.
  */
-static void
-redo_hash(hdr_t *h, int resize)
+static int
+reclaim_cache(hdr_t *h)
 {
     entry_t	*e;
-    entry_t	*last_e = NULL;
-    entry_t	*t;
     int		i;
-    entry_t	*last_active;
-    entry_t	*inactive;
-    entry_t	*last_inactive;
-
-    if (resize) {
-	entry_t		**old_inst;
-	entry_t		**old_name;
-	int		oldsize;
-	int		oldi;
-
-	old_inst = h->ctl_inst;
-	old_name = h->ctl_name;
-	oldsize = h->hsize;
-	h->hsize <<= 1;
-	h->ctl_inst = (entry_t **)calloc(h->hsize, sizeof(entry_t *));
-	if (h->ctl_inst == NULL) {
-	    h->ctl_inst = old_inst;
-	    h->hsize = oldsize;
-	    goto reorder;
-	}
-	h->ctl_name = (entry_t **)calloc(h->hsize, sizeof(entry_t *));
-	if (h->ctl_name == NULL) {
-	    free(h->ctl_inst);
-	    h->ctl_inst = old_inst;
-	    h->ctl_name = old_name;
-	    h->hsize = oldsize;
-	    goto reorder;
-	}
-	h->hbits = (h->hbits << 1) | 1;
-	for (oldi = 0; oldi < oldsize; oldi++) {
-	    for (e = old_inst[oldi]; e != NULL; ) {
-		t = e;
-		e = e->h_inst;
-		i = t->inst & h->hbits;
-		t->h_inst = h->ctl_inst[i];
-		h->ctl_inst[i] = t;
-	    }
-	}
-	for (oldi = 0; oldi < oldsize; oldi++) {
-	    for (e = old_name[oldi]; e != NULL; ) {
-		t = e;
-		e = e->h_name;
-		i = hash_str((const signed char *)t->name, t->hashlen) & h->hbits;
-		t->h_name = h->ctl_name[i];
-		h->ctl_name[i] = t;
-	    }
-	}
-	free(old_inst);
-	free(old_name);
-    }
-reorder:
-
-    /*
-     * first the inst hash list, moving active entries before inactive ones,
-     * and unlinking any empty ones
-     */ 
-    for (i = 0; i < h->hsize; i++) {
-	last_active = NULL;
-	inactive = NULL;
-	last_inactive = NULL;
-	e = h->ctl_inst[i];
-	h->ctl_inst[i] = NULL;
-	while (e != NULL) {
-	    t = e;
-	    e = e->h_inst;
-	    t->h_inst = NULL;
-	    if (t->state == PMDA_CACHE_ACTIVE) {
-		if (last_active == NULL)
-		    h->ctl_inst[i] = t;
-		else
-		    last_active->h_inst = t;
-		last_active = t;
-	    }
-	    else if (t->state == PMDA_CACHE_INACTIVE) {
-		if (last_inactive == NULL)
-		    inactive = t;
-		else
-		    last_inactive->h_inst = t;
-		last_inactive = t;
-	    }
-	}
-	if (last_active == NULL)
-	    h->ctl_inst[i] = inactive;
-	else
-	    last_active->h_inst = inactive;
-    }
+    int		n;
+    int		save = h->save;
 
-    /*
-     * and now the name hash list, doing the same thing
-     */
-    for (i = 0; i < h->hsize; i++) {
-	last_active = NULL;
-	inactive = NULL;
-	last_inactive = NULL;
-	e = h->ctl_name[i];
-	h->ctl_name[i] = NULL;
-	while (e != NULL) {
-	    t = e;
-	    e = e->h_name;
-	    t->h_name = NULL;
-	    if (t->state == PMDA_CACHE_ACTIVE) {
-		if (last_active == NULL)
-		    h->ctl_name[i] = t;
-		else
-		    last_active->h_name = t;
-		last_active = t;
-	    }
-	    else if (t->state == PMDA_CACHE_INACTIVE) {
-		if (last_inactive == NULL)
-		    inactive = t;
-		else
-		    last_inactive->h_name = t;
-		last_inactive = t;
+    for (i = n = 0, e = h->ent; i < h->nentry; i++, e++) {
+	if (e->state == PMDA_CACHE_EMPTY) {
+	    if (e->flags & ENTRY_SAVED) {
+		/* still in the external file, remember to journal the cull */
+		if (h->ntomb == h->maxtomb) {
+		    int	maxtomb = h->maxtomb == 0 ? 16 : 2 * h->maxtomb;
+		    int	*tomb = (int *)realloc(h->tomb, maxtomb * sizeof(int));
+		    if (tomb == NULL)
+			h->jvalid = 0;
+		    else {
+			h->tomb = tomb;
+			h->maxtomb = maxtomb;
+		    }
+		}
+		if (h->ntomb < h->maxtomb)
+		    h->tomb[h->ntomb++] = e->inst;
 	    }
+	    if (e->name)
+		free(e->name);
+	    if (e->key)
+		free(e->key);
+	    if (i < h->save)
+		save--;
+	    continue;
 	}
-	if (last_active == NULL)
-	    h->ctl_name[i] = inactive;
-	else
-	    last_active->h_name = inactive;
-    }
-
-    /*
-     * now walk the instance list, removing any culled entries and
-     * rebuilding the linked list
-     */
-    e = h->first;
-    while (e != NULL) {
-	t = e;
-	e = e->next;
-	if (t->state == PMDA_CACHE_EMPTY) {
-	    if (last_e == NULL)
-		h->first = e;
-	    else
-		last_e->next = e;
-	    if (t->name)
-		free(t->name);
-	    free(t);
-	}
-	else
-	    last_e = t;
+	if (n != i)
+	    h->ent[n] = *e;
+	n++;
     }
+    i = h->nentry - n;
+    h->nentry = n;
+    h->save = save;
+    if (i > 0)
+	h->gap = 0;
+    return i;
+}
 
+/*
+ * Reclaim culled entries, restore inst order and rebuild the hash
+ * indexes with active entries ahead of inactive entries.
+ */
+static void
+redo_hash(hdr_t *h)
+{
+    reclaim_cache(h);
+    build_index(h, h->hsize, 1);
 }
 
 /*
- * We need to keep the instances in ascending inst order.
+ * We need to be able to walk the instances in ascending inst order.
  * If inst _is_ PM_IN_NULL, then we need to choose a value ...
  * The default mode is appending to use the last value+1 (this is
  * ins_mode == 0).  If we wrap the instance identifier range, or
- * PMDA_CACHE_REUSE has been used, then ins_mode == 1 and we walk
- * the list starting from the beginning, looking for the first 
- * unused inst value.
+ * PMDA_CACHE_REUSE has been used, then ins_mode == 1 and we search
+ * upwards from the last known gap, looking for the first unused
+ * inst value.
  *
  * If inst is _not_ PM_IN_NULL, we're being called from load_cache
  * or pmdaCacheStoreKey() and the inst is known ... so we need to
  * check for possible duplicate entries.
+ *
+ * New entries are appended to ent[], and sort_cache() restores the
+ * inst order lazily if this was out of order.
  */
 static entry_t *
 insert_cache(hdr_t *h, const char *name, int inst, int *sts)
 {
     entry_t	*e;
-    entry_t	*last_e = NULL;
     char	*dup;
     int		i;
     int		hashlen = get_hashlen(h, name);
@@ -570,9 +601,7 @@ insert_cache(hdr_t *h, const char *name, int inst, int *sts)
 	 * inactive).
 	 * If one matches but the other is different, keep the
 	 * matching entry, but return an error as a warning.
-	 * If both fail to match, we're OK to insert the new entry,
-	 * although we need to run down the list quickly to find the
-	 * correct place to insert the new one.
+	 * If both fail to match, we're OK to insert the new entry.
 	 */
 	e = find_entry(h, NULL, inst, sts);
 	if (e != NULL) {
@@ -599,118 +628,131 @@ insert_cache(hdr_t *h, const char *name, int inst, int *sts)
 	    *sts = PM_ERR_INST;
 	    return e;
 	}
-	for (e = h->first; e != NULL; e = e->next) {
-	    if (e->inst < inst)
-		last_e = e;
-	    else if (e->inst > inst)
-		break;
+    }
+
+    if (h->nentry == h->nalloc) {
+	int	nalloc = h->nalloc == 0 ? 16 : 2 * h->nalloc;
+
+	if ((e = (entry_t *)realloc(h->ent, nalloc * sizeof(entry_t))) == NULL) {
+	    char	strbuf[20];
+	    __pmNotifyErr(LOG_ERR,
+		 "insert_cache: indom %s: unable to allocate memory for entry_t",
+		 pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)));
+	    *sts = PM_ERR_GENERIC;
+	    return NULL;
 	}
+	h->ent = e;
+	h->nalloc = nalloc;
     }
 
-    if ((dup = strdup(name)) == NULL) {
-	char	strbuf[20];
-	__pmNotifyErr(LOG_ERR, 
-	     "insert_cache: indom %s: unable to allocate %d bytes for name: %s\n",
-	     pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)), (int)strlen(name), name);
-	*sts = PM_ERR_GENERIC;
-	return NULL;
+    /*
+     * keep the hash indexes at most half full, reclaiming any culled
+     * entries before growing them
+     */
+    if (2 * (h->nentry + 1) > h->hsize) {
+	i = reclaim_cache(h);
+	if (2 * (h->nentry + 1) <= h->hsize)
+	    build_index(h, h->hsize, 0);
+	else if (build_index(h, 2 * h->hsize, 0) < 0 && i > 0)
+	    build_index(h, h->hsize, 0);
+	if (h->nentry + 1 >= h->hsize) {
+	    char	strbuf[20];
+	    __pmNotifyErr(LOG_ERR,
+		 "insert_cache: indom %s: unable to grow hash index to %d",
+		 pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)), 2 * h->hsize);
+	    *sts = PM_ERR_GENERIC;
+	    return NULL;
+	}
     }
 
     if (inst == PM_IN_NULL) {
 	if (h->ins_mode == 0) {
-	    last_e = h->last;
-	    if (last_e == NULL)
+	    if (h->lastinst < 0)
 		inst = 0;
-	    else {
-		if (last_e->inst == h->maxinst) {
-		    /*
-		     * overflowed inst identifier, need to shift to 
-		     * ins_mode == 1
-		     */
-		    h->ins_mode = 1;
-		    last_e = NULL;
-		    goto retry;
-		}
-		inst = last_e->inst+1;
+	    else if (h->lastinst >= h->maxinst) {
+		/*
+		 * overflowed inst identifier, need to shift to
+		 * ins_mode == 1
+		 */
+		h->ins_mode = 1;
+		goto retry;
 	    }
+	    else
+		inst = h->lastinst+1;
 	}
 	else {
 retry:
-	    inst = 0;
-	    for (e = h->first; e != NULL; e = e->next) {
-		if (inst < e->inst)
-		    break;
+	    for (inst = h->gap; find_inst_any(h, inst) != NULL; inst++) {
 		if (inst == h->maxinst) {
 		    /*
 		     * 2^32-1 is the maximum number of instances we can have
 		     */
 		    char	strbuf[20];
-		    __pmNotifyErr(LOG_ERR, 
+		    __pmNotifyErr(LOG_ERR,
 			 "insert_cache: indom %s: too many instances",
 			 pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)));
 		    *sts = PM_ERR_GENERIC;
-		    free(dup);
 		    return NULL;
 		}
-		inst++;
-		last_e = e;
 	    }
+	    h->gap = inst + 1;
 	}
     }
 
-    if ((e = (entry_t *)malloc(sizeof(entry_t))) == NULL) {
+    if ((dup = strdup(name)) == NULL) {
 	char	strbuf[20];
-	__pmNotifyErr(LOG_ERR, 
-	     "insert_cache: indom %s: unable to allocate memory for entry_t",
-	     pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)));
+	__pmNotifyErr(LOG_ERR,
+	     "insert_cache: indom %s: unable to allocate %d bytes for name: %s\n",
+	     pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)), (int)strlen(name), name);
 	*sts = PM_ERR_GENERIC;
-	free(dup);
 	return NULL;
     }
 
-    if (last_e == NULL) {
-	/* head of list */
-	e->next = h->first;
-	h->first = e;
-    }
-    else {
-	/* middle of list */
-	e->next = last_e->next;
-	last_e->next = e;
-    }
+    if (h->nentry > 0 && h->ent[h->nentry-1].inst >= inst)
+	h->sorted = 0;
+    e = &h->ent[h->nentry];
     e->inst = inst;
     e->name = dup;
-    e->hashlen = get_hashlen(h, dup);
+    e->hashlen = hashlen;
+    e->hash = hash_str((const signed char *)dup, hashlen);
+    e->keylen = 0;
     e->key = NULL;
     e->state = PMDA_CACHE_INACTIVE;
     e->private = NULL;
     e->stamp = 0;
-    if (h->last == NULL || h->last->inst < inst)
-	h->last = e;
+    e->flags = 0;
+    if (inst > h->lastinst)
+	h->lastinst = inst;
+
+    /* link into the inst and name hash indexes */
+    for (i = inst & h->hbits; h->ctl_inst[i] != NO_ENTRY; i = (i + 1) & h->hbits)
+	;
+    h->ctl_inst[i] = h->nentry;
+    for (i = e->hash & h->hbits; h->ctl_name[i] != NO_ENTRY; i = (i + 1) & h->hbits)
+	;
+    h->ctl_name[i] = h->nentry;
     h->nentry++;
 
-    if (h->hsize > 0 && h->hsize < 1024 && h->nentry > 4 * h->hsize)
-	redo_hash(h, 1);
+    return e;
+}
 
-    /* link into the inst hash list, if any */
-    if (h->ctl_inst != NULL) {
-	i = inst & h->hbits;
-	e->h_inst = h->ctl_inst[i];
-	h->ctl_inst[i] = e;
-    }
-    else
-	e->h_inst = NULL;
+static int
+cache_filename(hdr_t *h)
+{
+    int		sep = __pmPathSeparator();
+    char	strbuf[20];
 
-    /* link into the name hash list, if any */
-    if (h->ctl_name != NULL) {
-	i = hash_str((const signed char *)e->name, e->hashlen) & h->hbits;
-	e->h_name = h->ctl_name[i];
-	h->ctl_name[i] = e;
+    if (vdp == NULL) {
+	if ((vdp = pmGetOptionalConfig("PCP_VAR_DIR")) == NULL)
+	    return PM_ERR_GENERIC;
+	snprintf(filename, sizeof(filename),
+		"%s%c" "config" "%c" "pmda", vdp, sep, sep);
+	mkdir2(filename, 0755);
     }
-    else
-	e->h_name = NULL;
 
-    return e;
+    snprintf(filename, sizeof(filename), "%s%cconfig%cpmda%c%s",
+		vdp, sep, sep, sep, pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)));
+    return 0;
 }
 
 static int
@@ -719,6 +761,7 @@ load_cache(hdr_t *h)
     FILE	*fp;
     entry_t	*e;
     int		cnt;
+    int		version;
     int		x;
     int		inst;
     int		keylen = 0;
@@ -727,39 +770,34 @@ load_cache(hdr_t *h)
     char	buf[1024];	/* input line buffer, is this big enough? */
     char	*p;
     int		sts;
-    int		sep = __pmPathSeparator();
-    char	strbuf[20];
+    int		valid;
+    int		nlive;
+    int		ndrop = 0;
 
-    if (vdp == NULL) {
-	if ((vdp = pmGetOptionalConfig("PCP_VAR_DIR")) == NULL)
-	    return PM_ERR_GENERIC;
-	snprintf(filename, sizeof(filename),
-		"%s%c" "config" "%c" "pmda", vdp, sep, sep);
-	mkdir2(filename, 0755);
-    }
-
-    snprintf(filename, sizeof(filename), "%s%cconfig%cpmda%c%s",
-		vdp, sep, sep, sep, pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)));
+    if ((sts = cache_filename(h)) < 0)
+	return sts;
+    h->jvalid = 0;
+    h->ntomb = 0;
     if ((fp = fopen(filename, "r")) == NULL)
 	return -oserror();
     if (fgets(buf, sizeof(buf), fp) == NULL) {
-	__pmNotifyErr(LOG_ERR, 
+	__pmNotifyErr(LOG_ERR,
 	     "pmdaCacheOp: %s: empty file?", filename);
 	fclose(fp);
 	return PM_ERR_GENERIC;
     }
     /* First grab the file version. */
-    s = sscanf(buf, "%d ", &x);
-    if (s != 1 || x <= 0 || x > CACHE_VERSION) {
-	__pmNotifyErr(LOG_ERR, 
+    s = sscanf(buf, "%d ", &version);
+    if (s != 1 || version <= 0 || version > CACHE_VERSION) {
+	__pmNotifyErr(LOG_ERR,
 	     "pmdaCacheOp: %s: illegal cache header record: %s",
 	     filename, buf);
 	fclose(fp);
 	return PM_ERR_GENERIC;
-    }	
+    }
 
     /* Based on the file version, grab the entire line. */
-    switch (x) {
+    switch (version) {
 	case CACHE_VERSION1:
 	    h->maxinst = DEFAULT_MAXINST;
 	    s = sscanf(buf, "%d %d", &x, &h->ins_mode);
@@ -773,22 +811,49 @@ load_cache(hdr_t *h)
 	    break;
     }
     if (s == 0 || h->ins_mode < 0 || h->ins_mode > 1 || h->maxinst < 0) {
-	__pmNotifyErr(LOG_ERR, 
+	__pmNotifyErr(LOG_ERR,
 	     "pmdaCacheOp: %s: illegal cache header record: %s",
 	     filename, buf);
 	fclose(fp);
 	return PM_ERR_GENERIC;
     }
+    /* can only append to a header we know how to update in place */
+    valid = (version == CACHE_VERSION2 || version == CACHE_VERSION3) &&
+	    buf[0] == '0' + version;
 
     for (cnt = 0; ; cnt++) {
 	if (fgets(buf, sizeof(buf), fp) == NULL)
 	    break;
 	if ((p = strchr(buf, '\n')) != NULL)
 	    *p = '\0';
+	else if (version == CACHE_VERSION3 && feof(fp)) {
+	    /* incomplete journal record at the end, from an interrupted save */
+	    __pmNotifyErr(LOG_WARNING,
+		"pmdaCacheOp: %s: incomplete record ignored: %s",
+		filename, buf);
+	    valid = 0;
+	    break;
+	}
 	p = buf;
 	while (*p && isascii((int)*p) && isspace((int)*p))
 	    p++;
 	if (*p == '\0') goto bad;
+	if (*p == '-' && version == CACHE_VERSION3) {
+	    /* journal record for a culled entry */
+	    p++;
+	    inst = 0;
+	    while (*p && isascii((int)*p) && isdigit((int)*p)) {
+		inst = inst*10 + (*p-'0');
+		p++;
+	    }
+	    if (*p != '\0') goto bad;
+	    if ((e = find_entry(h, NULL, inst, &sts)) != NULL) {
+		e->state = PMDA_CACHE_EMPTY;
+		e->flags = 0;
+		ndrop++;
+	    }
+	    continue;
+	}
 	inst = 0;
 	while (*p && isascii((int)*p) && isdigit((int)*p)) {
 	    inst = inst*10 + (*p-'0');
@@ -820,7 +885,7 @@ load_cache(hdr_t *h)
 	     */
 	    keylen = (pend - p) / 2;
 	    if ((key = malloc(keylen)) == NULL) {
-		__pmNotifyErr(LOG_ERR, 
+		__pmNotifyErr(LOG_ERR,
 		     "load_cache: indom %s: unable to allocate memory for keylen=%d",
 		     pmInDomStr(h->indom), keylen);
 		fclose(fp);
@@ -842,7 +907,7 @@ load_cache(hdr_t *h)
 	}
 	if (*p == '\0') {
 bad:
-	    __pmNotifyErr(LOG_ERR, 
+	    __pmNotifyErr(LOG_ERR,
 		 "pmdaCacheOp: %s: illegal record: %s",
 		 filename, buf);
 	    if (key) free(key);
@@ -859,13 +924,31 @@ bad:
 	    __pmNotifyErr(LOG_WARNING,
 		"pmdaCacheOp: %s: loading instance %d (\"%s\") ignored, already in cache as %d (\"%s\")",
 		filename, inst, p, e->inst, e->name);
+	    valid = 0;
 	}
+	if (e->key != NULL && e->key != key)
+	    free(e->key);
 	e->keylen = keylen;
 	e->key = key;
 	e->stamp = x;
+	if (sts == 0)
+	    e->flags = ENTRY_SAVED;
     }
+    h->jsize = ftell(fp);
     fclose(fp);
 
+    if (ndrop > 0)
+	redo_hash(h);
+    for (nlive = 0, e = h->ent; e < &h->ent[h->nentry]; e++) {
+	if (e->flags & ENTRY_SAVED)
+	    nlive++;
+    }
+    h->jvalid = valid;
+    h->jversion = version;
+    h->jrecords = cnt - nlive;
+    h->jins_mode = h->ins_mode;
+    h->jmaxinst = h->maxinst;
+
 #ifdef PCP_DEBUG
     if (pmDebug & DBG_TRACE_INDOM) {
 	fprintf(stderr, "After PMDA_CACHE_LOAD\n");
@@ -876,57 +959,192 @@ bad:
     return cnt;
 }
 
+static void
+put_record(FILE *fp, entry_t *e)
+{
+    fprintf(fp, "%d %d", e->inst, (int)e->stamp);
+    if (e->keylen > 0) {
+	char	*p = (char *)e->key;
+	int	i;
+	fprintf(fp, " [");
+	for (i = 0; i < e->keylen; i++, p++)
+	    fprintf(fp, "%02x", (*p & 0xff));
+	fputc(']', fp);
+    }
+    fprintf(fp, " %s\n", e->name);
+}
+
+/*
+ * Rewrite the entire external file, in the version 2 format.
+ */
 static int
-save_cache(hdr_t *h, int hstate)
+compact_cache(hdr_t *h)
 {
     FILE	*fp;
     entry_t	*e;
+    entry_t	**order;
     int		cnt;
+    int		sts;
+    int		i;
+
+    if ((order = inst_order(h, &sts)) == NULL && sts < 0)
+	return sts;
+    h->jvalid = 0;
+    h->ntomb = 0;
+    if ((fp = fopen(filename, "w")) == NULL) {
+	sts = -oserror();
+	if (order != NULL)
+	    free(order);
+	return sts;
+    }
+    fprintf(fp, "%d %d %d\n", CACHE_VERSION2, h->ins_mode, h->maxinst);
+
+    cnt = 0;
+    for (i = 0; i < h->nentry; i++) {
+	e = order == NULL ? &h->ent[i] : order[i];
+	if (e->state == PMDA_CACHE_EMPTY) {
+	    e->flags = 0;
+	    continue;
+	}
+	put_record(fp, e);
+	e->flags = ENTRY_SAVED;
+	cnt++;
+    }
+    if (order != NULL)
+	free(order);
+    fflush(fp);
+    if (!ferror(fp)) {
+	h->jvalid = 1;
+	h->jversion = CACHE_VERSION2;
+	h->jrecords = 0;
+	h->jins_mode = h->ins_mode;
+	h->jmaxinst = h->maxinst;
+	h->jsize = ftell(fp);
+    }
+    fclose(fp);
+
+    return cnt;
+}
+
+/*
+ * Append the changed entries to the external file.  Culled entries
+ * come first, as a new entry may have reused the inst of a culled
+ * entry.  Entries with a changed key are always journalled, timestamp
+ * changes only if hstate includes DIRTY_STAMP.
+ */
+static int
+journal_cache(hdr_t *h, int hstate)
+{
+    FILE	*fp;
+    entry_t	*e;
+    int		cnt;
+    int		sts;
+
+    h->jvalid = 0;
+    if ((fp = fopen(filename, "r+")) == NULL)
+	return -oserror();
+    if (h->jversion != CACHE_VERSION3) {
+	/* external file now has journal records */
+	fputc('0' + CACHE_VERSION3, fp);
+	h->jversion = CACHE_VERSION3;
+    }
+    fseek(fp, 0, SEEK_END);
+
+    for (cnt = 0; cnt < h->ntomb; cnt++)
+	fprintf(fp, "-%d\n", h->tomb[cnt]);
+    h->ntomb = 0;
+    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
+	if (e->state == PMDA_CACHE_EMPTY && (e->flags & ENTRY_SAVED)) {
+	    fprintf(fp, "-%d\n", e->inst);
+	    e->flags = 0;
+	    cnt++;
+	}
+    }
+    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
+	if (e->state == PMDA_CACHE_EMPTY)
+	    continue;
+	if ((e->flags & ENTRY_SAVED) == 0 || (e->flags & DIRTY_KEY) ||
+	    ((hstate & DIRTY_STAMP) && (e->flags & DIRTY_STAMP))) {
+	    put_record(fp, e);
+	    e->flags = ENTRY_SAVED;
+	    cnt++;
+	}
+    }
+    fflush(fp);
+    if (ferror(fp))
+	sts = PM_ERR_GENERIC;
+    else {
+	sts = cnt;
+	h->jvalid = 1;
+	h->jrecords += cnt;
+	h->jsize = ftell(fp);
+    }
+    fclose(fp);
+
+    return sts;
+}
+
+static int
+save_cache(hdr_t *h, int hstate)
+{
+    entry_t	*e;
+    int		nlive;
+    int		ndirty;
+    int		nstamp;
+    int		sts;
     time_t	now;
-    int		sep = __pmPathSeparator();
     int		state = h->hstate & ~CACHE_STRINGS;
-    char	strbuf[20];
+    struct stat	sbuf;
 
     if ((state & hstate) == 0) {
 	/* nothing to be done */
 	return 0;
     }
 
-    if (vdp == NULL) {
-	if ((vdp = pmGetOptionalConfig("PCP_VAR_DIR")) == NULL)
-	    return PM_ERR_GENERIC;
-	snprintf(filename, sizeof(filename),
-		"%s%c" "config" "%c" "pmda", vdp, sep, sep);
-	mkdir2(filename, 0755);
-    }
-
-    snprintf(filename, sizeof(filename), "%s%cconfig%cpmda%c%s",
-		vdp, sep, sep, sep, pmInDomStr_r(h->indom, strbuf, sizeof(strbuf)));
-    if ((fp = fopen(filename, "w")) == NULL)
-	return -oserror();
-    fprintf(fp, "%d %d %d\n", CACHE_VERSION, h->ins_mode, h->maxinst);
+    if ((sts = cache_filename(h)) < 0)
+	return sts;
 
     now = time(NULL);
-    cnt = 0;
-    for (e = h->first; e != NULL; e = e->next) {
-	if (e->state == PMDA_CACHE_EMPTY)
+    nlive = nstamp = 0;
+    ndirty = h->ntomb;
+    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
+	if (e->state == PMDA_CACHE_EMPTY) {
+	    if (e->flags & ENTRY_SAVED)
+		ndirty++;
 	    continue;
-	if (e->stamp == 0)
+	}
+	nlive++;
+	if (e->stamp == 0) {
 	    e->stamp = now;
-	fprintf(fp, "%d %d", e->inst, (int)e->stamp);
-	if (e->keylen > 0) {
-	    char	*p = (char *)e->key;
-	    int		i;
-	    fprintf(fp, " [");
-	    for (i = 0; i < e->keylen; i++, p++)
-		fprintf(fp, "%02x", (*p & 0xff));
-	    fputc(']', fp);
+	    if (e->flags & ENTRY_SAVED)
+		e->flags |= DIRTY_STAMP;
+	}
+	if ((e->flags & ENTRY_SAVED) == 0 || (e->flags & DIRTY_KEY))
+	    ndirty++;
+	else if (e->flags & DIRTY_STAMP) {
+	    if (hstate & DIRTY_STAMP)
+		ndirty++;
+	    else
+		nstamp++;
 	}
-	fprintf(fp, " %s\n", e->name);
-	cnt++;
     }
-    fclose(fp);
+
+    if (h->jvalid && nlive >= CACHE_JOURNAL_MIN &&
+	h->jrecords + ndirty <= nlive &&
+	h->ins_mode == h->jins_mode && h->maxinst == h->jmaxinst &&
+	stat(filename, &sbuf) == 0 && sbuf.st_size == h->jsize) {
+	sts = journal_cache(h, hstate);
+    }
+    else {
+	sts = compact_cache(h);
+	nstamp = 0;
+    }
+    if (sts < 0)
+	return sts;
     h->hstate &= ~(DIRTY_INSTANCE | DIRTY_STAMP);
+    if (nstamp > 0)
+	/* timestamps not journalled yet, see PMDA_CACHE_SYNC */
+	h->hstate |= DIRTY_STAMP;
 
 #ifdef PCP_DEBUG
     if (pmDebug & DBG_TRACE_INDOM) {
@@ -938,7 +1156,7 @@ save_cache(hdr_t *h, int hstate)
     }
 #endif
 
-    return cnt;
+    return sts;
 }
 
 void
@@ -1004,6 +1222,13 @@ store(pmInDom indom, int flags, const char *name, pmInDom inst, int keylen, cons
 
     switch (flags) {
 	case PMDA_CACHE_ADD:
+	    if ((e->flags & ENTRY_SAVED) && key_eq(e, keylen, key) == 0) {
+		/* saved with the old key, so save again at the next save */
+		e->flags |= DIRTY_KEY;
+		h->hstate |= DIRTY_INSTANCE;
+	    }
+	    if (e->key != NULL)
+		free(e->key);
 	    e->keylen = keylen;
 	    if (keylen > 0) {
 		if ((e->key = malloc(keylen)) == NULL) {
@@ -1223,7 +1448,7 @@ int pmdaCacheOp(pmInDom indom, int op)
 
 	case PMDA_CACHE_ACTIVE:
 	    sts = 0;
-	    for (e = h->first; e != NULL; e = e->next) {
+	    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
 		if (e->state == PMDA_CACHE_INACTIVE) {
 		    e->state = PMDA_CACHE_ACTIVE;
 		    sts++;
@@ -1234,7 +1459,7 @@ int pmdaCacheOp(pmInDom indom, int op)
 
 	case PMDA_CACHE_INACTIVE:
 	    sts = 0;
-	    for (e = h->first; e != NULL; e = e->next) {
+	    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
 		if (e->state == PMDA_CACHE_ACTIVE) {
 		    e->state = PMDA_CACHE_INACTIVE;
 		    sts++;
@@ -1245,7 +1470,7 @@ int pmdaCacheOp(pmInDom indom, int op)
 
 	case PMDA_CACHE_CULL:
 	    sts = 0;
-	    for (e = h->first; e != NULL; e = e->next) {
+	    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
 		if (e->state != PMDA_CACHE_EMPTY) {
 		    e->state = PMDA_CACHE_EMPTY;
 		    sts++;
@@ -1260,7 +1485,7 @@ int pmdaCacheOp(pmInDom indom, int op)
 
 	case PMDA_CACHE_SIZE_ACTIVE:
 	    sts = 0;
-	    for (e = h->first; e != NULL; e = e->next) {
+	    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
 		if (e->state == PMDA_CACHE_ACTIVE)
 		    sts++;
 	    }
@@ -1268,7 +1493,7 @@ int pmdaCacheOp(pmInDom indom, int op)
 
 	case PMDA_CACHE_SIZE_INACTIVE:
 	    sts = 0;
-	    for (e = h->first; e != NULL; e = e->next) {
+	    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
 		if (e->state == PMDA_CACHE_INACTIVE)
 		    sts++;
 	    }
@@ -1279,7 +1504,7 @@ int pmdaCacheOp(pmInDom indom, int op)
 	    return 0;
 
 	case PMDA_CACHE_REORG:
-	    redo_hash(h, 0);
+	    redo_hash(h);
 	    return 0;
 
 	case PMDA_CACHE_WALK_REWIND:
@@ -1382,12 +1607,11 @@ int pmdaCacheLookupKey(pmInDom indom, const char *name, int keylen, const void *
     }
 
     /*
-     * No hash list for key[]s ... have to walk the cache.
+     * No hash index for key[]s ... have to scan the cache.
      * pmdaCacheStoreKey() ensures the key[]s are unique, so first match
      * wins.
      */
-    walk_cache(h, PMDA_CACHE_WALK_REWIND);
-    while ((e = walk_cache(h, PMDA_CACHE_WALK_NEXT)) != NULL) {
+    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
 	if (e->state == PMDA_CACHE_EMPTY)
 	    continue;
 	if (key_eq(e, mykeylen, mykey) == 1) {
@@ -1426,7 +1650,7 @@ int pmdaCachePurge(pmInDom indom, time_t recent)
 	return sts;
 
     cnt = 0;
-    for (e = h->first; e != NULL; e = e->next) {
+    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
 	/*
 	 * e->stamp == 0 => recently ACTIVE and no subsequent SAVE ...
 	 * keep these ones
@@ -1458,7 +1682,7 @@ int pmdaCacheResize(pmInDom indom, int maximum)
 	return PM_ERR_SIGN;
 
     /* Find the largest inst in the queue. */
-    for (e = h->first; e != NULL; e = e->next) {
+    for (e = h->ent; e < &h->ent[h->nentry]; e++) {
 	/* If the new maximum is smaller than an existing inst, error. */
 	if (maximum < e->inst)
 	    return PM_ERR_TOOBIG;
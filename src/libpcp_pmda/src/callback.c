@@ -477,6 +477,350 @@ pmdaInstance(pmInDom indom, int inst, char *name, __pmInResult **result, pmdaExt
     return 0;
 }
 
+/*
+ * Value set and pmValueBlock allocation for pmdaFetch.
+ *
+ * Normally every pmValueSet (and pmValueBlock) is individually malloc'd,
+ * because pmcd (for DSO PMDAs) or the result callback (for daemon PMDAs)
+ * releases them with __pmFreeResultValues().  When pmdaMain knows that
+ * the result will be handed back via __pmdaRecycleResult() instead, the
+ * value sets are kept between fetches (one per pmidlist[] slot, grown as
+ * needed) and pmValueBlocks are carved from an arena that is reset once
+ * the result has been sent.
+ */
+
+static pmValueSet *
+__pmdaValueSet(e_ext_t *extp, int i, pmValueSet *vset, int numval)
+{
+    size_t	need;
+    int		n;
+
+    if (numval >= 1)
+	need = sizeof(pmValueSet) + (numval - 1) * sizeof(pmValue);
+    else
+	need = sizeof(pmValueSet) - sizeof(pmValue);
+
+    /* Must use individual malloc()s because of pmFreeResult() */
+    if (!extp->recycle)
+	return (pmValueSet *)realloc(vset, need);
+
+    if (i >= extp->nvsets) {
+	pmValueSet	**vsets;
+	int		*maxvals;
+
+	n = extp->maxnpmids > i ? extp->maxnpmids : i + 1;
+	if ((vsets = (pmValueSet **)realloc(extp->vsets, n * sizeof(vsets[0]))) == NULL)
+	    return NULL;
+	extp->vsets = vsets;
+	if ((maxvals = (int *)realloc(extp->maxvals, n * sizeof(maxvals[0]))) == NULL)
+	    return NULL;
+	extp->maxvals = maxvals;
+	for ( ; extp->nvsets < n; extp->nvsets++) {
+	    extp->vsets[extp->nvsets] = NULL;
+	    extp->maxvals[extp->nvsets] = 0;
+	}
+    }
+    if (extp->vsets[i] == NULL || numval > extp->maxvals[i]) {
+	/* grow geometrically, instance domains tend to keep growing */
+	n = extp->maxvals[i] * 2;
+	if (n < numval)
+	    n = numval;
+	if (n < 1)
+	    n = 1;
+	need = sizeof(pmValueSet) + (n - 1) * sizeof(pmValue);
+	if ((vset = (pmValueSet *)realloc(extp->vsets[i], need)) == NULL)
+	    return NULL;
+	extp->vsets[i] = vset;
+	extp->maxvals[i] = n;
+    }
+    return extp->vsets[i];
+}
+
+static void *
+__pmdaArenaAlloc(e_ext_t *extp, size_t need)
+{
+    e_arena_t	*ap = extp->arena;
+    size_t	size;
+    void	*p;
+
+    need = (need + sizeof(__int64_t) - 1) & ~(sizeof(__int64_t) - 1);
+    if (ap == NULL || ap->used + need > ap->size) {
+	size = (ap == NULL) ? 4096 : 2 * ap->size;
+	while (size < need)
+	    size *= 2;
+	if ((ap = (e_arena_t *)malloc(sizeof(e_arena_t) + size)) == NULL)
+	    return NULL;
+	ap->next = extp->arena;
+	ap->size = size;
+	ap->used = 0;
+	extp->arena = ap;
+    }
+    p = (void *)&ap->buf[ap->used];
+    ap->used += need;
+    return p;
+}
+
+static void
+__pmdaArenaReset(e_ext_t *extp)
+{
+    e_arena_t	*ap = extp->arena;
+    e_arena_t	*next;
+
+    if (ap == NULL)
+	return;
+    /* most recent chunk is the largest, keep it and release the rest */
+    while ((next = ap->next) != NULL) {
+	ap->next = next->next;
+	free(next);
+    }
+    ap->used = 0;
+}
+
+static int
+__pmdaStuffValue(e_ext_t *extp, const pmAtomValue *avp, pmValue *vp, int type)
+{
+    const void	*src;
+    size_t	need, body;
+
+    if (!extp->recycle)
+	return __pmStuffValue(avp, vp, type);
+
+    switch (type) {
+	case PM_TYPE_FLOAT:
+	    body = sizeof(float);
+	    src  = (const void *)&avp->f;
+	    break;
+
+	case PM_TYPE_64:
+	case PM_TYPE_U64:
+	case PM_TYPE_DOUBLE:
+	    body = sizeof(__int64_t);
+	    src  = (const void *)&avp->ull;
+	    break;
+
+	case PM_TYPE_AGGREGATE:
+	    body = avp->vbp->vlen - PM_VAL_HDR_SIZE;
+	    src  = (const void *)avp->vbp->vbuf;
+	    break;
+
+	case PM_TYPE_STRING:
+	    body = strlen(avp->cp) + 1;
+	    src  = (const void *)avp->cp;
+	    break;
+
+	default:
+	    /* insitu, static pointer or bad type, nothing to allocate */
+	    return __pmStuffValue(avp, vp, type);
+    }
+    need = body + PM_VAL_HDR_SIZE;
+    vp->value.pval = (pmValueBlock *)__pmdaArenaAlloc(extp,
+	    (need < sizeof(pmValueBlock)) ? sizeof(pmValueBlock) : need);
+    if (vp->value.pval == NULL)
+	return -oserror();
+    vp->value.pval->vlen = (int)need;
+    vp->value.pval->vtype = type;
+    memcpy((void *)vp->value.pval->vbuf, src, body);
+    /* arena memory, so must not be freed by __pmFreeResultValues */
+    return PM_VAL_SPTR;
+}
+
+/*
+ * Called from pmdaMain once a pmResult from pmdaFetch has been sent to
+ * pmcd - returns 1 if the result was recycled (and so must not be passed
+ * to the result callback), else 0.
+ */
+int
+__pmdaRecycleResult(pmdaExt *pmda, pmResult *result)
+{
+    e_ext_t	*extp = (e_ext_t *)pmda->e_ext;
+
+    if (!extp->recycle || result != extp->res)
+	return 0;
+    __pmdaArenaReset(extp);
+    return 1;
+}
+
+/*
+ * Report a failed fetch callback for one metric-instance pair
+ */
+static void
+__pmdaFetchError(pmDesc *dp, int inst, int sts)
+{
+    char	strbuf[20];
+
+    pmIDStr_r(dp->pmid, strbuf, sizeof(strbuf));
+    if (sts == PM_ERR_PMID) {
+	__pmNotifyErr(LOG_ERR, 
+	    "pmdaFetch: PMID %s not handled by fetch callback\n",
+			strbuf);
+    }
+    else if (sts == PM_ERR_INST) {
+#ifdef PCP_DEBUG
+	if (pmDebug & DBG_TRACE_LIBPMDA) {
+	    __pmNotifyErr(LOG_ERR,
+		"pmdaFetch: Instance %d of PMID %s not handled by fetch callback\n",
+			    inst, strbuf);
+	}
+#endif
+    }
+    else if (sts == PM_ERR_APPVERSION ||
+	     sts == PM_ERR_PERMISSION ||
+	     sts == PM_ERR_AGAIN ||
+	     sts == PM_ERR_NYI) {
+#ifdef PCP_DEBUG
+	if (pmDebug & DBG_TRACE_LIBPMDA) {
+	    __pmNotifyErr(LOG_ERR,
+		 "pmdaFetch: Unavailable metric PMID %s[%d]\n",
+			    strbuf, inst);
+	}
+#endif
+    }
+    else {
+	__pmNotifyErr(LOG_ERR,
+	    "pmdaFetch: Fetch callback error from metric PMID %s[%d]: %s\n",
+			strbuf, inst, pmErrStr(sts));
+    }
+}
+
+/*
+ * Copy one value returned by a fetch callback into vp, honouring the
+ * callback return code sts ... returns 1 if a value was added, 0 if no
+ * value is available, else a negative error code.
+ */
+static int
+__pmdaFetchValue(e_ext_t *extp, pmDesc *dp, int sts, pmAtomValue *atom,
+		 pmValue *vp, int *valfmt)
+{
+    int		interface = extp->dispatch->comm.pmda_interface;
+    int		type = dp->type;
+    int		lsts;
+
+    /*
+     * PMDA_INTERFACE_2
+     *	>= 0 => OK
+     * PMDA_INTERFACE_3 or PMDA_INTERFACE_4
+     *	== 0 => no values
+     *	> 0  => OK
+     * PMDA_INTERFACE_5 or later
+     *	== 0 (PMDA_FETCH_NOVALUES) => no values
+     *	== 1 (PMDA_FETCH_STATIC) or > 2 => OK
+     *	== 2 (PMDA_FETCH_DYNAMIC) => OK and free(atom.vp)
+     *	     after __pmStuffValue() called
+     */
+    if (interface != PMDA_INTERFACE_2 && sts <= 0)
+	return sts;
+
+    if ((lsts = __pmdaStuffValue(extp, atom, vp, type)) == PM_ERR_TYPE) {
+	char	strbuf[20];
+	char	st2buf[20];
+	__pmNotifyErr(LOG_ERR, 
+		     "pmdaFetch: Descriptor type (%s) for metric %s is bad",
+		     pmTypeStr_r(type, strbuf, sizeof(strbuf)),
+		     pmIDStr_r(dp->pmid, st2buf, sizeof(st2buf)));
+    }
+    else if (lsts >= 0)
+	*valfmt = lsts;
+    if (interface >= PMDA_INTERFACE_5 && sts == PMDA_FETCH_DYNAMIC) {
+	if (type == PM_TYPE_STRING)
+	    free(atom->cp);
+	else if (type == PM_TYPE_AGGREGATE)
+	    free(atom->vbp);
+	else {
+	    char	strbuf[20];
+	    char	st2buf[20];
+	    __pmNotifyErr(LOG_WARNING,
+			  "pmdaFetch: Attempt to free value for metric %s of wrong type %s\n",
+			  pmIDStr_r(dp->pmid, strbuf, sizeof(strbuf)),
+			  pmTypeStr_r(type, st2buf, sizeof(st2buf)));
+	}
+    }
+    return (lsts < 0) ? lsts : 1;
+}
+
+/*
+ * Fill in the value set for slot i of the pmResult using the batch
+ * fetch callback, i.e. one callback for all instances in the profile.
+ * Returns PMDA_FETCH_UNBATCHED if the callback declined this metric,
+ * 0 on success, else a negative (allocation) error code.
+ */
+static int
+__pmdaFetchBatch(pmdaExt *pmda, e_ext_t *extp, int i, pmdaMetric *metap)
+{
+    pmDesc		*dp = &metap->m_desc;
+    pmValueSet		*vset;
+    int			numinst = 0;
+    int			inst;
+    int			sts;
+    int			j, k;
+
+    /* single pass over the profile to build the instance list */
+    if (dp->indom == PM_INDOM_NULL) {
+	inst = PM_IN_NULL;
+	numinst = 1;
+    }
+    else
+	__pmdaStartInst(dp->indom, pmda);
+    while (dp->indom == PM_INDOM_NULL || __pmdaNextInst(&inst, pmda)) {
+	if (numinst >= extp->maxinst || extp->instlist == NULL) {
+	    int			n = extp->maxinst ? extp->maxinst * 2 : 64;
+	    unsigned int	*instlist;
+	    pmAtomValue		*atomlist;
+	    int			*statuslist;
+
+	    if ((instlist = realloc(extp->instlist, n * sizeof(instlist[0]))) == NULL)
+		return -oserror();
+	    extp->instlist = instlist;
+	    if ((atomlist = realloc(extp->atomlist, n * sizeof(atomlist[0]))) == NULL)
+		return -oserror();
+	    extp->atomlist = atomlist;
+	    if ((statuslist = realloc(extp->statuslist, n * sizeof(statuslist[0]))) == NULL)
+		return -oserror();
+	    extp->statuslist = statuslist;
+	    extp->maxinst = n;
+	}
+	if (dp->indom == PM_INDOM_NULL) {
+	    extp->instlist[0] = inst;
+	    break;
+	}
+	extp->instlist[numinst++] = inst;
+    }
+
+    if (numinst > 0) {
+	memset(extp->statuslist, 0, numinst * sizeof(extp->statuslist[0]));
+	sts = (*(extp->batchCallBack))(metap, numinst, extp->instlist,
+				       extp->atomlist, extp->statuslist);
+	if (sts == PMDA_FETCH_UNBATCHED)
+	    return sts;
+    }
+    else
+	sts = 0;
+
+    if ((vset = __pmdaValueSet(extp, i, NULL, numinst)) == NULL)
+	return -oserror();
+    extp->res->vset[i] = vset;
+    vset->pmid = dp->pmid;
+    vset->valfmt = PM_VAL_INSITU;
+
+    if (sts < 0) {
+	/* error applies to every instance */
+	__pmdaFetchError(dp, numinst == 1 ? (int)extp->instlist[0] : PM_IN_NULL, sts);
+	vset->numval = sts;
+	return 0;
+    }
+
+    for (j = k = 0; k < numinst; k++) {
+	inst = extp->instlist[k];
+	vset->vlist[j].inst = inst;
+	if ((sts = extp->statuslist[k]) < 0)
+	    __pmdaFetchError(dp, inst, sts);
+	else if ((sts = __pmdaFetchValue(extp, dp, sts, &extp->atomlist[k],
+				&vset->vlist[j], &vset->valfmt)) > 0)
+	    j++;
+    }
+    vset->numval = (j == 0) ? sts : j;
+    return 0;
+}
+
 /*
  * resize the pmResult and call the e_callback for each metric instance
  * required in the profile.
@@ -496,7 +840,6 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
     pmdaMetric          metabuf;
     pmdaMetric		*metap;
     pmAtomValue		atom;
-    int			type;
     e_ext_t		*extp = (e_ext_t *)pmda->e_ext;
 
     if (extp->dispatch->version.any.ext != pmda)
@@ -530,8 +873,19 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	 * will be zero
 	 */
 	dp = &(metap->m_desc);
-	if (dp->pmid != 0)
+	if (dp->pmid != 0) {
+	    if (extp->batchCallBack != NULL) {
+		if ((sts = __pmdaFetchBatch(pmda, extp, i, metap)) < 0)
+		    goto error;
+		if (sts != PMDA_FETCH_UNBATCHED)
+		    continue;
+		if (pmda->e_fetchCallBack == NULL) {
+		    numval = PM_ERR_PMID;
+		    goto novalues;
+		}
+	    }
 	    numval = __pmdaCountInst(dp, pmda);
+	}
 	else {
 	    /* dynamic name metrics may often vanish, avoid log spam */
 	    if (extp->dispatch->comm.pmda_interface < PMDA_INTERFACE_4) {
@@ -543,14 +897,8 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	    numval = PM_ERR_PMID;
 	}
 
-
-	/* Must use individual malloc()s because of pmFreeResult() */
-	if (numval >= 1)
-	    extp->res->vset[i] = vset = (pmValueSet *)malloc(sizeof(pmValueSet) +
-					    (numval - 1)*sizeof(pmValue));
-	else
-	    extp->res->vset[i] = vset = (pmValueSet *)malloc(sizeof(pmValueSet) -
-					    sizeof(pmValue));
+novalues:
+	extp->res->vset[i] = vset = __pmdaValueSet(extp, i, NULL, numval);
 	if (vset == NULL) {
 	    sts = -oserror();
 	    goto error;
@@ -567,14 +915,12 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	    __pmdaStartInst(dp->indom, pmda);
 	    __pmdaNextInst(&inst, pmda);
 	}
-	type = dp->type;
 	j = 0;
 	do {
 	    if (j == numval) {
 		/* more instances than expected! */
 		numval++;
-		extp->res->vset[i] = vset = (pmValueSet *)realloc(vset,
-			    sizeof(pmValueSet) + (numval - 1)*sizeof(pmValue));
+		extp->res->vset[i] = vset = __pmdaValueSet(extp, i, vset, numval);
 		if (vset == NULL) {
 		    sts = -oserror();
 		    goto error;
@@ -582,89 +928,11 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	    }
 	    vset->vlist[j].inst = inst;
 
-	    if ((sts = (*(pmda->e_fetchCallBack))(metap, inst, &atom)) < 0) {
-		char	strbuf[20];
-
-		pmIDStr_r(dp->pmid, strbuf, sizeof(strbuf));
-		if (sts == PM_ERR_PMID) {
-		    __pmNotifyErr(LOG_ERR, 
-		        "pmdaFetch: PMID %s not handled by fetch callback\n",
-				strbuf);
-		}
-		else if (sts == PM_ERR_INST) {
-#ifdef PCP_DEBUG
-		    if (pmDebug & DBG_TRACE_LIBPMDA) {
-			__pmNotifyErr(LOG_ERR,
-			    "pmdaFetch: Instance %d of PMID %s not handled by fetch callback\n",
-				    inst, strbuf);
-		    }
-#endif
-		}
-		else if (sts == PM_ERR_APPVERSION ||
-			 sts == PM_ERR_PERMISSION ||
-			 sts == PM_ERR_AGAIN ||
-			 sts == PM_ERR_NYI) {
-#ifdef PCP_DEBUG
-		    if (pmDebug & DBG_TRACE_LIBPMDA) {
-			__pmNotifyErr(LOG_ERR,
-			     "pmdaFetch: Unavailable metric PMID %s[%d]\n",
-				    strbuf, inst);
-		    }
-#endif
-		}
-		else {
-		    __pmNotifyErr(LOG_ERR,
-			"pmdaFetch: Fetch callback error from metric PMID %s[%d]: %s\n",
-				strbuf, inst, pmErrStr(sts));
-		}
-	    }
-	    else {
-		/*
-		 * PMDA_INTERFACE_2
-		 *	>= 0 => OK
-		 * PMDA_INTERFACE_3 or PMDA_INTERFACE_4
-		 *	== 0 => no values
-		 *	> 0  => OK
-		 * PMDA_INTERFACE_5 or later
-		 *	== 0 (PMDA_FETCH_NOVALUES) => no values
-		 *	== 1 (PMDA_FETCH_STATIC) or > 2 => OK
-		 *	== 2 (PMDA_FETCH_DYNAMIC) => OK and free(atom.vp)
-		 *	     after __pmStuffValue() called
-		 */
-		if (extp->dispatch->comm.pmda_interface == PMDA_INTERFACE_2 ||
-		    (extp->dispatch->comm.pmda_interface >= PMDA_INTERFACE_3 && sts > 0)) {
-		    int		lsts;
-
-		    if ((lsts = __pmStuffValue(&atom, &vset->vlist[j], type)) == PM_ERR_TYPE) {
-			char	strbuf[20];
-			char	st2buf[20];
-			__pmNotifyErr(LOG_ERR, 
-				     "pmdaFetch: Descriptor type (%s) for metric %s is bad",
-				     pmTypeStr_r(type, strbuf, sizeof(strbuf)),
-				     pmIDStr_r(dp->pmid, st2buf, sizeof(st2buf)));
-		    }
-		    else if (lsts >= 0) {
-			vset->valfmt = lsts;
-			j++;
-		    }
-		    if (extp->dispatch->comm.pmda_interface >= PMDA_INTERFACE_5 && sts == PMDA_FETCH_DYNAMIC) {
-			if (type == PM_TYPE_STRING)
-			    free(atom.cp);
-			else if (type == PM_TYPE_AGGREGATE)
-			    free(atom.vbp);
-			else {
-			    char	strbuf[20];
-			    char	st2buf[20];
-			    __pmNotifyErr(LOG_WARNING,
-					  "pmdaFetch: Attempt to free value for metric %s of wrong type %s\n",
-					  pmIDStr_r(dp->pmid, strbuf, sizeof(strbuf)),
-					  pmTypeStr_r(type, st2buf, sizeof(st2buf)));
-			}
-		    }
-		    if (lsts < 0)
-			sts = lsts;
-		}
-	    }
+	    if ((sts = (*(pmda->e_fetchCallBack))(metap, inst, &atom)) < 0)
+		__pmdaFetchError(dp, inst, sts);
+	    else if ((sts = __pmdaFetchValue(extp, dp, sts, &atom,
+				&vset->vlist[j], &vset->valfmt)) > 0)
+		j++;
 	} while (dp->indom != PM_INDOM_NULL && __pmdaNextInst(&inst, pmda));
 
 	if (j == 0)
@@ -678,7 +946,9 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 
 error:
 
-    if (i) {
+    if (extp->recycle)
+	__pmdaArenaReset(extp);
+    else if (i) {
 	extp->res->numpmid = i;
 	__pmFreeResultValues(extp->res);
     }
@@ -21,6 +21,17 @@
 #define HAVE_V_SIX(interface)	((interface) >= PMDA_INTERFACE_6)
 #define HAVE_ANY(interface)	((interface) <= PMDA_INTERFACE_6 && HAVE_V_TWO(interface))
 
+/*
+ * Chunk of memory from which pmValueBlocks are carved during a fetch,
+ * when the pmResult is recycled by libpcp_pmda rather than freed.
+ */
+typedef struct e_arena {
+    struct e_arena	*next;		/* older (full) chunks */
+    size_t		size;		/* bytes in buf[] */
+    size_t		used;		/* bytes allocated from buf[] */
+    char		buf[1];		/* allocated beyond here */
+} e_arena_t;
+
 /*
  * Auxilliary structure used to save data from pmdaDSO or pmdaDaemon and
  * make it available to the other methods, also as private per PMDA data
@@ -31,8 +42,27 @@ typedef struct {
     pmResult		*res;		/* high-water allocation for */
     int			maxnpmids;	/* pmResult for each PMDA */
     __pmHashCtl		hashpmids;	/* hashed metrictab lookups */
+
+    pmdaBatchFetchCallBack batchCallBack; /* column-at-a-time fetch */
+    int			maxinst;	/* high-water for batch arrays */
+    unsigned int	*instlist;	/* batch instances in profile */
+    pmAtomValue		*atomlist;	/* batch values, one per inst */
+    int			*statuslist;	/* batch status, one per inst */
+
+    int			recycle;	/* =1 if res is reused, not freed */
+    int			nvsets;		/* number of recycled value sets */
+    pmValueSet		**vsets;	/* recycled value sets, by pmid slot */
+    int			*maxvals;	/* vlist[] capacity of each vset */
+    e_arena_t		*arena;		/* pmValueBlock allocations */
+
+    struct e_sampler	*sampler;	/* refresh thread, see mainloop.c */
 } e_ext_t;
 
+/*
+ * Result recycling for daemon PMDAs, see pmdaFetch() and pmdaMain()
+ */
+extern int __pmdaRecycleResult(pmdaExt *, pmResult *);
+
 /*
  * Local hash function
  */
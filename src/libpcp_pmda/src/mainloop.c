@@ -29,6 +29,126 @@ __pmdaInFd(pmdaInterface *dispatch)
     return -1;
 }
 
+/*
+ * Double-buffered snapshots refreshed by a sampler callback.  For daemon
+ * PMDAs the callback runs in a thread started from pmdaMain, and the PDU
+ * thread pins the front snapshot for the duration of each PDU - so the
+ * sampler only ever refreshes the other buffer, and swaps once complete.
+ */
+typedef struct e_sampler {
+    pmdaSamplerCallBack	refresh;
+    struct timeval	interval;	/* minimum time between refreshes */
+    void		*buf[2];	/* snapshots, size bytes each */
+    struct timeval	stamp[2];	/* when refresh of buf[i] started */
+    int			valid[2];	/* buf[i] holds a complete snapshot */
+    int			front;		/* most recent snapshot */
+    int			pin;		/* snapshot in use by PDU, or -1 */
+    int			running;	/* =1 once sampler thread started */
+#ifdef PM_MULTI_THREAD
+    pthread_t		thread;
+    pthread_mutex_t	lock;
+    pthread_cond_t	cond;		/* pin released, or shorter sleep */
+#endif
+} e_sampler_t;
+
+static int
+sampler_refresh(e_sampler_t *sp, int next, struct timeval *start)
+{
+    const void	*prev = sp->valid[sp->front] ? sp->buf[sp->front] : NULL;
+    int		sts;
+
+    __pmtimevalNow(start);
+    sts = (*sp->refresh)(sp->buf[next], prev);
+#ifdef PCP_DEBUG
+    if (sts < 0 && (pmDebug & DBG_TRACE_LIBPMDA))
+	__pmNotifyErr(LOG_DEBUG, "sampler refresh failed: %s\n", pmErrStr(sts));
+#endif
+    return sts;
+}
+
+#ifdef PM_MULTI_THREAD
+static void *
+sampler_thread(void *arg)
+{
+    e_sampler_t		*sp = (e_sampler_t *)arg;
+    struct timeval	start;
+    struct timespec	deadline;
+    int			next;
+    int			sts;
+
+    pthread_mutex_lock(&sp->lock);
+    for ( ; ; ) {
+	next = sp->valid[sp->front] ? 1 - sp->front : sp->front;
+	while (sp->pin == next)
+	    pthread_cond_wait(&sp->cond, &sp->lock);
+	sp->valid[next] = 0;
+	pthread_mutex_unlock(&sp->lock);
+
+	/* may block for as long as it likes, PDUs use the front snapshot */
+	sts = sampler_refresh(sp, next, &start);
+
+	pthread_mutex_lock(&sp->lock);
+	if (sts >= 0) {
+	    sp->stamp[next] = start;
+	    sp->valid[next] = 1;
+	    sp->front = next;
+	}
+	__pmtimevalInc(&start, &sp->interval);
+	deadline.tv_sec = start.tv_sec;
+	deadline.tv_nsec = start.tv_usec * 1000;
+	while (pthread_cond_timedwait(&sp->cond, &sp->lock, &deadline) != ETIMEDOUT)
+	    ;
+    }
+    /*NOTREACHED*/
+    return NULL;
+}
+#endif
+
+/*
+ * Called from pmdaMain, as only daemon PMDAs refresh asynchronously
+ */
+static void
+sampler_start(pmdaExt *pmda)
+{
+#ifdef PM_MULTI_THREAD
+    e_sampler_t	*sp = ((e_ext_t *)pmda->e_ext)->sampler;
+    int		sts;
+
+    if (sp == NULL || sp->running)
+	return;
+    pthread_mutex_init(&sp->lock, NULL);
+    pthread_cond_init(&sp->cond, NULL);
+    if ((sts = pthread_create(&sp->thread, NULL, sampler_thread, sp)) != 0) {
+	__pmNotifyErr(LOG_WARNING,
+		"%s: cannot create sampler thread, refreshing synchronously: %s",
+		pmda->e_name, pmErrStr(-sts));
+	pthread_cond_destroy(&sp->cond);
+	pthread_mutex_destroy(&sp->lock);
+	return;
+    }
+    sp->running = 1;
+#endif
+}
+
+static void
+sampler_unpin(pmdaExt *pmda)
+{
+    e_sampler_t	*sp = ((e_ext_t *)pmda->e_ext)->sampler;
+
+    if (sp == NULL || sp->pin < 0)
+	return;
+#ifdef PM_MULTI_THREAD
+    if (sp->running) {
+	pthread_mutex_lock(&sp->lock);
+	sp->pin = -1;
+	pthread_cond_broadcast(&sp->cond);
+	pthread_mutex_unlock(&sp->lock);
+	return;
+    }
+#endif
+    sp->pin = -1;
+}
+
 int
 __pmdaMainPDU(pmdaInterface *dispatch)
 {
@@ -74,6 +194,7 @@ __pmdaMainPDU(pmdaInterface *dispatch)
 	}
 	pmda = dispatch->version.any.ext;
 	dispatch->comm.pmapi_version = PMAPI_VERSION;
+	sampler_start(pmda);
 	first_time = 0;
     }
 
@@ -102,6 +223,7 @@ __pmdaMainPDU(pmdaInterface *dispatch)
 		/* all other PDUs expect an ACK */
 		__pmSendError(pmda->e_outfd, FROM_ANON, op_sts);
 	    __pmUnpinPDUBuf(pb);
+	    sampler_unpin(pmda);
 	    return 0;
 	}
     }
@@ -176,6 +298,12 @@ __pmdaMainPDU(pmdaInterface *dispatch)
 
 	sts = __pmDecodeFetch(pb, &ctxnum, &when, &npmids, &pmidlist);
 	if (sts >= 0) {
+	    /*
+	     * with the default result callback, any pmResult from pmdaFetch
+	     * is only used in __pmSendResult below, so it can be recycled
+	     */
+	    ((e_ext_t *)pmda->e_ext)->recycle =
+			(pmda->e_resultCallBack == __pmFreeResultValues);
 	    sts = dispatch->version.any.fetch(npmids, pmidlist, &result, pmda);
 	    __pmUnpinPDUBuf(pmidlist);
 	}
@@ -186,7 +314,8 @@ __pmdaMainPDU(pmdaInterface *dispatch)
 	    result->timestamp.tv_sec = 0;
 	    result->timestamp.tv_usec = 0;
 	    __pmSendResult(pmda->e_outfd, FROM_ANON, result);
-	    (pmda->e_resultCallBack)(result);
+	    if (!__pmdaRecycleResult(pmda, result))
+		(pmda->e_resultCallBack)(result);
 	}
 	break;
 
@@ -411,6 +540,9 @@ __pmdaMainPDU(pmdaInterface *dispatch)
     if (pinpdu > 0)
 	__pmUnpinPDUBuf(pb);
 
+    /* snapshot may now be refreshed by the sampler thread again */
+    sampler_unpin(pmda);
+
     /*
      * if defined, callback once per PDU to do termination checks,
      * stats, etc
@@ -467,6 +599,20 @@ pmdaSetFetchCallBack(pmdaInterface *dispatch, pmdaFetchCallBack callback)
     }
 }
 
+void
+pmdaSetBatchFetchCallBack(pmdaInterface *dispatch, pmdaBatchFetchCallBack callback)
+{
+    if (HAVE_ANY(dispatch->comm.pmda_interface)) {
+	e_ext_t	*extp = (e_ext_t *)dispatch->version.any.ext->e_ext;
+	extp->batchCallBack = callback;
+    }
+    else {
+	__pmNotifyErr(LOG_CRIT, "Unable to set batch fetch callback for PMDA interface version %d.",
+		     dispatch->comm.pmda_interface);
+	dispatch->status = PM_ERR_GENERIC;
+    }
+}
+
 void
 pmdaSetCheckCallBack(pmdaInterface *dispatch, pmdaCheckCallBack callback)
 {
@@ -490,3 +636,102 @@ pmdaSetDoneCallBack(pmdaInterface *dispatch, pmdaDoneCallBack callback)
 	dispatch->status = PM_ERR_GENERIC;
     }
 }
+
+void
+pmdaSetSamplerCallBack(pmdaInterface *dispatch, pmdaSamplerCallBack callback,
+			size_t size, const struct timeval *interval)
+{
+    e_ext_t	*extp;
+    e_sampler_t	*sp;
+
+    if (!HAVE_ANY(dispatch->comm.pmda_interface)) {
+	__pmNotifyErr(LOG_CRIT, "Unable to set sampler callback for PMDA interface version %d.",
+		     dispatch->comm.pmda_interface);
+	dispatch->status = PM_ERR_GENERIC;
+	return;
+    }
+    extp = (e_ext_t *)dispatch->version.any.ext->e_ext;
+    if (extp->sampler != NULL) {
+	/* cannot be changed once set, the thread may be using it */
+	__pmNotifyErr(LOG_ERR, "%s: sampler callback already set",
+		     dispatch->version.any.ext->e_name);
+	dispatch->status = PM_ERR_GENERIC;
+	return;
+    }
+    if (callback == NULL || size == 0)
+	return;
+    if ((sp = (e_sampler_t *)calloc(1, sizeof(*sp))) == NULL ||
+	(sp->buf[0] = calloc(1, size)) == NULL ||
+	(sp->buf[1] = calloc(1, size)) == NULL) {
+	__pmNotifyErr(LOG_ERR, "%s: Unable to allocate sampler snapshots (%d bytes)",
+		     dispatch->version.any.ext->e_name, (int)(2 * size));
+	if (sp) {
+	    free(sp->buf[0]);
+	    free(sp);
+	}
+	dispatch->status = PM_ERR_GENERIC;
+	return;
+    }
+    sp->refresh = callback;
+    if (interval)
+	sp->interval = *interval;
+    else
+	sp->interval.tv_sec = 1;
+    sp->pin = -1;
+    extp->sampler = sp;
+}
+
+void *
+pmdaSamplerSnapshot(pmdaExt *pmda, double *age)
+{
+    e_sampler_t		*sp = ((e_ext_t *)pmda->e_ext)->sampler;
+    struct timeval	now;
+    int			next;
+
+    if (sp == NULL)
+	return NULL;
+
+#ifdef PM_MULTI_THREAD
+    if (sp->running) {
+	/*
+	 * the first call while handling a PDU pins the most recent
+	 * snapshot, so all callbacks for this PDU see the same data
+	 */
+	pthread_mutex_lock(&sp->lock);
+	if (sp->pin < 0 && sp->valid[sp->front])
+	    sp->pin = sp->front;
+	pthread_mutex_unlock(&sp->lock);
+	if (sp->pin < 0)
+	    return NULL;
+	if (age) {
+	    __pmtimevalNow(&now);
+	    *age = __pmtimevalSub(&now, &sp->stamp[sp->pin]);
+	}
+	return sp->buf[sp->pin];
+    }
+#endif
+
+    /*
+     * no sampler thread (DSO PMDAs, or before pmdaMain), refresh here
+     * once the snapshot is older than the sampling interval
+     */
+    __pmtimevalNow(&now);
+    if (!sp->valid[sp->front] ||
+	__pmtimevalSub(&now, &sp->stamp[sp->front]) >=
+	__pmtimevalToReal(&sp->interval)) {
+	next = sp->valid[sp->front] ? 1 - sp->front : sp->front;
+	sp->valid[next] = 0;
+	if (sampler_refresh(sp, next, &now) >= 0) {
+	    sp->stamp[next] = now;
+	    sp->valid[next] = 1;
+	    sp->front = next;
+	}
+    }
+    if (!sp->valid[sp->front])
+	return NULL;
+    if (age) {
+	__pmtimevalNow(&now);
+	*age = __pmtimevalSub(&now, &sp->stamp[sp->front]);
+    }
+    return sp->buf[sp->front];
+}
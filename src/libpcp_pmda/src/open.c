@@ -484,6 +484,7 @@ pmdaHashDelete(__pmHashCtl *hashp)
 {
     __pmHashWalkCB(pmdaHashNodeDelete, NULL, hashp);
     __pmHashClear(hashp);
+    hashp->nodes = 0;	/* else rebuilds grow the table needlessly */
 }
 
 /*
@@ -505,6 +506,12 @@ pmdaRehash(pmdaExt *pmda, pmdaMetric *metrics, int nmetrics)
     pmda->e_nmetrics = nmetrics;
 
     pmdaHashDelete(hashp);
+    /*
+     * table size is known, so size the hash up front (chains of about
+     * one node) rather than growing and relinking it as nodes are added
+     */
+    if (nmetrics > 0)
+	__pmHashPreAlloc(nmetrics | 1, hashp);	/* on failure, grows as usual */
     for (m = 0; m < pmda->e_nmetrics; m++) {
 	metric = &pmda->e_metrics[m];
 
@@ -593,7 +600,8 @@ pmdaInit(pmdaInterface *dispatch, pmdaIndom *indoms, int nindoms,
     pmda = dispatch->version.any.ext;
 
     if (dispatch->version.any.fetch == pmdaFetch &&
-	pmda->e_fetchCallBack == (pmdaFetchCallBack)0) {
+	pmda->e_fetchCallBack == (pmdaFetchCallBack)0 &&
+	((e_ext_t *)pmda->e_ext)->batchCallBack == (pmdaBatchFetchCallBack)0) {
 	__pmNotifyErr(LOG_CRIT, "pmdaInit: PMDA %s: using pmdaFetch() but fetch call back not set", pmda->e_name);
 	dispatch->status = PM_ERR_GENERIC;
 	return;
@@ -712,10 +720,19 @@ pmdaInit(pmdaInterface *dispatch, pmdaIndom *indoms, int nindoms,
 	pmidp->domain = dispatch->domain;
     }
 
+    /*
+     * Use a direct mapping into the metric table where possible, else
+     * build the PMID hash so that lookups are not linear table scans
+     * (the hash is rebuilt whenever pmdaRehash is called, such as when
+     * dynamic metrics change via pmdaDynamicMetricTable).
+     */
     if (pmda->e_flags & PMDA_EXT_FLAG_HASHED)
 	pmdaRehash(pmda, metrics, nmetrics);
-    else
+    else {
 	pmdaDirect(pmda, metrics, nmetrics);
+	if (!pmda->e_direct && nmetrics > 0)
+	    pmdaRehash(pmda, metrics, nmetrics);
+    }
 
 #ifdef PCP_DEBUG
     if (pmDebug & DBG_TRACE_LIBPMDA) {
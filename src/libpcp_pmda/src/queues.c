@@ -1,7 +1,7 @@
 /*
  * Generic event queue support for PMDAs
  *
- * Copyright (c) 2011,2015-2016 Red Hat.
+ * Copyright (c) 2011,2015-2017 Red Hat.
  * Copyright (c) 2011 Nathan Scott.  All rights reserved.
  * 
  * This library is free software; you can redistribute it and/or modify it
@@ -45,51 +45,163 @@ queue_lookup(int handle)
 }
 
 /*
- * Drop an event after it has been queued (i.e. client was too slow)
+ * Ring buffer handling.  Events are appended at the tail and dropped
+ * from the head; each occupies a contiguous, aligned span of the ring
+ * so the event data can be handed to the decode callback in place.
  */
-static void
-queue_drop(event_clientq_t *clientq, event_queue_t *queue, void *data)
+#define EVENT_ALIGN(n)	(((n) + sizeof(__uint64_t) - 1) & ~(sizeof(__uint64_t) - 1))
+#define RING_MINSIZE	4096
+
+static inline int
+queue_empty(event_queue_t *queue)
+{
+    return queue->headseq == queue->tailseq;
+}
+
+/*
+ * Find the start of an event, given where the previous one ended
+ */
+static inline size_t
+ring_offset(event_queue_t *queue, size_t offset)
 {
-    event_t *event = (event_t *)data;
+    if (offset + sizeof(event_t) > queue->ringsize)
+	return 0;
+    if (((event_t *)(queue->ring + offset))->span == 0)
+	return 0;	/* end of ring marker */
+    return offset;
+}
 
-    if (clientq->last != NULL && clientq->last == event) {
-	clientq->last = TAILQ_NEXT(event, events);
-	clientq->missed++;
+static inline event_t *
+ring_event(event_queue_t *queue, size_t offset)
+{
+    return (event_t *)(queue->ring + offset);
+}
 
-	if (pmDebug & DBG_TRACE_LIBPMDA)
-	    __pmNotifyErr(LOG_DEBUG, "Client missed queue %s event %p",
-			queue->name, event);
+/*
+ * Drop the oldest event (i.e. client was too slow, or all have seen it).
+ * Clients that had not yet seen it notice from their cursor next fetch.
+ */
+static void
+queue_drop(event_queue_t *queue)
+{
+    event_t *event = ring_event(queue, queue->head);
+
+    if (pmDebug & DBG_TRACE_LIBPMDA)
+	__pmNotifyErr(LOG_DEBUG, "Removing %s event #%llu (%d bytes)",
+			queue->name, (unsigned long long)queue->headseq,
+			(int)event->size);
+
+    queue->qsize -= event->size;
+    queue->headseq++;
+    if (event->culled)
+	free(event->culled);
+    if (queue_empty(queue)) {
+	/* start over at the beginning, for the most contiguous space */
+	queue->head = queue->tail = 0;
+	queue->generation++;
+    } else {
+	queue->head = ring_offset(queue, queue->head + event->span);
     }
 }
 
 static void
-queue_drop_bytes(int handle, event_queue_t *queue, size_t bytes)
+queue_drop_bytes(event_queue_t *queue, size_t bytes)
 {
-    event_t *event, *next;
+    event_t *event;
 
-    event = TAILQ_FIRST(&queue->tailq);
-    while (event) {
+    while (!queue_empty(queue)) {
 	if (bytes <= queue->maxmemory - queue->qsize)
 	    break;
-	next = TAILQ_NEXT(event, events);
 
-	if (pmDebug & DBG_TRACE_LIBPMDA)
-	    __pmNotifyErr(LOG_DEBUG, "Dropping %s: e=%p sz=%d max=%d qsz=%d",
-				    queue->name, event, (int)event->size,
-				    (int)queue->maxmemory, (int)queue->qsize);
+	if (pmDebug & DBG_TRACE_LIBPMDA) {
+	    event = ring_event(queue, queue->head);
+	    __pmNotifyErr(LOG_DEBUG, "Dropping %s: e=#%llu sz=%d max=%d qsz=%d",
+				    queue->name,
+				    (unsigned long long)queue->headseq,
+				    (int)event->size, (int)queue->maxmemory,
+				    (int)queue->qsize);
+	}
+	queue_drop(queue);
+    }
+}
+
+/*
+ * Drop events from the head of the queue once every client of the
+ * queue has seen them - the ring may also be holding events for a
+ * client yet to connect, in which case they are kept until dropped.
+ */
+static void
+queue_trim_visit(event_clientq_t *clientq, event_queue_t *queue, void *data)
+{
+    __uint64_t	*seqs = (__uint64_t *)data;
 
-	/* Walk clients - if event last seen, drop it and bump missed count */
-	client_iterate(queue_drop, handle, queue, event);
+    if (clientq->seq < seqs[0])
+	seqs[0] = clientq->seq;
+    seqs[1]++;
+}
 
-	if (pmDebug & DBG_TRACE_LIBPMDA)
-	    __pmNotifyErr(LOG_DEBUG, "Removing %s event %p (%d bytes)",
-				    queue->name, event, (int)event->size);
+static void
+queue_trim(int handle, event_queue_t *queue)
+{
+    __uint64_t	seqs[2] = { queue->tailseq, 0 };
+
+    client_iterate(queue_trim_visit, handle, queue, seqs);
+    if (seqs[1] == 0 || seqs[1] < queue->numclients)
+	return;
+    while (!queue_empty(queue) && queue->headseq < seqs[0])
+	queue_drop(queue);
+}
+
+/*
+ * Copy events into a new (larger) ring, oldest first from its start
+ */
+static int
+ring_resize(event_queue_t *queue, size_t size)
+{
+    event_t *event;
+    __uint64_t seq;
+    size_t offset, tail = 0;
+    char *ring;
 
-	TAILQ_REMOVE(&queue->tailq, event, events);
-	queue->qsize -= event->size;
-	free(event);
-	event = next;
+    if ((ring = malloc(size)) == NULL)
+	return -ENOMEM;
+    offset = queue->head;
+    for (seq = queue->headseq; seq < queue->tailseq; seq++) {
+	offset = ring_offset(queue, offset);
+	event = ring_event(queue, offset);
+	memcpy(ring + tail, event, sizeof(event_t) + event->size);
+	tail += event->span;
+	offset += event->span;
     }
+    free(queue->ring);
+    queue->ring = ring;
+    queue->ringsize = size;
+    queue->head = 0;
+    queue->tail = tail;
+    queue->generation++;
+
+    if (pmDebug & DBG_TRACE_LIBPMDA)
+	__pmNotifyErr(LOG_DEBUG, "Resized %s ring to %d bytes",
+			queue->name, (int)size);
+    return 0;
+}
+
+/*
+ * Find a ring offset where an event spanning "need" bytes fits, else -1
+ */
+static long
+ring_space(event_queue_t *queue, size_t need)
+{
+    size_t head = queue->head, tail = queue->tail;
+
+    if (queue_empty(queue))
+	return (need <= queue->ringsize) ? 0 : -1;
+    if (tail > head) {
+	if (tail + need <= queue->ringsize)
+	    return tail;
+	return (need <= head) ? 0 : -1;
+    }
+    return (tail + need <= head) ? tail : -1;
 }
 
 int
@@ -111,27 +223,19 @@ pmdaEventNewActiveQueue(const char *name, size_t maxmemory, unsigned int numclie
 	    break;
     if (i == numqueues) {
 	/*
-	 * No free slots - extend the available set.
-	  realloc potentially moves "queues" address, fix up 
-	 * must tear down existing queues which may have back
-	 * references and then re-initialise them afterward.
+	 * No free slots - extend the available set.  Queued events
+	 * and client cursors are independent of the queue address.
 	 */
-	for (i = 0; i < numqueues; i++)
-	    queue_drop_bytes(i, &queues[i], INT_MAX);
 	size = (numqueues + 1) * sizeof(event_queue_t);
 	queues = realloc(queues, size);
 	if (!queues)
 	    __pmNoMem("pmdaEventNewQueue", size, PM_FATAL_ERR);
-	/* realloc moves tailq tqh_last pointer - reset 'em */
-	for (i = 0; i < numqueues; i++)
-	    TAILQ_INIT(&queues[i].tailq);
 	numqueues++;
     }
 
     /* "i" now indexes into a free slot */
     queue = &queues[i];
     memset(queue, 0, sizeof(*queue));
-    TAILQ_INIT(&queue->tailq); 
     queue->eventarray = pmdaEventNewArray();
     queue->numclients = numclients;
     queue->maxmemory = maxmemory;
@@ -206,6 +310,8 @@ pmdaEventQueueAppend(int handle, void *data, size_t bytes, struct timeval *tv)
 {
     event_queue_t *queue = queue_lookup(handle);
     event_t *event;
+    size_t need, size;
+    long offset;
 
     if (!queue)
 	return -EINVAL;
@@ -221,33 +327,56 @@ pmdaEventQueueAppend(int handle, void *data, size_t bytes, struct timeval *tv)
     /*
      * We may need to make room in the event queue.  If so, start at the head
      * and madly drop events until sufficient space exists or all are freed.
-     * Bump the missed counter for each client who missed an event we had to
-     * throw away.
+     * Clients who missed an event we had to throw away find out when they
+     * next fetch, from the sequence number of the oldest remaining event.
      */
-    queue_drop_bytes(handle, queue, bytes);
+    queue_drop_bytes(queue, bytes);
     if (queue->numclients == 0)
 	goto done;
 
-    if ((event = malloc(sizeof(event_t) + bytes + 1)) == NULL) {
-	__pmNotifyErr(LOG_ERR, "event allocation failure: %ld bytes",
-			(long)(bytes + 1));
-	return -ENOMEM;
+    /*
+     * Space in the ring for the event header is allowed for beyond the
+     * data limit, up to the same again, before more events are dropped.
+     */
+    need = EVENT_ALIGN(sizeof(event_t) + bytes + 1);
+    while ((offset = ring_space(queue, need)) < 0) {
+	size = queue->ringsize ? queue->ringsize * 2 : RING_MINSIZE;
+	while (size < need * 2)
+	    size *= 2;
+	if (queue_empty(queue) ||
+	    queue->ringsize < queue->maxmemory * 2 + need) {
+	    if (ring_resize(queue, size) < 0) {
+		__pmNotifyErr(LOG_ERR, "event allocation failure: %ld bytes",
+				(long)size);
+		return -ENOMEM;
+	    }
+	} else {
+	    queue_drop(queue);
+	}
     }
+    if (offset == 0 && queue->tail != 0 &&
+	queue->tail + sizeof(event_t) <= queue->ringsize)
+	ring_event(queue, queue->tail)->span = 0;	/* end of ring */
 
     /* Track the actual event data */
-    event->count = queue->numclients;
+    event = ring_event(queue, offset);
     memcpy(event->buffer, data, bytes);
     memcpy(&event->time, tv, sizeof(*tv));
     event->size = bytes;
+    event->span = need;
+    event->filtergen = event->nculled = 0;
+    event->culled = NULL;
 
     /* Finally, store the event in the queue */
-    TAILQ_INSERT_TAIL(&queue->tailq, event, events);
+    queue->tail = offset + need;
+    queue->tailseq++;
     queue->qsize += bytes;
 
     if (pmDebug & DBG_TRACE_LIBPMDA)
 	__pmNotifyErr(LOG_DEBUG,
-			"Inserted %s event %p (%ld bytes) clients = %d",
-			queue->name, event, (long)event->size, event->count);
+			"Inserted %s event #%llu (%ld bytes) clients = %d",
+			queue->name, (unsigned long long)queue->tailseq - 1,
+			(long)event->size, queue->numclients);
 
 done:
     /* Update event queue tracking stats (even for no-clients case) */
@@ -256,12 +385,113 @@ done:
     return 0;
 }
 
+/*
+ * Find (or start) the shared filter for this filter data and callback.
+ * Returns a filter table slot plus one, else zero if the table cannot
+ * grow (that client filter is then applied only on behalf of its own
+ * client).
+ */
+static int
+queue_filter_attach(event_queue_t *queue, void *filter,
+		    pmdaEventApplyFilterCallBack apply)
+{
+    event_filter_t *shared;
+    size_t size;
+    int i, slot = -1;
+
+    for (i = 0; i < queue->maxfilters; i++) {
+	shared = &queue->filters[i];
+	if (shared->refcount == 0) {
+	    if (slot < 0)
+		slot = i;
+	} else if (shared->filter == filter && shared->apply == apply) {
+	    slot = i;
+	    break;
+	}
+    }
+    if (slot < 0) {
+	i = queue->maxfilters ? queue->maxfilters * 2 : 8;
+	size = i * sizeof(event_filter_t);
+	if ((shared = realloc(queue->filters, size)) == NULL)
+	    return 0;
+	memset(shared + queue->maxfilters, 0,
+		(i - queue->maxfilters) * sizeof(event_filter_t));
+	slot = queue->maxfilters;
+	queue->filters = shared;
+	queue->maxfilters = i;
+    }
+
+    shared = &queue->filters[slot];
+    if (shared->refcount++ == 0) {
+	shared->filter = filter;
+	shared->apply = apply;
+    }
+    /* filter data may have changed since any earlier results */
+    if (++queue->filtergen == 0)
+	queue->filtergen = 1;
+    return slot + 1;
+}
+
+static void
+queue_filter_detach(event_queue_t *queue, event_clientq_t *clientq)
+{
+    event_filter_t *shared;
+
+    if (clientq->shared) {
+	shared = &queue->filters[clientq->shared - 1];
+	if (shared->refcount > 0 && --shared->refcount == 0)
+	    shared->filter = NULL;
+	clientq->shared = 0;
+    }
+}
+
+/*
+ * Apply every shared filter of the queue to an event, one after
+ * another, keeping the results with the event.
+ */
+static int
+queue_filter_event(event_queue_t *queue, event_t *event)
+{
+    event_filter_t *shared;
+    __uint64_t *culled;
+    unsigned int nwords = (queue->maxfilters + 63) / 64;
+    int i, sts;
+
+    if (event->nculled < nwords) {
+	if ((culled = realloc(event->culled, nwords * sizeof(__uint64_t))) == NULL)
+	    return -ENOMEM;
+	event->culled = culled;
+	event->nculled = nwords;
+    }
+    memset(event->culled, 0, event->nculled * sizeof(__uint64_t));
+    for (i = 0; i < queue->maxfilters; i++) {
+	shared = &queue->filters[i];
+	if (shared->refcount == 0)
+	    continue;
+	sts = shared->apply(shared->filter, event->buffer, event->size);
+	if (pmDebug & DBG_TRACE_LIBPMDA)
+	    __pmNotifyErr(LOG_DEBUG, "Clientq filter applied (%d)", sts);
+	if (sts)
+	    event->culled[i / 64] |= (__uint64_t)1 << (i % 64);
+    }
+    event->filtergen = queue->filtergen;
+    return 0;
+}
+
 static int
-queue_filter(event_clientq_t *clientq, void *data, size_t size)
+queue_filter(event_queue_t *queue, event_clientq_t *clientq, event_t *event)
 {
+    int slot, sts;
+
     /* Note: having a filter implies access (optionally) checked there */
     if (clientq->filter) {
-	int sts = clientq->apply(clientq->filter, data, size);
+	if (clientq->shared) {
+	    slot = clientq->shared - 1;
+	    if (event->filtergen == queue->filtergen ||
+		queue_filter_event(queue, event) == 0)
+		return (event->culled[slot / 64] >> (slot % 64)) & 1;
+	}
+	sts = clientq->apply(clientq->filter, event->buffer, event->size);
 	if (pmDebug & DBG_TRACE_LIBPMDA)
 	    __pmNotifyErr(LOG_DEBUG, "Clientq filter applied (%d)", sts);
 	return sts;
@@ -275,35 +505,60 @@ queue_filter(event_clientq_t *clientq, void *data, size_t size)
 }
 
 static int
-queue_fetch(event_queue_t *queue, event_clientq_t *clientq, pmAtomValue *atom,
-	    pmdaEventDecodeCallBack queue_decoder, void *data)
+queue_fetch(int handle, event_queue_t *queue, event_clientq_t *clientq,
+	    pmAtomValue *atom, pmdaEventDecodeCallBack queue_decoder, void *data)
 {
-    event_t *event, *next;
+    event_t *event;
+    __uint64_t seq;
+    size_t offset;
     int records, key, sts;
 
     /*
      * Ensure the way we keep track of which clients are interested
-     * in which queues is up to date.
+     * in which queues is up to date.  A new client starts with the
+     * oldest event still queued.
      */
     if (clientq->active == 0) {
 	clientq->active = 1;
+	clientq->seq = queue->headseq;
 	queue->numclients++;
     }
-    if (clientq->last == NULL)
-	clientq->last = TAILQ_FIRST(&queue->tailq);
-    event = clientq->last;
+
+    /* Work out where this clients next event is in the ring */
+    seq = clientq->seq;
+    if (seq < queue->headseq) {
+	clientq->missed += queue->headseq - seq;
+	seq = queue->headseq;
+    }
+    if (seq == queue->headseq)
+	offset = queue->head;
+    else if (clientq->generation == queue->generation)
+	offset = clientq->offset;
+    else {
+	/* ring has been reorganised since - step over events seen */
+	offset = queue->head;
+	for (seq = queue->headseq; seq < clientq->seq; seq++) {
+	    offset = ring_offset(queue, offset);
+	    offset += ring_event(queue, offset)->span;
+	}
+    }
 
     if (pmDebug & DBG_TRACE_LIBPMDA)
-	__pmNotifyErr(LOG_DEBUG, "queue_fetch start, last event=%p", event);
+	__pmNotifyErr(LOG_DEBUG, "queue_fetch start, next event=#%llu of %llu",
+			(unsigned long long)seq,
+			(unsigned long long)queue->tailseq);
 
     sts = records = 0;
     key = queue->eventarray;
     pmdaEventResetArray(key);
 
-    while (event != NULL) {
+    for (; seq < queue->tailseq; seq++) {
 	char	message[64];
 
-	if (queue_filter(clientq, event->buffer, event->size)) {
+	offset = ring_offset(queue, offset);
+	event = ring_event(queue, offset);
+
+	if (queue_filter(queue, clientq, event)) {
 	    if (pmDebug & DBG_TRACE_LIBPMDA)
 		__pmNotifyErr(LOG_DEBUG, "Culling event (sz=%ld): \"%s\"", 
 				(long)event->size,
@@ -315,6 +570,7 @@ queue_fetch(event_queue_t *queue, event_clientq_t *clientq, pmAtomValue *atom,
 				(long)event->size,
 				__pmdaEventPrint(event->buffer, event->size,
 					message, sizeof(message)));
+	    /* event data is passed in place, not copied for each client */
 	    if ((sts = queue_decoder(key,
 			event->buffer, event->size, &event->time, data)) < 0)
 		break;
@@ -322,29 +578,18 @@ queue_fetch(event_queue_t *queue, event_clientq_t *clientq, pmAtomValue *atom,
 	    sts = 0;
 	}
 
-	next = TAILQ_NEXT(event, events);
-
-	/* Remove the current one (if its use count hits zero) */
-	if (--event->count <= 0) {
-	    if (pmDebug & DBG_TRACE_LIBPMDA)
-		__pmNotifyErr(LOG_DEBUG, "Removing %s event %p in fetch",
-					queue->name, event);
-	    TAILQ_REMOVE(&queue->tailq, event, events);
-	    queue->qsize -= event->size;
-	    free(event);
-	}
-
 	/* Go on to the next event. */
-	event = next;
+	offset += event->span;
     }
 
-    /*
-     * Did this client miss any events?  The "extra" one is the last previously
-     * observed event (pointed at by per-context last pointer) - so, event only
-     * missed once we move past *more* than just that last observed event.
-     */
+    /* Update queue cursor for this client. */
+    clientq->seq = seq;
+    clientq->offset = offset;
+    clientq->generation = queue->generation;
+
+    /* Did this client miss any events? */
     if (sts == 0) {
-	sts = clientq->missed - 1;
+	sts = clientq->missed;
 	clientq->missed = 0;
 	if (sts > 0) {
 	    struct timeval timestamp;
@@ -356,8 +601,8 @@ queue_fetch(event_queue_t *queue, event_clientq_t *clientq, pmAtomValue *atom,
 	}
     }
 
-    /* Update queue tail pointer for this client. */
-    clientq->last = NULL;
+    /* Release the events every client has now seen. */
+    queue_trim(handle, queue);
 
     atom->vbp = records ? (pmValueBlock *)pmdaEventGetAddr(key) : NULL;
     return sts;
@@ -407,7 +652,7 @@ pmdaEventQueueRecords(int handle, pmAtomValue *atom, int context,
     if (!queue || !clientq)
 	return -EINVAL;
 
-    sts = queue_fetch(queue, clientq, atom, queue_decoder, data);
+    sts = queue_fetch(handle, queue, clientq, atom, queue_decoder, data);
     if (sts != 0)
 	return sts;
     return (atom->vbp == NULL) ? PMDA_FETCH_NOVALUES : PMDA_FETCH_STATIC;
@@ -418,6 +663,11 @@ queue_release(event_queue_t *queue)
 {
     /* free resources and mark as no longer inuse */
     pmdaEventReleaseArray(queue->eventarray);
+    while (!queue_empty(queue))
+	queue_drop(queue);
+    free(queue->ring);
+    if (queue->filters)
+	free(queue->filters);
     memset(queue, 0, sizeof(*queue));
 }
 
@@ -429,10 +679,11 @@ static void
 queue_cleanup(int handle, event_clientq_t *clientq)
 {
     event_queue_t *queue = queue_lookup(handle);
-    event_t *event, *next;
 
     if (clientq->release)
 	clientq->release(clientq->filter);
+    if (queue)
+	queue_filter_detach(queue, clientq);
 
     if (!queue || !clientq->active)
 	return;
@@ -441,23 +692,12 @@ queue_cleanup(int handle, event_clientq_t *clientq)
 	__pmNotifyErr(LOG_DEBUG, "queue_cleanup: %s numclients=%d",
 			queue->name, queue->numclients);
 
-    event = clientq->last;
-    while (event) {
-	next = TAILQ_NEXT(event, events);
-
-	/* Remove the current event (if use count hits zero) */
-	if (--event->count <= 0) {
-	    if (pmDebug & DBG_TRACE_LIBPMDA)
-		__pmNotifyErr(LOG_DEBUG, "Removing %s event %p",
-				queue->name, event);
-	    TAILQ_REMOVE(&queue->tailq, event, events);
-	    queue->qsize -= event->size;
-	    free(event);
-	}
-	event = next;
-    }
+    /* events held back only for this client can now be released */
+    clientq->active = 0;
+    queue->numclients--;
+    queue_trim(handle, queue);
 
-    if (--queue->numclients <= 0) {
+    if (queue->numclients <= 0) {
 	if (pmDebug & DBG_TRACE_LIBPMDA)
 	    __pmNotifyErr(LOG_DEBUG, "queue_cleanup: %s final shutdown=%d",
 			    queue->name, queue->shutdown);
@@ -623,6 +863,7 @@ pmdaEventSetFilter(int context, int handle, void *filter,
 		   pmdaEventReleaseFilterCallBack release)
 {
     event_clientq_t *clientq = client_queue_lookup(context, handle, 1);
+    event_queue_t *queue = queue_lookup(handle);
 
     if (!clientq)
 	return -EINVAL;
@@ -630,6 +871,9 @@ pmdaEventSetFilter(int context, int handle, void *filter,
     /* first, free up any existing filter */
     if (clientq->filter)
 	clientq->release(clientq->filter);
+    queue_filter_detach(queue, clientq);
+    if (filter && apply)
+	clientq->shared = queue_filter_attach(queue, filter, apply);
 
     clientq->apply = apply;
     clientq->filter = filter;
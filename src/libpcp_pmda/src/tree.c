@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2014 Red Hat.
+ * Copyright (c) 2014,2017 Red Hat.
  * Copyright (c) 2009-2010 Aconex.  All Rights Reserved.
  * 
  * This library is free software; you can redistribute it and/or modify it
@@ -54,6 +54,7 @@ pmdaTreeRebuildHash(__pmnsTree *tree, int numpmid)
 	if (htabsize % 2 == 0) htabsize++;
 	if (htabsize % 3 == 0) htabsize += 2;
 	if (htabsize % 5 == 0) htabsize += 2;
+	free(tree->htab);	/* rebuilding after names added or removed */
 	tree->htabsize = htabsize;
 	tree->htab = (__pmnsNode **)calloc(htabsize, sizeof(__pmnsNode *));
 	if (tree->htab) {
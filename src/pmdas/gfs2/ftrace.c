@@ -1,7 +1,7 @@
 /*
  * GFS2 ftrace based trace-point metrics.
  *
- * Copyright (c) 2013 - 2014 Red Hat.
+ * Copyright (c) 2013 - 2014,2017 Red Hat.
  * 
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the
@@ -25,12 +25,15 @@
 
 #include <fcntl.h>
 #include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <inttypes.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 
 
-static char *TRACE_PIPE = "/sys/kernel/debug/tracing/trace_pipe";
+static char *TRACE_DIR = "/sys/kernel/debug/tracing";
 static int max_glock_throughput = INITIAL_GLOBAL_MAX_GLOCK_THROUGHPUT;
 
 static struct ftrace_data ftrace_data;
@@ -95,11 +98,12 @@ ftrace_get_threshold()
 static int
 ftrace_clear_buffer()
 {
-    char *TRACE = "/sys/kernel/debug/tracing/trace";
+    char path[MAXPATHLEN];
     FILE *fp;
 
     /* Open in write mode and then straight close will purge buffer contents */
-    if (( fp = fopen(TRACE, "w")) == NULL )
+    snprintf(path, sizeof(path), "%s%s/trace", gfs2_statspath, TRACE_DIR);
+    if (( fp = fopen(path, "w")) == NULL )
         return -oserror();
 
     fclose(fp);
@@ -536,6 +540,815 @@ gfs2_assign_ftrace(pmInDom gfs2_fs_indom, int reset_flag)
     }
 }
 
+/*
+ * Binary trace_pipe_raw reader.  Each CPU has its own ring buffer in
+ * the kernel, read here a sub-buffer at a time by one thread per CPU
+ * (so a busy CPU cannot starve the others) without formatting events
+ * as text.  Tracepoint counts are accumulated in per-CPU tables, one
+ * row per filesystem, that only the reader thread for that CPU writes;
+ * a fetch sums the rows without locking.  Events needed for the
+ * latency and worst_glock metrics are queued on a per-CPU ring for
+ * the fetch path, as those metrics keep state in the instance cache.
+ */
+#define FTRACE_MAX_DEVICES	16	/* filesystems tracked per CPU */
+#define FTRACE_RECORDS		512	/* queued events per CPU, power of two */
+
+#define RB_MISSED_EVENTS	(1UL << 31)	/* ring buffer page flags */
+#define RB_MISSED_STORED	(1UL << 30)
+
+enum {
+    FIELD_DEV = 0,
+    FIELD_GLTYPE,
+    FIELD_GLNUM,
+    FIELD_CUR_STATE,
+    FIELD_NEW_STATE,
+    FIELD_TGT_STATE,
+    FIELD_DMT_STATE,
+    FIELD_STATE,
+    FIELD_REMOTE,
+    FIELD_FIRST,
+    FIELD_QUEUE,
+    FIELD_SRTT,
+    FIELD_SRTTVAR,
+    FIELD_SRTTB,
+    FIELD_SRTTVARB,
+    FIELD_SIRT,
+    FIELD_SIRTVAR,
+    FIELD_DCOUNT,
+    FIELD_QCOUNT,
+    FIELD_PIN,
+    FIELD_LEN,
+    FIELD_START,
+    FIELD_BLOCK_STATE,
+    FIELD_CREATE,
+    FIELD_FUNC,
+    NUM_FTRACE_FIELDS
+};
+
+static const char *field_names[] = {
+    [FIELD_DEV]		= "dev",
+    [FIELD_GLTYPE]	= "gltype",
+    [FIELD_GLNUM]	= "glnum",
+    [FIELD_CUR_STATE]	= "cur_state",
+    [FIELD_NEW_STATE]	= "new_state",
+    [FIELD_TGT_STATE]	= "tgt_state",
+    [FIELD_DMT_STATE]	= "dmt_state",
+    [FIELD_STATE]	= "state",
+    [FIELD_REMOTE]	= "remote",
+    [FIELD_FIRST]	= "first",
+    [FIELD_QUEUE]	= "queue",
+    [FIELD_SRTT]	= "srtt",
+    [FIELD_SRTTVAR]	= "srttvar",
+    [FIELD_SRTTB]	= "srttb",
+    [FIELD_SRTTVARB]	= "srttvarb",
+    [FIELD_SIRT]	= "sirt",
+    [FIELD_SIRTVAR]	= "sirtvar",
+    [FIELD_DCOUNT]	= "dcount",
+    [FIELD_QCOUNT]	= "qcount",
+    [FIELD_PIN]		= "pin",
+    [FIELD_LEN]		= "len",
+    [FIELD_START]	= "start",
+    [FIELD_BLOCK_STATE]	= "block_state",
+    [FIELD_CREATE]	= "create",
+    [FIELD_FUNC]	= "func",
+};
+
+static const char *event_names[] = {
+    [GLOCK_STATE_CHANGE] = "gfs2_glock_state_change",
+    [GLOCK_PUT]		= "gfs2_glock_put",
+    [DEMOTE_RQ]		= "gfs2_demote_rq",
+    [PROMOTE]		= "gfs2_promote",
+    [GLOCK_QUEUE]	= "gfs2_glock_queue",
+    [GLOCK_LOCK_TIME]	= "gfs2_glock_lock_time",
+    [PIN]		= "gfs2_pin",
+    [LOG_FLUSH]		= "gfs2_log_flush",
+    [LOG_BLOCKS]	= "gfs2_log_blocks",
+    [AIL_FLUSH]		= "gfs2_ail_flush",
+    [BLOCK_ALLOC]	= "gfs2_block_alloc",
+    [BMAP]		= "gfs2_bmap",
+    [RS]		= "gfs2_rs",
+};
+
+/* glock_lock_time glock types, in gfs2.tracepoints.glock_lock_time order */
+static const int lock_time_types[] = {
+    [1] = FTRACE_GLOCKLOCKTIME_TRANS,
+    [2] = FTRACE_GLOCKLOCKTIME_INDOE,
+    [3] = FTRACE_GLOCKLOCKTIME_RGRP,
+    [4] = FTRACE_GLOCKLOCKTIME_META,
+    [5] = FTRACE_GLOCKLOCKTIME_IOPEN,
+    [6] = FTRACE_GLOCKLOCKTIME_FLOCK,
+    [8] = FTRACE_GLOCKLOCKTIME_QUOTA,
+    [9] = FTRACE_GLOCKLOCKTIME_JOURNAL,
+};
+
+struct ftrace_field {
+    int offset;
+    int size;		/* zero if this event does not have the field */
+    int sign;
+};
+
+struct ftrace_event {
+    int                 id;	/* -1 if the tracepoint is not available */
+    struct ftrace_field fields[NUM_FTRACE_FIELDS];
+};
+
+struct ftrace_counts {
+    volatile dev_t    dev_id;	/* zero until claimed by the reader */
+    volatile uint64_t values[NUM_TRACEPOINT_STATS];
+};
+
+struct ftrace_record {
+    int tracepoint;
+    union {
+        struct latency_event latency;
+        struct glock         glock;
+    } u;
+};
+
+struct ftrace_cpu {
+    int                   cpu;
+    int                   fd;
+    struct ftrace_counts  counts[FTRACE_MAX_DEVICES];
+    struct ftrace_record  records[FTRACE_RECORDS];
+    volatile unsigned int head;	/* written by the reader thread only */
+    volatile unsigned int tail;	/* written by the fetch path only */
+    volatile uint64_t     missed;	/* pages with events lost to overruns */
+    volatile uint64_t     dropped;	/* events not queued, ring was full */
+};
+
+static struct ftrace_event ftrace_events[NUM_FTRACE_TRACEPOINTS];
+static struct ftrace_cpu **ftrace_cpus;
+static int ftrace_ncpus;
+static int ftrace_raw_state;	/* 1 working, -1 using trace_pipe */
+
+static struct {
+    struct ftrace_field timestamp;
+    struct ftrace_field commit;
+    struct ftrace_field data;
+} ftrace_page;
+
+/*
+ * Extract offset, size and signedness for one "field:" line of the
+ * ftrace format files, returning the field name.
+ */
+static char *
+ftrace_parse_field(char *line, struct ftrace_field *field)
+{
+    char *name, *end;
+
+    if ((name = strstr(line, "field:")) == NULL || 
+        (end = strchr(name, ';')) == NULL)
+        return NULL;
+    *end = '\0';
+    if (sscanf(end + 1, " offset:%d; size:%d; signed:%d;",
+               &field->offset, &field->size, &field->sign) != 3)
+        return NULL;
+
+    /* Field name is the last word of the declaration, less any array size */
+    if ((name = strrchr(name, ' ')) == NULL)
+        return NULL;
+    name[strcspn(name, "[")] = '\0';
+    return name + 1;
+}
+
+static int
+ftrace_parse_header_page(void)
+{
+    struct ftrace_field field;
+    char path[MAXPATHLEN], buffer[256], *name;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s%s/events/header_page", gfs2_statspath, TRACE_DIR);
+    if ((fp = fopen(path, "r")) == NULL)
+        return -oserror();
+
+    memset(&ftrace_page, 0, sizeof(ftrace_page));
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        if ((name = ftrace_parse_field(buffer, &field)) == NULL)
+            continue;
+        if (strcmp(name, "timestamp") == 0)
+            ftrace_page.timestamp = field;
+        else if (strcmp(name, "commit") == 0)
+            ftrace_page.commit = field;
+        else if (strcmp(name, "data") == 0)
+            ftrace_page.data = field;
+    }
+    fclose(fp);
+
+    if (ftrace_page.timestamp.size != 8 || ftrace_page.data.size <= 0 ||
+        (ftrace_page.commit.size != 4 && ftrace_page.commit.size != 8))
+        return PM_ERR_CONV;
+    return 0;
+}
+
+/*
+ * Find the event identifier and field layout of a GFS2 tracepoint, as
+ * these differ between kernel versions.  All of the events we handle
+ * record the filesystem device, other fields are optional.
+ */
+static int
+ftrace_parse_format(int tracepoint)
+{
+    struct ftrace_event *event = &ftrace_events[tracepoint];
+    struct ftrace_field field;
+    char path[MAXPATHLEN], buffer[256], *name;
+    FILE *fp;
+    int i;
+
+    memset(event, 0, sizeof(*event));
+    event->id = -1;
+
+    snprintf(path, sizeof(path), "%s%s/events/gfs2/%s/format",
+             gfs2_statspath, TRACE_DIR, event_names[tracepoint]);
+    if ((fp = fopen(path, "r")) == NULL)
+        return -oserror();
+
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        if (sscanf(buffer, "ID: %d", &i) == 1) {
+            event->id = i;
+            continue;
+        }
+        if ((name = ftrace_parse_field(buffer, &field)) == NULL)
+            continue;
+        if (field.size != 1 && field.size != 2 && field.size != 4 && field.size != 8)
+            continue;
+        for (i = 0; i < NUM_FTRACE_FIELDS; i++) {
+            if (strcmp(name, field_names[i]) == 0) {
+                event->fields[i] = field;
+                break;
+            }
+        }
+    }
+    fclose(fp);
+
+    if (event->id < 0 || event->fields[FIELD_DEV].size == 0) {
+        event->id = -1;
+        return PM_ERR_CONV;
+    }
+    return 0;
+}
+
+/*
+ * Read an integer field from the binary event data, sign extending as
+ * needed; absent (or truncated) fields read as zero.
+ */
+static int64_t
+ftrace_field_value(const char *data, unsigned int length, struct ftrace_field *field)
+{
+    union { uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64; } v;
+
+    if (field->size == 0 || field->offset + field->size > length)
+        return 0;
+    memcpy(&v, data + field->offset, field->size);
+    switch (field->size) {
+    case 1:
+        return field->sign ? (int8_t)v.u8 : v.u8;
+    case 2:
+        return field->sign ? (int16_t)v.u16 : v.u16;
+    case 4:
+        return field->sign ? (int32_t)v.u32 : v.u32;
+    default:
+        return v.u64;
+    }
+}
+
+/*
+ * Locate the table row for a filesystem, claiming a free row for any
+ * device not yet seen on this CPU.  Rows are never released, so the
+ * fetch path can safely scan them at any time.
+ */
+static struct ftrace_counts *
+ftrace_raw_counts(struct ftrace_cpu *cp, dev_t dev_id)
+{
+    int i;
+
+    for (i = 0; i < FTRACE_MAX_DEVICES; i++) {
+        if (cp->counts[i].dev_id == dev_id)
+            return &cp->counts[i];
+        if (cp->counts[i].dev_id == 0) {
+            cp->counts[i].dev_id = dev_id;
+            return &cp->counts[i];
+        }
+    }
+    return NULL;
+}
+
+/* The per-state metrics of each tracepoint follow in NL..EX lock mode order */
+static void
+ftrace_count_state(volatile uint64_t *values, int first, int64_t state)
+{
+    if (state >= 0 && state <= 5)
+        values[first + state]++;
+}
+
+/*
+ * Space for an event passed on to the latency or worst_glock code in the
+ * fetch path, or NULL if it is not keeping up.  The record is published
+ * by ftrace_raw_commit().
+ */
+static struct ftrace_record *
+ftrace_raw_record(struct ftrace_cpu *cp, int tracepoint)
+{
+    struct ftrace_record *record;
+
+    if (cp->head - cp->tail >= FTRACE_RECORDS) {
+        cp->dropped++;
+        return NULL;
+    }
+    record = &cp->records[cp->head % FTRACE_RECORDS];
+    memset(record, 0, sizeof(*record));
+    record->tracepoint = tracepoint;
+    return record;
+}
+
+static void
+ftrace_raw_commit(struct ftrace_cpu *cp)
+{
+    __sync_synchronize();
+    cp->head++;
+}
+
+/*
+ * Account for one binary trace event, equivalent to the trace_pipe text
+ * handling of gfs2_extract_trace_values() and gfs2_assign_ftrace().
+ */
+static void
+ftrace_raw_event(struct ftrace_cpu *cp, uint64_t timestamp, const char *data, unsigned int length)
+{
+    struct ftrace_counts *counts;
+    struct ftrace_record *record;
+    struct ftrace_event *event;
+    struct ftrace_field *fields;
+    volatile uint64_t *values;
+    uint64_t dev, old, len;
+    uint16_t id;
+    int64_t state, to, target;
+    int tracepoint, type;
+
+    if (length < sizeof(id))
+        return;
+    memcpy(&id, data, sizeof(id));	/* common_type */
+    for (tracepoint = 0; tracepoint < NUM_FTRACE_TRACEPOINTS; tracepoint++)
+        if (ftrace_events[tracepoint].id == id)
+            break;
+    if (tracepoint == NUM_FTRACE_TRACEPOINTS)
+        return;
+    event = &ftrace_events[tracepoint];
+    fields = event->fields;
+
+    /* Kernel device numbers have a 20 bit minor */
+    dev = ftrace_field_value(data, length, &fields[FIELD_DEV]);
+    if ((counts = ftrace_raw_counts(cp, makedev(dev >> 20, dev & 0xfffff))) == NULL)
+        return;
+    values = counts->values;
+
+    switch (tracepoint) {
+    case GLOCK_STATE_CHANGE:
+        state = ftrace_field_value(data, length, &fields[FIELD_CUR_STATE]);
+        to = ftrace_field_value(data, length, &fields[FIELD_NEW_STATE]);
+        target = ftrace_field_value(data, length, &fields[FIELD_TGT_STATE]);
+        ftrace_count_state(values, FTRACE_GLOCKSTATE_NULLLOCK, to);
+        values[FTRACE_GLOCKSTATE_TOTAL]++;
+        if (to == target)
+            values[FTRACE_GLOCKSTATE_GLOCK_CHANGEDTARGET]++;
+        else
+            values[FTRACE_GLOCKSTATE_GLOCK_MISSEDTARGET]++;
+
+        if (latency_get_state() == 1 &&
+            (record = ftrace_raw_record(cp, tracepoint)) != NULL) {
+            record->u.latency.state = state;
+            record->u.latency.to = to;
+            record->u.latency.target = target;
+            record->u.latency.queue = -1;
+            goto latency;
+        }
+        break;
+
+    case GLOCK_PUT:
+        state = ftrace_field_value(data, length, &fields[FIELD_CUR_STATE]);
+        ftrace_count_state(values, FTRACE_GLOCKPUT_NULLLOCK, state);
+        values[FTRACE_GLOCKPUT_TOTAL]++;
+        break;
+
+    case DEMOTE_RQ:
+        state = ftrace_field_value(data, length, &fields[FIELD_DMT_STATE]);
+        ftrace_count_state(values, FTRACE_DEMOTERQ_NULLLOCK, state);
+        values[FTRACE_DEMOTERQ_TOTAL]++;
+        if (fields[FIELD_REMOTE].size) {
+            if (ftrace_field_value(data, length, &fields[FIELD_REMOTE]))
+                values[FTRACE_DEMOTERQ_REQUESTED_REMOTE]++;
+            else
+                values[FTRACE_DEMOTERQ_REQUESTED_LOCAL]++;
+        }
+
+        /* Demote latency is kept by the state being demoted from */
+        if (latency_get_state() == 1 &&
+            (record = ftrace_raw_record(cp, tracepoint)) != NULL) {
+            record->u.latency.state =
+                ftrace_field_value(data, length, &fields[FIELD_CUR_STATE]);
+            record->u.latency.queue = -1;
+            goto latency;
+        }
+        break;
+
+    case PROMOTE:
+        state = ftrace_field_value(data, length, &fields[FIELD_STATE]);
+        if (fields[FIELD_FIRST].size) {	/* not recorded by newer kernels */
+            if (ftrace_field_value(data, length, &fields[FIELD_FIRST]))
+                ftrace_count_state(values, FTRACE_PROMOTE_FIRST_NULLLOCK, state);
+            else
+                ftrace_count_state(values, FTRACE_PROMOTE_OTHER_NULLLOCK, state);
+        }
+        values[FTRACE_PROMOTE_TOTAL]++;
+        break;
+
+    case GLOCK_QUEUE:
+        state = ftrace_field_value(data, length, &fields[FIELD_STATE]);
+        if (ftrace_field_value(data, length, &fields[FIELD_QUEUE])) {
+            ftrace_count_state(values, FTRACE_GLOCKQUEUE_QUEUE_NULLLOCK, state);
+            values[FTRACE_GLOCKQUEUE_QUEUE_TOTAL]++;
+        } else {
+            ftrace_count_state(values, FTRACE_GLOCKQUEUE_DEQUEUE_NULLLOCK, state);
+            values[FTRACE_GLOCKQUEUE_DEQUEUE_TOTAL]++;
+        }
+        values[FTRACE_GLOCKQUEUE_TOTAL]++;
+
+        if (latency_get_state() == 1 &&
+            (record = ftrace_raw_record(cp, tracepoint)) != NULL) {
+            record->u.latency.state = state;
+            record->u.latency.queue = 
+                ftrace_field_value(data, length, &fields[FIELD_QUEUE]) != 0;
+            goto latency;
+        }
+        break;
+
+    case GLOCK_LOCK_TIME:
+        type = ftrace_field_value(data, length, &fields[FIELD_GLTYPE]);
+        if (type > 0 && type < (int)sizeof(lock_time_types)/sizeof(lock_time_types[0]) &&
+            lock_time_types[type] != 0)
+            values[lock_time_types[type]]++;
+        values[FTRACE_GLOCKLOCKTIME_TOTAL]++;
+
+        if (worst_glock_get_state() == 1 &&
+            (record = ftrace_raw_record(cp, tracepoint)) != NULL) {
+            struct glock *glock = &record->u.glock;
+
+            glock->dev_id = counts->dev_id;
+            glock->lock_type = type;
+            glock->number = ftrace_field_value(data, length, &fields[FIELD_GLNUM]);
+            glock->srtt = ftrace_field_value(data, length, &fields[FIELD_SRTT]);
+            glock->srttvar = ftrace_field_value(data, length, &fields[FIELD_SRTTVAR]);
+            glock->srttb = ftrace_field_value(data, length, &fields[FIELD_SRTTB]);
+            glock->srttvarb = ftrace_field_value(data, length, &fields[FIELD_SRTTVARB]);
+            glock->sirt = ftrace_field_value(data, length, &fields[FIELD_SIRT]);
+            glock->sirtvar = ftrace_field_value(data, length, &fields[FIELD_SIRTVAR]);
+            glock->dlm = ftrace_field_value(data, length, &fields[FIELD_DCOUNT]);
+            glock->queue = ftrace_field_value(data, length, &fields[FIELD_QCOUNT]);
+            ftrace_raw_commit(cp);
+        }
+        break;
+
+    case PIN:
+        if (ftrace_field_value(data, length, &fields[FIELD_PIN]))
+            values[FTRACE_PIN_PINTOTAL]++;
+        else
+            values[FTRACE_PIN_UNPINTOTAL]++;
+        values[FTRACE_PIN_TOTAL]++;
+
+        /* The fetch path resets the longest pinned value as it reads it */
+        len = ftrace_field_value(data, length, &fields[FIELD_LEN]);
+        do {
+            old = values[FTRACE_PIN_LONGESTPINNED];
+        } while (old < len &&
+                 !__sync_bool_compare_and_swap(&values[FTRACE_PIN_LONGESTPINNED], old, len));
+        break;
+
+    case LOG_FLUSH:
+        if (!ftrace_field_value(data, length, &fields[FIELD_START]))
+            values[FTRACE_LOGFLUSH_TOTAL]++;
+        break;
+
+    case LOG_BLOCKS:
+        values[FTRACE_LOGBLOCKS_TOTAL]++;
+        break;
+
+    case AIL_FLUSH:
+        if (!ftrace_field_value(data, length, &fields[FIELD_START]))
+            values[FTRACE_AILFLUSH_TOTAL]++;
+        break;
+
+    case BLOCK_ALLOC:
+        /* GFS2_BLKST_FREE, USED, UNLINKED and DINODE */
+        switch (ftrace_field_value(data, length, &fields[FIELD_BLOCK_STATE])) {
+        case 0:
+            values[FTRACE_BLOCKALLOC_FREE]++;
+            break;
+        case 1:
+            values[FTRACE_BLOCKALLOC_USED]++;
+            break;
+        case 2:
+            values[FTRACE_BLOCKALLOC_UNLINKED]++;
+            break;
+        case 3:
+            values[FTRACE_BLOCKALLOC_DINODE]++;
+            break;
+        }
+        values[FTRACE_BLOCKALLOC_TOTAL]++;
+        break;
+
+    case BMAP:
+        if (ftrace_field_value(data, length, &fields[FIELD_CREATE]))
+            values[FTRACE_BMAP_CREATE]++;
+        else
+            values[FTRACE_BMAP_NOCREATE]++;
+        values[FTRACE_BMAP_TOTAL]++;
+        break;
+
+    case RS:
+        /* TRACE_RS_DELETE, TREEDEL, INSERT and CLAIM */
+        switch (ftrace_field_value(data, length, &fields[FIELD_FUNC])) {
+        case 0:
+            values[FTRACE_RS_DEL]++;
+            break;
+        case 1:
+            values[FTRACE_RS_TDEL]++;
+            break;
+        case 2:
+            values[FTRACE_RS_INS]++;
+            break;
+        case 3:
+            values[FTRACE_RS_CLM]++;
+            break;
+        }
+        values[FTRACE_RS_TOTAL]++;
+        break;
+    }
+    return;
+
+latency:
+    record->u.latency.tracepoint = tracepoint;
+    record->u.latency.dev_id = counts->dev_id;
+    record->u.latency.lock_type = ftrace_field_value(data, length, &fields[FIELD_GLTYPE]);
+    record->u.latency.number = ftrace_field_value(data, length, &fields[FIELD_GLNUM]);
+    record->u.latency.usecs = timestamp / 1000;
+    ftrace_raw_commit(cp);
+}
+
+/*
+ * Walk the events of one ring buffer sub-buffer, as returned by a read
+ * of trace_pipe_raw: a page header then compressed event headers, see
+ * the events/header_page and events/header_event files.
+ */
+static void
+ftrace_raw_page(struct ftrace_cpu *cp, const char *page, size_t size)
+{
+    const char *p, *end;
+    uint64_t timestamp, commit;
+    uint32_t header, word, type_len, delta, length;
+
+    if (size < ftrace_page.data.offset)
+        return;
+    memcpy(&timestamp, page + ftrace_page.timestamp.offset, sizeof(timestamp));
+    if (ftrace_page.commit.size == 8)
+        memcpy(&commit, page + ftrace_page.commit.offset, sizeof(commit));
+    else {
+        memcpy(&word, page + ftrace_page.commit.offset, sizeof(word));
+        commit = word;
+    }
+    if (commit & RB_MISSED_EVENTS)
+        cp->missed++;
+    commit &= ~(RB_MISSED_EVENTS | RB_MISSED_STORED);
+
+    p = page + ftrace_page.data.offset;
+    end = p + commit;
+    if (end > page + size)
+        end = page + size;
+
+    while (p + sizeof(header) <= end) {
+        memcpy(&header, p, sizeof(header));
+#ifdef HAVE_NETWORK_BYTEORDER
+        type_len = header >> 27;
+        delta = header & ((1 << 27) - 1);
+#else
+        type_len = header & 0x1f;
+        delta = header >> 5;
+#endif
+        word = 0;
+        if (p + 2 * sizeof(word) <= end)
+            memcpy(&word, p + sizeof(header), sizeof(word));
+
+        switch (type_len) {
+        case 29:	/* padding, or the end of the page if no delta */
+            if (delta == 0)
+                return;
+            p += sizeof(header) + word;
+            continue;
+        case 30:	/* time extend */
+            timestamp += ((uint64_t)word << 27) | delta;
+            p += 2 * sizeof(word);
+            continue;
+        case 31:	/* absolute time stamp, less the top bits */
+            timestamp = (timestamp & (0x1fULL << 59)) | ((uint64_t)word << 27) | delta;
+            p += 2 * sizeof(word);
+            continue;
+        case 0:		/* length in the first word, which it includes */
+            if (word < sizeof(word))
+                return;
+            length = word - sizeof(word);
+            p += 2 * sizeof(word);
+            break;
+        default:
+            length = type_len * sizeof(word);
+            p += sizeof(header);
+            break;
+        }
+        if (p + length > end)
+            return;
+        timestamp += delta;
+        ftrace_raw_event(cp, timestamp, p, length);
+        p += length;
+    }
+}
+
+static void *
+ftrace_raw_reader(void *arg)
+{
+    struct ftrace_cpu *cp = (struct ftrace_cpu *)arg;
+    size_t size = ftrace_page.data.offset + ftrace_page.data.size;
+    char *page;
+    ssize_t bytes;
+
+    if ((page = malloc(size)) == NULL) {
+        __pmNotifyErr(LOG_ERR, "gfs2: cpu%d trace reader: %s",
+                      cp->cpu, osstrerror());
+        return NULL;
+    }
+    for (;;) {
+        /* Blocks until the kernel has events for this CPU */
+        if ((bytes = read(cp->fd, page, size)) < 0) {
+            if (oserror() == EINTR)
+                continue;
+            if (oserror() != EAGAIN) {
+                __pmNotifyErr(LOG_ERR, "gfs2: cpu%d trace reader: %s",
+                              cp->cpu, osstrerror());
+                break;
+            }
+            bytes = 0;
+        }
+        if (bytes == 0) {	/* woken without data, e.g. tracing_on cleared */
+            usleep(100000);
+            continue;
+        }
+        ftrace_raw_page(cp, page, bytes);
+    }
+    free(page);
+    return NULL;
+}
+
+/*
+ * Open the per-CPU trace_pipe_raw files and start their reader threads.
+ * A missing GFS2 module is reported as PM_ERR_AGAIN, it may be loaded
+ * by a later mount.
+ */
+static int
+ftrace_raw_start(void)
+{
+    struct ftrace_cpu *cp;
+    pthread_t thread;
+    sigset_t all, saved;
+    char path[MAXPATHLEN];
+    int i, fd, sts, ncpus, nevents = 0;
+
+    for (i = 0; i < NUM_FTRACE_TRACEPOINTS; i++) {
+        sts = ftrace_parse_format(i);
+        if (sts == 0)
+            nevents++;
+        else if (i == 0 && sts == -ENOENT) {
+            snprintf(path, sizeof(path), "%s%s/events/gfs2", gfs2_statspath, TRACE_DIR);
+            if (access(path, F_OK) < 0)
+                return PM_ERR_AGAIN;
+        }
+    }
+    if (nevents == 0)
+        return PM_ERR_CONV;
+    if ((sts = ftrace_parse_header_page()) < 0)
+        return sts;
+
+    if ((ncpus = sysconf(_SC_NPROCESSORS_CONF)) <= 0)
+        ncpus = 1;
+    if ((ftrace_cpus = calloc(ncpus, sizeof(struct ftrace_cpu *))) == NULL)
+        return -oserror();
+
+    /* readers inherit a fully blocked signal mask */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (i = 0, sts = 0; i < ncpus; i++) {
+        snprintf(path, sizeof(path), "%s%s/per_cpu/cpu%d/trace_pipe_raw", gfs2_statspath, TRACE_DIR, i);
+        if ((fd = open(path, O_RDONLY)) < 0) {
+            if (oserror() != ENOENT)	/* else not a possible CPU */
+                sts = -oserror();
+            continue;
+        }
+        if ((cp = calloc(1, sizeof(struct ftrace_cpu))) == NULL) {
+            sts = -oserror();
+            close(fd);
+            break;
+        }
+        cp->cpu = i;
+        cp->fd = fd;
+        if ((sts = pthread_create(&thread, NULL, ftrace_raw_reader, cp)) != 0) {
+            sts = -sts;
+            close(fd);
+            free(cp);
+            break;
+        }
+        pthread_detach(thread);
+        ftrace_cpus[ftrace_ncpus++] = cp;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (ftrace_ncpus == 0)
+        return sts < 0 ? sts : -ENOENT;
+    if (sts < 0)
+        __pmNotifyErr(LOG_WARNING, "gfs2: trace_pipe_raw reading %d of %d CPUs: %s",
+                      ftrace_ncpus, ncpus, pmErrStr(sts));
+    return 0;
+}
+
+/*
+ * Sum the per-CPU tables for each filesystem, then hand queued events to
+ * the latency and worst_glock code - at most the glock threshold of them
+ * per fetch, as for trace_pipe.  Tracepoint metrics count events since
+ * the previous fetch, as they always have.
+ */
+static int
+ftrace_raw_refresh(pmInDom gfs_fs_indom)
+{
+    uint64_t totals[NUM_TRACEPOINT_STATS], longest, value;
+    struct ftrace_record *record;
+    struct ftrace_counts *counts;
+    struct ftrace_cpu *cp;
+    struct gfs2_fs *fs;
+    int i, j, c, sts;
+
+    for (pmdaCacheOp(gfs_fs_indom, PMDA_CACHE_WALK_REWIND);;) {
+	if ((i = pmdaCacheOp(gfs_fs_indom, PMDA_CACHE_WALK_NEXT)) < 0)
+	    break;
+	sts = pmdaCacheLookup(gfs_fs_indom, i, NULL, (void **)&fs);
+	if (sts != PMDA_CACHE_ACTIVE)
+	    continue;
+
+        memset(totals, 0, sizeof(totals));
+        longest = 0;
+        for (c = 0; c < ftrace_ncpus; c++) {
+            cp = ftrace_cpus[c];
+            for (j = 0; j < FTRACE_MAX_DEVICES; j++) {
+                if (cp->counts[j].dev_id == 0 || cp->counts[j].dev_id == fs->dev_id)
+                    break;
+            }
+            if (j == FTRACE_MAX_DEVICES || cp->counts[j].dev_id == 0)
+                continue;
+            counts = &cp->counts[j];
+            for (j = 0; j < NUM_TRACEPOINT_STATS; j++)
+                totals[j] += counts->values[j];
+            value = __sync_lock_test_and_set(&counts->values[FTRACE_PIN_LONGESTPINNED], 0);
+            if (longest < value)
+                longest = value;
+        }
+        for (j = 0; j < NUM_TRACEPOINT_STATS; j++) {
+            fs->ftrace.values[j] = totals[j] - fs->ftrace.totals[j];
+            fs->ftrace.totals[j] = totals[j];
+        }
+        fs->ftrace.values[FTRACE_PIN_LONGESTPINNED] = longest;
+    }
+
+    num_accepted_entries = 0;
+    for (c = 0; c < ftrace_ncpus; c++) {
+        cp = ftrace_cpus[c];
+        while (cp->tail != cp->head) {
+            if (num_accepted_entries >= max_glock_throughput) {
+                cp->tail = cp->head;	/* discard, as trace_pipe does */
+                break;
+            }
+            __sync_synchronize();
+            record = &cp->records[cp->tail % FTRACE_RECORDS];
+            if (record->tracepoint == GLOCK_LOCK_TIME)
+                gfs2_worst_glock_event(&record->u.glock, gfs_fs_indom);
+            else
+                gfs2_latency_event(&record->u.latency, gfs_fs_indom);
+            num_accepted_entries++;
+            __sync_synchronize();
+            cp->tail++;
+        }
+#if PCP_DEBUG
+        if ((pmDebug & DBG_TRACE_APPL0) && (cp->missed || cp->dropped))
+            fprintf(stderr, "gfs2: cpu%d: %" PRIu64 " pages with lost events, "
+                    "%" PRIu64 " events not queued\n", cp->cpu, cp->missed, cp->dropped);
+#endif
+    }
+    return 0;
+}
+
 /* 
  * We take all required data from the trace_pipe. Whilst keeping track of
  * the number of locks we have seen so far. After locks have been collected
@@ -545,15 +1358,29 @@ int
 gfs2_refresh_ftrace_stats(pmInDom gfs_fs_indom)
 {
     FILE *fp;
-    int fd, flags, reset_flag;
-    char buffer[8196];
+    int fd, flags, reset_flag, sts;
+    char buffer[8196], path[MAXPATHLEN];
+
+    /* Prefer the binary per-CPU buffers, once the GFS2 events exist */
+    if (ftrace_raw_state == 0) {
+        if ((sts = ftrace_raw_start()) == 0)
+            ftrace_raw_state = 1;
+        else if (sts != PM_ERR_AGAIN) {
+            __pmNotifyErr(LOG_INFO, "gfs2: trace_pipe_raw unavailable, "
+                          "using trace_pipe: %s", pmErrStr(sts));
+            ftrace_raw_state = -1;
+        }
+    }
+    if (ftrace_raw_state > 0)
+        return ftrace_raw_refresh(gfs_fs_indom);
 
     /* Reset the metric types we have found */
     num_accepted_entries = 0;
     reset_flag = 1;
 
     /* We open the pipe in both read-only and non-blocking mode */
-    if ((fp = fopen(TRACE_PIPE, "r")) == NULL)
+    snprintf(path, sizeof(path), "%s%s/trace_pipe", gfs2_statspath, TRACE_DIR);
+    if ((fp = fopen(path, "r")) == NULL)
 	return -oserror();
 
     /* Set flags of fp as non-blocking */
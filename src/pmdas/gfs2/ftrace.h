@@ -1,7 +1,7 @@
 /*
  * GFS2 ftrace based trace-point metrics.
  *
- * Copyright (c) 2013 - 2014 Red Hat.
+ * Copyright (c) 2013 - 2014,2017 Red Hat.
  * 
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the
@@ -124,6 +124,7 @@ enum {
 
 struct ftrace {
     uint64_t values[NUM_TRACEPOINT_STATS];
+    uint64_t totals[NUM_TRACEPOINT_STATS];  /* trace_pipe_raw event counts */
 };
 
 struct ftrace_data {
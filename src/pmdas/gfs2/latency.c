@@ -1,7 +1,7 @@
 /*
  * GFS2 latency metrics.
  *
- * Copyright (c) 2014 Red Hat.
+ * Copyright (c) 2014,2017 Red Hat.
  * 
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the
@@ -28,7 +28,6 @@
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 
-static struct ftrace_data latency_data;
 static int reset_flag;
 
 static int latency_state = DEFAULT_LATENCY_STATE;
@@ -134,7 +133,8 @@ concatenate(int64_t a, int64_t b)
 }
 
 /*
- * Converts lock state to an integer
+ * Converts lock state to an integer, using the DLM lock mode numbering
+ * that the kernel records in the binary trace data (IV is -1).
  */
 static int
 lock_to_decimal(char *state)
@@ -153,7 +153,7 @@ lock_to_decimal(char *state)
         return 5;
     }
 
-    return 0;
+    return -1;
 }
 
 /*
@@ -198,19 +198,30 @@ update_records(struct gfs2_fs *fs, int metric, struct latency_data data, int pla
 }
 
 /*
- * We work out the individual metric values from our buffer input and store
- * them for processing after all of the values have been extracted from the
- * trace pipe.
+ * Latency records are kept per lock state, the metrics for each state
+ * from null_lock to exclusive follow the "all" metric in order.
  */
-int
-gfs2_extract_latency(unsigned int major, unsigned int minor, int tracepoint, char *data, pmInDom gfs_fs_indom)
+static int
+valid_state(int state)
 {
-    latency_data.dev_id = makedev(major, minor);
-    latency_data.tracepoint = tracepoint;
-    strncpy(latency_data.data, data, sizeof(latency_data.data)-1);
+    return (state >= 0 && state <= 5);
+}
 
+/*
+ * Update the latency records of the filesystem the trace event belongs
+ * to; events come either from parsed trace_pipe text or directly from
+ * the binary trace_pipe_raw records.
+ */
+int
+gfs2_latency_event(struct latency_event *event, pmInDom gfs_fs_indom)
+{
     int i, sts;
     struct gfs2_fs *fs;
+    struct latency_data data;
+
+    data.lock_type = event->lock_type;
+    data.number = event->number;
+    data.usecs = event->usecs;
 
     /* We walk through for each filesystem */
     for (pmdaCacheOp(gfs_fs_indom, PMDA_CACHE_WALK_REWIND);;) {
@@ -228,146 +239,99 @@ gfs2_extract_latency(unsigned int major, unsigned int minor, int tracepoint, cha
         }
 
         /* Is the entry matching the filesystem we are on? */
-        if (fs->dev_id != latency_data.dev_id)
+        if (fs->dev_id != event->dev_id)
             continue; 
 
-        if (latency_data.tracepoint ==  GLOCK_QUEUE) {
-
-            struct latency_data data;
-            int64_t time_major, time_minor;
-            char queue[8], state[3];
-
-            sscanf(latency_data.data, 
-                "%*s [%*d] %"SCNd64".%"SCNd64": gfs2_glock_queue: %*d,%*d glock %"SCNu32":%"SCNu64" %s %s",
-                &time_major, &time_minor, &data.lock_type, &data.number, queue, state
-            );
-            data.usecs = concatenate(time_major, time_minor);
-
-            if (data.lock_type == WORSTGLOCK_INODE || data.lock_type == WORSTGLOCK_RGRP) {
-
-                /* queue trace data is used both for latency.grant and latency.queue */
-                if (strncmp(queue, "queue", 6) == 0) {
-                    if (strncmp(state, "NL", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_NL, data, START);
-                        update_records(fs, LATENCY_QUEUE_NL, data, START);
-                    } else if (strncmp(state, "CR", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_CR, data, START);
-                        update_records(fs, LATENCY_QUEUE_CR, data, START);
-                    } else if (strncmp(state, "CW", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_CW, data, START);
-                        update_records(fs, LATENCY_QUEUE_CW, data, START);
-                    } else if (strncmp(state, "PR", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_PR, data, START);
-                        update_records(fs, LATENCY_QUEUE_PR, data, START);
-                    } else if (strncmp(state, "PW", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_PW, data, START);
-                        update_records(fs, LATENCY_QUEUE_PW, data, START);
-                    } else if (strncmp(state, "EX", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_EX, data, START);
-                        update_records(fs, LATENCY_QUEUE_EX, data, START);
-                    }
-                    update_records(fs, LATENCY_GRANT_ALL, data, START);
-                    update_records(fs, LATENCY_QUEUE_ALL, data, START);
-
-                } else if (strncmp(queue, "dequeue", 8) == 0) {
-                    if (strncmp(state, "NL", 2) == 0) {
-                        update_records(fs, LATENCY_QUEUE_NL, data, END);
-                    } else if (strncmp(state, "CR", 2) == 0) {
-                        update_records(fs, LATENCY_QUEUE_CR, data, END);
-                    } else if (strncmp(state, "CW", 2) == 0) {
-                        update_records(fs, LATENCY_QUEUE_CW, data, END);
-                    } else if (strncmp(state, "PR", 2) == 0) {
-                        update_records(fs, LATENCY_QUEUE_PR, data, END);
-                    } else if (strncmp(state, "PW", 2) == 0) {
-                        update_records(fs, LATENCY_QUEUE_PW, data, END);
-                    } else if (strncmp(state, "EX", 2) == 0) {
-                        update_records(fs, LATENCY_QUEUE_EX, data, END);
-                    }
-                    update_records(fs, LATENCY_QUEUE_ALL, data, END);
-                }
-            }
-        } else if (latency_data.tracepoint ==  GLOCK_STATE_CHANGE) {
-
-            struct latency_data data;
-            int64_t time_major, time_minor;
-            char state[3], to[3], target[3];
-            int state_decimal, to_decimal;
-
-            sscanf(latency_data.data, 
-                "%*s [%*d] %"SCNd64".%"SCNd64": gfs2_glock_state_change: %*d,%*d glock %"SCNu32":%"SCNu64" state %s to %s tgt:%s dmt:%*s flags:%*s", 
-                &time_major, &time_minor, &data.lock_type, &data.number, state, to, target
-            );
-            data.usecs = concatenate(time_major, time_minor);
-            state_decimal = lock_to_decimal(state);
-            to_decimal = lock_to_decimal(to);
-
-            if (data.lock_type == WORSTGLOCK_INODE || data.lock_type == WORSTGLOCK_RGRP) {
-
-                /* state change trace data is used both for latency.grant and latency.demote */
-                if ((state_decimal < to_decimal) && (strncmp(to, target, 2) == 0)) {
-                    if (strncmp(to, "NL", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_NL, data, END);
-                    } else if (strncmp(to, "CR", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_CR, data, END);
-                    } else if (strncmp(to, "CW", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_CW, data, END);
-                    } else if (strncmp(to, "PR", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_PR, data, END);
-                    } else if (strncmp(to, "PW", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_PW, data, END);
-                    } else if (strncmp(to, "EX", 2) == 0) {
-                        update_records(fs, LATENCY_GRANT_EX, data, END);
-                    }
-                    update_records(fs, LATENCY_GRANT_ALL, data, END);
-
-                } else if ((state_decimal > to_decimal) && (strncmp(to, target, 2) == 0)) {
-                    if (strncmp(state, "NL", 2) == 0) {
-                        update_records(fs, LATENCY_DEMOTE_NL, data, END);
-                    } else if (strncmp(state, "CR", 2) == 0) {
-                        update_records(fs, LATENCY_DEMOTE_CR, data, END);
-                    } else if (strncmp(state, "CW", 2) == 0) {
-                        update_records(fs, LATENCY_DEMOTE_CW, data, END);
-                    } else if (strncmp(state, "PR", 2) == 0) {
-                        update_records(fs, LATENCY_DEMOTE_PR, data, END);
-                    } else if (strncmp(state, "PW", 2) == 0) {
-                        update_records(fs, LATENCY_DEMOTE_PW, data, END);
-                    } else if (strncmp(state, "EX", 2) == 0) {
-                        update_records(fs, LATENCY_DEMOTE_EX, data, END);
-                    }
-                    update_records(fs, LATENCY_DEMOTE_ALL, data, END);
+        /* Only inode and resource group glocks are of interest */
+        if (data.lock_type != WORSTGLOCK_INODE && data.lock_type != WORSTGLOCK_RGRP)
+            continue;
+
+        if (event->tracepoint == GLOCK_QUEUE) {
+
+            /* queue trace data is used both for latency.grant and latency.queue */
+            if (event->queue == 1) {
+                if (valid_state(event->state)) {
+                    update_records(fs, LATENCY_GRANT_NL + event->state, data, START);
+                    update_records(fs, LATENCY_QUEUE_NL + event->state, data, START);
                 }
+                update_records(fs, LATENCY_GRANT_ALL, data, START);
+                update_records(fs, LATENCY_QUEUE_ALL, data, START);
+
+            } else if (event->queue == 0) {
+                if (valid_state(event->state))
+                    update_records(fs, LATENCY_QUEUE_NL + event->state, data, END);
+                update_records(fs, LATENCY_QUEUE_ALL, data, END);
             }
-        } else if (latency_data.tracepoint ==  DEMOTE_RQ) {
-
-            struct latency_data data;
-            int64_t time_major, time_minor;
-            char state[3];
-
-            sscanf(latency_data.data, 
-                "%*s [%*d] %"SCNd64".%"SCNd64": gfs2_demote_rq: %*d,%*d glock %"SCNu32":%"SCNu64" demote %s to %*s flags:%*s %*s", 
-                &time_major, &time_minor, &data.lock_type, &data.number, state
-            );
-            data.usecs = concatenate(time_major, time_minor);
-
-            if ((data.lock_type == WORSTGLOCK_INODE) || (data.lock_type == WORSTGLOCK_RGRP)) {
-
-                /* demote rq trace data is used for latency.demote */
-                if (strncmp(state, "NL", 2) == 0) {
-                    update_records(fs, LATENCY_DEMOTE_NL, data, START);
-                } else if (strncmp(state, "CR", 2) == 0) {
-                    update_records(fs, LATENCY_DEMOTE_CR, data, START);
-                } else if (strncmp(state, "CW", 2) == 0) {
-                    update_records(fs, LATENCY_DEMOTE_CW, data, START);
-                } else if (strncmp(state, "PR", 2) == 0) {
-                    update_records(fs, LATENCY_DEMOTE_PR, data, START);
-                } else if (strncmp(state, "PW", 2) == 0) {
-                    update_records(fs, LATENCY_DEMOTE_PW, data, START);
-                } else if (strncmp(state, "EX", 2) == 0) {
-                    update_records(fs, LATENCY_DEMOTE_EX, data, START);
-                }
-                update_records(fs, LATENCY_DEMOTE_ALL, data, START);
+
+        } else if (event->tracepoint == GLOCK_STATE_CHANGE) {
+
+            /* state change trace data is used both for latency.grant and latency.demote */
+            if ((event->state < event->to) && (event->to == event->target)) {
+                if (valid_state(event->to))
+                    update_records(fs, LATENCY_GRANT_NL + event->to, data, END);
+                update_records(fs, LATENCY_GRANT_ALL, data, END);
+
+            } else if ((event->state > event->to) && (event->to == event->target)) {
+                if (valid_state(event->state))
+                    update_records(fs, LATENCY_DEMOTE_NL + event->state, data, END);
+                update_records(fs, LATENCY_DEMOTE_ALL, data, END);
             }
-        }     
+
+        } else if (event->tracepoint == DEMOTE_RQ) {
+
+            /* demote rq trace data is used for latency.demote */
+            if (valid_state(event->state))
+                update_records(fs, LATENCY_DEMOTE_NL + event->state, data, START);
+            update_records(fs, LATENCY_DEMOTE_ALL, data, START);
+        }
     }
-    return 0;                       
+    return 0;
+}
+
+/*
+ * We work out the individual metric values from our trace_pipe buffer
+ * input, then pass them on for assignment to the filesystem records.
+ */
+int
+gfs2_extract_latency(unsigned int major, unsigned int minor, int tracepoint, char *data, pmInDom gfs_fs_indom)
+{
+    struct latency_event event = { 0 };
+    int64_t time_major = 0, time_minor = 0;
+    char queue[8] = "", state[3] = "", to[3] = "", target[3] = "";
+
+    event.dev_id = makedev(major, minor);
+    event.tracepoint = tracepoint;
+    event.queue = -1;
+
+    if (tracepoint == GLOCK_QUEUE) {
+        sscanf(data, 
+            "%*s [%*d] %"SCNd64".%"SCNd64": gfs2_glock_queue: %*d,%*d glock %"SCNu32":%"SCNu64" %7s %2s",
+            &time_major, &time_minor, &event.lock_type, &event.number, queue, state
+        );
+        if (strncmp(queue, "queue", 6) == 0)
+            event.queue = 1;
+        else if (strncmp(queue, "dequeue", 8) == 0)
+            event.queue = 0;
+
+    } else if (tracepoint == GLOCK_STATE_CHANGE) {
+        sscanf(data, 
+            "%*s [%*d] %"SCNd64".%"SCNd64": gfs2_glock_state_change: %*d,%*d glock %"SCNu32":%"SCNu64" state %2s to %2s tgt:%2s dmt:%*s flags:%*s", 
+            &time_major, &time_minor, &event.lock_type, &event.number, state, to, target
+        );
+
+    } else if (tracepoint == DEMOTE_RQ) {
+        sscanf(data, 
+            "%*s [%*d] %"SCNd64".%"SCNd64": gfs2_demote_rq: %*d,%*d glock %"SCNu32":%"SCNu64" demote %2s to %*s flags:%*s %*s", 
+            &time_major, &time_minor, &event.lock_type, &event.number, state
+        );
+    } else {
+        return 0;
+    }
+
+    event.usecs = concatenate(time_major, time_minor);
+    event.state = lock_to_decimal(state);
+    event.to = lock_to_decimal(to);
+    event.target = lock_to_decimal(target);
+
+    return gfs2_latency_event(&event, gfs_fs_indom);
 }
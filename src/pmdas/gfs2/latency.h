@@ -1,7 +1,7 @@
 /*
  * GFS2 latency metrics.
  *
- * Copyright (c) 2014 Red Hat.
+ * Copyright (c) 2014,2017 Red Hat.
  * 
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the
@@ -56,6 +56,18 @@ struct latency_data {
     int64_t usecs; 
 };
 
+struct latency_event {
+    int      tracepoint;
+    dev_t    dev_id;
+    uint32_t lock_type;
+    uint64_t number;
+    int64_t  usecs;
+    int      queue;     /* 1 queue, 0 dequeue */
+    int      state;     /* Lock states as DLM lock modes, NL (0) to EX (5) */
+    int      to;
+    int      target;
+};
+
 struct latency {
     struct latency_data values  [NUM_LATENCY_STATS * NUM_LATENCY_VALUES * 2]; /* START and STOP values */
     int                 counter [NUM_LATENCY_STATS];
@@ -63,6 +75,7 @@ struct latency {
 
 extern int gfs2_latency_fetch(int, struct latency *, pmAtomValue *);
 extern int gfs2_extract_latency(unsigned int, unsigned int, int, char *, pmInDom);
+extern int gfs2_latency_event(struct latency_event *, pmInDom);
 
 extern int latency_get_state();
 extern int latency_set_state(pmValueSet *vsp);
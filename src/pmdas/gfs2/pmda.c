@@ -21,9 +21,11 @@
 
 #include "pmdagfs2.h"
 
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <ctype.h>
 
+char *gfs2_statspath = "";
 static char *gfs2_sysfsdir = "/sys/kernel/debug/gfs2";
 static char *gfs2_sysdir = "/sys/fs/gfs2";
 
@@ -684,7 +686,7 @@ gfs2_device_identifier(const char *name)
      * /sys/fs/gfs2/NAME/id, we extract the data and store it in gfs2_fs->dev
      *
      */
-    snprintf(buffer, sizeof(buffer), "%s/%s/id", gfs2_sysdir, name);
+    snprintf(buffer, sizeof(buffer), "%s%s/%s/id", gfs2_statspath, gfs2_sysdir, name);
     buffer[sizeof(buffer)-1] = '\0';
 
     if ((fp = fopen(buffer, "r")) == NULL)
@@ -712,11 +714,13 @@ gfs2_instance_refresh(void)
     int i, sts, count, gfs2_status;
     struct dirent **files;
     pmInDom indom = INDOM(GFS_FS_INDOM);
+    char path[MAXPATHLEN];
 
     pmdaCacheOp(indom, PMDA_CACHE_INACTIVE);
 
-    /* update indom cache based on scan of /sys/fs/gfs2 */
-    count = scandir(gfs2_sysdir, &files, NULL, NULL);
+    /* update indom cache based on scan of /sys/fs/gfs2, in name order */
+    snprintf(path, sizeof(path), "%s%s", gfs2_statspath, gfs2_sysdir);
+    count = scandir(path, &files, NULL, alphasort);
     if (count < 0) { /* give some feedback as to GFS2 kernel state */
 	if (oserror() == EPERM)
 	    gfs2_status = PM_ERR_PERMISSION;
@@ -774,23 +778,25 @@ gfs2_fetch_refresh(pmdaExt *pmda, int *need_refresh)
 {
     pmInDom indom = INDOM(GFS_FS_INDOM);
     struct gfs2_fs *fs;
-    char *name;
+    char *name, sysfs[MAXPATHLEN];
     int i, sts;
 
     if ((sts = gfs2_instance_refresh()) < 0)
 	return sts;
 
+    snprintf(sysfs, sizeof(sysfs), "%s%s", gfs2_statspath, gfs2_sysfsdir);
+
     for (pmdaCacheOp(indom, PMDA_CACHE_WALK_REWIND);;) {
 	if ((i = pmdaCacheOp(indom, PMDA_CACHE_WALK_NEXT)) < 0)
 	    break;
 	if (!pmdaCacheLookup(indom, i, &name, (void **)&fs) || !fs)
 	    continue;
 	if (need_refresh[CLUSTER_GLOCKS])
-	    gfs2_refresh_glocks(gfs2_sysfsdir, name, &fs->glocks);
+	    gfs2_refresh_glocks(sysfs, name, &fs->glocks);
 	if (need_refresh[CLUSTER_SBSTATS])
-	    gfs2_refresh_sbstats(gfs2_sysfsdir, name, &fs->sbstats);
+	    gfs2_refresh_sbstats(sysfs, name, &fs->sbstats);
         if (need_refresh[CLUSTER_GLSTATS])
-            gfs2_refresh_glstats(gfs2_sysfsdir, name, &fs->glstats);
+            gfs2_refresh_glstats(sysfs, name, &fs->glstats);
     }
 
     if (need_refresh[CLUSTER_TRACEPOINTS] || need_refresh[CLUSTER_WORSTGLOCK] || need_refresh[CLUSTER_LATENCY])
@@ -878,9 +884,12 @@ gfs2_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 static void
 gfs2_tracepoints_init()
 {
+    char path[MAXPATHLEN];
     FILE *fp;
 
-    fp = fopen("/sys/kernel/debug/tracing/events/gfs2/enable", "w");
+    snprintf(path, sizeof(path), "%s/sys/kernel/debug/tracing/events/gfs2/enable",
+		gfs2_statspath);
+    fp = fopen(path, "w");
     if (!fp) {
         fprintf(stderr, "Unable to automatically enable GFS2 tracepoints");
     } else {
@@ -895,9 +904,12 @@ gfs2_tracepoints_init()
 static void
 gfs2_buffer_default_size_set()
 {
+    char path[MAXPATHLEN];
     FILE *fp;
 
-    fp = fopen("/sys/kernel/debug/tracing/buffer_size_kb", "w");
+    snprintf(path, sizeof(path), "%s/sys/kernel/debug/tracing/buffer_size_kb",
+		gfs2_statspath);
+    fp = fopen(path, "w");
     if (!fp) {
         fprintf(stderr, "Unable to set default buffer size");
     } else {
@@ -914,9 +926,12 @@ gfs2_buffer_default_size_set()
 static void
 gfs2_ftrace_irq_info_set()
 {
+    char path[MAXPATHLEN];
     FILE *fp;
 
-    fp = fopen("/sys/kernel/debug/tracing/options/irq-info", "w");
+    snprintf(path, sizeof(path), "%s/sys/kernel/debug/tracing/options/irq-info",
+		gfs2_statspath);
+    fp = fopen(path, "w");
     if (fp) {
         /* We only need to set value if irq-info exists */
         fprintf(fp, "0"); /* Switch off irq-info in trace_pipe */
@@ -995,10 +1010,15 @@ gfs2_init(pmdaInterface *dp)
 {
     int		nindoms = sizeof(indomtable)/sizeof(indomtable[0]);
     int		nmetrics = sizeof(metrictable)/sizeof(metrictable[0]);
+    char	*envpath;
 
     if (dp->status != 0)
 	return;
 
+    /* Testing with a filesystem tree copied from a GFS2 host */
+    if ((envpath = getenv("GFS2_STATSPATH")) != NULL)
+	gfs2_statspath = envpath;
+
     dp->version.four.instance = gfs2_instance;
     dp->version.four.store = gfs2_store;
     dp->version.four.fetch = gfs2_fetch;
@@ -51,6 +51,7 @@ struct gfs2_fs {
         struct latency     latency;
 };
 
+extern char *gfs2_statspath;
 extern pmdaMetric metrictable[];
 extern int metrictable_size();
 
@@ -1,7 +1,7 @@
 /*
  * GFS2 gfs2_glock_lock_time trace-point metrics.
  *
- * Copyright (c) 2013 - 2014 Red Hat.
+ * Copyright (c) 2013 - 2014,2017 Red Hat.
  * 
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the
@@ -248,6 +248,26 @@ worst_glock_assign_glocks(pmInDom gfs_fs_indom)
     }   
 }
 
+/*
+ * Filter the glock lock time statistics of a trace event, updating the
+ * worst glocks of the filesystem it belongs to.
+ */
+int
+gfs2_worst_glock_event(struct glock *glock, pmInDom gfs_fs_indom)
+{
+    /* Filter on required lock types */
+    if ((glock->lock_type == WORSTGLOCK_INODE || glock->lock_type == WORSTGLOCK_RGRP) &&
+        (glock->dlm > COUNT_THRESHOLD || glock->queue > COUNT_THRESHOLD)) {
+          
+        /* Increase counters */
+        glock_data = *glock;
+        ftrace_increase_num_accepted_entries(); 
+    }
+
+    worst_glock_assign_glocks(gfs_fs_indom);
+    return 0;
+}
+
 /*
  * We work out the individual metric values from our buffer input and store
  * them for processing after all of the values have been extracted from the
@@ -277,17 +297,7 @@ gfs2_extract_worst_glock(char **buffer, pmInDom gfs_fs_indom)
     );
     temp.dev_id = makedev(major, minor);
 
-    /* Filter on required lock types */
-    if ((temp.lock_type == WORSTGLOCK_INODE || temp.lock_type == WORSTGLOCK_RGRP) &&
-        (temp.dlm > COUNT_THRESHOLD || temp.queue > COUNT_THRESHOLD)) {
-          
-        /* Increase counters */
-        glock_data = temp;         
-        ftrace_increase_num_accepted_entries(); 
-    }
-
-    worst_glock_assign_glocks(gfs_fs_indom);
-    return 0;
+    return gfs2_worst_glock_event(&temp, gfs_fs_indom);
 }
 
 static void
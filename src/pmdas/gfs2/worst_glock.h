@@ -84,6 +84,7 @@ struct worst_glock {
 extern void gfs2_worst_glock_init(pmdaMetric *, int);
 extern int gfs2_worst_glock_fetch(int, struct worst_glock *, pmAtomValue *);
 extern int gfs2_extract_worst_glock(char **, pmInDom);
+extern int gfs2_worst_glock_event(struct glock *, pmInDom);
 
 extern int worst_glock_get_state();
 extern int worst_glock_set_state(pmValueSet *vsp);
@@ -1,14 +1,14 @@
 /*
  * Linux Filesystem Cluster
  *
- * Copyright (c) 2014-2016 Red Hat.
+ * Copyright (c) 2014-2017 Red Hat.
  * Copyright (c) 2000,2004,2007-2008 Silicon Graphics, Inc.  All Rights Reserved.
- * 
+ *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the
  * Free Software Foundation; either version 2 of the License, or (at your
  * option) any later version.
- * 
+ *
  * This program is distributed in the hope that it will be useful, but
  * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
  * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
@@ -16,6 +16,64 @@
  */
 #include "linux.h"
 #include "filesys.h"
+#include "statsfile.h"
+#include <poll.h>
+#if defined(HAVE_SETNS)
+#include <sched.h>
+#endif
+
+/*
+ * statfs(2) blocks for as long as the filesystem takes to answer, and
+ * a mount with an unresponsive device behind it would stall the PMDA
+ * (and pmcd, when we are a DSO) indefinitely.  So statfs calls are
+ * handed to a small pool of worker threads, each request having its
+ * own deadline.  When a request misses its deadline the last good
+ * values are returned, and the request is left to complete (or not)
+ * in the background - no further requests are made for that mount
+ * until it does, so one hung mount occupies at most one worker.
+ */
+enum { STATFS_IDLE, STATFS_QUEUED, STATFS_BUSY, STATFS_DONE };
+
+typedef struct statfs_request {
+    struct statfs_request *next;	/* work queue linkage */
+    int			state;		/* STATFS_* above */
+    int			error;		/* errno from statfs, or zero */
+    int			sts;		/* outcome returned for this fetch */
+    int			warned;		/* reported the missed deadline */
+    char		*path;		/* private copy of the mount point */
+    struct statfs	result;
+    struct timespec	deadline;
+} statfs_request_t;
+
+static int		nworkers = 4;		/* threads requested */
+static int		nstarted;		/* threads running */
+static int		nready;			/* threads with private fs info */
+static int		timeout = 1000;		/* msec per statfs request */
+static int		delay;			/* msec added to statfs, for QA */
+static statfs_request_t	*queue_head, *queue_tail;
+static pthread_mutex_t	statfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	statfs_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	statfs_done = PTHREAD_COND_INITIALIZER;
+
+/*
+ * The kernel sets POLLPRI on an open mounts file once the mount table
+ * of its namespace changes, so the file is kept open and only re-read
+ * (and the device names resolved again) after that.
+ */
+static statsfile_t	self_mounts = STATSFILE_INIT("/proc/self/mounts");
+static statsfile_t	init_mounts = STATSFILE_INIT("/proc/1/mounts");
+static int		mounts_current;	/* instances match self_mounts */
+
+void
+setup_filesys(int workers, int msec, int slow)
+{
+    if (workers >= 0)
+	nworkers = workers;
+    if (msec >= 0)
+	timeout = msec;
+    if (slow >= 0)
+	delay = slow;
+}
 
 char *
 scan_filesys_options(const char *options, const char *option)
@@ -35,37 +93,88 @@ scan_filesys_options(const char *options, const char *option)
     return NULL;
 }
 
+static int
+mounts_changed(void)
+{
+    struct pollfd	pfd;
+
+    /* in test mode the file is replaced, keeping it open thwarts that */
+    if (!mounts_current || self_mounts.fd < 0 ||
+	(linux_test_mode & LINUX_TEST_STATSPATH))
+	return 1;
+    pfd.fd = self_mounts.fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) < 0)
+	return 1;
+    return (pfd.revents & (POLLPRI|POLLERR)) != 0;
+}
+
+/* mount table unchanged, so just start a new fetch for each instance */
+static void
+reset_filesys(pmInDom indom)
+{
+    filesys_t	*fs;
+    int		inst;
+
+    for (pmdaCacheOp(indom, PMDA_CACHE_WALK_REWIND);;) {
+	if ((inst = pmdaCacheOp(indom, PMDA_CACHE_WALK_NEXT)) < 0)
+	    break;
+	if (!pmdaCacheLookup(indom, inst, NULL, (void **)&fs) || !fs)
+	    continue;
+	fs->flags &= ~FSF_FETCHED;
+    }
+}
+
 int
 refresh_filesys(pmInDom filesys_indom, pmInDom tmpfs_indom,
 		struct linux_container *cp)
 {
-    char buf[MAXPATHLEN];
     char src[MAXPATHLEN];
+    statsfile_t *mounts;
     filesys_t *fs;
     pmInDom indom;
-    FILE *fp;
+    char *line, *eol, *end;
     char *path, *device, *type, *options;
     int sts;
 
-    pmdaCacheOp(tmpfs_indom, PMDA_CACHE_INACTIVE);
-    pmdaCacheOp(filesys_indom, PMDA_CACHE_INACTIVE);
+    if (!cp && !mounts_changed()) {
+	reset_filesys(filesys_indom);
+	reset_filesys(tmpfs_indom);
+	return 0;
+    }
 
     /*
      * When operating within a container namespace, cannot refer
      * to "self" due to it being a symlinked pid from the host.
+     * Nor is the container file kept open, as the next context
+     * may well be in a different namespace.
      */
-    snprintf(src, sizeof(src), "%s/proc/%s/mounts",
-				linux_statspath, cp ? "1" : "self");
-    if ((fp = fopen(src, "r")) == NULL)
-	return -oserror();
+    mounts = cp ? &init_mounts : &self_mounts;
+    sts = statsfile_read(mounts);
+    if (cp)
+	statsfile_close(mounts);
+    mounts_current = 0;
+    if (sts < 0)
+	return sts;
+
+    pmdaCacheOp(tmpfs_indom, PMDA_CACHE_INACTIVE);
+    pmdaCacheOp(filesys_indom, PMDA_CACHE_INACTIVE);
+
+    end = mounts->buf + mounts->length;
+    for (line = mounts->buf; line < end; line = eol + 1) {
+	if ((eol = memchr(line, '\n', end - line)) == NULL)
+	    eol = end;
+	*eol = '\0';
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-	if ((device = strtok(buf, " ")) == 0)
+	if ((device = strtok(line, " ")) == 0)
 	    continue;
 
 	path = strtok(NULL, " ");
 	type = strtok(NULL, " ");
 	options = strtok(NULL, " ");
+	if (path == NULL || type == NULL || options == NULL)
+	    continue;
 	if (strcmp(type, "proc") == 0 ||
 	    strcmp(type, "nfs") == 0 ||
 	    strcmp(type, "devfs") == 0 ||
@@ -101,6 +210,7 @@ refresh_filesys(pmInDom filesys_indom, pmInDom tmpfs_indom,
 	    if (strcmp(path, fs->path) != 0) {	/* old device, new path */
 		free(fs->path);
 		fs->path = strdup(path);
+		fs->flags &= ~FSF_VALID;
 	    }
 	    if (strcmp(options, fs->options) != 0) {	/* old device, new opts */
 		free(fs->options);
@@ -108,7 +218,7 @@ refresh_filesys(pmInDom filesys_indom, pmInDom tmpfs_indom,
 	    }
 	}
 	else {	/* new mount */
-	    if ((fs = malloc(sizeof(filesys_t))) == NULL)
+	    if ((fs = calloc(1, sizeof(filesys_t))) == NULL)
 		continue;
 	    fs->device = strdup(device);
 	    fs->path = strdup(path);
@@ -121,14 +231,253 @@ refresh_filesys(pmInDom filesys_indom, pmInDom tmpfs_indom,
 #endif
 	    pmdaCacheStore(indom, PMDA_CACHE_ADD, device, fs);
 	}
-	fs->flags = 0;
+	fs->flags &= ~FSF_FETCHED;
     }
+    mounts_current = (cp == NULL);
 
     /*
      * success
      * Note: we do not call statfs() here since only some instances
-     * may be requested (rather, we do it in linux_fetch, see pmda.c).
+     * may be requested (rather, prefetch_filesys queues requests for
+     * the instances in the profile, see linux_refresh in pmda.c).
      */
-    fclose(fp);
     return 0;
 }
+
+static void *
+statfs_worker(void *arg)
+{
+    statfs_request_t	*rp;
+    struct statfs	sbuf;
+    int			sts;
+
+    (void)arg;
+#if defined(HAVE_SETNS)
+    /*
+     * setns(2) into a container mount namespace fails while any other
+     * thread shares our filesystem information (root, cwd, umask).
+     */
+    unshare(CLONE_FS);
+#endif
+    pthread_mutex_lock(&statfs_lock);
+    nready++;
+    pthread_cond_broadcast(&statfs_done);
+    for (;;) {
+	while ((rp = queue_head) == NULL)
+	    pthread_cond_wait(&statfs_work, &statfs_lock);
+	if ((queue_head = rp->next) == NULL)
+	    queue_tail = NULL;
+	rp->state = STATFS_BUSY;
+	pthread_mutex_unlock(&statfs_lock);
+
+	/* may block for as long as it likes, the fetch has moved on */
+	if (delay > 0) {
+	    struct timeval	tv = { delay / 1000, (delay % 1000) * 1000 };
+	    __pmtimevalSleep(tv);
+	}
+	sts = statfs(rp->path, &sbuf) < 0 ? oserror() : 0;
+
+	pthread_mutex_lock(&statfs_lock);
+	if ((rp->error = sts) == 0)
+	    rp->result = sbuf;
+	rp->state = STATFS_DONE;
+	pthread_cond_broadcast(&statfs_done);
+    }
+    /*NOTREACHED*/
+    return NULL;
+}
+
+static void
+statfs_start(void)
+{
+    pthread_t	thread;
+    sigset_t	all, saved;
+    int		sts;
+
+    /* workers inherit a fully blocked signal mask */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    while (nstarted < nworkers) {
+	if ((sts = pthread_create(&thread, NULL, statfs_worker, NULL)) != 0) {
+	    __pmNotifyErr(LOG_ERR, "filesys: started %d of %d statfs workers: %s",
+			nstarted, nworkers, pmErrStr(-sts));
+	    nworkers = nstarted;
+	    break;
+	}
+	pthread_detach(thread);
+	nstarted++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    /* returning earlier could race with setns(2) in the caller */
+    pthread_mutex_lock(&statfs_lock);
+    while (nready < nstarted)
+	pthread_cond_wait(&statfs_done, &statfs_lock);
+    pthread_mutex_unlock(&statfs_lock);
+}
+
+/* called with statfs_lock held, keeps the result of a finished request */
+static void
+statfs_finish(filesys_t *fs)
+{
+    statfs_request_t	*rp = fs->request;
+
+    if (rp->error == 0) {
+	fs->stats = rp->result;
+	fs->flags |= FSF_VALID;
+	rp->sts = 0;
+    } else {
+	fs->flags &= ~FSF_VALID;
+	rp->sts = PM_ERR_INST;
+    }
+    if (rp->warned) {
+	__pmNotifyErr(LOG_INFO, "filesys: statfs of \"%s\" completed", rp->path);
+	rp->warned = 0;
+    }
+    rp->state = STATFS_IDLE;
+}
+
+/* called with statfs_lock held */
+static void
+statfs_submit(filesys_t *fs, const struct timespec *deadline)
+{
+    statfs_request_t	*rp = fs->request;
+
+    if (rp == NULL) {
+	if ((rp = calloc(1, sizeof(statfs_request_t))) == NULL)
+	    return;	/* fetch_filesys calls statfs itself */
+	fs->request = rp;
+    }
+    /* an outstanding request keeps its original deadline */
+    if (rp->state == STATFS_QUEUED || rp->state == STATFS_BUSY)
+	return;
+    if (rp->state == STATFS_DONE)	/* completed after its deadline */
+	statfs_finish(fs);
+    if (rp->path == NULL || strcmp(rp->path, fs->path) != 0) {
+	free(rp->path);
+	if ((rp->path = strdup(fs->path)) == NULL)
+	    return;
+    }
+    rp->deadline = *deadline;
+    rp->state = STATFS_QUEUED;
+    rp->next = NULL;
+    if (queue_tail)
+	queue_tail->next = rp;
+    else
+	queue_head = rp;
+    queue_tail = rp;
+}
+
+static void
+statfs_deadline(struct timespec *deadline)
+{
+    struct timeval	now;
+
+    __pmtimevalNow(&now);
+    deadline->tv_sec = now.tv_sec + timeout / 1000;
+    deadline->tv_nsec = now.tv_usec * 1000 + (timeout % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+	deadline->tv_sec++;
+	deadline->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Before pmdaFetch runs, queue a statfs request for each instance in
+ * the profile, all with the same deadline - so a fetch waits at most
+ * once for the timeout, however many mounts are slow to respond.
+ */
+void
+prefetch_filesys(pmInDom indom, pmdaInProfile *prof)
+{
+    struct timespec	deadline;
+    filesys_t		*fs;
+    int			inst;
+
+    if (nstarted < nworkers)
+	statfs_start();
+    if (nstarted == 0)
+	return;
+
+    statfs_deadline(&deadline);
+    pthread_mutex_lock(&statfs_lock);
+    for (pmdaCacheOp(indom, PMDA_CACHE_WALK_REWIND);;) {
+	if ((inst = pmdaCacheOp(indom, PMDA_CACHE_WALK_NEXT)) < 0)
+	    break;
+	if (!__pmInProfile(indom, prof, inst))
+	    continue;
+	if (!pmdaCacheLookup(indom, inst, NULL, (void **)&fs) || !fs)
+	    continue;
+	if (!(fs->flags & FSF_FETCHED))
+	    statfs_submit(fs, &deadline);
+    }
+    if (queue_head)
+	pthread_cond_broadcast(&statfs_work);
+    pthread_mutex_unlock(&statfs_lock);
+}
+
+/*
+ * Called from the fetch callback, fills in fs->stats for this fetch.
+ * Returns PM_ERR_AGAIN if statfs has not yet completed for a mount
+ * that has never had a good result.
+ */
+int
+fetch_filesys(filesys_t *fs)
+{
+    statfs_request_t	*rp = NULL;
+    struct timespec	deadline;
+    int			sts;
+
+    if (fs->flags & FSF_FETCHED)
+	return fs->request ? fs->request->sts : 0;
+
+    if (nstarted > 0) {
+	pthread_mutex_lock(&statfs_lock);
+	rp = fs->request;
+	if (rp == NULL || rp->state == STATFS_IDLE) {
+	    /* not prefetched, so queue it now - still never waiting forever */
+	    statfs_deadline(&deadline);
+	    statfs_submit(fs, &deadline);
+	    if ((rp = fs->request) != NULL && rp->state == STATFS_QUEUED)
+		pthread_cond_broadcast(&statfs_work);
+	}
+	if (rp == NULL || rp->state == STATFS_IDLE) {
+	    pthread_mutex_unlock(&statfs_lock);
+	    rp = NULL;
+	}
+    }
+    if (rp == NULL) {	/* no workers, or out of memory */
+	if (statfs(fs->path, &fs->stats) < 0)
+	    return PM_ERR_INST;
+	fs->flags |= (FSF_FETCHED|FSF_VALID);
+	if (fs->request)
+	    fs->request->sts = 0;
+	return 0;
+    }
+
+    while (rp->state == STATFS_QUEUED || rp->state == STATFS_BUSY) {
+	sts = pthread_cond_timedwait(&statfs_done, &statfs_lock, &rp->deadline);
+	if (sts == ETIMEDOUT)
+	    break;
+    }
+    if (rp->state == STATFS_DONE)
+	statfs_finish(fs);
+    else {
+	if (!rp->warned) {
+	    __pmNotifyErr(LOG_WARNING, "filesys: statfs of \"%s\" timed out,"
+			" reporting %s", rp->path, (fs->flags & FSF_VALID) ?
+			"previous values" : "no values");
+	    rp->warned = 1;
+	}
+	rp->sts = (fs->flags & FSF_VALID) ? 0 : PM_ERR_AGAIN;
+    }
+    pthread_mutex_unlock(&statfs_lock);
+
+#if PCP_DEBUG
+    if ((pmDebug & DBG_TRACE_LIBPMDA) && rp->warned)
+	fprintf(stderr, "fetch_filesys: \"%s\" statfs outstanding: %s\n",
+		fs->path, rp->sts < 0 ? pmErrStr(rp->sts) : "previous values");
+#endif
+    fs->flags |= FSF_FETCHED;
+    return rp->sts;
+}
@@ -1,6 +1,7 @@
 /*
  * Linux Filesystem Cluster
  *
+ * Copyright (c) 2017 Red Hat.
  * Copyright (c) 2000,2004,2007 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -18,6 +19,7 @@
 
 /* Values for flags in filesys_t */
 #define FSF_FETCHED		(1U << 0)
+#define FSF_VALID		(1U << 1)	/* stats holds a good result */
 
 typedef struct filesys {
     int		  id;
@@ -26,8 +28,12 @@ typedef struct filesys {
     char	  *path;
     char	  *options;
     struct statfs stats;
+    struct statfs_request *request;	/* private to the statfs workers */
 } filesys_t;
 
 struct linux_container;
+extern void setup_filesys(int, int, int);
 extern int refresh_filesys(pmInDom, pmInDom, struct linux_container *);
+extern void prefetch_filesys(pmInDom, pmdaInProfile *);
+extern int fetch_filesys(filesys_t *);
 extern char *scan_filesys_options(const char *, const char *);
@@ -15,6 +15,7 @@
 #include "linux.h"
 #include "filesys.h"
 #include "interrupts.h"
+#include "statsfile.h"
 #include <sys/stat.h>
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -28,13 +29,46 @@ typedef struct {
     unsigned long	*values;	/* per-CPU values for this counter */
 } interrupt_t;
 
+/*
+ * Rows of /proc/interrupts and /proc/softirqs, as seen at the previous
+ * refresh.  Row zero is the header line naming the CPU of each column.
+ */
+enum { ROW_HEADER, ROW_LINE, ROW_ERROR, ROW_MISS, ROW_OTHER };
+
 typedef struct {
-    unsigned int	cpuid;		/* CPU identifier */
-    unsigned long long	count;		/* per-CPU sum of interrupt counts */
-} online_cpu_t;
+    unsigned int	offset;		/* start of the row in the file */
+    unsigned int	length;		/* row length, including newline */
+    unsigned int	kind;		/* ROW_HEADER, ROW_LINE, etc */
+    unsigned int	index;		/* interrupt_t array index */
+} irqrow_t;
+
+/*
+ * The per-CPU interrupt files are a matrix of rows by CPU columns which
+ * on large systems runs to megabytes, yet most rows (devices with no
+ * activity since the last sample) are unchanged between refreshes.
+ * So the file contents are kept, and each row is only parsed when its
+ * offset, length or contents differ from the previous refresh.  Values
+ * are stored in file column order, with maps between columns and CPU
+ * identifiers rebuilt only when the header line changes.
+ */
+typedef struct {
+    statsfile_t		file;
+    char		*prev;		/* file contents at previous refresh */
+    size_t		prevsize;
+    irqrow_t		*rows;		/* rows found by previous refresh */
+    unsigned int	nrows;
+    unsigned int	maxrows;
+    unsigned int	ncolumns;	/* CPU columns in the header line */
+    unsigned int	*cpuids;	/* maps file column to CPU identifier */
+    int			*columns;	/* maps CPU identifier to file column */
+} irqfile_t;
+
+static irqfile_t interrupts_file = { STATSFILE_INIT("/proc/interrupts") };
+static irqfile_t softirqs_file = { STATSFILE_INIT("/proc/softirqs") };
 
 static unsigned int cpu_count;
-static online_cpu_t *online_cpumap;	/* maps input columns to CPU info */
+static unsigned long long *interrupt_sums;	/* per-column sum of all rows */
+static int interrupt_summed;
 static unsigned int lines_count;
 static interrupt_t *interrupt_lines;
 static unsigned int other_count;
@@ -48,11 +82,27 @@ static __pmnsTree *interrupt_tree;
 static __pmnsTree *softirqs_tree;
 unsigned int irq_err_count;
 
+static int
+setup_irqfile(irqfile_t *fp)
+{
+    int i;
+
+    fp->cpuids = realloc(fp->cpuids, _pm_ncpus * sizeof(unsigned int));
+    fp->columns = realloc(fp->columns, _pm_ncpus * sizeof(int));
+    if (!fp->cpuids || !fp->columns)
+	return -oserror();
+    for (i = 0; i < _pm_ncpus; i++)
+	fp->columns[i] = -1;
+    fp->ncolumns = 0;
+    fp->nrows = 0;	/* re-parse every row */
+    return 0;
+}
+
 /*
  * One-shot initialisation for global interrupt-metric-related state
  */
 static int
-setup_interrupts(int reset)
+setup_interrupts(void)
 {
     static int setup;
 
@@ -63,13 +113,15 @@ setup_interrupts(int reset)
     }
 
     if (cpu_count != _pm_ncpus) {
-	online_cpumap = realloc(online_cpumap, _pm_ncpus * sizeof(online_cpu_t));
-	if (!online_cpumap)
+	if (setup_irqfile(&interrupts_file) < 0 ||
+	    setup_irqfile(&softirqs_file) < 0)
+	    return -oserror();
+	interrupt_sums = realloc(interrupt_sums,
+				_pm_ncpus * sizeof(unsigned long long));
+	if (!interrupt_sums)
 	    return -oserror();
 	cpu_count = _pm_ncpus;
     }
-    if (reset)
-	memset(online_cpumap, 0, cpu_count * sizeof(online_cpu_t));
     return 0;
 }
 
@@ -189,52 +241,49 @@ noop_softirqs_pmns(int domain)
     return softirqs_tree;
 }
 
+/* parse the header line, which maps online CPU number to column number */
 static int
-map_online_cpus(char *buffer)
+map_online_cpus(irqfile_t *fp, char *buffer)
 {
     unsigned int i = 0, cpuid;
     char *s, *end;
 
-    for (s = buffer; i < _pm_ncpus && *s != '\0'; s++) {
+    for (cpuid = 0; cpuid < cpu_count; cpuid++)
+	fp->columns[cpuid] = -1;
+    for (s = buffer; i < cpu_count && *s != '\0'; s++) {
 	if (!isdigit((int)*s))
 	    continue;
 	cpuid = (unsigned int)strtoul(s, &end, 10);
 	if (end == s)
 	    break;
-	online_cpumap[i++].cpuid = cpuid;
+	if (cpuid < cpu_count)
+	    fp->columns[cpuid] = i;
+	fp->cpuids[i++] = cpuid;
 	s = end;
     }
+    fp->ncolumns = i;
     return i;
 }
 
-static int
-column_to_cpuid(int column)
-{
-    int i;
-
-    if (online_cpumap[column].cpuid == column)
-	return column;
-    for (i = 0; i < cpu_count; i++)
-	if (online_cpumap[i].cpuid == column)
-	    return i;
-    return 0;
-}
-
 static char *
-extract_values(char *buffer, unsigned long *values, int ncolumns, int count)
+extract_values(char *buffer, unsigned long *values, int ncolumns)
 {
-    unsigned long i, cpuid, value;
+    unsigned long i;
+    __uint64_t value;
     char *s = buffer, *end = NULL;
 
     for (i = 0; i < ncolumns; i++) {
-	value = strtoul(s, &end, 10);
+	end = (char *)statsfile_skip_space(s);
+	if ((unsigned int)(*end - '0') < 10)
+	    end = (char *)statsfile_ull(end, &value);
+	else {		/* short row, as strtoul with no digits */
+	    value = 0;
+	    end = s;
+	}
 	if (!isspace(*end))
 	    return NULL;
 	s = end;
-	cpuid = column_to_cpuid(i);
-	if (count)
-	    online_cpumap[cpuid].count += value;
-	values[cpuid] = value;
+	values[i] = value;
     }
     return end;
 }
@@ -280,8 +329,7 @@ initialise_named_interrupt(interrupt_t *ip, int cache, char *name, char *end)
 static int
 extend_interrupts(interrupt_t **interp, unsigned int *countp)
 {
-    int cnt = cpu_count * sizeof(unsigned long);
-    unsigned long *values = malloc(cnt);
+    unsigned long *values = calloc(cpu_count, sizeof(unsigned long));
     interrupt_t *interrupt = *interp;
     int count = *countp + 1;
 
@@ -331,7 +379,7 @@ extract_interrupt_lines(char *buffer, int ncolumns, int nlines)
 	return 0;
     if (resize && !extend_interrupts(&interrupt_lines, &lines_count))
 	return 0;
-    end = extract_values(values, interrupt_lines[nlines].values, ncolumns, 1);
+    end = extract_values(values, interrupt_lines[nlines].values, ncolumns);
     if (resize) {
 	initialise_interrupt(&interrupt_lines[nlines], id, name, end);
 	return 2;
@@ -363,7 +411,7 @@ extract_interrupt_other(char *buffer, int ncolumns, int nlines)
     name = extract_interrupt_name(buffer, &values);
     if (resize && !extend_interrupts(&interrupt_other, &other_count))
 	return 0;
-    end = extract_values(values, interrupt_other[nlines].values, ncolumns, 1);
+    end = extract_values(values, interrupt_other[nlines].values, ncolumns);
     if (resize) {
 	initialise_named_interrupt(&interrupt_other[nlines],
 				   INTERRUPT_NAMES_INDOM, name, end);
@@ -381,7 +429,7 @@ extract_softirqs(char *buffer, int ncolumns, int nlines)
     name = extract_interrupt_name(buffer, &values);
     if (resize && !extend_interrupts(&softirqs, &softirqs_count))
 	return 0;
-    end = extract_values(values, softirqs[nlines].values, ncolumns, 0);
+    end = extract_values(values, softirqs[nlines].values, ncolumns);
     if (resize) {
 	initialise_named_interrupt(&softirqs[nlines],
 				    SOFTIRQS_NAMES_INDOM, name, end);
@@ -390,50 +438,160 @@ extract_softirqs(char *buffer, int ncolumns, int nlines)
     return 1;
 }
 
+/*
+ * Iterate over the lines of a statsfile buffer, each line terminated
+ * by its newline and a NUL so the extract routines above can be used
+ * in place; the overwritten character is restored for the next line.
+ */
+static char *
+next_line(statsfile_t *sp, char **line, char *save)
+{
+    char *p = *line, *eol, *end = sp->buf + sp->length;
+
+    if (p > sp->buf && p <= end)
+	*p = *save;		/* restore the start of this line */
+    if (p >= end)
+	return NULL;
+    if ((eol = memchr(p, '\n', end - p)) == NULL)
+	eol = end - 1;
+    *line = eol + 1;
+    *save = eol[1];
+    eol[1] = '\0';
+    return p;
+}
+
+/*
+ * Compare a row with the same row at the previous refresh, if it has
+ * changed then keep a copy (before the extract routines modify it).
+ */
+static int
+unchanged_row(irqfile_t *fp, unsigned int row, const char *buf, int length)
+{
+    unsigned int offset = buf - fp->file.buf;
+    irqrow_t *rp = &fp->rows[row];
+
+    if (row < fp->nrows && rp->offset == offset && rp->length == length &&
+	memcmp(fp->prev + offset, buf, length) == 0)
+	return 1;
+    memcpy(fp->prev + offset, buf, length);
+    return 0;
+}
+
+static void
+update_row(irqfile_t *fp, unsigned int row, const char *buf, int length,
+	   unsigned int kind, unsigned int index)
+{
+    irqrow_t *rp = &fp->rows[row];
+
+    rp->offset = buf - fp->file.buf;
+    rp->length = length;
+    rp->kind = kind;
+    rp->index = index;
+}
+
+/*
+ * Read the file and size the previous contents buffer and row table
+ * to match, returning the number of rows that can be tracked.
+ */
+static int
+read_irqfile(irqfile_t *fp)
+{
+    unsigned int maxrows;
+    irqrow_t *rows;
+    char *prev, *p, *end;
+    int sts;
+
+    if ((sts = statsfile_read(&fp->file)) < 0)
+	return sts;
+    if (fp->prevsize < fp->file.size) {
+	if ((prev = realloc(fp->prev, fp->file.size)) == NULL)
+	    return -ENOMEM;
+	fp->prev = prev;
+	fp->prevsize = fp->file.size;
+    }
+    end = fp->file.buf + fp->file.length;
+    for (maxrows = 1, p = fp->file.buf; p < end; maxrows++) {
+	if ((p = memchr(p, '\n', end - p)) == NULL)
+	    break;
+	p++;
+    }
+    if (maxrows > fp->maxrows) {
+	if ((rows = realloc(fp->rows, maxrows * sizeof(irqrow_t))) == NULL)
+	    return -ENOMEM;
+	fp->rows = rows;
+	fp->maxrows = maxrows;
+    }
+    return maxrows;
+}
+
 int
 refresh_interrupt_values(void)
 {
-    FILE *fp;
-    char buf[BUFSIZ];
-    int i, j, ncolumns;
-    int sts, resized = 0;
+    irqfile_t *fp = &interrupts_file;
+    char *buf, *line, save;
+    unsigned int row;
+    int j, ncolumns, length;
+    int sts, parsed = 0, resized = 0;
 
     refresh_interrupt_count++;
+    interrupt_summed = 0;
 
-    if ((sts = setup_interrupts(1)) < 0)
+    if ((sts = setup_interrupts()) < 0)
 	return sts;
 
-    if ((fp = linux_statsfile("/proc/interrupts", buf, sizeof(buf))) == NULL)
-	return -oserror();
+    if ((sts = read_irqfile(fp)) < 0)
+	return sts;
 
     /* first parse header, which maps online CPU number to column number */
-    if (fgets(buf, sizeof(buf), fp)) {
-	ncolumns = map_online_cpus(buf);
-    } else {
-	fclose(fp);
+    line = fp->file.buf;
+    if ((buf = next_line(&fp->file, &line, &save)) == NULL)
 	return -EINVAL;		/* unrecognised file format */
+    if (!unchanged_row(fp, 0, buf, line - buf)) {
+	map_online_cpus(fp, buf);
+	update_row(fp, 0, buf, line - buf, ROW_HEADER, 0);
+	fp->nrows = 1;		/* column layout changed, parse every row */
     }
+    ncolumns = fp->ncolumns;
+
+    for (row = 1, j = 0; (buf = next_line(&fp->file, &line, &save)) != NULL; row++) {
+	length = line - buf;
+	if (unchanged_row(fp, row, buf, length) &&
+	    (fp->rows[row].kind != ROW_OTHER || fp->rows[row].index == j)) {
+	    if (fp->rows[row].kind == ROW_OTHER)
+		j++;
+	    continue;
+	}
+	parsed++;
 
-    i = j = 0;
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
 	/* next we parse each interrupt line row (starting with a digit) */
-	sts = extract_interrupt_lines(buf, ncolumns, i++);
+	sts = extract_interrupt_lines(buf, ncolumns, row - 1);
 	if (sts > 1)
 	    resized++;
-	if (sts)
+	if (sts) {
+	    update_row(fp, row, buf, length, ROW_LINE, row - 1);
 	    continue;
-	if (extract_interrupt_errors(buf))
+	}
+	if (extract_interrupt_errors(buf)) {
+	    update_row(fp, row, buf, length, ROW_ERROR, 0);
 	    continue;
-	if (extract_interrupt_misses(buf))
+	}
+	if (extract_interrupt_misses(buf)) {
+	    update_row(fp, row, buf, length, ROW_MISS, 0);
 	    continue;
+	}
 	/* parse other per-CPU interrupt counter rows (starts non-digit) */
-	sts = extract_interrupt_other(buf, ncolumns, j++);
+	sts = extract_interrupt_other(buf, ncolumns, j);
 	if (sts > 1)
 	    resized++;
 	if (!sts)
 	    break;
+	update_row(fp, row, buf, length, ROW_OTHER, j++);
     }
-    fclose(fp);
+    fp->nrows = row;
+
+    if (pmDebug & DBG_TRACE_LIBPMDA)
+	fprintf(stderr, "refresh_interrupt_values: parsed %d of %u rows\n",
+		parsed, row - 1);
 
     if (resized)
 	dynamic_name_save(INTERRUPT_NAMES_INDOM, interrupt_other, other_count);
@@ -441,39 +599,73 @@ refresh_interrupt_values(void)
     return 0;
 }
 
+/*
+ * Per-CPU sum of all interrupt rows at the last refresh, only done
+ * when kernel.percpu.intr is fetched.
+ */
+static void
+sum_interrupt_values(void)
+{
+    irqfile_t *fp = &interrupts_file;
+    unsigned long *values;
+    unsigned int row, i;
+
+    memset(interrupt_sums, 0, cpu_count * sizeof(unsigned long long));
+    for (row = 1; row < fp->nrows; row++) {
+	if (fp->rows[row].kind == ROW_LINE)
+	    values = interrupt_lines[fp->rows[row].index].values;
+	else if (fp->rows[row].kind == ROW_OTHER)
+	    values = interrupt_other[fp->rows[row].index].values;
+	else
+	    continue;
+	for (i = 0; i < fp->ncolumns; i++)
+	    interrupt_sums[i] += values[i];
+    }
+    interrupt_summed = 1;
+}
+
 int
 refresh_softirqs_values(void)
 {
-    FILE *fp;
-    char buf[BUFSIZ];
-    int i = 0, ncolumns;
+    irqfile_t *fp = &softirqs_file;
+    char *buf, *line, save;
+    unsigned int row;
+    int ncolumns, length;
     int sts, resized = 0;
 
     refresh_softirqs_count++;
 
-    if ((sts = setup_interrupts(0)) < 0)
+    if ((sts = setup_interrupts()) < 0)
 	return sts;
 
-    if ((fp = linux_statsfile("/proc/softirqs", buf, sizeof(buf))) == NULL)
-	return -oserror();
+    if ((sts = read_irqfile(fp)) < 0)
+	return sts;
 
     /* first parse header, which maps online CPU number to column number */
-    if (fgets(buf, sizeof(buf), fp)) {
-	ncolumns = map_online_cpus(buf);
-    } else {
-	fclose(fp);
+    line = fp->file.buf;
+    if ((buf = next_line(&fp->file, &line, &save)) == NULL)
 	return -EINVAL;		/* unrecognised file format */
+    if (!unchanged_row(fp, 0, buf, line - buf)) {
+	map_online_cpus(fp, buf);
+	update_row(fp, 0, buf, line - buf, ROW_HEADER, 0);
+	fp->nrows = 1;		/* column layout changed, parse every row */
     }
+    ncolumns = fp->ncolumns;
+
+    for (row = 1; (buf = next_line(&fp->file, &line, &save)) != NULL; row++) {
+	length = line - buf;
+	if (unchanged_row(fp, row, buf, length))
+	    continue;
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
 	/* next we parse each softirqs line */
-	sts = extract_softirqs(buf, ncolumns, i++);
+	sts = extract_softirqs(buf, ncolumns, row - 1);
 	if (sts > 1)
 	    resized = 1;
 	if (sts == 0)
 	    break;
+	update_row(fp, row, buf, length, ROW_LINE, row - 1);
     }
-    fclose(fp);
+    fp->nrows = row;
 
     if (resized)
 	dynamic_name_save(SOFTIRQS_NAMES_INDOM, softirqs, softirqs_count);
@@ -549,7 +741,7 @@ int
 interrupts_fetch(int cluster, int item, unsigned int inst, pmAtomValue *atom)
 {
     interrupt_t *ip;
-    int cpuid;
+    int column;
 
     if (!refresh_interrupt_count)
 	refresh_interrupt_values();
@@ -567,29 +759,38 @@ interrupts_fetch(int cluster, int item, unsigned int inst, pmAtomValue *atom)
 	case CLUSTER_INTERRUPTS:
 	    if (item != 4)
 		break;
-	    cpuid = column_to_cpuid(inst);
-	    atom->ull = online_cpumap[cpuid].count;
+	    if ((column = interrupts_file.columns[inst]) < 0)
+		return 0;
+	    if (!interrupt_summed)
+		sum_interrupt_values();
+	    atom->ull = interrupt_sums[column];
 	    return 1;
 	case CLUSTER_INTERRUPT_LINES:
 	    if (!lines_count)
 		return 0;
-	    if (item > lines_count)
+	    if (item >= lines_count)
 		break;
-	    atom->ul = interrupt_lines[item].values[inst];
+	    if ((column = interrupts_file.columns[inst]) < 0)
+		return 0;
+	    atom->ul = interrupt_lines[item].values[column];
 	    return 1;
 	case CLUSTER_INTERRUPT_OTHER:
 	    if (!other_count)
 		return 0;
 	    if (!(ip = dynamic_data_lookup(item, INTERRUPT_NAMES_INDOM)))
 		break;
-	    atom->ul = ip->values[inst];
+	    if ((column = interrupts_file.columns[inst]) < 0)
+		return 0;
+	    atom->ul = ip->values[column];
 	    return 1;
 	case CLUSTER_SOFTIRQS:
 	    if (!softirqs_count)
 		return 0;
 	    if (!(ip = dynamic_data_lookup(item, SOFTIRQS_NAMES_INDOM)))
 		break;
-	    atom->ul = ip->values[inst];
+	    if ((column = softirqs_file.columns[inst]) < 0)
+		return 0;
+	    atom->ul = ip->values[column];
 	    return 1;
     }
     return PM_ERR_PMID;
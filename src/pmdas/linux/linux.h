@@ -96,6 +96,10 @@ enum {
 	CLUSTER_TAPEDEV,	/* 71 /sys/class/scsi_tape */
 	CLUSTER_RANDOM,		/* 72 /proc/sys/kernel/random entropy state */
 	CLUSTER_NET_SOCKSTAT6,	/* 73 /proc/net/sockstat6 */
+	CLUSTER_REFRESH,	/* 74 PMDA refresh intervals and statistics */
+	CLUSTER_NET_TCP6,	/* 75 /proc/net/tcp6 or sock_diag */
+	CLUSTER_NET_UDP,	/* 76 /proc/net/udp or sock_diag */
+	CLUSTER_NET_UDP6,	/* 77 /proc/net/udp6 or sock_diag */
 
 	NUM_CLUSTERS		/* one more than highest numbered cluster */
 };
@@ -156,6 +160,7 @@ enum {
 	ZONEINFO_INDOM,	        /* 32 - proc zoneinfo */
 	ZONEINFO_PROTECTION_INDOM,	/* 33 - proc zoneinfo protection item */
 	TAPEDEV_INDOM,		/* 34 - tape devices */
+	REFRESH_INDOM,		/* 35 - PMDA refresh clusters */
 
 	NUM_INDOMS		/* one more than highest numbered cluster */
 };
@@ -69,6 +69,9 @@ static proc_meminfo_t		proc_meminfo;
 static proc_loadavg_t		proc_loadavg;
 static proc_net_rpc_t		proc_net_rpc;
 static proc_net_tcp_t		proc_net_tcp;
+static proc_net_tcp_t		proc_net_tcp6;
+static proc_net_tcp_t		proc_net_udp;
+static proc_net_tcp_t		proc_net_udp6;
 static proc_net_sockstat_t	proc_net_sockstat;
 static proc_net_sockstat6_t	proc_net_sockstat6;
 static struct utsname		kernel_uname;
@@ -302,6 +305,57 @@ static pmdaInstid nfs4_svr_indom_id[NR_RPC4_SVR_COUNTERS] = {
 	{ 71, "write_same" },
 };
 
+/*
+ * Refresh clusters which may be given a minimum refresh interval, the
+ * instance identifier being the cluster (also the refresh array index).
+ */
+static pmdaInstid refresh_indom_id[] = {
+	{ CLUSTER_STAT, "stat" },
+	{ CLUSTER_MEMINFO, "meminfo" },
+	{ CLUSTER_LOADAVG, "loadavg" },
+	{ CLUSTER_NET_DEV, "net_dev" },
+	{ CLUSTER_INTERRUPTS, "interrupts" },
+	{ CLUSTER_FILESYS, "filesys" },
+	{ CLUSTER_SWAPDEV, "swapdev" },
+	{ CLUSTER_NET_NFS, "net_rpc" },
+	{ CLUSTER_PARTITIONS, "partitions" },
+	{ CLUSTER_NET_SOCKSTAT, "net_sockstat" },
+	{ CLUSTER_KERNEL_UNAME, "uname" },
+	{ CLUSTER_NET_SNMP, "net_snmp" },
+	{ CLUSTER_SCSI, "scsi" },
+	{ CLUSTER_CPUINFO, "cpuinfo" },
+	{ CLUSTER_NET_TCP, "net_tcp" },
+	{ CLUSTER_SLAB, "slabinfo" },
+	{ CLUSTER_SEM_LIMITS, "sem_limits" },
+	{ CLUSTER_MSG_LIMITS, "msg_limits" },
+	{ CLUSTER_SHM_LIMITS, "shm_limits" },
+	{ CLUSTER_UPTIME, "uptime" },
+	{ CLUSTER_VFS, "sys_fs" },
+	{ CLUSTER_VMSTAT, "vmstat" },
+	{ CLUSTER_NET_ADDR, "net_addr" },
+	{ CLUSTER_SYSFS_KERNEL, "sysfs_kernel" },
+	{ CLUSTER_NUMA_MEMINFO, "numa_meminfo" },
+	{ CLUSTER_NET_NETSTAT, "net_netstat" },
+	{ CLUSTER_SHM_INFO, "shm_info" },
+	{ CLUSTER_NET_SOFTNET, "net_softnet" },
+	{ CLUSTER_NET_SNMP6, "net_snmp6" },
+	{ CLUSTER_SEM_INFO, "sem_info" },
+	{ CLUSTER_MSG_INFO, "msg_info" },
+	{ CLUSTER_SOFTIRQS, "softirqs" },
+	{ CLUSTER_SHM_STAT, "shm_stat" },
+	{ CLUSTER_MSG_STAT, "msg_stat" },
+	{ CLUSTER_SEM_STAT, "sem_stat" },
+	{ CLUSTER_BUDDYINFO, "buddyinfo" },
+	{ CLUSTER_ZONEINFO, "zoneinfo" },
+	{ CLUSTER_KSM_INFO, "ksm_info" },
+	{ CLUSTER_TAPEDEV, "tapestats" },
+	{ CLUSTER_RANDOM, "random" },
+	{ CLUSTER_NET_SOCKSTAT6, "net_sockstat6" },
+	{ CLUSTER_NET_TCP6, "net_tcp6" },
+	{ CLUSTER_NET_UDP, "net_udp" },
+	{ CLUSTER_NET_UDP6, "net_udp6" },
+};
+
 static pmdaIndom indomtab[] = {
     { CPU_INDOM, 0, NULL }, /* cached */
     { DISK_INDOM, 0, NULL }, /* cached */
@@ -337,7 +391,8 @@ static pmdaIndom indomtab[] = {
     { BUDDYINFO_INDOM, 0, NULL },
     { ZONEINFO_INDOM, 0, NULL },
     { ZONEINFO_PROTECTION_INDOM, 0, NULL },
-    { TAPEDEV_INDOM, 0, NULL }
+    { TAPEDEV_INDOM, 0, NULL },
+    { REFRESH_INDOM, sizeof(refresh_indom_id)/sizeof(pmdaInstid), refresh_indom_id },
 };
 
 
@@ -2475,6 +2530,81 @@ static pmdaMetric metrictab[] = {
     { PMDA_PMID(CLUSTER_NET_TCP, 11), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
     PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
 
+/* network.tcp6conn.established */
+  { &proc_net_tcp6.stat[_PM_TCP_ESTABLISHED],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 1), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.syn_sent */
+  { &proc_net_tcp6.stat[_PM_TCP_SYN_SENT],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 2), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.syn_recv */
+  { &proc_net_tcp6.stat[_PM_TCP_SYN_RECV],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 3), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.fin_wait1 */
+  { &proc_net_tcp6.stat[_PM_TCP_FIN_WAIT1],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 4), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.fin_wait2 */
+  { &proc_net_tcp6.stat[_PM_TCP_FIN_WAIT2],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 5), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.time_wait */
+  { &proc_net_tcp6.stat[_PM_TCP_TIME_WAIT],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 6), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.close */
+  { &proc_net_tcp6.stat[_PM_TCP_CLOSE],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 7), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.close_wait */
+  { &proc_net_tcp6.stat[_PM_TCP_CLOSE_WAIT],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 8), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.last_ack */
+  { &proc_net_tcp6.stat[_PM_TCP_LAST_ACK],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 9), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.listen */
+  { &proc_net_tcp6.stat[_PM_TCP_LISTEN],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 10), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.tcp6conn.closing */
+  { &proc_net_tcp6.stat[_PM_TCP_CLOSING],
+    { PMDA_PMID(CLUSTER_NET_TCP6, 11), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.udpconn.established */
+  { &proc_net_udp.stat[_PM_TCP_ESTABLISHED],
+    { PMDA_PMID(CLUSTER_NET_UDP, 1), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.udpconn.listen */
+  { &proc_net_udp.stat[_PM_TCP_CLOSE],
+    { PMDA_PMID(CLUSTER_NET_UDP, 2), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.udp6conn.established */
+  { &proc_net_udp6.stat[_PM_TCP_ESTABLISHED],
+    { PMDA_PMID(CLUSTER_NET_UDP6, 1), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* network.udp6conn.listen */
+  { &proc_net_udp6.stat[_PM_TCP_CLOSE],
+    { PMDA_PMID(CLUSTER_NET_UDP6, 2), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+    PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
 /* network.tcp.activeopens */
   { &_pm_proc_net_snmp.tcp[_PM_SNMP_TCP_ACTIVEOPENS], 
     { PMDA_PMID(CLUSTER_NET_SNMP,54), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER,
@@ -5288,6 +5418,26 @@ static pmdaMetric metrictab[] = {
     /* hinv.ntape */
     { NULL, { PMDA_PMID(CLUSTER_TAPEDEV, TAPESTATS_HINV_NTAPE), PM_TYPE_U32, PM_INDOM_NULL,
 	PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) }, },
+
+/*
+ * PMDA refresh cluster
+ */
+
+    /* pmda.refresh.interval */
+    { NULL, { PMDA_PMID(CLUSTER_REFRESH, 0), PM_TYPE_U32, REFRESH_INDOM,
+	PM_SEM_DISCRETE, PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) }, },
+
+    /* pmda.refresh.count */
+    { NULL, { PMDA_PMID(CLUSTER_REFRESH, 1), PM_TYPE_U64, REFRESH_INDOM,
+	PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) }, },
+
+    /* pmda.refresh.hits */
+    { NULL, { PMDA_PMID(CLUSTER_REFRESH, 2), PM_TYPE_U64, REFRESH_INDOM,
+	PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) }, },
+
+    /* pmda.refresh.time */
+    { NULL, { PMDA_PMID(CLUSTER_REFRESH, 3), PM_TYPE_U64, REFRESH_INDOM,
+	PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) }, },
 };
 
 typedef struct {
@@ -5331,6 +5481,157 @@ linux_ctx_container(int ctx)
     return NULL;
 }
 
+/*
+ * Refresh scheduling.  Each refresh cluster has a minimum interval
+ * (pmda.refresh.interval, milliseconds) within which fetches are
+ * answered from the previous refresh of that cluster, so that many
+ * clients sampling overlapping metrics do not each cause a re-read.
+ * Fine-grained refresh indices and clusters refreshed together share
+ * the interval and statistics of an owning cluster, but keep their
+ * own last refresh times - they may not have been refreshed at all.
+ */
+typedef struct {
+    int			owner;		/* cluster with interval and stats */
+    unsigned int	interval;	/* milliseconds, zero for always */
+    double		last;		/* time of last refresh, seconds */
+    __uint64_t		count;		/* refreshes performed */
+    __uint64_t		hits;		/* refreshes avoided by interval */
+    double		time;		/* microseconds spent refreshing */
+} linux_refresh_t;
+
+static linux_refresh_t refreshtab[NUM_REFRESHES];
+
+static struct {
+    int			index;
+    int			owner;
+} refresh_owners[] = {
+    { CLUSTER_INTERRUPT_LINES, CLUSTER_INTERRUPTS },
+    { CLUSTER_INTERRUPT_OTHER, CLUSTER_INTERRUPTS },
+    { CLUSTER_TMPFS, CLUSTER_FILESYS },
+    { CLUSTER_ZONEINFO_PROTECTION, CLUSTER_ZONEINFO },
+    { REFRESH_NET_MTU, CLUSTER_NET_DEV },
+    { REFRESH_NET_SPEED, CLUSTER_NET_DEV },
+    { REFRESH_NET_DUPLEX, CLUSTER_NET_DEV },
+    { REFRESH_NET_LINKUP, CLUSTER_NET_DEV },
+    { REFRESH_NET_RUNNING, CLUSTER_NET_DEV },
+    { REFRESH_NETADDR_INET, CLUSTER_NET_ADDR },
+    { REFRESH_NETADDR_IPV6, CLUSTER_NET_ADDR },
+    { REFRESH_NETADDR_HW, CLUSTER_NET_ADDR },
+};
+
+static int		refresh_current = -1;
+static struct timeval	refresh_start;
+
+static void
+refresh_setup(unsigned int interval)
+{
+    int			i;
+
+    for (i = 0; i < NUM_REFRESHES; i++)
+	refreshtab[i].owner = -1;
+    for (i = 0; i < sizeof(refresh_indom_id)/sizeof(pmdaInstid); i++) {
+	refreshtab[refresh_indom_id[i].i_inst].owner = refresh_indom_id[i].i_inst;
+	refreshtab[refresh_indom_id[i].i_inst].interval = interval;
+    }
+    for (i = 0; i < sizeof(refresh_owners)/sizeof(refresh_owners[0]); i++)
+	refreshtab[refresh_owners[i].index].owner = refresh_owners[i].owner;
+}
+
+static int
+refresh_instance(unsigned int inst)
+{
+    return inst < NUM_CLUSTERS && refreshtab[inst].owner == inst;
+}
+
+/*
+ * Decide which of the requested refreshes are due, clearing need_refresh
+ * entries for data refreshed within the interval of its owning cluster.
+ * Container contexts always refresh (values depend on the namespaces)
+ * and invalidate the previous refresh, as does the per-client slabinfo
+ * permission check.
+ */
+static void
+refresh_schedule(int *need_refresh, int container)
+{
+    struct timeval	now;
+    double		stamp;
+    char		requested[NUM_CLUSTERS] = {0};
+    char		refreshed[NUM_CLUSTERS] = {0};
+    int			i, owner;
+
+    __pmtimevalNow(&now);
+    stamp = __pmtimevalToReal(&now);
+
+    for (i = 0; i < NUM_REFRESHES; i++) {
+	if (!need_refresh[i] || (owner = refreshtab[i].owner) < 0)
+	    continue;
+	requested[owner] = 1;
+	if (container || i == CLUSTER_SLAB) {
+	    refreshtab[i].last = 0;
+	    refreshed[owner] = 1;
+	}
+	else if (refreshtab[owner].interval && refreshtab[i].last &&
+		 (stamp - refreshtab[i].last) * 1000 < refreshtab[owner].interval) {
+	    need_refresh[i] = 0;
+	}
+	else {
+	    refreshtab[i].last = stamp;
+	    refreshed[owner] = 1;
+	}
+    }
+
+    for (i = 0; i < NUM_CLUSTERS; i++) {
+	if (refreshed[i])
+	    refreshtab[i].count++;
+	else if (requested[i])
+	    refreshtab[i].hits++;
+    }
+    if (pmDebug & DBG_TRACE_LIBPMDA) {
+	for (i = 0; i < NUM_CLUSTERS; i++)
+	    if (requested[i])
+		fprintf(stderr, "refresh_schedule: cluster %d %s\n",
+			i, refreshed[i] ? "refresh" : "hit");
+    }
+}
+
+/*
+ * Charge time since the previous call to the owner of the refresh
+ * in progress, then start timing the given refresh index (or none).
+ */
+static void
+refresh_clock(int index)
+{
+    struct timeval	now;
+    int			owner;
+
+    __pmtimevalNow(&now);
+    if (refresh_current >= 0 && (owner = refreshtab[refresh_current].owner) >= 0)
+	refreshtab[owner].time += __pmtimevalSub(&now, &refresh_start) * 1000000;
+    refresh_current = index;
+    refresh_start = now;
+}
+
+static int
+refresh_store(pmValueSet *vsp, linux_access_t *access)
+{
+    pmAtomValue		av;
+    int			i, sts;
+
+    if (access == NULL || !access->uid_flag || access->uid != 0)
+	return PM_ERR_PERMISSION;
+    for (i = 0; i < vsp->numval; i++) {
+	if (!refresh_instance(vsp->vlist[i].inst))
+	    return PM_ERR_INST;
+    }
+    for (i = 0; i < vsp->numval; i++) {
+	if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[i],
+			PM_TYPE_U32, &av, PM_TYPE_U32)) < 0)
+	    return sts;
+	refreshtab[vsp->vlist[i].inst].interval = av.ul;
+    }
+    return 0;
+}
+
 static int
 linux_refresh(pmdaExt *pmda, int *need_refresh, int context)
 {
@@ -5344,46 +5645,89 @@ linux_refresh(pmdaExt *pmda, int *need_refresh, int context)
     if (cp && (sts = container_lookup(rootfd, cp)) < 0)
 	return sts;
 
-    if (need_refresh[CLUSTER_PARTITIONS])
-    	refresh_proc_partitions(INDOM(DISK_INDOM),
+    refresh_schedule(need_refresh, cp != NULL);
+
+    if (need_refresh[CLUSTER_PARTITIONS]) {
+	refresh_clock(CLUSTER_PARTITIONS);
+	refresh_proc_partitions(INDOM(DISK_INDOM),
 				INDOM(PARTITIONS_INDOM),
 				INDOM(DM_INDOM), INDOM(MD_INDOM));
+    }
 
-    if (need_refresh[CLUSTER_STAT])
+    if (need_refresh[CLUSTER_STAT]) {
+	refresh_clock(CLUSTER_STAT);
 	refresh_proc_stat(&proc_stat);
+    }
 
-    if (need_refresh[CLUSTER_CPUINFO])
+    if (need_refresh[CLUSTER_CPUINFO]) {
+	refresh_clock(CLUSTER_CPUINFO);
 	refresh_proc_cpuinfo();
+    }
 
-    if (need_refresh[CLUSTER_MEMINFO])
+    if (need_refresh[CLUSTER_MEMINFO]) {
+	refresh_clock(CLUSTER_MEMINFO);
 	refresh_proc_meminfo(&proc_meminfo);
+    }
 
-    if (need_refresh[CLUSTER_NUMA_MEMINFO])
+    if (need_refresh[CLUSTER_NUMA_MEMINFO]) {
+	refresh_clock(CLUSTER_NUMA_MEMINFO);
 	refresh_numa_meminfo();
+    }
 
-    if (need_refresh[CLUSTER_LOADAVG])
+    if (need_refresh[CLUSTER_LOADAVG]) {
+	refresh_clock(CLUSTER_LOADAVG);
 	refresh_proc_loadavg(&proc_loadavg);
+    }
 
-    if (need_refresh[CLUSTER_NET_NFS])
+    if (need_refresh[CLUSTER_NET_NFS]) {
+	refresh_clock(CLUSTER_NET_NFS);
 	refresh_proc_net_rpc(&proc_net_rpc);
+    }
 
-    if (need_refresh[CLUSTER_NET_SOCKSTAT])
+    if (need_refresh[CLUSTER_NET_SOCKSTAT]) {
+	refresh_clock(CLUSTER_NET_SOCKSTAT);
 	refresh_proc_net_sockstat(&proc_net_sockstat);
+    }
 
-    if (need_refresh[CLUSTER_NET_SOCKSTAT6])
+    if (need_refresh[CLUSTER_NET_SOCKSTAT6]) {
+	refresh_clock(CLUSTER_NET_SOCKSTAT6);
 	refresh_proc_net_sockstat6(&proc_net_sockstat6);
+    }
 
-    if (need_refresh[CLUSTER_NET_SNMP])
+    if (need_refresh[CLUSTER_NET_SNMP]) {
+	refresh_clock(CLUSTER_NET_SNMP);
 	refresh_proc_net_snmp(&_pm_proc_net_snmp);
+    }
 
-    if (need_refresh[CLUSTER_NET_SNMP6])
+    if (need_refresh[CLUSTER_NET_SNMP6]) {
+	refresh_clock(CLUSTER_NET_SNMP6);
 	refresh_proc_net_snmp6(_pm_proc_net_snmp6);
+    }
 
-    if (need_refresh[CLUSTER_NET_TCP])
-	refresh_proc_net_tcp(&proc_net_tcp);
+    if (need_refresh[CLUSTER_NET_TCP]) {
+	refresh_clock(CLUSTER_NET_TCP);
+	refresh_proc_net_tcp(&proc_net_tcp, _PM_SOCK_TCP);
+    }
+
+    if (need_refresh[CLUSTER_NET_TCP6]) {
+	refresh_clock(CLUSTER_NET_TCP6);
+	refresh_proc_net_tcp(&proc_net_tcp6, _PM_SOCK_TCP6);
+    }
+
+    if (need_refresh[CLUSTER_NET_UDP]) {
+	refresh_clock(CLUSTER_NET_UDP);
+	refresh_proc_net_tcp(&proc_net_udp, _PM_SOCK_UDP);
+    }
 
-    if (need_refresh[CLUSTER_NET_NETSTAT])
+    if (need_refresh[CLUSTER_NET_UDP6]) {
+	refresh_clock(CLUSTER_NET_UDP6);
+	refresh_proc_net_tcp(&proc_net_udp6, _PM_SOCK_UDP6);
+    }
+
+    if (need_refresh[CLUSTER_NET_NETSTAT]) {
+	refresh_clock(CLUSTER_NET_NETSTAT);
 	refresh_proc_net_netstat(&_pm_proc_net_netstat);
+    }
 
     /*
      * Network interface metrics and namespaces are complicated by a
@@ -5409,8 +5753,25 @@ linux_refresh(pmdaExt *pmda, int *need_refresh, int context)
 	pmInDom netaddr = INDOM(NET_ADDR_INDOM);
 	pmInDom netdev = INDOM(NET_DEV_INDOM);
 
-	if (need_refresh[CLUSTER_NET_ADDR])
+	/* rtnetlink dumps provide all but link speed and duplex */
+	if (!cp && (need_refresh[CLUSTER_NET_DEV] || need_refresh[CLUSTER_NET_ADDR])) {
+	    refresh_clock(CLUSTER_NET_DEV);
+	    if (refresh_net_netlink(netdev, netaddr, need_refresh) == 0) {
+		need_refresh[CLUSTER_NET_DEV] = 0;
+		need_refresh[CLUSTER_NET_ADDR] = 0;
+		need_refresh[REFRESH_NET_MTU] = 0;
+		need_refresh[REFRESH_NET_LINKUP] = 0;
+		need_refresh[REFRESH_NET_RUNNING] = 0;
+		need_refresh[REFRESH_NETADDR_INET] = 0;
+		need_refresh[REFRESH_NETADDR_IPV6] = 0;
+		need_refresh[REFRESH_NETADDR_HW] = 0;
+	    }
+	}
+
+	if (need_refresh[CLUSTER_NET_ADDR]) {
+	    refresh_clock(CLUSTER_NET_ADDR);
 	    clear_net_addr_indom(netaddr);
+	}
 	if (need_refresh[REFRESH_NETADDR_INET])
 	    need_net_ioctl = 1;
 	if (need_refresh[REFRESH_NETADDR_IPV6])
@@ -5419,120 +5780,178 @@ linux_refresh(pmdaExt *pmda, int *need_refresh, int context)
 	if (need_refresh[CLUSTER_NET_DEV]) {
 	    if ((sts = container_nsenter(cp, LINUX_NAMESPACE_NET, &ns_fds)) < 0)
 		goto done;
+	    refresh_clock(CLUSTER_NET_DEV);
 	    refresh_proc_net_dev(netdev, cp);
 	    container_nsleave(cp, LINUX_NAMESPACE_NET);
 	}
 
 	if ((sts = container_nsenter(cp, LINUX_NAMESPACE_MNT, &ns_fds)) < 0)
 	    goto done;
+	refresh_clock(CLUSTER_NET_ADDR);
 	refresh_net_addr_sysfs(netaddr, need_refresh);
+	refresh_clock(CLUSTER_NET_DEV);
 	need_net_ioctl |= refresh_net_sysfs(netdev, need_refresh);
-	if (need_refresh[CLUSTER_FILESYS] || need_refresh[CLUSTER_TMPFS])
+	if (need_refresh[CLUSTER_FILESYS] || need_refresh[CLUSTER_TMPFS]) {
+	    refresh_clock(CLUSTER_FILESYS);
 	    refresh_filesys(INDOM(FILESYS_INDOM), INDOM(TMPFS_INDOM), cp);
+	}
 	container_nsleave(cp, LINUX_NAMESPACE_MNT);
 
 	if (need_net_ioctl) {
 	    if ((sts = container_nsenter(cp, LINUX_NAMESPACE_NET, &ns_fds)) < 0)
 		goto done;
+	    refresh_clock(CLUSTER_NET_ADDR);
 	    refresh_net_addr_ioctl(netaddr, cp, need_refresh);
+	    refresh_clock(CLUSTER_NET_DEV);
 	    refresh_net_ioctl(netdev, cp, need_refresh);
 	    container_nsleave(cp, LINUX_NAMESPACE_NET);
 	}
 
-	if (need_refresh[CLUSTER_NET_ADDR])
+	if (need_refresh[CLUSTER_NET_ADDR]) {
+	    refresh_clock(CLUSTER_NET_ADDR);
 	    store_net_addr_indom(netaddr, cp);
+	}
     }
 
     if (need_refresh[CLUSTER_KERNEL_UNAME]) {
 	if ((sts = container_nsenter(cp, LINUX_NAMESPACE_UTS, &ns_fds)) < 0)
 	    goto done;
+	refresh_clock(CLUSTER_KERNEL_UNAME);
 	uname(&kernel_uname);
 	container_nsleave(cp, LINUX_NAMESPACE_UTS);
     }
 
     if (need_refresh[CLUSTER_INTERRUPTS] ||
 	need_refresh[CLUSTER_INTERRUPT_LINES] ||
-	need_refresh[CLUSTER_INTERRUPT_OTHER])
+	need_refresh[CLUSTER_INTERRUPT_OTHER]) {
+	refresh_clock(CLUSTER_INTERRUPTS);
 	need_refresh_mtab |= refresh_interrupt_values();
+    }
 
-    if (need_refresh[CLUSTER_SOFTIRQS])
+    if (need_refresh[CLUSTER_SOFTIRQS]) {
+	refresh_clock(CLUSTER_SOFTIRQS);
 	need_refresh_mtab |= refresh_softirqs_values();
+    }
 
-    if (need_refresh[CLUSTER_SWAPDEV])
+    if (need_refresh[CLUSTER_SWAPDEV]) {
+	refresh_clock(CLUSTER_SWAPDEV);
 	refresh_swapdev(INDOM(SWAPDEV_INDOM));
+    }
 
-    if (need_refresh[CLUSTER_SCSI])
+    if (need_refresh[CLUSTER_SCSI]) {
+	refresh_clock(CLUSTER_SCSI);
 	refresh_proc_scsi(INDOM(SCSI_INDOM));
+    }
 
     if (need_refresh[CLUSTER_SLAB]) {
 	if (access != NULL && (access->uid == 0 && access->uid_flag)) {
 	    proc_slabinfo.permission = 1;
+	    refresh_clock(CLUSTER_SLAB);
 	    refresh_proc_slabinfo(INDOM(SLAB_INDOM), &proc_slabinfo);
 	} else {
 	    proc_slabinfo.permission = 0;
 	}
     }
 
-    if (need_refresh[CLUSTER_SEM_LIMITS])
+    if (need_refresh[CLUSTER_SEM_LIMITS]) {
+	refresh_clock(CLUSTER_SEM_LIMITS);
 	refresh_sem_limits(&sem_limits);
+    }
 
-    if (need_refresh[CLUSTER_MSG_LIMITS])
-        refresh_msg_limits(&msg_limits);
+    if (need_refresh[CLUSTER_MSG_LIMITS]) {
+	refresh_clock(CLUSTER_MSG_LIMITS);
+	refresh_msg_limits(&msg_limits);
+    }
 
-    if (need_refresh[CLUSTER_SHM_INFO])
-        refresh_shm_info(&_shm_info);
+    if (need_refresh[CLUSTER_SHM_INFO]) {
+	refresh_clock(CLUSTER_SHM_INFO);
+	refresh_shm_info(&_shm_info);
+    }
 
-    if (need_refresh[CLUSTER_SEM_INFO])
-        refresh_sem_info(&_sem_info);
+    if (need_refresh[CLUSTER_SEM_INFO]) {
+	refresh_clock(CLUSTER_SEM_INFO);
+	refresh_sem_info(&_sem_info);
+    }
 
-    if (need_refresh[CLUSTER_MSG_INFO])
-        refresh_msg_info(&_msg_info);
+    if (need_refresh[CLUSTER_MSG_INFO]) {
+	refresh_clock(CLUSTER_MSG_INFO);
+	refresh_msg_info(&_msg_info);
+    }
 
-    if (need_refresh[CLUSTER_SHM_LIMITS])
-        refresh_shm_limits(&shm_limits);
+    if (need_refresh[CLUSTER_SHM_LIMITS]) {
+	refresh_clock(CLUSTER_SHM_LIMITS);
+	refresh_shm_limits(&shm_limits);
+    }
 
-    if (need_refresh[CLUSTER_UPTIME])
-        refresh_proc_uptime(&proc_uptime);
+    if (need_refresh[CLUSTER_UPTIME]) {
+	refresh_clock(CLUSTER_UPTIME);
+	refresh_proc_uptime(&proc_uptime);
+    }
 
-    if (need_refresh[CLUSTER_VFS])
-    	refresh_proc_sys_fs(&proc_sys_fs);
+    if (need_refresh[CLUSTER_VFS]) {
+	refresh_clock(CLUSTER_VFS);
+	refresh_proc_sys_fs(&proc_sys_fs);
+    }
 
-    if (need_refresh[CLUSTER_RANDOM])
-    	refresh_proc_sys_kernel(&proc_sys_kernel);
+    if (need_refresh[CLUSTER_RANDOM]) {
+	refresh_clock(CLUSTER_RANDOM);
+	refresh_proc_sys_kernel(&proc_sys_kernel);
+    }
 
-    if (need_refresh[CLUSTER_VMSTAT])
-    	refresh_proc_vmstat(&_pm_proc_vmstat);
+    if (need_refresh[CLUSTER_VMSTAT]) {
+	refresh_clock(CLUSTER_VMSTAT);
+	refresh_proc_vmstat(&_pm_proc_vmstat);
+    }
 
-    if (need_refresh[CLUSTER_SYSFS_KERNEL])
-    	refresh_sysfs_kernel(&sysfs_kernel);
+    if (need_refresh[CLUSTER_SYSFS_KERNEL]) {
+	refresh_clock(CLUSTER_SYSFS_KERNEL);
+	refresh_sysfs_kernel(&sysfs_kernel);
+    }
 
-    if (need_refresh[CLUSTER_NET_SOFTNET])
+    if (need_refresh[CLUSTER_NET_SOFTNET]) {
+	refresh_clock(CLUSTER_NET_SOFTNET);
 	refresh_proc_net_softnet(&proc_net_softnet);
+    }
 
-    if (need_refresh[CLUSTER_SHM_STAT])
+    if (need_refresh[CLUSTER_SHM_STAT]) {
+	refresh_clock(CLUSTER_SHM_STAT);
 	refresh_shm_stat(INDOM(IPC_STAT_INDOM));
+    }
 
-    if (need_refresh[CLUSTER_MSG_STAT])
+    if (need_refresh[CLUSTER_MSG_STAT]) {
+	refresh_clock(CLUSTER_MSG_STAT);
 	refresh_msg_que(INDOM(IPC_MSG_INDOM));
+    }
 
-    if (need_refresh[CLUSTER_SEM_STAT])
+    if (need_refresh[CLUSTER_SEM_STAT]) {
+	refresh_clock(CLUSTER_SEM_STAT);
 	refresh_sem_array(INDOM(IPC_SEM_INDOM));
+    }
 
-    if (need_refresh[CLUSTER_BUDDYINFO])
+    if (need_refresh[CLUSTER_BUDDYINFO]) {
+	refresh_clock(CLUSTER_BUDDYINFO);
 	refresh_proc_buddyinfo(&proc_buddyinfo);
+    }
 
     if (need_refresh[CLUSTER_ZONEINFO] ||
-        need_refresh[CLUSTER_ZONEINFO_PROTECTION])
+        need_refresh[CLUSTER_ZONEINFO_PROTECTION]) {
+	refresh_clock(CLUSTER_ZONEINFO);
 	refresh_proc_zoneinfo(INDOM(ZONEINFO_INDOM),
 			      INDOM(ZONEINFO_PROTECTION_INDOM));
+    }
 
-    if (need_refresh[CLUSTER_KSM_INFO])
+    if (need_refresh[CLUSTER_KSM_INFO]) {
+	refresh_clock(CLUSTER_KSM_INFO);
 	refresh_ksm_info(&ksm_info);
+    }
 
-    if (need_refresh[CLUSTER_TAPEDEV])
+    if (need_refresh[CLUSTER_TAPEDEV]) {
+	refresh_clock(CLUSTER_TAPEDEV);
 	refresh_sysfs_tapestats(INDOM(TAPEDEV_INDOM));
+    }
 
 done:
+    refresh_clock(-1);
     if (need_refresh_mtab)
 	pmdaDynamicMetricTable(pmda);
     container_close(cp, ns_fds);
@@ -6500,12 +6919,9 @@ linux_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    if (sts != PMDA_CACHE_ACTIVE)
 	    	return PM_ERR_INST;
 
+	    if ((sts = fetch_filesys(fs)) < 0)
+		return sts;
 	    sbuf = &fs->stats;
-	    if (!(fs->flags & FSF_FETCHED)) {
-		if (statfs(fs->path, sbuf) < 0)
-		    return PM_ERR_INST;
-		fs->flags |= FSF_FETCHED;
-	    }
 
 	    switch (idp->item) {
 	    case 1: /* filesys.capacity */
@@ -6563,12 +6979,9 @@ linux_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    if (sts != PMDA_CACHE_ACTIVE)
 	    	return PM_ERR_INST;
 
+	    if ((sts = fetch_filesys(fs)) < 0)
+		return sts;
 	    sbuf = &fs->stats;
-	    if (!(fs->flags & FSF_FETCHED)) {
-		if (statfs(fs->path, sbuf) < 0)
-		    return PM_ERR_INST;
-		fs->flags |= FSF_FETCHED;
-	    }
 
 	    switch (idp->item) {
 	    case 1: /* tmpfs.capacity */
@@ -7491,6 +7904,27 @@ linux_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	}
 	break;
 
+    case CLUSTER_REFRESH:
+	if (!refresh_instance(inst))
+	    return PM_ERR_INST;
+	switch (idp->item) {
+	case 0: /* pmda.refresh.interval */
+	    atom->ul = refreshtab[inst].interval;
+	    break;
+	case 1: /* pmda.refresh.count */
+	    atom->ull = refreshtab[inst].count;
+	    break;
+	case 2: /* pmda.refresh.hits */
+	    atom->ull = refreshtab[inst].hits;
+	    break;
+	case 3: /* pmda.refresh.time */
+	    atom->ull = (__uint64_t)refreshtab[inst].time;
+	    break;
+	default:
+	    return PM_ERR_PMID;
+	}
+	break;
+
     default: /* unknown cluster */
 	return PM_ERR_PMID;
     }
@@ -7588,9 +8022,34 @@ linux_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 
     if ((sts = linux_refresh(pmda, need_refresh, pmda->e_context)) < 0)
 	return sts;
+
+    /* hand statfs calls to the workers, the callbacks wait for results */
+    if (need_refresh[CLUSTER_FILESYS])
+	prefetch_filesys(INDOM(FILESYS_INDOM), pmda->e_prof);
+    if (need_refresh[CLUSTER_TMPFS])
+	prefetch_filesys(INDOM(TMPFS_INDOM), pmda->e_prof);
+
     return pmdaFetch(numpmid, pmidlist, resp, pmda);
 }
 
+static int
+linux_store(pmResult *result, pmdaExt *pmda)
+{
+    linux_access_t	*access = access_ctx(pmda->e_context);
+    int			i, sts = 0;
+
+    for (i = 0; i < result->numpmid && sts == 0; i++) {
+	pmValueSet	*vsp = result->vset[i];
+	__pmID_int	*idp = (__pmID_int *)&(vsp->pmid);
+
+	if (idp->cluster == CLUSTER_REFRESH && idp->item == 0)
+	    sts = refresh_store(vsp, access);	/* pmda.refresh.interval */
+	else
+	    sts = PM_ERR_PERMISSION;
+    }
+    return sts;
+}
+
 static int
 linux_text(int ident, int type, char **buf, pmdaExt *pmda)
 {
@@ -7752,6 +8211,22 @@ linux_init(pmdaInterface *dp)
     if (getenv("PCP_QA_ESTIMATE_MEMAVAILABLE") != NULL)
 	linux_test_mode |= (LINUX_TEST_MODE|LINUX_TEST_MEMINFO);
 
+    /* default minimum refresh interval (msec), see pmda.refresh.interval */
+    if ((envpath = getenv("LINUX_REFRESH_INTERVAL")) != NULL)
+	refresh_setup(atoi(envpath));
+    else
+	refresh_setup(0);
+
+    /* statfs worker threads and per-request timeout (msec) */
+    if ((envpath = getenv("LINUX_STATFS_WORKERS")) != NULL)
+	setup_filesys(atoi(envpath), -1, -1);
+    if ((envpath = getenv("LINUX_STATFS_TIMEOUT")) != NULL)
+	setup_filesys(-1, atoi(envpath), -1);
+    if ((envpath = getenv("LINUX_STATFS_DELAY")) != NULL) {
+	linux_test_mode |= LINUX_TEST_MODE;
+	setup_filesys(-1, -1, atoi(envpath));
+    }
+
     if (_isDSO) {
 	char helppath[MAXPATHLEN];
 	int sep = __pmPathSeparator();
@@ -7769,6 +8244,7 @@ linux_init(pmdaInterface *dp)
 
     dp->version.six.instance = linux_instance;
     dp->version.six.fetch = linux_fetch;
+    dp->version.six.store = linux_store;
     dp->version.six.text = linux_text;
     dp->version.six.pmid = linux_pmid;
     dp->version.six.name = linux_name;
@@ -18,6 +18,7 @@
 #include <sys/stat.h>
 #include "linux.h"
 #include "proc_meminfo.h"
+#include "statsfile.h"
 
 static proc_meminfo_t moff;
 
@@ -88,10 +89,13 @@ static struct {
 int
 refresh_proc_meminfo(proc_meminfo_t *proc_meminfo)
 {
+    static statsfile_t meminfo = STATSFILE_INIT("/proc/meminfo");
+    const char	*name, *colon, *eol, *end;
     char	buf[1024];
     char	*bufp;
     int64_t	*p;
-    int		i;
+    __uint64_t	value;
+    int		i, line, sts;
     FILE	*fp;
 
     for (i = 0; meminfo_fields[i].field != NULL; i++) {
@@ -99,29 +103,28 @@ refresh_proc_meminfo(proc_meminfo_t *proc_meminfo)
 	*p = -1; /* marked as "no value available" */
     }
 
-    if ((fp = linux_statsfile("/proc/meminfo", buf, sizeof(buf))) == NULL)
-	return -oserror();
+    if ((sts = statsfile_read(&meminfo)) < 0)
+	return sts;
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-	if ((bufp = strchr(buf, ':')) == NULL)
+    end = meminfo.buf + meminfo.length;
+    for (name = meminfo.buf, line = 0; name < end; name = eol + 1, line++) {
+	eol = statsfile_eol(name, end);
+	if ((colon = memchr(name, ':', eol - name)) == NULL)
 	    continue;
-	*bufp = '\0';
-	for (i=0; meminfo_fields[i].field != NULL; i++) {
-	    if (strcmp(buf, meminfo_fields[i].field) != 0)
-		continue;
-	    p = MOFFSET(i, proc_meminfo);
-	    for (bufp++; *bufp; bufp++) {
-	    	if (isdigit((int)*bufp)) {
-		    sscanf(bufp, "%llu", (unsigned long long *)p);
-		    *p *= 1024; /* kbytes -> bytes */
-		    break;
-		}
+	i = statsfile_lookup(&meminfo, line, name, colon - name,
+			meminfo_fields, sizeof(meminfo_fields[0]));
+	if (i < 0)
+	    continue;
+	p = MOFFSET(i, proc_meminfo);
+	for (colon++; colon < eol; colon++) {
+	    if ((unsigned int)(*colon - '0') < 10) {
+		statsfile_ull(colon, &value);
+		*p = value * 1024; /* kbytes -> bytes */
+		break;
 	    }
 	}
     }
 
-    fclose(fp);
-
     /*
      * MemAvailable is only in 3.x or later kernels but we can calculate it
      * using other values, similar to upstream kernel commit 34e431b0ae.
@@ -1,7 +1,7 @@
 /*
  * Linux /proc/net/dev metrics cluster
  *
- * Copyright (c) 2013-2016 Red Hat.
+ * Copyright (c) 2013-2017 Red Hat.
  * Copyright (c) 1995,2004 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -19,8 +19,12 @@
 #include <net/if.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
 #include "namespaces.h"
 #include "proc_net_dev.h"
+#include "statsfile.h"
 
 static int
 refresh_inet_socket(linux_container_t *container)
@@ -224,28 +228,44 @@ refresh_net_hw_addr(char *name, net_addr_t *netip)
     }
 }
 
-int
-refresh_proc_net_dev(pmInDom indom, linux_container_t *container)
+static void
+net_dev_cache_load(pmInDom indom)
 {
-    static uint32_t	gen;	/* refresh generation number */
-    static uint32_t	cache_err;	/* throttle messages */
-    char		buf[1024];
-    FILE		*fp;
-    char		*p, *v;
-    int			j, sts;
-    net_interface_t	*netip;
-
-    if ((fp = linux_statsfile("/proc/net/dev", buf, sizeof(buf))) == NULL)
-    	return -oserror();
+    static int		loaded;
 
-    if (gen == 0) {
+    if (!loaded) {
 	/*
 	 * first time, reload cache from external file, and force any
 	 * subsequent changes to be saved
 	 */
 	pmdaCacheOp(indom, PMDA_CACHE_LOAD);
-	gen++;
+	loaded = 1;
     }
+}
+
+int
+refresh_proc_net_dev(pmInDom indom, linux_container_t *container)
+{
+    static uint32_t	cache_err;	/* throttle messages */
+    static statsfile_t	host = STATSFILE_INIT("/proc/net/dev");
+    static statsfile_t	other = STATSFILE_INIT("/proc/net/dev");
+    statsfile_t		*sp;
+    const char		*v, *eol, *end;
+    char		*p, *name;
+    int			j, sts;
+    net_interface_t	*netip;
+
+    /*
+     * Descriptors are bound to the network namespace they were opened
+     * in, so a container's file is opened afresh for each refresh.
+     */
+    sp = container ? &other : &host;
+    if ((sts = statsfile_read(sp)) < 0)
+    	return sts;
+    if (container)
+	statsfile_close(sp);
+
+    net_dev_cache_load(indom);
 
     /*
 Inter-|   Receive                                                |  Transmit
@@ -256,11 +276,14 @@ Inter-|   Receive                                                |  Transmit
 
     pmdaCacheOp(indom, PMDA_CACHE_INACTIVE);
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-	if ((p = v = strchr(buf, ':')) == NULL)
+    end = sp->buf + sp->length;
+    for (name = sp->buf; name < end; name = (char *)eol + 1) {
+	eol = statsfile_eol(name, end);
+	if ((p = memchr(name, ':', eol - name)) == NULL)
 	    continue;
 	*p = '\0';
-	for (p=buf; *p && isspace((int)*p); p++) {;}
+	v = p + 1;
+	for (p = name; *p == ' ' || *p == '\t'; p++) {;}
 
 	sts = pmdaCacheLookupName(indom, p, NULL, (void **)&netip);
 	if (sts == PM_ERR_INST || (sts >= 0 && netip == NULL)) {
@@ -288,16 +311,14 @@ Inter-|   Receive                                                |  Transmit
 	}
 
 	memset(&netip->ioc, 0, sizeof(netip->ioc));
-	for (p=v, j=0; j < PROC_DEV_COUNTERS_PER_LINE; j++) {
-	    for (; !isdigit((int)*p); p++) {;}
-	    sscanf(p, "%llu", (long long unsigned int *)&netip->counters[j]);
-	    for (; !isspace((int)*p); p++) {;}
+	for (j = 0; j < PROC_DEV_COUNTERS_PER_LINE; j++) {
+	    for (; v < eol && (unsigned int)(*v - '0') >= 10; v++) {;}
+	    if (v >= eol)
+		break;
+	    v = statsfile_ull(v, (__uint64_t *)&netip->counters[j]);
 	}
     }
 
-    /* success */
-    fclose(fp);
-
     if (!container)
 	pmdaCacheOp(indom, PMDA_CACHE_SAVE);
     return 0;
@@ -508,6 +529,436 @@ refresh_net_dev_ipv6_addr(pmInDom indom)
     return 0;
 }
 
+/*
+ * The rtnetlink interface describes every interface, with the same
+ * 64 bit statistics reported in /proc/net/dev, in one RTM_GETLINK dump
+ * and every address in one RTM_GETADDR dump - in place of the ioctls
+ * and sysfs reads made for each interface otherwise, which add up on
+ * hosts with thousands of (e.g. veth) interfaces.  Addresses are kept
+ * between refreshes until a link or address change notification is
+ * seen on a second socket, subscribed to those multicast groups.
+ * Link speed and duplex are not available here and still come from
+ * sysfs or the ethtool ioctl.  If the first dump fails the older
+ * interfaces are used from then on.
+ */
+static int		rtnl_fd = -1;		/* dump requests */
+static int		rtnl_mon = -1;		/* change notifications */
+static unsigned int	rtnl_seq;
+static int		rtnl_state;		/* 1 working, -1 failed */
+static int		rtnl_addr_current;	/* no changes since address dump */
+
+typedef struct {
+    int		index;
+    char	name[IF_NAMESIZE];
+} rtnl_link_t;
+
+static rtnl_link_t	*rtnl_links;		/* ifindex to name, sorted */
+static int		rtnl_nlinks;
+static int		rtnl_maxlinks;
+
+typedef struct {
+    pmInDom	netdev;		/* PM_INDOM_NULL unless refreshing */
+    pmInDom	netaddr;	/* PM_INDOM_NULL unless refreshing */
+} rtnl_refresh_t;
+
+static void *
+rtnl_cache_lookup(pmInDom indom, const char *name, size_t size)
+{
+    static uint32_t	cache_err;
+    void		*data;
+    int			sts;
+
+    sts = pmdaCacheLookupName(indom, name, NULL, &data);
+    if (sts == PM_ERR_INST || (sts >= 0 && data == NULL)) {
+	/* first time since re-loaded, else new one */
+	if ((data = calloc(1, size)) == NULL)
+	    return NULL;
+#if PCP_DEBUG
+	if (pmDebug & DBG_TRACE_LIBPMDA) {
+	    fprintf(stderr, "rtnl_cache_lookup: initialize %s \"%s\"\n",
+		    pmInDomStr(indom), name);
+	}
+#endif
+    }
+    else if (sts < 0) {
+	if (cache_err++ < 10) {
+	    fprintf(stderr, "rtnl_cache_lookup: pmdaCacheLookupName(%s, %s, ...) failed: %s\n",
+		pmInDomStr(indom), name, pmErrStr(sts));
+	}
+	return NULL;
+    }
+    if ((sts = pmdaCacheStore(indom, PMDA_CACHE_ADD, name, data)) < 0) {
+	if (cache_err++ < 10) {
+	    fprintf(stderr, "rtnl_cache_lookup: pmdaCacheStore(%s, PMDA_CACHE_ADD, %s, " PRINTF_P_PFX "%p) failed: %s\n",
+		pmInDomStr(indom), name, data, pmErrStr(sts));
+	}
+	return NULL;
+    }
+    return data;
+}
+
+static int
+rtnl_link_compare(const void *a, const void *b)
+{
+    return ((const rtnl_link_t *)a)->index - ((const rtnl_link_t *)b)->index;
+}
+
+static const char *
+rtnl_link_name(int index)
+{
+    rtnl_link_t		key, *lp;
+
+    key.index = index;
+    lp = bsearch(&key, rtnl_links, rtnl_nlinks, sizeof(key), rtnl_link_compare);
+    return lp ? lp->name : NULL;
+}
+
+static void
+rtnl_link_add(int index, const char *name)
+{
+    rtnl_link_t		*lp;
+
+    if (rtnl_nlinks == rtnl_maxlinks) {
+	int		size = rtnl_maxlinks ? rtnl_maxlinks * 2 : 64;
+
+	if ((lp = realloc(rtnl_links, size * sizeof(*lp))) == NULL)
+	    return;
+	rtnl_links = lp;
+	rtnl_maxlinks = size;
+    }
+    lp = &rtnl_links[rtnl_nlinks++];
+    lp->index = index;
+    strncpy(lp->name, name, sizeof(lp->name));
+    lp->name[sizeof(lp->name)-1] = '\0';
+}
+
+/*
+ * Fill in /proc/net/dev counters, which are derived from the same
+ * kernel statistics (see dev_seq_printf_stats in net/core/net-procfs.c)
+ */
+static void
+rtnl_link_counters(uint64_t *counters, const struct rtnl_link_stats64 *s)
+{
+    counters[0] = s->rx_bytes;
+    counters[1] = s->rx_packets;
+    counters[2] = s->rx_errors;
+    counters[3] = s->rx_dropped + s->rx_missed_errors;
+    counters[4] = s->rx_fifo_errors;
+    counters[5] = s->rx_length_errors + s->rx_over_errors +
+		  s->rx_crc_errors + s->rx_frame_errors;
+    counters[6] = s->rx_compressed;
+    counters[7] = s->multicast;
+    counters[8] = s->tx_bytes;
+    counters[9] = s->tx_packets;
+    counters[10] = s->tx_errors;
+    counters[11] = s->tx_dropped;
+    counters[12] = s->tx_fifo_errors;
+    counters[13] = s->collisions;
+    counters[14] = s->tx_carrier_errors + s->tx_aborted_errors +
+		   s->tx_window_errors + s->tx_heartbeat_errors;
+    counters[15] = s->tx_compressed;
+}
+
+static void
+rtnl_parse_link(struct nlmsghdr *nlh, rtnl_refresh_t *rp)
+{
+    struct ifinfomsg	*ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
+    struct rtnl_link_stats64 stats;
+    struct rtattr	*rta;
+    net_interface_t	*netip;
+    net_addr_t		*addrp;
+    const char		*name = NULL;
+    unsigned char	*hw = NULL;
+    unsigned int	mtu = 0;
+    int			i, len, hwlen = 0, have_stats = 0;
+    char		*p;
+
+    if (nlh->nlmsg_type != RTM_NEWLINK)
+	return;
+    memset(&stats, 0, sizeof(stats));
+    len = IFLA_PAYLOAD(nlh);
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	switch (rta->rta_type) {
+	case IFLA_IFNAME:
+	    name = (const char *)RTA_DATA(rta);
+	    break;
+	case IFLA_MTU:
+	    if (RTA_PAYLOAD(rta) >= sizeof(mtu))
+		memcpy(&mtu, RTA_DATA(rta), sizeof(mtu));
+	    break;
+	case IFLA_ADDRESS:
+	    hw = (unsigned char *)RTA_DATA(rta);
+	    hwlen = RTA_PAYLOAD(rta);
+	    break;
+	case IFLA_STATS64:	/* not necessarily 64 bit aligned */
+	    i = RTA_PAYLOAD(rta);
+	    memcpy(&stats, RTA_DATA(rta), i < sizeof(stats) ? i : sizeof(stats));
+	    have_stats = 1;
+	    break;
+	case IFLA_STATS:	/* kernels before 2.6.35, same field order */
+	    if (!have_stats) {
+		__u32	*s32 = (__u32 *)RTA_DATA(rta);
+		__u64	*s64 = (__u64 *)&stats;
+
+		for (i = 0; i < RTA_PAYLOAD(rta) / sizeof(__u32) &&
+			    i < sizeof(stats) / sizeof(__u64); i++)
+		    s64[i] = s32[i];
+	    }
+	    break;
+	}
+    }
+    if (name == NULL)
+	return;
+    rtnl_link_add(ifi->ifi_index, name);
+
+    if (rp->netdev != PM_INDOM_NULL &&
+	(netip = rtnl_cache_lookup(rp->netdev, name, sizeof(*netip))) != NULL) {
+	memset(&netip->ioc, 0, sizeof(netip->ioc));
+	netip->ioc.mtu = mtu;
+	netip->ioc.linkup = !!(ifi->ifi_flags & IFF_UP);
+	netip->ioc.running = !!(ifi->ifi_flags & IFF_RUNNING);
+	rtnl_link_counters(netip->counters, &stats);
+    }
+
+    /* hardware address, formatted as in /sys/class/net/<name>/address */
+    if (rp->netaddr != PM_INDOM_NULL && hwlen > 0 &&
+	(addrp = rtnl_cache_lookup(rp->netaddr, name, sizeof(*addrp))) != NULL) {
+	for (i = 0, p = addrp->hw_addr; i < hwlen &&
+	     p + 3 < addrp->hw_addr + sizeof(addrp->hw_addr); i++, p += 3)
+	    sprintf(p, "%02x:", hw[i]);
+	p[-1] = '\0';
+	addrp->has_hw = 1;
+    }
+}
+
+static int
+rtnl_scope(int scope)
+{
+    switch (scope) {
+    case RT_SCOPE_HOST:
+	return IPV6_ADDR_LOOPBACK;
+    case RT_SCOPE_LINK:
+	return IPV6_ADDR_LINKLOCAL;
+    case RT_SCOPE_SITE:
+	return IPV6_ADDR_SITELOCAL;
+    }
+    return IPV6_ADDR_ANY;
+}
+
+static void
+rtnl_parse_addr(struct nlmsghdr *nlh, rtnl_refresh_t *rp)
+{
+    struct ifaddrmsg	*ifa = (struct ifaddrmsg *)NLMSG_DATA(nlh);
+    struct rtattr	*rta;
+    net_addr_t		*addrp;
+    const char		*name, *label = NULL;
+    void		*address = NULL, *local = NULL;
+    char		addr[INET6_ADDRSTRLEN];
+    int			len;
+
+    if (nlh->nlmsg_type != RTM_NEWADDR)
+	return;
+    len = IFA_PAYLOAD(nlh);
+    for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	switch (rta->rta_type) {
+	case IFA_ADDRESS:
+	    address = RTA_DATA(rta);
+	    break;
+	case IFA_LOCAL:
+	    local = RTA_DATA(rta);
+	    break;
+	case IFA_LABEL:
+	    label = (const char *)RTA_DATA(rta);
+	    break;
+	}
+    }
+
+    if (ifa->ifa_family == AF_INET) {
+	/* aliases (eth0:0) by label, first (primary) address as SIOCGIFADDR */
+	if ((name = label) == NULL && (name = rtnl_link_name(ifa->ifa_index)) == NULL)
+	    return;
+	if (local == NULL && (local = address) == NULL)
+	    return;
+	if ((addrp = rtnl_cache_lookup(rp->netaddr, name, sizeof(*addrp))) == NULL)
+	    return;
+	if (!addrp->has_inet &&
+	    inet_ntop(AF_INET, local, addrp->inet, INET_ADDRSTRLEN))
+	    addrp->has_inet = 1;
+    }
+    else if (ifa->ifa_family == AF_INET6) {
+	if ((name = rtnl_link_name(ifa->ifa_index)) == NULL || address == NULL)
+	    return;
+	if ((addrp = rtnl_cache_lookup(rp->netaddr, name, sizeof(*addrp))) == NULL)
+	    return;
+	if (!inet_ntop(AF_INET6, address, addr, INET6_ADDRSTRLEN))
+	    return;
+	snprintf(addrp->ipv6, sizeof(addrp->ipv6), "%s/%d", addr, ifa->ifa_prefixlen);
+	addrp->ipv6scope = rtnl_scope(ifa->ifa_scope);
+	addrp->has_ipv6 = 1;
+    }
+}
+
+static int
+rtnl_dump(int type, void (*parse)(struct nlmsghdr *, rtnl_refresh_t *),
+		rtnl_refresh_t *rp)
+{
+    static long		buf[8192];	/* aligned for netlink messages */
+    struct nlmsghdr	*nlh;
+    struct {
+	struct nlmsghdr		n;
+	struct ifinfomsg	i;	/* family first, as in ifaddrmsg */
+    } req;
+    ssize_t		len;
+
+    if (rtnl_fd < 0 &&
+	(rtnl_fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0)
+	return -oserror();
+
+    memset(&req, 0, sizeof(req));
+    req.n.nlmsg_len = NLMSG_LENGTH(type == RTM_GETLINK ?
+		sizeof(struct ifinfomsg) : sizeof(struct ifaddrmsg));
+    req.n.nlmsg_type = type;
+    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.n.nlmsg_seq = ++rtnl_seq;
+    req.i.ifi_family = AF_UNSPEC;
+    if (send(rtnl_fd, &req, req.n.nlmsg_len, 0) < 0)
+	return -oserror();
+
+    for (;;) {
+	if ((len = recv(rtnl_fd, buf, sizeof(buf), 0)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    return -oserror();
+	}
+	if (len == 0)
+	    return -EPROTO;
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+	     nlh = NLMSG_NEXT(nlh, len)) {
+	    if (nlh->nlmsg_seq != rtnl_seq)	/* from an abandoned dump */
+		continue;
+	    if (nlh->nlmsg_type == NLMSG_DONE)
+		return 0;
+	    if (nlh->nlmsg_type == NLMSG_ERROR)
+		return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+	    parse(nlh, rp);
+	}
+    }
+}
+
+/*
+ * Drain pending link and address notifications - any at all (or
+ * notifications lost to a full socket buffer) invalidate addresses.
+ */
+static void
+rtnl_monitor(void)
+{
+    static long		buf[2048];
+    struct sockaddr_nl	addr;
+    ssize_t		len;
+
+    if (rtnl_mon < 0) {
+	if ((rtnl_mon = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0)
+	    return;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	if (bind(rtnl_mon, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	    close(rtnl_mon);
+	    rtnl_mon = -1;
+	}
+	return;
+    }
+    while ((len = recv(rtnl_mon, buf, sizeof(buf), MSG_DONTWAIT)) != 0) {
+	if (len < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    if (oserror() == EAGAIN || oserror() == EWOULDBLOCK)
+		break;
+	    rtnl_addr_current = 0;
+	    if (oserror() == ENOBUFS)
+		continue;
+	    close(rtnl_mon);
+	    rtnl_mon = -1;
+	    break;
+	}
+#if PCP_DEBUG
+	if (rtnl_addr_current && (pmDebug & DBG_TRACE_LIBPMDA))
+	    fprintf(stderr, "rtnl_monitor: change notification, type %d\n",
+		    ((struct nlmsghdr *)buf)->nlmsg_type);
+#endif
+	rtnl_addr_current = 0;
+    }
+}
+
+/*
+ * Refresh interface statistics and state (CLUSTER_NET_DEV) and
+ * addresses (CLUSTER_NET_ADDR) from rtnetlink dumps, other than
+ * link speed and duplex.  Returns zero if the caller need not
+ * use the /proc, sysfs and ioctl interfaces for these values.
+ */
+int
+refresh_net_netlink(pmInDom netdev, pmInDom netaddr, int *need_refresh)
+{
+    rtnl_refresh_t	r = { PM_INDOM_NULL, PM_INDOM_NULL };
+    int			sts;
+
+    /* test mode uses captured /proc and /sys files */
+    if (rtnl_state < 0 || (linux_test_mode & LINUX_TEST_STATSPATH))
+	return PM_ERR_AGAIN;
+
+    if (need_refresh[CLUSTER_NET_ADDR]) {
+	rtnl_monitor();
+	if (!rtnl_addr_current) {
+	    clear_net_addr_indom(netaddr);
+	    r.netaddr = netaddr;
+	}
+    }
+    if (need_refresh[CLUSTER_NET_DEV]) {
+	net_dev_cache_load(netdev);
+	pmdaCacheOp(netdev, PMDA_CACHE_INACTIVE);
+	r.netdev = netdev;
+    }
+    if (r.netdev == PM_INDOM_NULL && r.netaddr == PM_INDOM_NULL)
+	return 0;
+
+    rtnl_nlinks = 0;
+    if ((sts = rtnl_dump(RTM_GETLINK, rtnl_parse_link, &r)) < 0)
+	goto fail;
+    qsort(rtnl_links, rtnl_nlinks, sizeof(rtnl_link_t), rtnl_link_compare);
+    if (r.netaddr != PM_INDOM_NULL &&
+	(sts = rtnl_dump(RTM_GETADDR, rtnl_parse_addr, &r)) < 0)
+	goto fail;
+    rtnl_state = 1;
+
+    if (r.netdev != PM_INDOM_NULL)
+	pmdaCacheOp(netdev, PMDA_CACHE_SAVE);
+    if (r.netaddr != PM_INDOM_NULL) {
+	store_net_addr_indom(netaddr, NULL);
+	rtnl_addr_current = (rtnl_mon >= 0);
+    }
+    return 0;
+
+fail:
+    if (rtnl_fd >= 0) {	/* drop any part-read dump */
+	close(rtnl_fd);
+	rtnl_fd = -1;
+    }
+    if (rtnl_state == 0) {
+	rtnl_state = -1;
+	if (rtnl_mon >= 0) {
+	    close(rtnl_mon);
+	    rtnl_mon = -1;
+	}
+	__pmNotifyErr(LOG_INFO, "rtnetlink unavailable, using /proc/net/dev: %s",
+			pmErrStr(sts));
+    }
+#if PCP_DEBUG
+    else if (pmDebug & DBG_TRACE_LIBPMDA)
+	fprintf(stderr, "refresh_net_netlink: dump failed: %s\n", pmErrStr(sts));
+#endif
+    return sts;
+}
+
 /*
  * This separate indom provides the addresses for all interfaces including
  * aliases (e.g. eth0, eth0:0, eth0:1, etc) - this is what ifconfig does.
@@ -528,6 +979,7 @@ clear_net_addr_indom(pmInDom indom)
 	p->has_hw   = 0;
     }
     pmdaCacheOp(indom, PMDA_CACHE_INACTIVE);
+    rtnl_addr_current = 0;
 }
 
 void
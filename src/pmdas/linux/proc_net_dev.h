@@ -1,7 +1,7 @@
 /*
  * Linux /proc/net/dev metrics cluster
  *
- * Copyright (c) 2013 Red Hat.
+ * Copyright (c) 2013,2017 Red Hat.
  * Copyright (c) 1995,2005 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -124,6 +124,7 @@ struct iwreq {
 
 struct linux_container;
 extern int refresh_proc_net_dev(pmInDom, struct linux_container *);
+extern int refresh_net_netlink(pmInDom, pmInDom, int *);
 extern void refresh_net_addr_ioctl(pmInDom, struct linux_container *, int *);
 extern int refresh_net_ioctl(pmInDom, struct linux_container *, int *);
 extern void refresh_net_addr_sysfs(pmInDom, int *);
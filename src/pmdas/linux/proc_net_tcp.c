@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2014 Red Hat.
+ * Copyright (c) 2014,2017 Red Hat.
  * Copyright (c) 1999,2004 Silicon Graphics, Inc.  All Rights Reserved.
  * This code contributed by Michal Kara (lemming@arthur.plbohnice.cz)
  * 
@@ -16,11 +16,92 @@
 #include <ctype.h>
 #include "linux.h"
 #include "proc_net_tcp.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
 
 #define MYBUFSZ (1<<14) /*16k*/
 
+static const struct {
+    const char	*path;
+    int		family;
+    int		protocol;
+} sockets[_PM_SOCK_LAST] = {
+    { "/proc/net/tcp", AF_INET, IPPROTO_TCP },	/* _PM_SOCK_TCP */
+    { "/proc/net/tcp6", AF_INET6, IPPROTO_TCP },	/* _PM_SOCK_TCP6 */
+    { "/proc/net/udp", AF_INET, IPPROTO_UDP },	/* _PM_SOCK_UDP */
+    { "/proc/net/udp6", AF_INET6, IPPROTO_UDP },	/* _PM_SOCK_UDP6 */
+};
+
+/*
+ * The sock_diag netlink interface returns one fixed size binary record
+ * per socket (no extensions are requested), in place of a formatted
+ * line of text - on hosts with millions of connections this is much
+ * cheaper than reading and parsing the /proc/net files.  The kernel
+ * offers no summary-only request, so sockets are still counted here.
+ * If the first dump for a socket type fails (e.g. no udp_diag support)
+ * the /proc file is used for that socket type from then on.
+ */
+static int		diag_fd = -1;
+static unsigned int	diag_seq;
+static int		diag_state[_PM_SOCK_LAST];	/* 1 working, -1 failed */
+
+static int
+refresh_sock_diag(proc_net_tcp_t *proc_net_tcp, int type)
+{
+    static long		buf[8192];	/* aligned for netlink messages */
+    struct nlmsghdr	*nlh;
+    struct inet_diag_msg *msg;
+    struct {
+	struct nlmsghdr		n;
+	struct inet_diag_req_v2	r;
+    } req;
+    ssize_t		len;
+
+    if (diag_fd < 0 &&
+	(diag_fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_SOCK_DIAG)) < 0)
+	return -oserror();
+
+    memset(&req, 0, sizeof(req));
+    req.n.nlmsg_len = sizeof(req);
+    req.n.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.n.nlmsg_seq = ++diag_seq;
+    req.r.sdiag_family = sockets[type].family;
+    req.r.sdiag_protocol = sockets[type].protocol;
+    req.r.idiag_states = ~0U;
+    if (send(diag_fd, &req, sizeof(req), 0) < 0)
+	return -oserror();
+
+    for (;;) {
+	if ((len = recv(diag_fd, buf, sizeof(buf), 0)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    return -oserror();
+	}
+	if (len == 0)
+	    return -EPROTO;
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+	     nlh = NLMSG_NEXT(nlh, len)) {
+	    if (nlh->nlmsg_seq != diag_seq)	/* from an abandoned dump */
+		continue;
+	    if (nlh->nlmsg_type == NLMSG_DONE)
+		return 0;
+	    if (nlh->nlmsg_type == NLMSG_ERROR)
+		return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+	    if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+		continue;
+	    msg = (struct inet_diag_msg *)NLMSG_DATA(nlh);
+	    if (msg->idiag_state < _PM_TCP_LAST)
+		proc_net_tcp->stat[msg->idiag_state]++;
+	}
+    }
+}
+
 int
-refresh_proc_net_tcp(proc_net_tcp_t *proc_net_tcp)
+refresh_proc_net_tcp(proc_net_tcp_t *proc_net_tcp, int type)
 {
     FILE *fp;
     char buf[MYBUFSZ]; 
@@ -29,22 +110,47 @@ refresh_proc_net_tcp(proc_net_tcp_t *proc_net_tcp)
     unsigned int n;
     ssize_t got = 0;
     ptrdiff_t remnant = 0;
+    int header = 1;
+    int sts;
 
     memset(proc_net_tcp, 0, sizeof(*proc_net_tcp));
 
-    if ((fp = linux_statsfile("/proc/net/tcp", buf, sizeof(buf))) == NULL)
-	return -oserror();
+    /* test mode uses captured /proc files */
+    if (diag_state[type] >= 0 && !(linux_test_mode & LINUX_TEST_STATSPATH)) {
+	if ((sts = refresh_sock_diag(proc_net_tcp, type)) >= 0) {
+	    diag_state[type] = 1;
+	    return 0;
+	}
+	memset(proc_net_tcp, 0, sizeof(*proc_net_tcp));
+	if (diag_fd >= 0) {	/* drop any part-read dump */
+	    close(diag_fd);
+	    diag_fd = -1;
+	}
+	if (diag_state[type] == 0) {
+	    diag_state[type] = -1;
+	    __pmNotifyErr(LOG_INFO, "sock_diag unavailable, using %s: %s",
+			sockets[type].path, pmErrStr(sts));
+	}
+#if PCP_DEBUG
+	else if (pmDebug & DBG_TRACE_LIBPMDA)
+	    fprintf(stderr, "refresh_proc_net_tcp: %s dump failed: %s\n",
+			sockets[type].path, pmErrStr(sts));
+#endif
+    }
 
-    /* skip header */
-    if (fgets(buf, sizeof(buf), fp) == NULL) {
-    	/* oops, no header! */
-	fclose(fp);
+    if ((fp = linux_statsfile(sockets[type].path, buf, sizeof(buf))) == NULL)
 	return -oserror();
-    }
+
+    /*
+     * Note: the header is skipped here, not with stdio, which would
+     * have buffered (and so hidden from read) the lines following it.
+     */
     for (buf[0]='\0';;) {
 	q = strchrnul(p, '\n');
 	if (*q == '\n') {
-	    if (1 == sscanf(p, " %*s %*s %*s %x", &n)
+	    if (header)
+		header = 0;
+	    else if (1 == sscanf(p, " %*s %*s %*s %x", &n)
 		&& n < _PM_TCP_LAST) {
 		proc_net_tcp->stat[n]++;
             }
@@ -1,4 +1,5 @@
 /*
+ * Copyright (c) 2017 Red Hat.
  * Copyright (c) 1999,2004 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -31,9 +32,18 @@ enum {
 	_PM_TCP_LAST
 };
 
+/* sockets counted by state, from /proc/net/{tcp,tcp6,udp,udp6} */
+enum {
+	_PM_SOCK_TCP = 0,
+	_PM_SOCK_TCP6,
+	_PM_SOCK_UDP,
+	_PM_SOCK_UDP6,
+	_PM_SOCK_LAST
+};
+
 typedef struct {
     int stat[_PM_TCP_LAST];
 } proc_net_tcp_t;
 
-extern int refresh_proc_net_tcp(proc_net_tcp_t *);
+extern int refresh_proc_net_tcp(proc_net_tcp_t *, int);
 
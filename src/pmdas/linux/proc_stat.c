@@ -17,6 +17,7 @@
  */
 #include "linux.h"
 #include "proc_stat.h"
+#include "statsfile.h"
 #include <sys/stat.h>
 #include <dirent.h>
 #include <ctype.h>
@@ -142,22 +143,41 @@ done:
     }
 }
 
-static int
-find_line_format(const char *fmt, int fmtlen, char **bufindex, int nbufindex, int start)
+/*
+ * Convert the space-separated values of a cpu line, leaving any values
+ * missing from the end of the line (older kernels) untouched.
+ */
+static void
+stat_cpuacct(const char *p, cpuacct_t *acct)
 {
-    int j;
-
-    if (start < nbufindex-1 && strncmp(fmt, bufindex[++start], fmtlen) == 0)
-	return start;	/* fast-path, next line found where expected */
-
-    for (j = 0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 5) != 0)
-	    continue;
-	return j;
+    unsigned long long	*fields[] = {
+	&acct->user, &acct->nice, &acct->sys, &acct->idle, &acct->wait,
+	&acct->irq, &acct->sirq, &acct->steal, &acct->guest, &acct->guest_nice
+    };
+    __uint64_t		value;
+    int			i;
+
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+	p = statsfile_skip_space(p);
+	if ((unsigned int)(*p - '0') >= 10)
+	    break;
+	p = statsfile_ull(p, &value);
+	*fields[i] = value;
     }
-    return -1;
 }
 
+/* convert the next value on a line, returns NULL if there is none */
+static const char *
+stat_value(const char *p, __uint64_t *value)
+{
+    p = statsfile_skip_space(p);
+    if ((unsigned int)(*p - '0') >= 10)
+	return NULL;
+    return statsfile_ull(p, value);
+}
+
+#define MATCH(s)	(strncmp(p, s " ", sizeof(s)) == 0)
+
 /*
  * We use /proc/stat as a single source of truth regarding online/offline
  * state for CPUs (its per-CPU stats are for online CPUs only).
@@ -171,15 +191,12 @@ refresh_proc_stat(proc_stat_t *proc_stat)
     pernode_t	*np;
     percpu_t	*cp;
     pmInDom	cpus, nodes;
-    char	buf[MAXPATHLEN], *name;
-    int		n = 0, i, size;
+    __uint64_t	value;
+    const char	*p, *eol, *end;
+    char	*name;
+    int		i, sts, size;
 
-    static int fd = -1; /* kept open until exit(), unless testing */
-    static char *statbuf;
-    static int maxstatbuf;
-    static char **bufindex;
-    static int nbufindex;
-    static int maxbufindex;
+    static statsfile_t stat = STATSFILE_INIT("/proc/stat");
 
     cpu_node_setup();
     cpus = INDOM(CPU_INDOM);
@@ -195,99 +212,38 @@ refresh_proc_stat(proc_stat_t *proc_stat)
 	memset(&np->stat, 0, sizeof(np->stat));
     }
 
-    /* in test mode we replace procfs files (keeping fd open thwarts that) */
-    if (fd >= 0 && (linux_test_mode & LINUX_TEST_STATSPATH)) {
-	close(fd);
-	fd = -1;
-    }
+    if ((sts = statsfile_read(&stat)) < 0)
+	return sts;
 
-    if (fd >= 0) {
-	if (lseek(fd, 0, SEEK_SET) < 0)
-	    return -oserror();
-    } else {
-	snprintf(buf, sizeof(buf), "%s/proc/stat", linux_statspath);
-	if ((fd = open(buf, O_RDONLY)) < 0)
-	    return -oserror();
-    }
-
-    for (;;) {
-	while (n >= maxstatbuf) {
-	    size = maxstatbuf + 512;
-	    if ((statbuf = (char *)realloc(statbuf, size)) == NULL)
-		return -ENOMEM;
-	    maxstatbuf = size;
-	}
-	size = (statbuf + maxstatbuf) - (statbuf + n);
-	if ((i = read(fd, statbuf + n, size)) > 0)
-	    n += i;
-	else
-	    break;
-    }
-    statbuf[n] = '\0';
-
-    if (bufindex == NULL) {
-	size = 16 * sizeof(char *);
-	if ((bufindex = (char **)malloc(size)) == NULL)
-	    return -ENOMEM;
-	maxbufindex = 16;
-    }
-
-    nbufindex = 0;
-    bufindex[nbufindex] = statbuf;
-    for (i = 0; i < n; i++) {
-	if (statbuf[i] == '\n' || statbuf[i] == '\0') {
-	    statbuf[i] = '\0';
-	    if (nbufindex + 1 >= maxbufindex) {
-		size = (maxbufindex + 4) * sizeof(char *);
-		if ((bufindex = (char **)realloc(bufindex, size)) == NULL)
-		    return -ENOMEM;
-	    	maxbufindex += 4;
-	    }
-	    bufindex[++nbufindex] = statbuf + i + 1;
-	}
-    }
-
-#define ALLCPU_FMT "cpu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu"
-    n = sscanf((const char *)bufindex[0], ALLCPU_FMT,
-	&proc_stat->all.user, &proc_stat->all.nice,
-	&proc_stat->all.sys, &proc_stat->all.idle,
-	&proc_stat->all.wait, &proc_stat->all.irq,
-	&proc_stat->all.sirq, &proc_stat->all.steal,
-	&proc_stat->all.guest, &proc_stat->all.guest_nice);
-
-#define PERCPU_FMT "cpu%u %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu"
     /*
-     * per-CPU stats
-     * e.g. cpu0 95379 4 20053 6502503
-     * 2.6 kernels have 3 additional fields for wait, irq and soft_irq.
-     * More recent (2008) 2.6 kernels have an extra field for guest and
-     * also (since 2009) guest_nice.
-     * In the single-CPU system case, don't bother scanning, use "all";
-     * this handles non-SMP kernels with no line starting with "cpu0".
+     * In the single-CPU system case, don't bother with per-CPU lines,
+     * use "all"; this handles non-SMP kernels with no "cpu0" line.
      */
-    if ((size = pmdaCacheOp(cpus, PMDA_CACHE_SIZE)) == 1) {
-	pmdaCacheLookup(cpus, 0, &name, (void **)&cp);
-	memcpy(&cp->stat, &proc_stat->all, sizeof(cp->stat));
-	pmdaCacheStore(cpus, PMDA_CACHE_ADD, name, (void *)cp);
-	pmdaCacheLookup(nodes, 0, NULL, (void **)&np);
-	memcpy(&np->stat, &proc_stat->all, sizeof(np->stat));
-    }
-    else {
-	for (n = 0; n < nbufindex; n++) {
-	    if (strncmp("cpu", bufindex[n], 3) != 0 ||
-		!isdigit((int)bufindex[n][3]))
+    size = pmdaCacheOp(cpus, PMDA_CACHE_SIZE);
+
+    end = stat.buf + stat.length;
+    for (p = stat.buf; p < end; p = eol + 1) {
+	eol = statsfile_eol(p, end);
+
+	if (p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+	    /*
+	     * e.g. cpu0 95379 4 20053 6502503
+	     * 2.6 kernels have 3 additional fields for wait, irq and soft_irq.
+	     * More recent (2008) 2.6 kernels have an extra field for guest and
+	     * also (since 2009) guest_nice.
+	     */
+	    if (p[3] == ' ') {
+		stat_cpuacct(p + 4, &proc_stat->all);
+		continue;
+	    }
+	    if ((unsigned int)(p[3] - '0') >= 10 || size == 1)
 		continue;
+	    p = statsfile_ull(p + 3, &value);	/* extract CPU identifier */
 	    cp = NULL;
-	    np = NULL;
-	    i = atoi(&bufindex[n][3]);	/* extract CPU identifier */
-	    if (pmdaCacheLookup(cpus, i, &name, (void **)&cp) < 0 || !cp)
+	    if (pmdaCacheLookup(cpus, (int)value, &name, (void **)&cp) < 0 || !cp)
 		continue;
 	    memset(&cp->stat, 0, sizeof(cp->stat));
-	    sscanf(bufindex[n], PERCPU_FMT, &i,
-		    &cp->stat.user, &cp->stat.nice, &cp->stat.sys,
-		    &cp->stat.idle, &cp->stat.wait, &cp->stat.irq,
-		    &cp->stat.sirq, &cp->stat.steal, &cp->stat.guest,
-		    &cp->stat.guest_nice);
+	    stat_cpuacct(p, &cp->stat);
 	    pmdaCacheStore(cpus, PMDA_CACHE_ADD, name, (void *)cp);
 
 	    /* update per-node aggregate CPU utilisation stats as well */
@@ -304,43 +260,55 @@ refresh_proc_stat(proc_stat_t *proc_stat)
 	    np->stat.guest += cp->stat.guest;
 	    np->stat.guest_nice += cp->stat.guest_nice;
 	}
+	/* NB: page and swap moved to /proc/vmstat in 2.6 kernels */
+	else if (MATCH("page")) {
+	    if ((p = stat_value(p + 5, &value)) != NULL) {
+		proc_stat->page[0] = (unsigned int)value;
+		if (stat_value(p, &value) != NULL)
+		    proc_stat->page[1] = (unsigned int)value;
+	    }
+	}
+	else if (MATCH("swap")) {
+	    if ((p = stat_value(p + 5, &value)) != NULL) {
+		proc_stat->swap[0] = (unsigned int)value;
+		if (stat_value(p, &value) != NULL)
+		    proc_stat->swap[1] = (unsigned int)value;
+	    }
+	}
+	/* export the first 'total interrupts' value only */
+	else if (MATCH("intr")) {
+	    if (stat_value(p + 5, &value) != NULL)
+		proc_stat->intr = value;
+	}
+	else if (MATCH("ctxt")) {
+	    if (stat_value(p + 5, &value) != NULL)
+		proc_stat->ctxt = value;
+	}
+	else if (MATCH("btime")) {
+	    if (stat_value(p + 6, &value) != NULL)
+		proc_stat->btime = (unsigned long)value;
+	}
+	else if (MATCH("processes")) {
+	    if (stat_value(p + 10, &value) != NULL)
+		proc_stat->processes = (unsigned long)value;
+	}
+	else if (MATCH("procs_running")) {
+	    if (stat_value(p + 14, &value) != NULL)
+		proc_stat->procs_running = (unsigned long)value;
+	}
+	else if (MATCH("procs_blocked")) {
+	    if (stat_value(p + 14, &value) != NULL)
+		proc_stat->procs_blocked = (unsigned long)value;
+	}
     }
 
-    i = size;
-
-#define PAGE_FMT "page %u %u"	/* NB: moved to /proc/vmstat in 2.6 kernels */
-    if ((i = find_line_format(PAGE_FMT, 5, bufindex, nbufindex, i)) >= 0)
-	sscanf((const char *)bufindex[i], PAGE_FMT,
-		&proc_stat->page[0], &proc_stat->page[1]);
-
-#define SWAP_FMT "swap %u %u"	/* NB: moved to /proc/vmstat in 2.6 kernels */
-    if ((i = find_line_format(SWAP_FMT, 5, bufindex, nbufindex, i)) >= 0)
-	sscanf((const char *)bufindex[i], SWAP_FMT,
-		&proc_stat->swap[0], &proc_stat->swap[1]);
-
-#define INTR_FMT "intr %llu"	/* (export 1st 'total interrupts' value only) */
-    if ((i = find_line_format(INTR_FMT, 5, bufindex, nbufindex, i)) >= 0)
-	sscanf((const char *)bufindex[i], INTR_FMT, &proc_stat->intr);
-
-#define CTXT_FMT "ctxt %llu"
-    if ((i = find_line_format(CTXT_FMT, 5, bufindex, nbufindex, i)) >= 0)
-	sscanf((const char *)bufindex[i], CTXT_FMT, &proc_stat->ctxt);
-
-#define BTIME_FMT "btime %lu"
-    if ((i = find_line_format(BTIME_FMT, 6, bufindex, nbufindex, i)) >= 0)
-	sscanf((const char *)bufindex[i], BTIME_FMT, &proc_stat->btime);
-
-#define PROCESSES_FMT "processes %lu"
-    if ((i = find_line_format(PROCESSES_FMT, 10, bufindex, nbufindex, i)) >= 0)
-	sscanf((const char *)bufindex[i], PROCESSES_FMT, &proc_stat->processes);
-
-#define RUNNING_FMT "procs_running %lu"
-    if ((i = find_line_format(RUNNING_FMT, 14, bufindex, nbufindex, i)) >= 0)
-	sscanf((const char *)bufindex[i], RUNNING_FMT, &proc_stat->procs_running);
-
-#define BLOCKED_FMT "procs_blocked %lu"
-    if ((i = find_line_format(BLOCKED_FMT, 14, bufindex, nbufindex, i)) >= 0)
-	sscanf((const char *)bufindex[i], BLOCKED_FMT, &proc_stat->procs_blocked);
+    if (size == 1) {
+	pmdaCacheLookup(cpus, 0, &name, (void **)&cp);
+	memcpy(&cp->stat, &proc_stat->all, sizeof(cp->stat));
+	pmdaCacheStore(cpus, PMDA_CACHE_ADD, name, (void *)cp);
+	pmdaCacheLookup(nodes, 0, NULL, (void **)&np);
+	memcpy(&np->stat, &proc_stat->all, sizeof(np->stat));
+    }
 
     /* success */
     return 0;
@@ -18,6 +18,7 @@
 #include <ctype.h>
 #include "linux.h"
 #include "proc_vmstat.h"
+#include "statsfile.h"
 
 static struct {
     const char	*field;
@@ -337,39 +338,40 @@ proc_vmstat_init(void)
 int
 refresh_proc_vmstat(proc_vmstat_t *proc_vmstat)
 {
-    char	buf[1024];
-    char	*bufp;
+    static statsfile_t vmstat = STATSFILE_INIT("/proc/vmstat");
+    const char	*name, *space, *eol, *end;
     int64_t	*p;
-    int		i;
-    FILE	*fp;
+    __uint64_t	value;
+    int		i, line, sts;
 
     for (i = 0; vmstat_fields[i].field != NULL; i++) {
 	p = VMSTAT_OFFSET(i, proc_vmstat);
 	*p = -1; /* marked as "no value available" */
     }
 
-    if ((fp = linux_statsfile("/proc/vmstat", buf, sizeof(buf))) == NULL)
-    	return -oserror();
+    if ((sts = statsfile_read(&vmstat)) < 0)
+    	return sts;
 
     _pm_have_proc_vmstat = 1;
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-	if ((bufp = strchr(buf, ' ')) == NULL)
+    end = vmstat.buf + vmstat.length;
+    for (name = vmstat.buf, line = 0; name < end; name = eol + 1, line++) {
+	eol = statsfile_eol(name, end);
+	if ((space = memchr(name, ' ', eol - name)) == NULL)
+	    continue;
+	i = statsfile_lookup(&vmstat, line, name, space - name,
+			vmstat_fields, sizeof(vmstat_fields[0]));
+	if (i < 0)
 	    continue;
-	*bufp = '\0';
-	for (i = 0; vmstat_fields[i].field != NULL; i++) {
-	    if (strcmp(buf, vmstat_fields[i].field) != 0)
-		continue;
-	    p = VMSTAT_OFFSET(i, proc_vmstat);
-	    for (bufp++; *bufp; bufp++) {
-	    	if (isdigit((int)*bufp)) {
-		    sscanf(bufp, "%llu", (unsigned long long *)p);
-		    break;
-		}
+	p = VMSTAT_OFFSET(i, proc_vmstat);
+	for (space++; space < eol; space++) {
+	    if ((unsigned int)(*space - '0') < 10) {
+		statsfile_ull(space, &value);
+		*p = value;
+		break;
 	    }
 	}
     }
-    fclose(fp);
 
     if (proc_vmstat->nr_slab == -1)	/* split apart in 2.6.18 */
 	proc_vmstat->nr_slab = proc_vmstat->nr_slab_reclaimable +
@@ -0,0 +1,125 @@
+/*
+ * Linux stats file reading and parsing helpers
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#include "linux.h"
+#include "statsfile.h"
+
+void
+statsfile_close(statsfile_t *sp)
+{
+    if (sp->fd >= 0) {
+	close(sp->fd);
+	sp->fd = -1;
+    }
+}
+
+static int
+statsfile_open(statsfile_t *sp)
+{
+    char	path[MAXPATHLEN];
+
+    snprintf(path, sizeof(path), "%s%s", linux_statspath, sp->path);
+    if ((sp->fd = open(path, O_RDONLY)) < 0)
+	return -oserror();
+    return 0;
+}
+
+/*
+ * procfs files cannot be mapped, but they are regenerated from the
+ * start on each read at offset zero - so there is no need to reopen
+ * (or even lseek) between refreshes.
+ */
+int
+statsfile_read(statsfile_t *sp)
+{
+    size_t	size, length = 0;
+    ssize_t	bytes;
+    char	*buf;
+    int		sts, retry = 1;
+
+    /* in test mode we replace procfs files (keeping fd open thwarts that) */
+    if (linux_test_mode & LINUX_TEST_STATSPATH)
+	statsfile_close(sp);
+
+    if (sp->fd < 0) {
+	if ((sts = statsfile_open(sp)) < 0)
+	    return sts;
+	retry = 0;
+    }
+
+    for (;;) {
+	if (length + STATSFILE_PAD + 1 >= sp->size) {
+	    size = sp->size ? sp->size * 2 : 4096;
+	    if ((buf = (char *)realloc(sp->buf, size)) == NULL)
+		return -ENOMEM;
+	    sp->buf = buf;
+	    sp->size = size;
+	}
+	size = sp->size - length - STATSFILE_PAD - 1;
+	if ((bytes = pread(sp->fd, sp->buf + length, size, length)) > 0) {
+	    length += bytes;
+	    continue;
+	}
+	if (bytes == 0)
+	    break;
+	sts = -oserror();
+	statsfile_close(sp);
+	if (!retry || (sts = statsfile_open(sp)) < 0)
+	    return sts;
+	retry = length = 0;
+    }
+    memset(sp->buf + length, 0, STATSFILE_PAD + 1);
+    sp->length = length;
+    return (int)length;
+}
+
+int
+statsfile_lookup(statsfile_t *sp, int line, const char *name, int length,
+		const void *table, size_t stride)
+{
+    const char	*entry;
+    int		i, size, *hints;
+
+    if (line >= sp->nhints) {
+	size = sp->nhints ? sp->nhints * 2 : 64;
+	while (line >= size)
+	    size *= 2;
+	if ((hints = (int *)realloc(sp->hints, size * sizeof(int))) != NULL) {
+	    for (i = sp->nhints; i < size; i++)
+		hints[i] = -1;
+	    sp->hints = hints;
+	    sp->nhints = size;
+	}
+    }
+
+    if (line < sp->nhints && (i = sp->hints[line]) >= 0) {
+	entry = *(const char **)((const char *)table + i * stride);
+	if (strncmp(entry, name, length) == 0 && entry[length] == '\0')
+	    return i;
+    }
+
+    for (i = 0; ; i++) {
+	entry = *(const char **)((const char *)table + i * stride);
+	if (entry == NULL)
+	    break;
+	if (strncmp(entry, name, length) == 0 && entry[length] == '\0')
+	    break;
+    }
+    if (entry == NULL)
+	i = -1;
+    if (line < sp->nhints)
+	sp->hints[line] = i;
+    return i;
+}
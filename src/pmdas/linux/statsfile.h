@@ -0,0 +1,114 @@
+/*
+ * Linux stats file reading and parsing helpers
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef _STATSFILE_H
+#define _STATSFILE_H
+
+/*
+ * A procfs file read whole into a private buffer on each refresh.
+ * The descriptor is kept open between refreshes and re-read from the
+ * start with pread(2), so there is one system call per refresh for
+ * most files.  The buffer is NUL-terminated and always followed by
+ * STATSFILE_PAD readable bytes, which the number scanner relies on.
+ */
+#define STATSFILE_PAD	8
+
+typedef struct statsfile {
+    const char		*path;		/* below linux_statspath */
+    int			fd;		/* -1 until first opened */
+    char		*buf;		/* file contents, NUL-terminated */
+    size_t		size;		/* allocated buffer size */
+    size_t		length;		/* bytes read by last refresh */
+    int			*hints;		/* per-line statsfile_lookup cache */
+    int			nhints;
+} statsfile_t;
+
+#define STATSFILE_INIT(path)	{ (path), -1, NULL, 0, 0, NULL, 0 }
+
+/* read whole file, returns length or negative errno */
+extern int statsfile_read(statsfile_t *);
+extern void statsfile_close(statsfile_t *);
+
+/*
+ * Find a "name value" line name in a table of structures, the first
+ * member of each being the name and terminated by a NULL name.  The
+ * table index matched for each line is remembered, so when the file
+ * layout is unchanged since the last refresh there is one comparison
+ * per line.  Returns the table index or -1.
+ */
+extern int statsfile_lookup(statsfile_t *, int, const char *, int,
+			const void *, size_t);
+
+static inline const char *
+statsfile_eol(const char *p, const char *end)
+{
+    const char	*eol = memchr(p, '\n', end - p);
+
+    return eol ? eol : end;
+}
+
+static inline const char *
+statsfile_skip_space(const char *p)
+{
+    while (*p == ' ' || *p == '\t')
+	p++;
+    return p;
+}
+
+/*
+ * Convert unsigned decimal digits at p, returning the first non-digit.
+ * Little endian GNU C builds convert eight digits per step, this is
+ * only safe within (and up to the terminator of) a statsfile buffer.
+ */
+static inline const char *
+statsfile_ull(const char *p, __uint64_t *value)
+{
+    __uint64_t		v = 0;
+#if defined(__GNUC__) && !defined(HAVE_NETWORK_BYTEORDER)
+    static const __uint64_t scale[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL,
+	100000ULL, 1000000ULL, 10000000ULL, 100000000ULL
+    };
+    __uint64_t		chunk, mask;
+    int			n;
+
+    for (;;) {
+	memcpy(&chunk, p, sizeof(chunk));
+	chunk -= 0x3030303030303030ULL;
+	/* top bit set in each byte that is not an ASCII digit */
+	mask = (chunk | (chunk + 0x7676767676767676ULL)) & 0x8080808080808080ULL;
+	n = mask ? __builtin_ctzll(mask) >> 3 : 8;
+	if (n == 0)
+	    break;
+	/* discard trailing non-digits, leaving leading zero digits */
+	if (n < 8)
+	    chunk <<= (8 - n) * 8;
+	chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FFULL;
+	chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFFULL;
+	chunk = (chunk * 10000 + (chunk >> 32)) & 0x00000000FFFFFFFFULL;
+	v = v * scale[n] + chunk;
+	p += n;
+	if (n < 8)
+	    break;
+    }
+#else
+    while ((unsigned int)(*p - '0') < 10)
+	v = v * 10 + (*p++ - '0');
+#endif
+    *value = v;
+    return p;
+}
+
+#endif /* _STATSFILE_H */
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Uses the same stats file reading and number scanning as pmdalinux,
+ * but extracted here so captured snapshots can be checked and the cost
+ * of each refresh compared with stdio line-at-a-time parsing.
+ *
+ * Usage: statsparse [-v] [-i iterations] root ...
+ *	-v	report the values found in each file, do not time
+ *	-i	number of refreshes of each file when timing (default 1000)
+ *	root	snapshot directory containing proc/{stat,meminfo,...}
+ *		(as for $LINUX_STATSPATH), or "" for the live system
+ */
+
+#include <ctype.h>
+#include <pmapi.h>
+#include <impl.h>
+#include "statsfile.h"
+
+char		*linux_statspath = "";
+int		linux_test_mode;
+
+static const char *files[] = {
+    "/proc/stat", "/proc/meminfo", "/proc/vmstat", "/proc/net/dev",
+    "/proc/interrupts", "/proc/softirqs",
+};
+#define NFILES	(sizeof(files) / sizeof(files[0]))
+
+typedef struct {
+    int		lines;
+    int		values;
+    __uint64_t	sum;
+} summary_t;
+
+/* previous refresh method - stdio, then strtoull for each value */
+static int
+stdio_refresh(const char *file, summary_t *sp)
+{
+    static char	*buf;
+    static int	size;
+    char	path[MAXPATHLEN];
+    char	*p;
+    unsigned long long value;
+    FILE	*fp;
+
+    if (size == 0) {
+	size = 1 << 20;		/* avoid truncation of long lines here */
+	if ((buf = malloc(size)) == NULL)
+	    return -ENOMEM;
+    }
+    snprintf(path, sizeof(path), "%s%s", linux_statspath, file);
+    if ((fp = fopen(path, "r")) == NULL)
+	return -oserror();
+    memset(sp, 0, sizeof(*sp));
+    while (fgets(buf, size, fp) != NULL) {
+	sp->lines++;
+	for (p = buf; *p; ) {
+	    if (!isdigit((int)*p)) {
+		p++;
+		continue;
+	    }
+	    value = strtoull(p, &p, 10);
+	    sp->values++;
+	    sp->sum += value;
+	}
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* pmdalinux refresh method - one pread, then the statsfile scanner */
+static int
+statsfile_refresh(statsfile_t *file, summary_t *sp)
+{
+    const char	*p, *end;
+    __uint64_t	value;
+    int		sts;
+
+    if ((sts = statsfile_read(file)) < 0)
+	return sts;
+    memset(sp, 0, sizeof(*sp));
+    end = file->buf + file->length;
+    for (p = file->buf; p < end; ) {
+	if (*p == '\n') {
+	    sp->lines++;
+	    p++;
+	}
+	else if ((unsigned int)(*p - '0') >= 10) {
+	    p++;
+	}
+	else {
+	    p = statsfile_ull(p, &value);
+	    sp->values++;
+	    sp->sum += value;
+	}
+    }
+    return 0;
+}
+
+static double
+timing(int (*refresh)(const char *, statsfile_t *, summary_t *),
+	const char *name, statsfile_t *file, int iterations)
+{
+    struct timeval	start, end;
+    summary_t		summary;
+    int			i;
+
+    __pmtimevalNow(&start);
+    for (i = 0; i < iterations; i++)
+	refresh(name, file, &summary);
+    __pmtimevalNow(&end);
+    return __pmtimevalSub(&end, &start) * 1e9 / iterations;
+}
+
+static int
+old_method(const char *name, statsfile_t *file, summary_t *sp)
+{
+    (void)file;
+    return stdio_refresh(name, sp);
+}
+
+static int
+new_method(const char *name, statsfile_t *file, summary_t *sp)
+{
+    (void)name;
+    return statsfile_refresh(file, sp);
+}
+
+int
+main(int argc, char *argv[])
+{
+    summary_t		old, new;
+    statsfile_t		file;
+    double		before, after;
+    int			c, i, j, sts, verbose = 0, iterations = 1000;
+    char		*end;
+
+    while ((c = getopt(argc, argv, "i:v")) != EOF) {
+	switch (c) {
+	case 'i':
+	    iterations = (int)strtol(optarg, &end, 10);
+	    if (*end != '\0' || iterations <= 0) {
+		fprintf(stderr, "statsparse: bad iterations \"%s\"\n", optarg);
+		exit(1);
+	    }
+	    break;
+	case 'v':
+	    verbose = 1;
+	    break;
+	default:
+	    optind = argc + 1;
+	    break;
+	}
+    }
+    if (optind >= argc) {
+	fprintf(stderr, "Usage: statsparse [-v] [-i iterations] root ...\n");
+	exit(1);
+    }
+
+    if (!verbose)
+	printf("%d iterations, nsec per refresh\n", iterations);
+    for (i = optind; i < argc; i++) {
+	linux_statspath = argv[i];
+	for (j = 0; j < NFILES; j++) {
+	    memset(&file, 0, sizeof(file));
+	    file.path = files[j];
+	    file.fd = -1;
+	    if (stdio_refresh(files[j], &old) < 0)
+		continue;
+	    if ((sts = statsfile_refresh(&file, &new)) < 0) {
+		printf("%s: %s\n", files[j], pmErrStr(sts));
+		continue;
+	    }
+	    if (verbose) {
+		printf("%s: %d lines, %d values, sum %llu%s\n", files[j],
+			new.lines, new.values, (unsigned long long)new.sum,
+			(old.lines == new.lines && old.values == new.values &&
+			 old.sum == new.sum) ? "" : " - stdio MISMATCH");
+	    }
+	    else {
+		before = timing(old_method, files[j], &file, iterations);
+		after = timing(new_method, files[j], &file, iterations);
+		printf("%-18s stdio %10.1f  statsfile %10.1f  (%d lines)\n",
+			files[j], before, after, new.lines);
+	    }
+	    statsfile_close(&file);
+	    free(file.buf);
+	    free(file.hints);
+	}
+    }
+    exit(0);
+}
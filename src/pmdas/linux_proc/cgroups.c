@@ -21,8 +21,21 @@
 #include "clusters.h"
 #include "proc_pid.h"
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <dirent.h>
 #include <ctype.h>
 
+/* control group version 2 mount and tree state, see refresh_cgroup2 */
+static char		*cgroup2_mount;	/* unified hierarchy mount point */
+static int		cgroup2_found;	/* mount seen in latest /proc/mounts */
+static int		cgroup2_fd = -1;	/* inotify descriptor */
+static int		cgroup2_notify = 1;	/* =0 if inotify unusable */
+static int		cgroup2_valid;	/* =1 if cgroup2_list reflects tree */
+static unsigned int	cgroup2_scan;	/* full walk generation */
+static cgroup2_t	*cgroup2_list;	/* all cgroups in the hierarchy */
+static __pmHashCtl	cgroup2_watches;	/* wd -> cgroup2_t */
+static void		cgroup2_reset(void);
+
 static void
 refresh_cgroup_cpus(void)
 {
@@ -169,12 +182,24 @@ refresh_cgroup_filesys(void)
     if ((fp = proc_statsfile("/proc/mounts", buf, sizeof(buf))) == NULL)
 	return;
 
+    cgroup2_found = 0;
     while (fgets(buf, sizeof(buf), fp) != NULL) {
 	device = strtok(buf, " ");
 	path = strtok(NULL, " ");
 	type = strtok(NULL, " ");
 	options = strtok(NULL, " ");
-	if (strcmp(type, "cgroup") != 0)
+	if (type && strcmp(type, "cgroup2") == 0 && !cgroup2_found) {
+	    /* unified hierarchy, first mount only - others are duplicates */
+	    cgroup2_found = 1;
+	    if (cgroup2_mount && strcmp(path, cgroup2_mount) == 0)
+		continue;
+	    if (pmDebug & DBG_TRACE_APPL0)
+		fprintf(stderr, "refresh_filesys: cgroup2 \"%s\"\n", path);
+	    cgroup2_reset();
+	    cgroup2_mount = strdup(path);
+	    continue;
+	}
+	if (type == NULL || strcmp(type, "cgroup") != 0)
 	    continue;
 
 	sts = pmdaCacheLookupName(mounts, path, NULL, (void **)&fs);
@@ -203,6 +228,9 @@ refresh_cgroup_filesys(void)
 	}
     }
     fclose(fp);
+
+    if (!cgroup2_found && cgroup2_mount)
+	cgroup2_reset();
 }
 
 static char *
@@ -277,6 +305,12 @@ cgroup_mounts_subsys(const char *system, char *buffer, int length)
 	buffer[length-1] = '\0';
 	return strlen(buffer);
     }
+    /* all controllers share the unified hierarchy, if mounted */
+    if (cgroup2_mount) {
+	snprintf(buffer, length, "%s%s/", proc_statspath, cgroup2_mount);
+	buffer[length-1] = '\0';
+	return strlen(buffer);
+    }
     return 0;
 }
 
@@ -1014,3 +1048,414 @@ refresh_blkio(const char *path, const char *name)
 
     pmdaCacheStore(indom, PMDA_CACHE_ADD, name, blkio);
 }
+
+/*
+ * Control group version 2 - the unified hierarchy.
+ *
+ * Every controller shares the one hierarchy, so a single walk finds all
+ * cgroups, and each refresh reads cpu.stat, memory.stat, io.stat and
+ * cgroup.procs (only those needed) once per cgroup into one structure.
+ *
+ * Rather than walking the whole tree on every refresh, each directory
+ * is watched with inotify.  The tree is walked once, after which only
+ * subtrees reported as created are walked, and cgroups are dropped as
+ * their directories are removed.  Should inotify be unavailable, or
+ * report an event queue overflow or a rename, the whole tree is walked
+ * again (marking each cgroup found, and dropping the remainder).
+ */
+
+#define CGROUP2_WATCH	(IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO| \
+			 IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+static void
+cgroup2_unwatch(cgroup2_t *cg, int remove)
+{
+    if (cg->wd < 0)
+	return;
+    __pmHashDel(cg->wd, (void *)cg, &cgroup2_watches);
+    if (remove && cgroup2_fd >= 0)
+	inotify_rm_watch(cgroup2_fd, cg->wd);
+    cg->wd = -1;
+}
+
+static void
+cgroup2_watch(cgroup2_t *cg)
+{
+    __pmHashNode	*node;
+    int			wd;
+
+    if ((wd = inotify_add_watch(cgroup2_fd, cg->path, CGROUP2_WATCH)) < 0) {
+	if (oserror() != ENOENT) {
+	    /* typically ENOSPC (max_user_watches), walk the tree instead */
+	    __pmNotifyErr(LOG_WARNING, "cgroup2: inotify watch on %s: %s",
+			cg->path, osstrerror());
+	    close(cgroup2_fd);
+	    cgroup2_fd = -1;
+	    cgroup2_notify = 0;
+	    for (cg = cgroup2_list; cg != NULL; cg = cg->next)
+		cgroup2_unwatch(cg, 0);
+	}
+	return;
+    }
+    /* same directory known by an old (renamed) path - no longer valid */
+    if ((node = __pmHashSearch(wd, &cgroup2_watches)) != NULL)
+	cgroup2_unwatch((cgroup2_t *)node->data, 0);
+    if (__pmHashAdd(wd, (void *)cg, &cgroup2_watches) < 0)
+	inotify_rm_watch(cgroup2_fd, wd);
+    else
+	cg->wd = wd;
+}
+
+static void
+cgroup2_add(const char *path, int offset)
+{
+    pmInDom indom = INDOM(CGROUP2_INDOM);
+    cgroup2_t *cg = NULL;
+    const char *name = cgroup_name(path, offset);
+
+    if (pmdaCacheLookupName(indom, name, NULL, (void **)&cg) < 0 || !cg) {
+	if ((cg = (cgroup2_t *)calloc(1, sizeof(cgroup2_t))) == NULL)
+	    return;
+	if ((cg->path = strdup(path)) == NULL) {
+	    free(cg);
+	    return;
+	}
+	cg->name = cgroup_name(cg->path, offset);
+	cg->wd = -1;
+	if ((cg->next = cgroup2_list) != NULL)
+	    cgroup2_list->prev = cg;
+	cgroup2_list = cg;
+	pmdaCacheStore(indom, PMDA_CACHE_ADD, cg->name, (void *)cg);
+	if (pmDebug & DBG_TRACE_APPL0)
+	    fprintf(stderr, "cgroup2_add: \"%s\"\n", cg->name);
+    }
+    cg->scan = cgroup2_scan;
+    if (cgroup2_fd >= 0 && cg->wd < 0)
+	cgroup2_watch(cg);
+}
+
+static void
+cgroup2_drop(cgroup2_t *cg)
+{
+    if (pmDebug & DBG_TRACE_APPL0)
+	fprintf(stderr, "cgroup2_drop: \"%s\"\n", cg->name);
+    cgroup2_unwatch(cg, 1);
+    if (cg->prev)
+	cg->prev->next = cg->next;
+    else
+	cgroup2_list = cg->next;
+    if (cg->next)
+	cg->next->prev = cg->prev;
+    pmdaCacheStore(INDOM(CGROUP2_INDOM), PMDA_CACHE_CULL, cg->name, NULL);
+    free(cg->path);
+    free(cg);
+}
+
+/*
+ * Add the cgroup at path and all below it.  The watch is placed before
+ * the directory is read, so no subdirectory created meanwhile is missed.
+ */
+static void
+cgroup2_walk(const char *path, int offset)
+{
+    char cgpath[MAXPATHLEN];
+    struct dirent *dp;
+    struct stat sbuf;
+    DIR *dirp;
+
+    if ((dirp = opendir(path)) == NULL)
+	return;
+    cgroup2_add(path, offset);
+    while ((dp = readdir(dirp)) != NULL) {
+	if (dp->d_name[0] == '.')
+	    continue;
+	if (dp->d_type != DT_DIR && dp->d_type != DT_UNKNOWN)
+	    continue;
+	snprintf(cgpath, sizeof(cgpath), "%s/%s", path, dp->d_name);
+	if (dp->d_type == DT_UNKNOWN &&
+	    (stat(cgpath, &sbuf) < 0 || !S_ISDIR(sbuf.st_mode)))
+	    continue;
+	cgroup2_walk(cgpath, offset);
+    }
+    closedir(dirp);
+}
+
+/* apply queued directory changes, returns zero if a full walk is needed */
+static int
+cgroup2_events(int offset)
+{
+    union {
+	struct inotify_event	event;
+	char			buffer[16 * 1024];
+    } events;
+    struct inotify_event *ep;
+    __pmHashNode *node;
+    cgroup2_t *cg, *child;
+    char path[MAXPATHLEN];
+    int bytes, valid = 1;
+    char *p;
+
+    while ((bytes = read(cgroup2_fd, &events, sizeof(events))) > 0) {
+	for (p = events.buffer; p < events.buffer + bytes;
+	     p += sizeof(struct inotify_event) + ep->len) {
+	    ep = (struct inotify_event *)p;
+	    if (ep->mask & (IN_Q_OVERFLOW|IN_UNMOUNT)) {
+		valid = 0;
+		continue;
+	    }
+	    if ((node = __pmHashSearch(ep->wd, &cgroup2_watches)) == NULL)
+		continue;
+	    cg = (cgroup2_t *)node->data;
+	    if (ep->mask & IN_IGNORED) {	/* directory removed */
+		cgroup2_unwatch(cg, 0);
+		cgroup2_drop(cg);
+		continue;
+	    }
+	    if (ep->mask & (IN_MOVE_SELF|IN_MOVED_FROM)) {
+		valid = 0;
+		continue;
+	    }
+	    if (!(ep->mask & IN_ISDIR) || ep->len == 0)
+		continue;
+	    snprintf(path, sizeof(path), "%s/%s", cg->path, ep->name);
+	    if (ep->mask & (IN_CREATE|IN_MOVED_TO))
+		cgroup2_walk(path, offset);
+	    else if ((ep->mask & IN_DELETE) &&
+		     pmdaCacheLookupName(INDOM(CGROUP2_INDOM),
+			cgroup_name(path, offset), NULL, (void **)&child) >= 0 &&
+		     child != NULL)
+		cgroup2_drop(child);
+	}
+    }
+    return valid;
+}
+
+static int
+read_cgroup2(const char *path, const char *file, char *buffer, int size)
+{
+    char name[MAXPATHLEN];
+    int fd, bytes, count = 0;
+
+    snprintf(name, sizeof(name), "%s/%s", path, file);
+    if ((fd = open(name, O_RDONLY)) < 0)
+	return -oserror();
+    while (count < size - 1 &&
+	   (bytes = read(fd, buffer + count, size - 1 - count)) > 0)
+	count += bytes;
+    close(fd);
+    buffer[count] = '\0';
+    return count;
+}
+
+typedef struct {
+    const char		*field;
+    int			length;
+    int			offset;
+} cgroup2_field_t;
+
+#define CG2_FIELD(name, type, member) \
+	{ name, sizeof(name)-1, offsetof(type, member) }
+
+/* "name value" lines, as in the cpu.stat and memory.stat files */
+static void
+read_cgroup2_fields(char *buffer, const cgroup2_field_t *fields, void *base)
+{
+    const cgroup2_field_t *fp;
+    char *p, *name, *endp;
+    int length;
+
+    for (p = buffer; *p != '\0'; p = endp) {
+	name = p;
+	while (*p != ' ' && *p != '\n' && *p != '\0')
+	    p++;
+	length = p - name;
+	for (fp = fields; fp->field != NULL; fp++) {
+	    if (fp->length != length || memcmp(fp->field, name, length) != 0)
+		continue;
+	    *(__uint64_t *)((char *)base + fp->offset) = strtoull(p, &endp, 10);
+	    break;
+	}
+	if ((endp = strchr(p, '\n')) == NULL)
+	    break;
+	endp++;
+    }
+}
+
+static const cgroup2_field_t cpustat_fields[] = {
+    CG2_FIELD("usage_usec",		cgroup2_cpustat_t, usage),
+    CG2_FIELD("user_usec",		cgroup2_cpustat_t, user),
+    CG2_FIELD("system_usec",		cgroup2_cpustat_t, system),
+    CG2_FIELD("nr_periods",		cgroup2_cpustat_t, nr_periods),
+    CG2_FIELD("nr_throttled",		cgroup2_cpustat_t, nr_throttled),
+    CG2_FIELD("throttled_usec",		cgroup2_cpustat_t, throttled),
+    { NULL, 0, 0 }
+};
+
+static const cgroup2_field_t memstat_fields[] = {
+    CG2_FIELD("anon",			cgroup2_memstat_t, anon),
+    CG2_FIELD("file",			cgroup2_memstat_t, file),
+    CG2_FIELD("kernel_stack",		cgroup2_memstat_t, kernel_stack),
+    CG2_FIELD("slab",			cgroup2_memstat_t, slab),
+    CG2_FIELD("sock",			cgroup2_memstat_t, sock),
+    CG2_FIELD("shmem",			cgroup2_memstat_t, shmem),
+    CG2_FIELD("file_mapped",		cgroup2_memstat_t, file_mapped),
+    CG2_FIELD("file_dirty",		cgroup2_memstat_t, file_dirty),
+    CG2_FIELD("file_writeback",		cgroup2_memstat_t, file_writeback),
+    CG2_FIELD("anon_thp",		cgroup2_memstat_t, anon_thp),
+    CG2_FIELD("inactive_anon",		cgroup2_memstat_t, inactive_anon),
+    CG2_FIELD("active_anon",		cgroup2_memstat_t, active_anon),
+    CG2_FIELD("inactive_file",		cgroup2_memstat_t, inactive_file),
+    CG2_FIELD("active_file",		cgroup2_memstat_t, active_file),
+    CG2_FIELD("unevictable",		cgroup2_memstat_t, unevictable),
+    CG2_FIELD("pgfault",		cgroup2_memstat_t, pgfault),
+    CG2_FIELD("pgmajfault",		cgroup2_memstat_t, pgmajfault),
+    { NULL, 0, 0 }
+};
+
+static const cgroup2_field_t iostat_fields[] = {
+    CG2_FIELD("rbytes",			cgroup2_iostat_t, rbytes),
+    CG2_FIELD("wbytes",			cgroup2_iostat_t, wbytes),
+    CG2_FIELD("rios",			cgroup2_iostat_t, rios),
+    CG2_FIELD("wios",			cgroup2_iostat_t, wios),
+    CG2_FIELD("dbytes",			cgroup2_iostat_t, dbytes),
+    CG2_FIELD("dios",			cgroup2_iostat_t, dios),
+    { NULL, 0, 0 }
+};
+
+/* "major:minor name=value ..." lines, summed over all devices */
+static void
+read_cgroup2_iostat(char *buffer, cgroup2_iostat_t *io)
+{
+    const cgroup2_field_t *fp;
+    char *p, *name, *endp;
+    int length;
+
+    memset(io, 0, sizeof(*io));
+    for (p = buffer; *p != '\0'; ) {
+	while (*p == ' ' || *p == '\n')
+	    p++;
+	name = p;
+	while (*p != '=' && *p != ' ' && *p != '\n' && *p != '\0')
+	    p++;
+	if (*p != '=')
+	    continue;
+	length = p++ - name;
+	for (fp = iostat_fields; fp->field != NULL; fp++) {
+	    if (fp->length != length || memcmp(fp->field, name, length) != 0)
+		continue;
+	    *(__uint64_t *)((char *)io + fp->offset) += strtoull(p, &endp, 10);
+	    break;
+	}
+	while (*p != ' ' && *p != '\n' && *p != '\0')
+	    p++;
+    }
+}
+
+static void
+refresh_cgroup2_values(cgroup2_t *cg, unsigned int want)
+{
+    char buffer[16 * 1024];
+    char *p;
+    int bytes;
+
+    cg->have = 0;
+    if ((want & CGROUP2_CPU) &&
+	read_cgroup2(cg->path, "cpu.stat", buffer, sizeof(buffer)) >= 0) {
+	memset(&cg->cpu, 0, sizeof(cg->cpu));
+	read_cgroup2_fields(buffer, cpustat_fields, &cg->cpu);
+	cg->have |= CGROUP2_CPU;
+    }
+    if ((want & CGROUP2_MEMORY) &&
+	read_cgroup2(cg->path, "memory.stat", buffer, sizeof(buffer)) >= 0) {
+	memset(&cg->memory, 0, sizeof(cg->memory));
+	read_cgroup2_fields(buffer, memstat_fields, &cg->memory);
+	cg->have |= CGROUP2_MEMORY;
+    }
+    if ((want & CGROUP2_IO) &&
+	read_cgroup2(cg->path, "io.stat", buffer, sizeof(buffer)) >= 0) {
+	read_cgroup2_iostat(buffer, &cg->io);
+	cg->have |= CGROUP2_IO;
+    }
+    if (want & CGROUP2_PROCS) {
+	int fd;
+
+	snprintf(buffer, sizeof(buffer), "%s/cgroup.procs", cg->path);
+	if ((fd = open(buffer, O_RDONLY)) >= 0) {
+	    cg->nprocs = 0;
+	    while ((bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (p = buffer; (p = memchr(p, '\n', buffer + bytes - p)); p++)
+		    cg->nprocs++;
+	    }
+	    close(fd);
+	    cg->have |= CGROUP2_PROCS;
+	}
+    }
+}
+
+/* forget the hierarchy when unmounted, or mounted elsewhere */
+static void
+cgroup2_reset(void)
+{
+    while (cgroup2_list != NULL)
+	cgroup2_drop(cgroup2_list);
+    if (cgroup2_fd >= 0) {
+	close(cgroup2_fd);
+	cgroup2_fd = -1;
+    }
+    if (cgroup2_mount)
+	free(cgroup2_mount);
+    cgroup2_mount = NULL;
+    cgroup2_valid = 0;
+}
+
+/*
+ * Bring the set of cgroups in the unified hierarchy up to date, then
+ * refresh the wanted values of each (matching the container, if any).
+ */
+void
+refresh_cgroup2(unsigned int want, const char *container, int length)
+{
+    pmInDom indom = INDOM(CGROUP2_INDOM);
+    char path[MAXPATHLEN];
+    cgroup2_t *cg, *next;
+    int offset;
+
+    if (cgroup2_mount == NULL)
+	return;
+
+    snprintf(path, sizeof(path), "%s%s", proc_statspath, cgroup2_mount);
+    offset = strlen(path);
+    if (cgroup2_fd < 0 && cgroup2_notify &&
+	(cgroup2_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0) {
+	__pmNotifyErr(LOG_WARNING, "cgroup2: inotify_init: %s", osstrerror());
+	cgroup2_notify = 0;
+    }
+    if (cgroup2_valid && cgroup2_fd >= 0)
+	cgroup2_valid = cgroup2_events(offset);
+    if (!cgroup2_valid || cgroup2_fd < 0) {
+	if (pmDebug & DBG_TRACE_APPL0)
+	    fprintf(stderr, "refresh_cgroup2: walk \"%s\"\n", cgroup2_mount);
+	cgroup2_scan++;
+	cgroup2_walk(path, offset);
+	for (cg = cgroup2_list; cg != NULL; cg = next) {
+	    next = cg->next;
+	    if (cg->scan != cgroup2_scan)
+		cgroup2_drop(cg);
+	}
+	cgroup2_valid = (cgroup2_fd >= 0);
+    }
+
+    for (cg = cgroup2_list; cg != NULL; cg = cg->next) {
+	if (!check_refresh(cg->name, container, length)) {
+	    if (!cg->hidden)
+		pmdaCacheStore(indom, PMDA_CACHE_HIDE, cg->name, NULL);
+	    cg->hidden = 1;
+	    continue;
+	}
+	if (cg->hidden)
+	    pmdaCacheStore(indom, PMDA_CACHE_ADD, cg->name, (void *)cg);
+	cg->hidden = 0;
+	if (want)
+	    refresh_cgroup2_values(cg, want);
+    }
+}
@@ -298,6 +298,113 @@ enum {
     CG_SUBSYS_ENABLED			= 3,
 };
 
+/*
+ * Control group version 2 (unified hierarchy) - one set of values for
+ * each cgroup, from the files of each controller enabled for it.
+ */
+typedef struct {
+    __uint64_t		usage;
+    __uint64_t		user;
+    __uint64_t		system;
+    __uint64_t		nr_periods;
+    __uint64_t		nr_throttled;
+    __uint64_t		throttled;
+} cgroup2_cpustat_t;
+
+enum {
+    CG2_CPU_USAGE		= 0,
+    CG2_CPU_USER		= 1,
+    CG2_CPU_SYSTEM		= 2,
+    CG2_CPU_PERIODS		= 3,
+    CG2_CPU_THROTTLED		= 4,
+    CG2_CPU_THROTTLED_TIME	= 5,
+};
+
+typedef struct {
+    __uint64_t		anon;
+    __uint64_t		file;
+    __uint64_t		kernel_stack;
+    __uint64_t		slab;
+    __uint64_t		sock;
+    __uint64_t		shmem;
+    __uint64_t		file_mapped;
+    __uint64_t		file_dirty;
+    __uint64_t		file_writeback;
+    __uint64_t		anon_thp;
+    __uint64_t		inactive_anon;
+    __uint64_t		active_anon;
+    __uint64_t		inactive_file;
+    __uint64_t		active_file;
+    __uint64_t		unevictable;
+    __uint64_t		pgfault;
+    __uint64_t		pgmajfault;
+} cgroup2_memstat_t;
+
+enum {
+    CG2_MEMORY_ANON		= 0,
+    CG2_MEMORY_FILE		= 1,
+    CG2_MEMORY_KERNEL_STACK	= 2,
+    CG2_MEMORY_SLAB		= 3,
+    CG2_MEMORY_SOCK		= 4,
+    CG2_MEMORY_SHMEM		= 5,
+    CG2_MEMORY_FILE_MAPPED	= 6,
+    CG2_MEMORY_FILE_DIRTY	= 7,
+    CG2_MEMORY_FILE_WRITEBACK	= 8,
+    CG2_MEMORY_ANON_THP		= 9,
+    CG2_MEMORY_INACTIVE_ANON	= 10,
+    CG2_MEMORY_ACTIVE_ANON	= 11,
+    CG2_MEMORY_INACTIVE_FILE	= 12,
+    CG2_MEMORY_ACTIVE_FILE	= 13,
+    CG2_MEMORY_UNEVICTABLE	= 14,
+    CG2_MEMORY_PGFAULT		= 15,
+    CG2_MEMORY_PGMAJFAULT	= 16,
+};
+
+typedef struct {
+    __uint64_t		rbytes;
+    __uint64_t		wbytes;
+    __uint64_t		rios;
+    __uint64_t		wios;
+    __uint64_t		dbytes;
+    __uint64_t		dios;
+} cgroup2_iostat_t;
+
+enum {
+    CG2_IO_RBYTES		= 0,
+    CG2_IO_WBYTES		= 1,
+    CG2_IO_RIOS			= 2,
+    CG2_IO_WIOS			= 3,
+    CG2_IO_DBYTES		= 4,
+    CG2_IO_DIOS			= 5,
+};
+
+enum {
+    CG2_PROCS_COUNT		= 0,
+};
+
+/* files read for each cgroup, and found at the last refresh */
+enum {
+    CGROUP2_CPU			= 0x1,	/* cpu.stat */
+    CGROUP2_MEMORY		= 0x2,	/* memory.stat */
+    CGROUP2_IO			= 0x4,	/* io.stat */
+    CGROUP2_PROCS		= 0x8,	/* cgroup.procs */
+};
+
+typedef struct cgroup2 {
+    struct cgroup2	*prev;		/* all known cgroups, see refresh */
+    struct cgroup2	*next;
+    char		*path;		/* cgroup directory */
+    const char		*name;		/* instance name, within path */
+    int			wd;		/* inotify watch descriptor or -1 */
+    int			hidden;		/* excluded by a container */
+    unsigned int	scan;		/* last full walk finding this */
+    unsigned int	have;		/* CGROUP2_* values available */
+    cgroup2_cpustat_t	cpu;
+    cgroup2_memstat_t	memory;
+    cgroup2_iostat_t	io;
+    __uint32_t		nprocs;
+} cgroup2_t;
+
 /*
  * General cgroup interfaces
  */
@@ -310,6 +417,7 @@ extern int cgroup_mounts_subsys(const char *, char *, int);
 
 extern void refresh_cgroup_subsys(void);
 extern void refresh_cgroup_filesys(void);
+extern void refresh_cgroup2(unsigned int, const char *, int);
 
 /*
  * Indom-specific interfaces (iteratively populating)
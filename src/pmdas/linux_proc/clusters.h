@@ -51,8 +51,13 @@
 #define CLUSTER_HOTPROC_GLOBAL		60 /* overall hotproc stats and controls*/
 #define CLUSTER_HOTPROC_PRED      	61 /* derived hotproc metrics */
 
+#define CLUSTER_CGROUP2_CPU	62 /* unified hierarchy cpu.stat */
+#define CLUSTER_CGROUP2_MEMORY	63 /* unified hierarchy memory.stat */
+#define CLUSTER_CGROUP2_IO	64 /* unified hierarchy io.stat */
+#define CLUSTER_CGROUP2_PROCS	65 /* unified hierarchy cgroup.procs */
+
 
 #define MIN_CLUSTER  8		/* first cluster number we use here */
-#define NUM_CLUSTERS 62		/* one more than highest cluster number used */
+#define NUM_CLUSTERS 66		/* one more than highest cluster number used */
 
 #endif /* _CLUSTERS_H */
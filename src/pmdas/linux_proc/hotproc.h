@@ -28,6 +28,16 @@
 #define ITEM_HOTPROC_G_CONFIG 8
 #define ITEM_HOTPROC_G_CONFIG_GEN 9
 #define ITEM_HOTPROC_G_RELOAD_CONFIG 10
+#define ITEM_HOTPROC_G_TOPK 11
+#define ITEM_HOTPROC_G_RANK 12
+#define ITEM_HOTPROC_G_EVAL_COUNT 13
+#define ITEM_HOTPROC_G_EVAL_TIME 14
+#define ITEM_HOTPROC_G_EVAL_LAST 15
+#define ITEM_HOTPROC_G_EVAL_NPROCS 16
+
+/* top-K ranking */
+#define HOTPROC_RANK_CPUBURN 0
+#define HOTPROC_RANK_IODEMAND 1
 
 /* Predicate items */
 #define ITEM_HOTPROC_P_SYSCALLS 0
@@ -42,8 +42,10 @@
 
 #define HOTPROC_INDOM		39 /* - hot procs */
 
+#define CGROUP2_INDOM		40 /* - control group v2, groups */
+
 #define MIN_INDOM  9		/* first indom number we use here */
-#define NUM_INDOMS 40		/* one more than highest indom number we use here */
+#define NUM_INDOMS 41		/* one more than highest indom number we use here */
 
 extern pmInDom proc_indom(int);
 #define INDOM(i) proc_indom(i)
@@ -4,7 +4,7 @@
  * Copyright (c) 2000,2004,2007-2008 Silicon Graphics, Inc.  All Rights Reserved.
  * Portions Copyright (c) 2002 International Business Machines Corp.
  * Portions Copyright (c) 2007-2011 Aconex.  All Rights Reserved.
- * Portions Copyright (c) 2012-2016 Red Hat.
+ * Portions Copyright (c) 2012-2017 Red Hat.
  * 
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the
@@ -29,6 +29,7 @@
 #include <sys/vfs.h>
 #include <sys/stat.h>
 #include <sys/times.h>
+#include <sys/resource.h>
 #include <sys/utsname.h>
 #include <utmp.h>
 #include <pwd.h>
@@ -41,6 +42,7 @@
 #include "getinfo.h"
 #include "proc_pid.h"
 #include "proc_runq.h"
+#include "proc_netlink.h"
 #include "proc_dynamic.h"
 #include "ksym.h"
 #include "cgroups.h"
@@ -57,9 +59,20 @@ static int			have_access;	/* =1 recvd uid/gid */
 static size_t			_pm_system_pagesize;
 static unsigned int		threads;	/* control.all.threads */
 static char *			cgroups;	/* control.all.cgroups */
+static int			workers;	/* proc/<pid> prefetch threads */
+static int			fdcache = -1;	/* proc/<pid> descriptors kept */
+static int			netlink;	/* =1 use proc connector, taskstats */
 int				conf_gen;	/* hotproc config version, if zero hotproc not configured yet */
 long				hz;
 
+/*
+ * Numbers formatted as strings while fetching are built on the stack of
+ * proc_fetch, rather than in a static buffer - pmdaFetch copies each
+ * value as soon as the fetch callback returns, so one buffer will do.
+ */
+#define FETCH_TEXTLEN			32
+static char			*fetch_text;	/* FETCH_TEXTLEN bytes */
+
 /*
  * Note on "jiffies".
  * In the Linux kernel jiffies are always "unsigned long" (aka
@@ -1462,6 +1475,156 @@ static pmdaMetric metrictab[] = {
     { PMDA_PMID(CLUSTER_BLKIO_GROUPS, CG_BLKIO_THROTTLEIOSERVICED_TOTAL), PM_TYPE_U64,
     CGROUP_BLKIO_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
 
+/* cgroup.unified.cpu.usage */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_CPU, CG2_CPU_USAGE), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) } },
+
+/* cgroup.unified.cpu.user */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_CPU, CG2_CPU_USER), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) } },
+
+/* cgroup.unified.cpu.system */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_CPU, CG2_CPU_SYSTEM), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) } },
+
+/* cgroup.unified.cpu.periods */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_CPU, CG2_CPU_PERIODS), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* cgroup.unified.cpu.throttled */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_CPU, CG2_CPU_THROTTLED), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* cgroup.unified.cpu.throttled_time */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_CPU, CG2_CPU_THROTTLED_TIME), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) } },
+
+/* cgroup.unified.memory.anon */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_ANON), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.file */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_FILE), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.kernel_stack */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_KERNEL_STACK), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.slab */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_SLAB), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.sock */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_SOCK), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.shmem */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_SHMEM), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.file_mapped */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_FILE_MAPPED), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.file_dirty */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_FILE_DIRTY), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.file_writeback */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_FILE_WRITEBACK), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.anon_thp */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_ANON_THP), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.inactive_anon */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_INACTIVE_ANON), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.active_anon */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_ACTIVE_ANON), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.inactive_file */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_INACTIVE_FILE), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.active_file */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_ACTIVE_FILE), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.unevictable */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_UNEVICTABLE), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.memory.pgfault */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_PGFAULT), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* cgroup.unified.memory.pgmajfault */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_MEMORY, CG2_MEMORY_PGMAJFAULT), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* cgroup.unified.io.rbytes */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_IO, CG2_IO_RBYTES), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.io.wbytes */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_IO, CG2_IO_WBYTES), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.io.rios */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_IO, CG2_IO_RIOS), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* cgroup.unified.io.wios */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_IO, CG2_IO_WIOS), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* cgroup.unified.io.dbytes */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_IO, CG2_IO_DBYTES), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* cgroup.unified.io.dios */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_IO, CG2_IO_DIOS), PM_TYPE_U64,
+    CGROUP2_INDOM, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* cgroup.unified.nprocs */
+  { NULL,
+    { PMDA_PMID(CLUSTER_CGROUP2_PROCS, CG2_PROCS_COUNT), PM_TYPE_U32,
+    CGROUP2_INDOM, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
 
 /*
  * proc/<pid>/fd cluster
@@ -1511,6 +1674,24 @@ static pmdaMetric metrictab[] = {
     /* hotproc.control.reload_config */
     { NULL, {PMDA_PMID(CLUSTER_HOTPROC_GLOBAL,ITEM_HOTPROC_G_RELOAD_CONFIG),
       PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0)} },
+    /* hotproc.control.topk */
+    { NULL, {PMDA_PMID(CLUSTER_HOTPROC_GLOBAL,ITEM_HOTPROC_G_TOPK),
+      PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0)} },
+    /* hotproc.control.rank */
+    { NULL, {PMDA_PMID(CLUSTER_HOTPROC_GLOBAL,ITEM_HOTPROC_G_RANK),
+      PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0)} },
+    /* hotproc.control.eval.count */
+    { NULL, {PMDA_PMID(CLUSTER_HOTPROC_GLOBAL,ITEM_HOTPROC_G_EVAL_COUNT),
+      PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE)} },
+    /* hotproc.control.eval.time */
+    { NULL, {PMDA_PMID(CLUSTER_HOTPROC_GLOBAL,ITEM_HOTPROC_G_EVAL_TIME),
+      PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0)} },
+    /* hotproc.control.eval.last */
+    { NULL, {PMDA_PMID(CLUSTER_HOTPROC_GLOBAL,ITEM_HOTPROC_G_EVAL_LAST),
+      PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0)} },
+    /* hotproc.control.eval.nprocs */
+    { NULL, {PMDA_PMID(CLUSTER_HOTPROC_GLOBAL,ITEM_HOTPROC_G_EVAL_NPROCS),
+      PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0)} },
     /* hotproc.total.cpuidle */
     { NULL, {PMDA_PMID(CLUSTER_HOTPROC_GLOBAL,ITEM_HOTPROC_G_CPUIDLE),
       PM_TYPE_FLOAT, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0)} },
@@ -1577,6 +1758,7 @@ proc_refresh(pmdaExt *pmda, int *need_refresh)
 {
     char cgroup[MAXPATHLEN];
     proc_container_t *container;
+    unsigned int want = 0;
     int sts, cgrouplen = 0;
 
     if ((container = proc_ctx_container(pmda->e_context)) != NULL) {
@@ -1595,6 +1777,10 @@ proc_refresh(pmdaExt *pmda, int *need_refresh)
 	need_refresh[CLUSTER_MEMORY_GROUPS] ||
 	need_refresh[CLUSTER_NETCLS_GROUPS] ||
 	need_refresh[CLUSTER_BLKIO_GROUPS] ||
+	need_refresh[CLUSTER_CGROUP2_CPU] ||
+	need_refresh[CLUSTER_CGROUP2_MEMORY] ||
+	need_refresh[CLUSTER_CGROUP2_IO] ||
+	need_refresh[CLUSTER_CGROUP2_PROCS] ||
 	container) {
 
 	refresh_cgroup_subsys();
@@ -1618,6 +1804,17 @@ proc_refresh(pmdaExt *pmda, int *need_refresh)
 	if (need_refresh[CLUSTER_BLKIO_GROUPS])
 	    refresh_cgroups("blkio", cgroup, cgrouplen,
 			    setup_blkio, refresh_blkio);
+
+	if (need_refresh[CLUSTER_CGROUP2_CPU])
+	    want |= CGROUP2_CPU;
+	if (need_refresh[CLUSTER_CGROUP2_MEMORY])
+	    want |= CGROUP2_MEMORY;
+	if (need_refresh[CLUSTER_CGROUP2_IO])
+	    want |= CGROUP2_IO;
+	if (need_refresh[CLUSTER_CGROUP2_PROCS])
+	    want |= CGROUP2_PROCS;
+	if (want || need_refresh[CLUSTER_CGROUP_MOUNTS])
+	    refresh_cgroup2(want, cgroup, cgrouplen);
     }
 
     if (need_refresh[CLUSTER_PID_STAT] ||
@@ -1711,6 +1908,9 @@ proc_instance(pmInDom indom, int inst, char *name, __pmInResult **result, pmdaEx
     case CGROUP_MOUNTS_INDOM:
     	need_refresh[CLUSTER_CGROUP_MOUNTS]++;
 	break;
+    case CGROUP2_INDOM:
+	need_refresh[CLUSTER_CGROUP_MOUNTS]++;
+	break;
     /* no default label : pmdaInstance will pick up errors */
     }
 
@@ -1750,6 +1950,107 @@ proc_instance(pmInDom indom, int inst, char *name, __pmInResult **result, pmdaEx
     return sts;
 }
 
+/*
+ * Fields of /proc/<pid>/stat, and the files read with it, that must be
+ * converted to fetch a CLUSTER_PID_STAT metric item.
+ */
+static __uint64_t
+pid_stat_fields(int item)
+{
+    switch (item) {
+    case PROC_PID_STAT_PID:
+    case PROC_PID_STAT_PSARGS:
+	return 0;
+    case PROC_PID_STAT_TTYNAME:
+	return PROC_STAT_FIELD(PROC_PID_STAT_TTY);
+    case PROC_PID_STAT_ENVIRON:
+	return PROC_PID_STAT_ENVIRON_FILE;
+    case PROC_PID_STAT_WCHAN_SYMBOL:
+	return PROC_STAT_FIELD(PROC_PID_STAT_WCHAN) | PROC_PID_STAT_WCHAN_FILE;
+    case PROC_PID_STAT_RTPRIORITY:
+    case PROC_PID_STAT_POLICY:
+    case PROC_PID_STAT_DELAYACCT_BLKIO_TICKS:
+    case PROC_PID_STAT_GUEST_TIME:
+    case PROC_PID_STAT_CGUEST_TIME:
+	return PROC_STAT_FIELD(item - 3);	/* Note the offset */
+    }
+    return (item < NR_PROC_PID_STAT) ? PROC_STAT_FIELD(item) : 0;
+}
+
+/*
+ * Line of /proc/<pid>/status holding the value of a CLUSTER_PID_STATUS
+ * metric item, or -1 for unknown items.
+ */
+static int
+pid_status_line(int item)
+{
+    switch (item) {
+    case PROC_PID_STATUS_UID:
+    case PROC_PID_STATUS_EUID:
+    case PROC_PID_STATUS_SUID:
+    case PROC_PID_STATUS_FSUID:
+    case PROC_PID_STATUS_UID_NM:
+    case PROC_PID_STATUS_EUID_NM:
+    case PROC_PID_STATUS_SUID_NM:
+    case PROC_PID_STATUS_FSUID_NM:
+	return PROC_STATUS_UID;
+    case PROC_PID_STATUS_GID:
+    case PROC_PID_STATUS_EGID:
+    case PROC_PID_STATUS_SGID:
+    case PROC_PID_STATUS_FSGID:
+    case PROC_PID_STATUS_GID_NM:
+    case PROC_PID_STATUS_EGID_NM:
+    case PROC_PID_STATUS_SGID_NM:
+    case PROC_PID_STATUS_FSGID_NM:
+	return PROC_STATUS_GID;
+    case PROC_PID_STATUS_SIGNAL:	return PROC_STATUS_SIGPND;
+    case PROC_PID_STATUS_BLOCKED:	return PROC_STATUS_SIGBLK;
+    case PROC_PID_STATUS_SIGIGNORE:	return PROC_STATUS_SIGIGN;
+    case PROC_PID_STATUS_SIGCATCH:	return PROC_STATUS_SIGCGT;
+    case PROC_PID_STATUS_VMSIZE:	return PROC_STATUS_VMSIZE;
+    case PROC_PID_STATUS_VMLOCK:	return PROC_STATUS_VMLCK;
+    case PROC_PID_STATUS_VMRSS:		return PROC_STATUS_VMRSS;
+    case PROC_PID_STATUS_VMDATA:	return PROC_STATUS_VMDATA;
+    case PROC_PID_STATUS_VMSTACK:	return PROC_STATUS_VMSTK;
+    case PROC_PID_STATUS_VMEXE:		return PROC_STATUS_VMEXE;
+    case PROC_PID_STATUS_VMLIB:		return PROC_STATUS_VMLIB;
+    case PROC_PID_STATUS_VMSWAP:	return PROC_STATUS_VMSWAP;
+    case PROC_PID_STATUS_THREADS:	return PROC_STATUS_THREADS;
+    case PROC_PID_STATUS_VCTXSW:	return PROC_STATUS_VCTXSW;
+    case PROC_PID_STATUS_NVCTXSW:	return PROC_STATUS_NVCTXSW;
+    case PROC_PID_STATUS_CPUSALLOWED:	return PROC_STATUS_CPUSALLOWED;
+    case PROC_PID_STATUS_NGID:		return PROC_STATUS_NGID;
+    case PROC_PID_STATUS_VMPEAK:	return PROC_STATUS_VMPEAK;
+    case PROC_PID_STATUS_VMPIN:		return PROC_STATUS_VMPIN;
+    case PROC_PID_STATUS_VMHWM:		return PROC_STATUS_VMHWM;
+    case PROC_PID_STATUS_VMPTE:		return PROC_STATUS_VMPTE;
+    case PROC_PID_STATUS_NSTGID:	return PROC_STATUS_NSTGID;
+    case PROC_PID_STATUS_NSPID:		return PROC_STATUS_NSPID;
+    case PROC_PID_STATUS_NSPGID:	return PROC_STATUS_NSPGID;
+    case PROC_PID_STATUS_NSSID:		return PROC_STATUS_NSSID;
+    case PROC_PID_STATUS_TGID:		return PROC_STATUS_TGID;
+    case PROC_PID_STATUS_ENVID:		return PROC_STATUS_ENVID;
+    }
+    return -1;
+}
+
+/*
+ * Find a unified hierarchy cgroup with values from the given file,
+ * returns zero (no values) if absent, e.g. controller not enabled.
+ */
+static int
+fetch_cgroup2(unsigned int inst, unsigned int file, cgroup2_t **cgp)
+{
+    int		sts;
+
+    sts = pmdaCacheLookup(INDOM(CGROUP2_INDOM), inst, NULL, (void **)cgp);
+    if (sts < 0)
+	return sts;
+    if (sts != PMDA_CACHE_ACTIVE || !((*cgp)->have & file))
+	return 0;
+    return 1;
+}
+
 /*
  * callback provided to pmdaFetch
  */
@@ -1827,6 +2128,30 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	case ITEM_HOTPROC_G_RELOAD_CONFIG: /* hotproc.control.reload_config */
 	    atom->ul = 0;
 	    break;
+	case ITEM_HOTPROC_G_TOPK: /* hotproc.control.topk */
+	    atom->ul = get_hotproc_topk();
+	    break;
+	case ITEM_HOTPROC_G_RANK: /* hotproc.control.rank */
+	    atom->cp = (char *)get_hotproc_rank();
+	    break;
+	case ITEM_HOTPROC_G_EVAL_COUNT: /* hotproc.control.eval.count */
+	case ITEM_HOTPROC_G_EVAL_TIME: /* hotproc.control.eval.time */
+	case ITEM_HOTPROC_G_EVAL_LAST: /* hotproc.control.eval.last */
+	case ITEM_HOTPROC_G_EVAL_NPROCS: { /* hotproc.control.eval.nprocs */
+	    __uint32_t count, last, nprocs;
+	    __uint64_t total;
+
+	    get_hot_eval(&count, &total, &last, &nprocs);
+	    if (idp->item == ITEM_HOTPROC_G_EVAL_COUNT)
+		atom->ul = count;
+	    else if (idp->item == ITEM_HOTPROC_G_EVAL_TIME)
+		atom->ull = total;
+	    else if (idp->item == ITEM_HOTPROC_G_EVAL_LAST)
+		atom->ul = last;
+	    else
+		atom->ul = nprocs;
+	    break;
+	}
 	case ITEM_HOTPROC_G_CPUIDLE: /* hotproc.total.cpuidle */
 	    atom->f = have_totals ? tci : 0;
 	    break;
@@ -1918,21 +2243,19 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		break;
 
 	    case PROC_PID_STAT_TTYNAME: /* proc.psinfo.tty */
-		f = _pm_getfield(entry->stat_buf, PROC_PID_STAT_TTY);
-		if (f == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(PROC_PID_STAT_TTY)))
 		    atom->cp = "?";
 		else {
-		    dev_t dev = get_encoded_dev(f);
+		    dev_t dev = (dev_t)(unsigned int)entry->stat.field[PROC_PID_STAT_TTY];
 		    atom->cp = get_ttyname_info(inst, dev);
 		}
 		break;
 
 	    case PROC_PID_STAT_TTY_PGRP: /* proc.psinfo.tty_pgrp */
-		f = _pm_getfield(entry->stat_buf, PROC_PID_STAT_TTY_PGRP);
-		if (f == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(PROC_PID_STAT_TTY_PGRP)))
 		    return 0;
 		else {
-		    __int32_t value = (__int32_t)strtol(f, &tail, 0);
+		    __int32_t value = (__int32_t)entry->stat.field[PROC_PID_STAT_TTY_PGRP];
 		    if (value < 0)
 			return 0;
 		    atom->ul = (__uint32_t)value;
@@ -1940,11 +2263,9 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		break;
 
 	    case PROC_PID_STAT_CMD: /* proc.psinfo.cmd */
-		f = _pm_getfield(entry->stat_buf, idp->item);
-		if (f == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(PROC_PID_STAT_CMD)))
 		    return 0;
-		atom->cp = f + 1;
-		atom->cp[strlen(atom->cp)-1] = '\0';
+		atom->cp = entry->stat.cmd;
 		break;
 
 	    case PROC_PID_STAT_PSARGS: /* proc.psinfo.psargs */
@@ -1952,26 +2273,23 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		break;
 
 	    case PROC_PID_STAT_STATE: /* string */ /* proc.psinfo.sname */
-		f = _pm_getfield(entry->stat_buf, idp->item);
-		if (f == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(PROC_PID_STAT_STATE)))
 		    return 0;
-	    	atom->cp = f;
+	    	atom->cp = entry->stat.state;
 		break;
 
 	    case PROC_PID_STAT_VSIZE: /* proc.psinfo.vsize */
 	    case PROC_PID_STAT_RSS_RLIM: /* bytes converted to kbytes */ /* proc.psinfo.rss_rlim */
-		f = _pm_getfield(entry->stat_buf, idp->item);
-		if (f == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(idp->item)))
 		    return 0;
-		atom->ull = strtoull(f, &tail, 0);
+		atom->ull = entry->stat.field[idp->item];
 		atom->ull /= 1024;
 		break;
 
 	    case PROC_PID_STAT_RSS: /* pages converted to kbytes */ /* proc.psinfo.rss */
-		f = _pm_getfield(entry->stat_buf, idp->item);
-		if (f == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(idp->item)))
 		    return 0;
-		atom->ull = strtoull(f, &tail, 0);
+		atom->ull = entry->stat.field[idp->item];
 		atom->ull *= _pm_system_pagesize / 1024;
 		break;
 
@@ -1980,26 +2298,24 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    case PROC_PID_STAT_CUTIME: /* proc.psinfo.cutime */
 	    case PROC_PID_STAT_CSTIME: /* proc.psinfo.cstime */
 		/* unsigned jiffies converted to unsigned msecs */
-		f = _pm_getfield(entry->stat_buf, idp->item);
-		if (f == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(idp->item)))
 		    return 0;
-		jiffies = (__int64_t)strtoul(f, &tail, 0);
+		jiffies = (__int64_t)(unsigned long)entry->stat.field[idp->item];
 		_pm_assign_ulong(atom, jiffies * 1000 / hz);
 		break;
 
 	    case PROC_PID_STAT_PRIORITY: /* proc.psinfo.priority */
 	    case PROC_PID_STAT_NICE: /* signed decimal int */ /* proc.psinfo.nice */
 		/* both are signed decimal integers in range [-20,20] */
-		f = _pm_getfield(entry->stat_buf, idp->item);
-		if (f == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(idp->item)))
 		    return 0;
-		atom->l = (__int32_t)strtol(f, &tail, 0);
+		atom->l = (__int32_t)entry->stat.field[idp->item];
 		break;
 
 	    case PROC_PID_STAT_WCHAN: /* proc.psinfo.wchan */
-		if ((f = _pm_getfield(entry->stat_buf, idp->item)) == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(idp->item)))
 		    return 0;
-		_pm_assign_ulong(atom, (__pm_kernel_ulong_t)strtoull(f, &tail, 0));
+		_pm_assign_ulong(atom, (__pm_kernel_ulong_t)entry->stat.field[idp->item]);
 		break;
  
 	    case PROC_PID_STAT_ENVIRON: /* proc.psinfo.environ */
@@ -2015,20 +2331,21 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		     * Convert address to symbol name if requested
 		     * Added by Mike Mason <mmlnx@us.ibm.com>
 		     */
-		    f = _pm_getfield(entry->stat_buf, PROC_PID_STAT_WCHAN);
-		    if (f == NULL)
+		    if (!(entry->stat.have & PROC_STAT_FIELD(PROC_PID_STAT_WCHAN)))
 			return 0;
-		    _pm_assign_ulong(atom, (__pm_kernel_ulong_t)strtoull(f, &tail, 0));
+		    _pm_assign_ulong(atom, (__pm_kernel_ulong_t)entry->stat.field[PROC_PID_STAT_WCHAN]);
+		    snprintf(fetch_text, FETCH_TEXTLEN, "%llu",
+			(unsigned long long)entry->stat.field[PROC_PID_STAT_WCHAN]);
 #if defined(HAVE_64BIT_LONG)
 		    if ((wc = wchan(atom->ull)))
 			atom->cp = wc;
 		    else
-			atom->cp = atom->ull ? f : "";
+			atom->cp = atom->ull ? fetch_text : "";
 #else
 		    if ((wc = wchan((__psint_t)atom->ul)))
 			atom->cp = wc;
 		    else
-			atom->cp = atom->ul ? f : "";
+			atom->cp = atom->ul ? fetch_text : "";
 #endif
 		}
 		break;
@@ -2036,9 +2353,9 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    /* The following 2 case groups need to be here since the #defines don't match the index into the buffer */
 	    case PROC_PID_STAT_RTPRIORITY: /* proc.psinfo.rt_priority */
 	    case PROC_PID_STAT_POLICY: /* proc.psinfo.policy */
-	    	if ((f = _pm_getfield(entry->stat_buf, idp->item - 3)) == NULL) /* Note the offset */
-		    	return 0;
-		    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+		if (!(entry->stat.have & PROC_STAT_FIELD(idp->item - 3)))
+		    return 0;
+		atom->ul = (__uint32_t)entry->stat.field[idp->item - 3]; /* Note the offset */
 	    	break;
 
 	    case PROC_PID_STAT_DELAYACCT_BLKIO_TICKS: /* proc.psinfo.delayacct_blkio_time */
@@ -2047,20 +2364,18 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    	/*
 		 * unsigned jiffies converted to unsigned milliseconds
 		 */
-		if ((f = _pm_getfield(entry->stat_buf, idp->item - 3)) == NULL)  /* Note the offset */
+		if (!(entry->stat.have & PROC_STAT_FIELD(idp->item - 3)))
 		    return 0;
-
-		jiffies = (__uint64_t)strtoul(f, &tail, 0);
+		jiffies = (__uint64_t)(unsigned long)entry->stat.field[idp->item - 3]; /* Note the offset */
 		atom->ull = jiffies * 1000 / hz;
 	    	break;
 	    case PROC_PID_STAT_START_TIME: /* proc.psinfo.start_time */
 	    	/*
 		 * unsigned jiffies converted to unsigned milliseconds
 		 */
-		if ((f = _pm_getfield(entry->stat_buf, idp->item)) == NULL)
+		if (!(entry->stat.have & PROC_STAT_FIELD(idp->item)))
 		    return 0;
-
-		jiffies = (__uint64_t)strtoul(f, &tail, 0);
+		jiffies = (__uint64_t)(unsigned long)entry->stat.field[idp->item];
 		atom->ull = jiffies * 1000 / hz;
 	    	break;
 
@@ -2069,9 +2384,9 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		 * unsigned decimal int
 		 */
 		if (idp->item < NR_PROC_PID_STAT) {
-		    if ((f = _pm_getfield(entry->stat_buf, idp->item)) == NULL)
-		    	return 0;
-		    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+		    if (!(entry->stat.have & PROC_STAT_FIELD(idp->item)))
+			return 0;
+		    atom->ul = (__uint32_t)entry->stat.field[idp->item];
 		}
 		else
 		    return PM_ERR_PMID;
@@ -2096,9 +2411,9 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 
 	    if (idp->item <= PROC_PID_STATM_DIRTY) {
 		/* unsigned int */
-		if ((f = _pm_getfield(entry->statm_buf, idp->item)) == NULL)
+		if (entry->statm.nfields == 0)
 		    return 0;
-		atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+		atom->ul = (__uint32_t)entry->statm.field[idp->item];
 		atom->ul *= _pm_system_pagesize / 1024;
 	    }
 	    else
@@ -2192,8 +2507,18 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
     case CLUSTER_PID_STATUS:
 	if (!have_access)
 	    return PM_ERR_PERMISSION;
-	if ((entry = fetch_proc_pid_status(inst, active_proc_pid, &sts)) == NULL)
-		return sts;
+	if ((entry = fetch_proc_pid_status(inst, active_proc_pid, &sts)) == NULL) {
+	    switch (idp->item) {
+	    case PROC_PID_STATUS_SIGNAL:
+	    case PROC_PID_STATUS_BLOCKED:
+	    case PROC_PID_STATUS_SIGCATCH:
+	    case PROC_PID_STATUS_SIGIGNORE:
+		/* signal masks missing are no values, not an error */
+		if (sts == PM_ERR_APPVERSION)
+		    return 0;
+	    }
+	    return sts;
+	}
 
 	switch (idp->item) {
 
@@ -2207,9 +2532,9 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	case PROC_PID_STATUS_FSUID_NM: { /* proc.id.fsuid_nm */
 	    struct passwd *pwe;
 
-	    if ((f = _pm_getfield(entry->status_lines.uid, (idp->item % 4) + 1)) == NULL)
+	    if (!(entry->status.have & PROC_STATUS_LINE(PROC_STATUS_UID)))
 		return 0;
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+	    atom->ul = entry->status.uid[idp->item % 4];
 	    if (idp->item > PROC_PID_STATUS_FSUID) {
 		if ((pwe = getpwuid((uid_t)atom->ul)) != NULL)
 		    atom->cp = pwe->pw_name;
@@ -2229,9 +2554,9 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	case PROC_PID_STATUS_FSGID_NM: { /* proc.id.fsgid_nm */
 	    struct group *gre;
 
-	    if ((f = _pm_getfield(entry->status_lines.gid, (idp->item % 4) + 1)) == NULL)
+	    if (!(entry->status.have & PROC_STATUS_LINE(PROC_STATUS_GID)))
 		return 0;
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+	    atom->ul = entry->status.gid[idp->item % 4];
 	    if (idp->item > PROC_PID_STATUS_FSGID) {
 		if ((gre = getgrgid((gid_t)atom->ul)) != NULL) {
 		    atom->cp = gre->gr_name;
@@ -2242,175 +2567,58 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	}
 	break;
 
-	case PROC_PID_STATUS_SIGNAL: /* proc.psinfo.signal_s */
-	if ((atom->cp = _pm_getfield(entry->status_lines.sigpnd, 1)) == NULL)
-	    return 0;
-	break;
-
-	case PROC_PID_STATUS_BLOCKED: /* proc.psinfo.blocked_s */
-	if ((atom->cp = _pm_getfield(entry->status_lines.sigblk, 1)) == NULL)
-	    return 0;
-	break;
-
-	case PROC_PID_STATUS_SIGCATCH: /* proc.psinfo.sigcatch_s */
-	if ((atom->cp = _pm_getfield(entry->status_lines.sigcgt, 1)) == NULL)
-	    return 0;
-	break;
-
-	case PROC_PID_STATUS_SIGIGNORE: /* proc.psinfo.sigignore_s */
-	if ((atom->cp = _pm_getfield(entry->status_lines.sigign, 1)) == NULL)
-	    return 0;
-	break;
-
 	case PROC_PID_STATUS_VMPEAK: /* proc.memory.vmpeak */
-	if ((f = _pm_getfield(entry->status_lines.vmpeak, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMSIZE: /* proc.memory.vmsize */
-	if ((f = _pm_getfield(entry->status_lines.vmsize, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMPIN: /* proc.memory.vmpin */
-	if ((f = _pm_getfield(entry->status_lines.vmpin, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMHWM: /* proc.memory.vmhwm */
-	if ((f = _pm_getfield(entry->status_lines.vmhwm, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMPTE: /* proc.memory.vmpte */
-	if ((f = _pm_getfield(entry->status_lines.vmpte, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMLOCK: /* proc.memory.vmlock */
-	if ((f = _pm_getfield(entry->status_lines.vmlck, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMRSS: /* proc.memory.vmrss */
-        if ((f = _pm_getfield(entry->status_lines.vmrss, 1)) == NULL)
-            atom->ul = 0;
-        else
-            atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-        break;
-
 	case PROC_PID_STATUS_VMDATA: /* proc.memory.vmdata */
-	if ((f = _pm_getfield(entry->status_lines.vmdata, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMSTACK: /* proc.memory.vmstack */
-	if ((f = _pm_getfield(entry->status_lines.vmstk, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMEXE: /* proc.memory.vmexe */
-	if ((f = _pm_getfield(entry->status_lines.vmexe, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMLIB: /* proc.memory.vmlib */
-	if ((f = _pm_getfield(entry->status_lines.vmlib, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VMSWAP: /* proc.memory.vmswap */
-	if ((f = _pm_getfield(entry->status_lines.vmswap, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_THREADS: /* proc.psinfo.threads */
-	if ((f = _pm_getfield(entry->status_lines.threads, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_VCTXSW: /* proc.psinfo.vctxsw */
-	if ((f = _pm_getfield(entry->status_lines.vctxsw, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
 	case PROC_PID_STATUS_NVCTXSW: /* proc.psinfo.nvctxsw */
-	if ((f = _pm_getfield(entry->status_lines.nvctxsw, 1)) == NULL)
-	    atom->ul = 0;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
-	case PROC_PID_STATUS_CPUSALLOWED: /* proc.psinfo.cpusallowed */
-	if ((atom->cp = _pm_getfield(entry->status_lines.cpusallowed, 1)) == NULL)
-	    return PM_ERR_APPVERSION;
-	break;
+	case PROC_PID_STATUS_NGID: { /* proc.psinfo.ngid, default NUMA group 0 */
+	    int line = pid_status_line(idp->item);
 
-	case PROC_PID_STATUS_NGID: /* proc.psinfo.ngid */
-	if ((f = _pm_getfield(entry->status_lines.ngid, 1)) == NULL)
-	    atom->ul = 0;	/* default to NUMA group zero */
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
-	break;
-
-	case PROC_PID_STATUS_TGID: /* proc.psinfo.tgid */
-	if ((f = _pm_getfield(entry->status_lines.tgid, 1)) == NULL)
-	    return PM_ERR_APPVERSION;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+	    if (!(entry->status.have & PROC_STATUS_LINE(line)))
+		atom->ul = 0;
+	    else
+		atom->ul = (__uint32_t)entry->status.value[line];
+	}
 	break;
 
-	case PROC_PID_STATUS_ENVID: /* proc.psinfo.envid */
-	if ((f = _pm_getfield(entry->status_lines.envid, 1)) == NULL)
-	    return PM_ERR_APPVERSION;
-	else
-	    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+	case PROC_PID_STATUS_SIGNAL: /* proc.psinfo.signal_s */
+	case PROC_PID_STATUS_BLOCKED: /* proc.psinfo.blocked_s */
+	case PROC_PID_STATUS_SIGCATCH: /* proc.psinfo.sigcatch_s */
+	case PROC_PID_STATUS_SIGIGNORE: /* proc.psinfo.sigignore_s */
+	if ((atom->cp = entry->status_text[pid_status_line(idp->item) - PROC_STATUS_SIGPND]) == NULL)
+	    return 0;
 	break;
 
+	case PROC_PID_STATUS_CPUSALLOWED: /* proc.psinfo.cpusallowed */
 	case PROC_PID_STATUS_NSTGID: /* proc.namespaces.tgid */
-	if ((atom->cp = entry->status_lines.nstgid) == NULL)
-	    return PM_ERR_APPVERSION;
-	break;
-
 	case PROC_PID_STATUS_NSPID: /* proc.namespaces.pid */
-	if ((atom->cp = entry->status_lines.nspid) == NULL)
+	case PROC_PID_STATUS_NSPGID: /* proc.namespaces.pgid */
+	case PROC_PID_STATUS_NSSID: /* proc.namespaces.sid */
+	if ((atom->cp = entry->status_text[pid_status_line(idp->item) - PROC_STATUS_SIGPND]) == NULL)
 	    return PM_ERR_APPVERSION;
 	break;
 
-	case PROC_PID_STATUS_NSPGID: /* proc.namespaces.pgid */
-	if ((atom->cp = entry->status_lines.nspgid) == NULL)
+	case PROC_PID_STATUS_TGID: /* proc.psinfo.tgid */
+	if (!(entry->status.have & PROC_STATUS_LINE(PROC_STATUS_TGID)))
 	    return PM_ERR_APPVERSION;
+	atom->ul = (__uint32_t)entry->status.value[PROC_STATUS_TGID];
 	break;
 
-	case PROC_PID_STATUS_NSSID: /* proc.namespaces.sid */
-	if ((atom->cp = entry->status_lines.nssid) == NULL)
+	case PROC_PID_STATUS_ENVID: /* proc.psinfo.envid */
+	if (!(entry->status.have & PROC_STATUS_LINE(PROC_STATUS_ENVID)))
 	    return PM_ERR_APPVERSION;
+	atom->ul = (__uint32_t)entry->status.value[PROC_STATUS_ENVID];
 	break;
 
 	default:
@@ -2979,6 +3187,144 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	break;
     }
 
+    case CLUSTER_CGROUP2_CPU: {
+	cgroup2_t *cg;
+
+	if ((sts = fetch_cgroup2(inst, CGROUP2_CPU, &cg)) <= 0)
+	    return sts;
+	switch (idp->item) {
+	case CG2_CPU_USAGE: /* cgroup.unified.cpu.usage */
+	    atom->ull = cg->cpu.usage;
+	    break;
+	case CG2_CPU_USER: /* cgroup.unified.cpu.user */
+	    atom->ull = cg->cpu.user;
+	    break;
+	case CG2_CPU_SYSTEM: /* cgroup.unified.cpu.system */
+	    atom->ull = cg->cpu.system;
+	    break;
+	case CG2_CPU_PERIODS: /* cgroup.unified.cpu.periods */
+	    atom->ull = cg->cpu.nr_periods;
+	    break;
+	case CG2_CPU_THROTTLED: /* cgroup.unified.cpu.throttled */
+	    atom->ull = cg->cpu.nr_throttled;
+	    break;
+	case CG2_CPU_THROTTLED_TIME: /* cgroup.unified.cpu.throttled_time */
+	    atom->ull = cg->cpu.throttled;
+	    break;
+	default:
+	    return PM_ERR_PMID;
+	}
+	break;
+    }
+
+    case CLUSTER_CGROUP2_MEMORY: {
+	cgroup2_t *cg;
+
+	if ((sts = fetch_cgroup2(inst, CGROUP2_MEMORY, &cg)) <= 0)
+	    return sts;
+	switch (idp->item) {
+	case CG2_MEMORY_ANON: /* cgroup.unified.memory.anon */
+	    atom->ull = cg->memory.anon;
+	    break;
+	case CG2_MEMORY_FILE: /* cgroup.unified.memory.file */
+	    atom->ull = cg->memory.file;
+	    break;
+	case CG2_MEMORY_KERNEL_STACK: /* cgroup.unified.memory.kernel_stack */
+	    atom->ull = cg->memory.kernel_stack;
+	    break;
+	case CG2_MEMORY_SLAB: /* cgroup.unified.memory.slab */
+	    atom->ull = cg->memory.slab;
+	    break;
+	case CG2_MEMORY_SOCK: /* cgroup.unified.memory.sock */
+	    atom->ull = cg->memory.sock;
+	    break;
+	case CG2_MEMORY_SHMEM: /* cgroup.unified.memory.shmem */
+	    atom->ull = cg->memory.shmem;
+	    break;
+	case CG2_MEMORY_FILE_MAPPED: /* cgroup.unified.memory.file_mapped */
+	    atom->ull = cg->memory.file_mapped;
+	    break;
+	case CG2_MEMORY_FILE_DIRTY: /* cgroup.unified.memory.file_dirty */
+	    atom->ull = cg->memory.file_dirty;
+	    break;
+	case CG2_MEMORY_FILE_WRITEBACK: /* cgroup.unified.memory.file_writeback */
+	    atom->ull = cg->memory.file_writeback;
+	    break;
+	case CG2_MEMORY_ANON_THP: /* cgroup.unified.memory.anon_thp */
+	    atom->ull = cg->memory.anon_thp;
+	    break;
+	case CG2_MEMORY_INACTIVE_ANON: /* cgroup.unified.memory.inactive_anon */
+	    atom->ull = cg->memory.inactive_anon;
+	    break;
+	case CG2_MEMORY_ACTIVE_ANON: /* cgroup.unified.memory.active_anon */
+	    atom->ull = cg->memory.active_anon;
+	    break;
+	case CG2_MEMORY_INACTIVE_FILE: /* cgroup.unified.memory.inactive_file */
+	    atom->ull = cg->memory.inactive_file;
+	    break;
+	case CG2_MEMORY_ACTIVE_FILE: /* cgroup.unified.memory.active_file */
+	    atom->ull = cg->memory.active_file;
+	    break;
+	case CG2_MEMORY_UNEVICTABLE: /* cgroup.unified.memory.unevictable */
+	    atom->ull = cg->memory.unevictable;
+	    break;
+	case CG2_MEMORY_PGFAULT: /* cgroup.unified.memory.pgfault */
+	    atom->ull = cg->memory.pgfault;
+	    break;
+	case CG2_MEMORY_PGMAJFAULT: /* cgroup.unified.memory.pgmajfault */
+	    atom->ull = cg->memory.pgmajfault;
+	    break;
+	default:
+	    return PM_ERR_PMID;
+	}
+	break;
+    }
+
+    case CLUSTER_CGROUP2_IO: {
+	cgroup2_t *cg;
+
+	if ((sts = fetch_cgroup2(inst, CGROUP2_IO, &cg)) <= 0)
+	    return sts;
+	switch (idp->item) {
+	case CG2_IO_RBYTES: /* cgroup.unified.io.rbytes */
+	    atom->ull = cg->io.rbytes;
+	    break;
+	case CG2_IO_WBYTES: /* cgroup.unified.io.wbytes */
+	    atom->ull = cg->io.wbytes;
+	    break;
+	case CG2_IO_RIOS: /* cgroup.unified.io.rios */
+	    atom->ull = cg->io.rios;
+	    break;
+	case CG2_IO_WIOS: /* cgroup.unified.io.wios */
+	    atom->ull = cg->io.wios;
+	    break;
+	case CG2_IO_DBYTES: /* cgroup.unified.io.dbytes */
+	    atom->ull = cg->io.dbytes;
+	    break;
+	case CG2_IO_DIOS: /* cgroup.unified.io.dios */
+	    atom->ull = cg->io.dios;
+	    break;
+	default:
+	    return PM_ERR_PMID;
+	}
+	break;
+    }
+
+    case CLUSTER_CGROUP2_PROCS: {
+	cgroup2_t *cg;
+
+	if ((sts = fetch_cgroup2(inst, CGROUP2_PROCS, &cg)) <= 0)
+	    return sts;
+	switch (idp->item) {
+	case CG2_PROCS_COUNT: /* cgroup.unified.nprocs */
+	    atom->ul = cg->nprocs;
+	    break;
+	default:
+	    return PM_ERR_PMID;
+	}
+	break;
+    }
+
     case CLUSTER_HOTPROC_PID_FD:
 	active_proc_pid = &hotproc_pid;
 	/*FALLTHROUGH*/
@@ -3044,19 +3390,66 @@ static int
 proc_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 {
     __pmID_int	*idp;
-    int		i, sts, cluster;
+    int		i, sts, line, cluster, prefetch = 0;
     int		need_refresh[NUM_CLUSTERS] = { 0 };
+    __uint64_t	stat_fields[2] = { 0 };		/* proc, hotproc */
+    unsigned int status_lines[2] = { 0 };
+    char	text[FETCH_TEXTLEN];
 
     for (i = 0; i < numpmid; i++) {
 	idp = (__pmID_int *)&(pmidlist[i]);
 	cluster = idp->cluster;
 	if (cluster >= MIN_CLUSTER && cluster < NUM_CLUSTERS)
 	    need_refresh[cluster]++;
+
+	/* only the fields needed for this fetch are extracted */
+	switch (cluster) {
+	case CLUSTER_PID_STAT:
+	case CLUSTER_HOTPROC_PID_STAT:
+	    stat_fields[cluster != CLUSTER_PID_STAT] |= pid_stat_fields(idp->item);
+	    break;
+	case CLUSTER_PID_STATUS:
+	case CLUSTER_HOTPROC_PID_STATUS:
+	    if ((line = pid_status_line(idp->item)) >= 0)
+		status_lines[cluster != CLUSTER_PID_STATUS] |= PROC_STATUS_LINE(line);
+	    break;
+	}
+
+	/* per-process files that can be read in parallel up front */
+	switch (cluster) {
+	case CLUSTER_PID_STAT:
+	    if (idp->item != 99)	/* not proc.nprocs */
+		prefetch |= PROC_PID_FLAG_STAT_FETCHED;
+	    break;
+	case CLUSTER_PID_STATM:
+	    if (idp->item != PROC_PID_STATM_MAPS)
+		prefetch |= PROC_PID_FLAG_STATM_FETCHED;
+	    break;
+	case CLUSTER_PID_STATUS:
+	    prefetch |= PROC_PID_FLAG_STATUS_FETCHED;
+	    break;
+	case CLUSTER_PID_SCHEDSTAT:
+	    prefetch |= PROC_PID_FLAG_SCHEDSTAT_FETCHED;
+	    break;
+	case CLUSTER_PID_IO:
+	    prefetch |= PROC_PID_FLAG_IO_FETCHED;
+	    break;
+	}
     }
 
+    proc_pid.stat_fields = stat_fields[0];
+    proc_pid.status_lines = status_lines[0];
+    hotproc_pid.stat_fields = stat_fields[1];
+    hotproc_pid.status_lines = status_lines[1];
+
     have_access = all_access || proc_ctx_access(pmda->e_context);
-    if ((sts = proc_refresh(pmda, need_refresh)) == 0)
+    if ((sts = proc_refresh(pmda, need_refresh)) == 0) {
+	if (have_access && prefetch)
+	    proc_pid_prefetch(&proc_pid, prefetch, pmda);
+	fetch_text = text;
 	sts = pmdaFetch(numpmid, pmidlist, resp, pmda);
+	fetch_text = NULL;
+    }
     have_access = all_access || proc_ctx_revert(pmda->e_context);
     return sts;
 }
@@ -3164,6 +3557,18 @@ proc_store(pmResult *result, pmdaExt *pmda)
 		    reset_hotproc_timer();
 		}
 		break;
+	    case ITEM_HOTPROC_G_TOPK: /* hotproc.control.topk */
+		if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[0],
+				PM_TYPE_U32, &av, PM_TYPE_U32)) >= 0)
+		    sts = set_hotproc_topk(av.ul);
+		break;
+	    case ITEM_HOTPROC_G_RANK: /* hotproc.control.rank */
+		if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[0],
+				PM_TYPE_STRING, &av, PM_TYPE_STRING)) >= 0) {
+		    sts = set_hotproc_rank(av.cp);
+		    free(av.cp);
+		}
+		break;
 
 	    default:
 		sts = PM_ERR_PERMISSION;
@@ -3282,6 +3687,25 @@ proc_init(pmdaInterface *dp)
 	threads = atoi(envpath);
     if ((envpath = getenv("PROC_ACCESS")) != NULL)
 	all_access = atoi(envpath);
+    if ((envpath = getenv("PROC_WORKERS")) != NULL)
+	workers = atoi(envpath);
+    proc_pid_workers(workers);
+    if ((envpath = getenv("PROC_FDCACHE")) != NULL)
+	fdcache = atoi(envpath);
+    if (fdcache < 0) {
+	/* default to a quarter of the descriptor limit */
+	struct rlimit	rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur != RLIM_INFINITY)
+	    fdcache = rlim.rlim_cur / 4;
+	else
+	    fdcache = 256;
+    }
+    proc_pid_fdcache(fdcache);
+    if ((envpath = getenv("PROC_NETLINK")) != NULL)
+	netlink = atoi(envpath);
+    if (netlink)
+	proc_netlink_init();
 
     if (_isDSO) {
 	char helppath[MAXPATHLEN];
@@ -3323,15 +3747,27 @@ proc_init(pmdaInterface *dp)
     indomtab[CGROUP_PERDEVBLKIO_INDOM].it_indom = CGROUP_PERDEVBLKIO_INDOM;
     indomtab[CGROUP_SUBSYS_INDOM].it_indom = CGROUP_SUBSYS_INDOM;
     indomtab[CGROUP_MOUNTS_INDOM].it_indom = CGROUP_MOUNTS_INDOM;
+    indomtab[CGROUP2_INDOM].it_indom = CGROUP2_INDOM;
 
     proc_pid.indom = &indomtab[PROC_INDOM];
+    proc_pid.fdcache = 1;
 
     indomtab[HOTPROC_INDOM].it_indom = HOTPROC_INDOM;
     hotproc_pid.indom = &indomtab[HOTPROC_INDOM];
 
     hotproc_init();
     init_hotproc_pid(&hotproc_pid);
- 
+
+    /* optional hotproc interval and top-K selection, for testing */
+    if ((envpath = getenv("PROC_HOTPROC_REFRESH")) != NULL) {
+	hotproc_update_interval.tv_sec = atoi(envpath);
+	reset_hotproc_timer();
+    }
+    if ((envpath = getenv("PROC_HOTPROC_RANK")) != NULL)
+	set_hotproc_rank(envpath);
+    if ((envpath = getenv("PROC_HOTPROC_TOPK")) != NULL)
+	set_hotproc_topk(atoi(envpath));
+
     /* 
      * Read System.map and /proc/ksyms. Used to translate wait channel
      * addresses to symbol names. 
@@ -3360,6 +3796,7 @@ proc_init(pmdaInterface *dp)
     pmdaCacheOp(INDOM(CGROUP_PERDEVBLKIO_INDOM), PMDA_CACHE_CULL);
     pmdaCacheOp(INDOM(CGROUP_SUBSYS_INDOM), PMDA_CACHE_CULL);
     pmdaCacheOp(INDOM(CGROUP_MOUNTS_INDOM), PMDA_CACHE_CULL);
+    pmdaCacheOp(INDOM(CGROUP2_INDOM), PMDA_CACHE_CULL);
 }
 
 pmLongOptions	longopts[] = {
@@ -3367,16 +3804,19 @@ pmLongOptions	longopts[] = {
     PMOPT_DEBUG,
     { "no-access-checks", 0, 'A', 0, "no access checks will be performed (insecure, beware!)" },
     PMDAOPT_DOMAIN,
+    { "descriptors", 1, 'F', "N", "per-process file descriptors kept open for re-reading" },
     PMDAOPT_LOGFILE,
     { "with-threads", 0, 'L', 0, "include threads in the all-processes instance domain" },
+    { "netlink", 0, 'N', 0, "track processes and scheduler statistics using netlink" },
     { "from-cgroup", 1, 'r', "NAME", "restrict monitoring to processes in the named cgroup" },
     PMDAOPT_USERNAME,
+    { "workers", 1, 'w', "N", "threads used to read per-process files in parallel" },
     PMOPT_HELP,
     PMDA_OPTIONS_END
 };
 
 pmdaOptions	opts = {
-    .short_options = "AD:d:l:Lr:U:?",
+    .short_options = "AD:d:F:l:LNr:U:w:?",
     .long_options = longopts,
 };
 
@@ -3399,12 +3839,29 @@ main(int argc, char **argv)
 	case 'A':
 	    all_access = 1;
 	    break;
+	case 'F':
+	    fdcache = atoi(opts.optarg);
+	    if (fdcache < 0) {
+		pmprintf("%s: -F requires a non-negative descriptor count\n", pmProgname);
+		opts.errors++;
+	    }
+	    break;
 	case 'L':
 	    threads = 1;
 	    break;
+	case 'N':
+	    netlink = 1;
+	    break;
 	case 'r':
 	    cgroups = opts.optarg;
 	    break;
+	case 'w':
+	    workers = atoi(opts.optarg);
+	    if (workers < 0) {
+		pmprintf("%s: -w requires a non-negative thread count\n", pmProgname);
+		opts.errors++;
+	    }
+	    break;
 	}
     }
 
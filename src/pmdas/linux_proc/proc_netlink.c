@@ -0,0 +1,601 @@
+/*
+ * Linux netlink process tracking and taskstats
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Instead of rescanning /proc with readdir on every fetch, the set of
+ * live tasks can be tracked incrementally from the fork, exec and exit
+ * events multicast by the kernel proc connector.  The table is seeded
+ * once from /proc, then kept current by draining the connector socket
+ * at the start of each refresh.  Should the socket overflow, events
+ * have been lost and the table is reseeded from /proc.
+ *
+ * The taskstats generic netlink family returns per-task accounting
+ * for many tasks with one send and one receive system call, which
+ * replaces the open/read/close of /proc/<pid>/schedstat for each task.
+ * All other fields are still extracted from the /proc files.
+ *
+ * Both interfaces require CAP_NET_ADMIN, and only see the initial pid
+ * namespace, so they are used only when the PMDA runs as root against
+ * the real /proc (not $PROC_STATSPATH), and /proc is not mounted with
+ * the hidepid option (which restricts the pids visible to each client).
+ */
+
+#include "pmapi.h"
+#include "impl.h"
+#include "pmda.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#include "proc_pid.h"
+#include "proc_netlink.h"
+
+extern char *proc_statspath;
+
+typedef struct {
+    int			tgid;		/* thread group (process) id */
+    unsigned int	seq;		/* event sequence number when added */
+} task_t;
+
+static int		cn_fd = -1;	/* proc connector socket */
+static int		ts_fd = -1;	/* taskstats generic netlink socket */
+static int		ts_family;	/* taskstats generic netlink family id */
+static unsigned int	ts_seq;		/* taskstats request sequence number */
+static int		seeded;		/* =1 if tasks reflects /proc */
+static unsigned int	events;		/* proc connector event sequence */
+static __pmHashCtl	tasks;		/* tid -> task_t for live tasks */
+static __pmHashCtl	execs;		/* tgid -> seq of exec since last walk */
+
+static void
+task_add(int tid, int tgid)
+{
+    __pmHashNode	*node;
+    task_t		*tp;
+
+    if ((node = __pmHashSearch(tid, &tasks)) != NULL)
+	tp = (task_t *)node->data;
+    else if ((tp = (task_t *)malloc(sizeof(task_t))) == NULL)
+	return;
+    else if (__pmHashAdd(tid, (void *)tp, &tasks) < 0) {
+	free(tp);
+	return;
+    }
+    tp->tgid = tgid;
+    tp->seq = events;
+}
+
+static void
+task_drop(int tid)
+{
+    __pmHashNode	*node;
+    void		*data;
+
+    if ((node = __pmHashSearch(tid, &tasks)) != NULL) {
+	data = node->data;
+	__pmHashDel(tid, data, &tasks);
+	free(data);
+    }
+}
+
+static __pmHashWalkState
+task_clear(const __pmHashNode *node, void *arg)
+{
+    free(node->data);
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+static __pmHashWalkState
+exec_clear(const __pmHashNode *node, void *arg)
+{
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+/*
+ * (Re)populate the task table from /proc/<pid>/task/<tid>
+ */
+static int
+task_seed(void)
+{
+    DIR			*dirp, *taskdirp;
+    struct dirent	*dp, *tdp;
+    char		path[MAXPATHLEN];
+    int			tgid, count = 0;
+
+    __pmHashWalkCB(task_clear, NULL, &tasks);
+    __pmHashWalkCB(exec_clear, NULL, &execs);
+    seeded = 0;
+
+    if ((dirp = opendir("/proc")) == NULL)
+	return -oserror();
+    while ((dp = readdir(dirp)) != NULL) {
+	if (!isdigit((int)dp->d_name[0]))
+	    continue;
+	tgid = atoi(dp->d_name);
+	task_add(tgid, tgid);
+	snprintf(path, sizeof(path), "/proc/%d/task", tgid);
+	if ((taskdirp = opendir(path)) == NULL) {
+	    count++;
+	    continue;
+	}
+	while ((tdp = readdir(taskdirp)) != NULL) {
+	    if (!isdigit((int)tdp->d_name[0]))
+		continue;
+	    task_add(atoi(tdp->d_name), tgid);
+	    count++;
+	}
+	closedir(taskdirp);
+    }
+    closedir(dirp);
+    seeded = 1;
+
+#if PCP_DEBUG
+    if (pmDebug & DBG_TRACE_LIBPMDA)
+	fprintf(stderr, "task_seed: %d tasks from /proc\n", count);
+#endif
+    return 0;
+}
+
+static void
+task_event(struct proc_event *ev)
+{
+    __pmHashNode	*node;
+    int			tgid;
+
+    events++;
+    switch (ev->what) {
+    case PROC_EVENT_FORK:
+	task_add(ev->event_data.fork.child_pid, ev->event_data.fork.child_tgid);
+	break;
+    case PROC_EVENT_EXEC:
+	/*
+	 * After exec the process has one thread (tid == tgid), but
+	 * no exit event is sent for the tid of an exec'ing thread
+	 * that was not the group leader - remember the exec, so the
+	 * next walk can discard threads of this tgid added earlier.
+	 */
+	tgid = ev->event_data.exec.process_tgid;
+	task_add(ev->event_data.exec.process_pid, tgid);
+	if ((node = __pmHashSearch(tgid, &execs)) != NULL)
+	    node->data = (void *)(__psint_t)events;
+	else
+	    __pmHashAdd(tgid, (void *)(__psint_t)events, &execs);
+	break;
+    case PROC_EVENT_EXIT:
+	task_drop(ev->event_data.exit.process_pid);
+	break;
+    default:
+	break;
+    }
+}
+
+/*
+ * Consume all pending proc connector events, without blocking
+ */
+static int
+task_drain(void)
+{
+    struct nlmsghdr	*nlh;
+    struct cn_msg	*cn;
+    char		buf[8192] __attribute__ ((aligned(NLMSG_ALIGNTO)));
+    int			n, sts = 0;
+
+    for (;;) {
+	if ((n = recv(cn_fd, buf, sizeof(buf), MSG_DONTWAIT)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    if (oserror() != EAGAIN && oserror() != EWOULDBLOCK)
+		sts = -oserror();
+	    break;
+	}
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, n);
+	     nlh = NLMSG_NEXT(nlh, n)) {
+	    if (nlh->nlmsg_type == NLMSG_NOOP)
+		continue;
+	    if (nlh->nlmsg_type == NLMSG_ERROR ||
+		nlh->nlmsg_type == NLMSG_OVERRUN) {
+		sts = -ENOBUFS;
+		continue;
+	    }
+	    cn = (struct cn_msg *)NLMSG_DATA(nlh);
+	    if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+		continue;
+	    task_event((struct proc_event *)cn->data);
+	}
+    }
+    return sts;
+}
+
+static int
+compare_pid(const void *pa, const void *pb)
+{
+    int a = *(int *)pa;
+    int b = *(int *)pb;
+    return a - b;
+}
+
+static void
+pidlist_append(int pid, proc_pid_list_t *pids)
+{
+    if (pids->count >= pids->size) {
+	pids->size = pids->size ? pids->size * 2 : 1024;
+	if (!(pids->pids = (int *)realloc(pids->pids, pids->size * sizeof(int)))) {
+	    perror("pidlist_append: out of memory");
+	    pids->size = pids->count = 0;
+	    return;	/* soldier on bravely */
+	}
+    }
+    pids->pids[pids->count++] = pid;
+}
+
+typedef struct {
+    int			threads;	/* =1 if thread ids are wanted */
+    proc_pid_list_t	*pids;		/* list being built */
+} task_walk_t;
+
+static __pmHashWalkState
+task_walk(const __pmHashNode *node, void *arg)
+{
+    task_walk_t		*walk = (task_walk_t *)arg;
+    task_t		*tp = (task_t *)node->data;
+    __pmHashNode	*exec;
+
+    if (tp->tgid != node->key &&
+	(exec = __pmHashSearch(tp->tgid, &execs)) != NULL &&
+	tp->seq < (unsigned int)(__psint_t)exec->data) {
+	/* thread replaced by a later exec in its thread group */
+	free(tp);
+	return PM_HASH_WALK_DELETE_NEXT;
+    }
+    pidlist_append(tp->tgid, walk->pids);
+    if (walk->threads && tp->tgid != node->key)
+	pidlist_append(node->key, walk->pids);
+    return PM_HASH_WALK_NEXT;
+}
+
+/*
+ * Produce the same list of pids as a readdir of /proc would, i.e. one
+ * entry per thread group (even if the group leader has exited), plus
+ * one entry per thread if want_threads is set, sorted ascending.
+ */
+int
+proc_netlink_pidlist(int want_threads, proc_pid_list_t *pids)
+{
+    task_walk_t		walk;
+    int			i, j, sts;
+
+    if (cn_fd < 0)
+	return -ENOTCONN;
+    if ((sts = task_drain()) < 0 || !seeded) {
+#if PCP_DEBUG
+	if (sts < 0 && (pmDebug & DBG_TRACE_LIBPMDA))
+	    fprintf(stderr, "proc_netlink_pidlist: events lost: %s\n",
+		    pmErrStr(sts));
+#endif
+	/* events still queued are applied on top of the rescan */
+	if ((sts = task_seed()) < 0)
+	    return sts;
+    }
+
+    pids->count = 0;
+    pids->threads = want_threads;
+    walk.threads = want_threads;
+    walk.pids = pids;
+    __pmHashWalkCB(task_walk, &walk, &tasks);
+    __pmHashWalkCB(exec_clear, NULL, &execs);
+
+    /* sort, then squash duplicate thread group ids */
+    qsort(pids->pids, pids->count, sizeof(int), compare_pid);
+    for (i = j = 0; i < pids->count; i++) {
+	if (j == 0 || pids->pids[j-1] != pids->pids[i])
+	    pids->pids[j++] = pids->pids[i];
+    }
+    pids->count = j;
+    return 0;
+}
+
+/*
+ * Taskstats requests need CAP_NET_ADMIN in the current credentials,
+ * which are those of the client while the PMDA is switched to them.
+ */
+int
+proc_netlink_taskstats(void)
+{
+    return ts_fd >= 0 && geteuid() == 0;
+}
+
+/*
+ * Resolve the generic netlink family id for taskstats
+ */
+static int
+taskstats_family(int fd)
+{
+    struct {
+	struct nlmsghdr		n;
+	struct genlmsghdr	g;
+	char			buf[256];
+    } msg;
+    struct nlattr		*na;
+    int				len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    msg.n.nlmsg_type = GENL_ID_CTRL;
+    msg.n.nlmsg_flags = NLM_F_REQUEST;
+    msg.n.nlmsg_seq = ++ts_seq;
+    msg.g.cmd = CTRL_CMD_GETFAMILY;
+    msg.g.version = 1;
+    na = (struct nlattr *)((char *)&msg + NLMSG_ALIGN(msg.n.nlmsg_len));
+    na->nla_type = CTRL_ATTR_FAMILY_NAME;
+    na->nla_len = NLA_HDRLEN + sizeof(TASKSTATS_GENL_NAME);
+    memcpy((char *)na + NLA_HDRLEN, TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+    msg.n.nlmsg_len = NLMSG_ALIGN(msg.n.nlmsg_len) + NLA_ALIGN(na->nla_len);
+
+    if (send(fd, &msg, msg.n.nlmsg_len, 0) < 0)
+	return -oserror();
+    if ((len = recv(fd, &msg, sizeof(msg), 0)) < 0)
+	return -oserror();
+    if (!NLMSG_OK(&msg.n, len))
+	return -EINVAL;
+    if (msg.n.nlmsg_type == NLMSG_ERROR)
+	return ((struct nlmsgerr *)NLMSG_DATA(&msg.n))->error;
+
+    len = msg.n.nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    na = (struct nlattr *)((char *)NLMSG_DATA(&msg.n) + GENL_HDRLEN);
+    while (len >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN && na->nla_len <= len) {
+	if (na->nla_type == CTRL_ATTR_FAMILY_ID)
+	    return *(__u16 *)((char *)na + NLA_HDRLEN);
+	len -= NLA_ALIGN(na->nla_len);
+	na = (struct nlattr *)((char *)na + NLA_ALIGN(na->nla_len));
+    }
+    return -ENOENT;
+}
+
+/*
+ * Extract the scheduler statistics from one taskstats reply
+ */
+static void
+taskstats_reply(struct nlmsghdr *nlh, proc_taskstats_t *tp)
+{
+    struct nlattr	*na, *nested;
+    struct taskstats	stats;
+    int			len, nlen, size;
+
+    len = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    na = (struct nlattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+    while (len >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN && na->nla_len <= len) {
+	if (na->nla_type == TASKSTATS_TYPE_AGGR_PID) {
+	    nlen = na->nla_len - NLA_HDRLEN;
+	    nested = (struct nlattr *)((char *)na + NLA_HDRLEN);
+	    while (nlen >= NLA_HDRLEN && nested->nla_len >= NLA_HDRLEN &&
+		   nested->nla_len <= nlen) {
+		if (nested->nla_type == TASKSTATS_TYPE_STATS) {
+		    /* older kernels may send a shorter structure */
+		    memset(&stats, 0, sizeof(stats));
+		    size = nested->nla_len - NLA_HDRLEN;
+		    if (size > sizeof(stats))
+			size = sizeof(stats);
+		    memcpy(&stats, (char *)nested + NLA_HDRLEN, size);
+		    if (stats.ac_pid != tp->id)
+			return;
+		    tp->cputime = stats.cpu_run_virtual_total;
+		    tp->rundelay = stats.cpu_delay_total;
+		    tp->pcount = stats.cpu_count;
+		    tp->valid = 1;
+		    return;
+		}
+		nlen -= NLA_ALIGN(nested->nla_len);
+		nested = (struct nlattr *)((char *)nested + NLA_ALIGN(nested->nla_len));
+	    }
+	}
+	len -= NLA_ALIGN(na->nla_len);
+	na = (struct nlattr *)((char *)na + NLA_ALIGN(na->nla_len));
+    }
+}
+
+/*
+ * Request taskstats for a batch of tasks.  The kernel processes every
+ * request in the one datagram during the send, queueing one reply (or
+ * error) for each, and these are all then collected by a single call.
+ * Tasks for which no reply arrives are left with valid set to zero,
+ * and the caller falls back to /proc for those.
+ */
+int
+proc_netlink_schedstat(proc_taskstats_t *list, int count)
+{
+    static char		*replies;
+    static struct mmsghdr msgs[PROC_TASKSTATS_BATCH];
+    static struct iovec	iovs[PROC_TASKSTATS_BATCH];
+    static const int	replysize = 2048;
+    struct {
+	struct nlmsghdr		n;
+	struct genlmsghdr	g;
+	struct nlattr		a;
+	__u32			pid;
+    } *req, reqs[PROC_TASKSTATS_BATCH];
+    struct nlmsghdr	*nlh;
+    unsigned int	base;
+    int			i, n, len, sts;
+
+    if (ts_fd < 0)
+	return -ENOTCONN;
+    if (count > PROC_TASKSTATS_BATCH)
+	count = PROC_TASKSTATS_BATCH;
+
+    if (replies == NULL) {
+	if ((replies = malloc(PROC_TASKSTATS_BATCH * replysize)) == NULL)
+	    return -ENOMEM;
+	for (i = 0; i < PROC_TASKSTATS_BATCH; i++) {
+	    iovs[i].iov_base = replies + i * replysize;
+	    iovs[i].iov_len = replysize;
+	    msgs[i].msg_hdr.msg_iov = &iovs[i];
+	    msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+    }
+
+    base = ts_seq + 1;
+    memset(reqs, 0, count * sizeof(reqs[0]));
+    for (i = 0; i < count; i++) {
+	req = &reqs[i];
+	req->n.nlmsg_len = sizeof(*req);
+	req->n.nlmsg_type = ts_family;
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->n.nlmsg_seq = ++ts_seq;
+	req->g.cmd = TASKSTATS_CMD_GET;
+	req->g.version = TASKSTATS_GENL_VERSION;
+	req->a.nla_type = TASKSTATS_CMD_ATTR_PID;
+	req->a.nla_len = NLA_HDRLEN + sizeof(__u32);
+	req->pid = list[i].id;
+	list[i].valid = 0;
+    }
+    if (send(ts_fd, reqs, count * sizeof(reqs[0]), 0) < 0)
+	return -oserror();
+
+    /* replies are already queued, so never wait for missing ones */
+    if ((n = recvmmsg(ts_fd, msgs, count, MSG_DONTWAIT, NULL)) < 0) {
+	sts = -oserror();
+	return (sts == -EAGAIN || sts == -EWOULDBLOCK) ? 0 : sts;
+    }
+    for (sts = i = 0; i < n; i++) {
+	nlh = (struct nlmsghdr *)iovs[i].iov_base;
+	len = msgs[i].msg_len;
+	for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+	    if (nlh->nlmsg_type != ts_family ||
+		nlh->nlmsg_seq - base >= (unsigned int)count)
+		continue;	/* errors (task exited) or stale replies */
+	    taskstats_reply(nlh, &list[nlh->nlmsg_seq - base]);
+	    sts += list[nlh->nlmsg_seq - base].valid;
+	}
+    }
+
+#if PCP_DEBUG
+    if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE))
+	fprintf(stderr, "proc_netlink_schedstat: %d of %d tasks\n", sts, count);
+#endif
+    return sts;
+}
+
+static int
+netlink_socket(int protocol, unsigned int groups)
+{
+    struct sockaddr_nl	addr;
+    int			fd, size = 4 * 1024 * 1024;
+
+    if ((fd = socket(PF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC, protocol)) < 0)
+	return -oserror();
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = groups;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	int	sts = -oserror();
+	close(fd);
+	return sts;
+    }
+    /* try for a larger receive buffer, to ride out bursts of forks */
+    if (groups && setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    return fd;
+}
+
+static int
+proc_connector_listen(int fd)
+{
+    struct {
+	struct nlmsghdr		n;
+	struct cn_msg		cn;
+	enum proc_cn_mcast_op	op;
+    } __attribute__ ((packed)) msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.n.nlmsg_len = sizeof(msg);
+    msg.n.nlmsg_type = NLMSG_DONE;
+    msg.n.nlmsg_pid = getpid();
+    msg.cn.id.idx = CN_IDX_PROC;
+    msg.cn.id.val = CN_VAL_PROC;
+    msg.cn.len = sizeof(enum proc_cn_mcast_op);
+    msg.op = PROC_CN_MCAST_LISTEN;
+    if (send(fd, &msg, sizeof(msg), 0) < 0)
+	return -oserror();
+    return 0;
+}
+
+/*
+ * Check whether /proc restricts pid visibility per-user, in which
+ * case the pid list must come from readdir as the requesting user.
+ */
+static int
+proc_hidepid(void)
+{
+    FILE	*fp;
+    char	buf[MAXPATHLEN], *p;
+    int		hidden = 0;
+
+    if ((fp = fopen("/proc/mounts", "r")) == NULL)
+	return 0;
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+	if (strncmp(buf, "proc /proc ", 11) != 0)
+	    continue;
+	if ((p = strstr(buf, "hidepid=")) != NULL &&
+	    strncmp(p + 8, "0", 1) != 0 && strncmp(p + 8, "off", 3) != 0)
+	    hidden = 1;
+    }
+    fclose(fp);
+    return hidden;
+}
+
+void
+proc_netlink_init(void)
+{
+    int		fd, sts;
+
+    if (proc_statspath[0] != '\0') {
+	__pmNotifyErr(LOG_INFO, "netlink disabled for %s/proc", proc_statspath);
+	return;
+    }
+
+    if (proc_hidepid())
+	__pmNotifyErr(LOG_INFO, "netlink process tracking disabled, "
+			"/proc is mounted with hidepid");
+    else if ((fd = netlink_socket(NETLINK_CONNECTOR, CN_IDX_PROC)) < 0)
+	__pmNotifyErr(LOG_WARNING, "proc connector socket: %s", pmErrStr(fd));
+    else if ((sts = proc_connector_listen(fd)) < 0) {
+	__pmNotifyErr(LOG_WARNING, "proc connector listen: %s", pmErrStr(sts));
+	close(fd);
+    }
+    else {
+	cn_fd = fd;
+	task_seed();
+    }
+
+    if ((fd = netlink_socket(NETLINK_GENERIC, 0)) < 0)
+	__pmNotifyErr(LOG_WARNING, "taskstats socket: %s", pmErrStr(fd));
+    else if ((sts = taskstats_family(fd)) < 0) {
+	__pmNotifyErr(LOG_WARNING, "taskstats family: %s", pmErrStr(sts));
+	close(fd);
+    }
+    else {
+	ts_family = sts;
+	ts_fd = fd;
+    }
+
+    if (pmDebug & DBG_TRACE_APPL0)
+	__pmNotifyErr(LOG_DEBUG, "netlink: process tracking %s, taskstats %s",
+			cn_fd >= 0 ? "enabled" : "disabled",
+			ts_fd >= 0 ? "enabled" : "disabled");
+}
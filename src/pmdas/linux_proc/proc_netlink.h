@@ -0,0 +1,42 @@
+/*
+ * Linux netlink process tracking and taskstats
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef _PROC_NETLINK_H
+#define _PROC_NETLINK_H
+
+/* maximum number of tasks in one batched taskstats request */
+#define PROC_TASKSTATS_BATCH	64
+
+typedef struct {	/* per-task scheduler statistics from taskstats */
+    int			id;		/* pid or tid, set by the caller */
+    int			valid;		/* =1 if the kernel replied for id */
+    __uint64_t		cputime;	/* /proc/<pid>/schedstat fields ... */
+    __uint64_t		rundelay;
+    __uint64_t		pcount;
+} proc_taskstats_t;
+
+/* subscribe to proc connector events, open the taskstats socket */
+extern void proc_netlink_init(void);
+
+/* build pid list from tracked fork/exit events, instead of readdir */
+extern int proc_netlink_pidlist(int, proc_pid_list_t *);
+
+/* =1 if taskstats requests can be made with current credentials */
+extern int proc_netlink_taskstats(void);
+
+/* batched taskstats request for up to PROC_TASKSTATS_BATCH tasks */
+extern int proc_netlink_schedstat(proc_taskstats_t *, int);
+
+#endif /* _PROC_NETLINK_H */
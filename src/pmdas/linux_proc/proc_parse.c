@@ -0,0 +1,275 @@
+/*
+ * Field-selective parsers for /proc/<pid> files
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Each parser makes a single pass over a buffer holding the whole file,
+ * converting only the fields (or lines) requested by the caller directly
+ * into binary form.  Unwanted fields are skipped without being examined.
+ * There is no tokenising copy and no allocation, so unlike _pm_getfield
+ * these can be used concurrently from the prefetch threads.
+ */
+
+#include "pmapi.h"
+#include "impl.h"
+#include "proc_parse.h"
+
+static inline const char *
+skip_space(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+	p++;
+    return p;
+}
+
+static inline const char *
+skip_field(const char *p, const char *end)
+{
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n')
+	p++;
+    return p;
+}
+
+/* unsigned decimal with optional sign, negative values wrap like strtoull */
+static inline const char *
+convert(const char *p, const char *end, __uint64_t *value)
+{
+    __uint64_t	v = 0;
+    int		negate = 0;
+
+    if (p < end && *p == '-') {
+	negate = 1;
+	p++;
+    }
+    while (p < end && (unsigned int)(*p - '0') < 10)
+	v = v * 10 + (*p++ - '0');
+    *value = negate ? -v : v;
+    return p;
+}
+
+/*
+ * Wanted fields missing from the end of the file (older kernels) are
+ * zeroed and still marked as converted, matching the values reported by
+ * earlier versions of the PMDA.  The command and state are only marked
+ * when found.
+ */
+int
+proc_parse_stat(const char *buf, int len, __uint64_t want, proc_stat_t *sp)
+{
+    const char	*p, *cmd, *close, *end = buf + len;
+    int		n;
+
+    sp->have = 0;
+    sp->cmd[0] = sp->state[0] = sp->state[1] = '\0';
+    p = skip_space(buf, end);
+    if (p >= end)
+	return 0;
+
+    for (n = 0; n < PROC_STAT_NFIELDS; n++) {
+	if (want & PROC_STAT_FIELD(n))
+	    sp->field[n] = 0;
+    }
+    sp->have = want & ~(PROC_STAT_FIELD(1) | PROC_STAT_FIELD(2));
+    if (want & PROC_STAT_FIELD(0))
+	convert(p, end, &sp->field[0]);
+
+    /* command may contain whitespace and parentheses, find the last one */
+    if ((cmd = memchr(p, '(', end - p)) == NULL)
+	return 1;
+    if ((close = memrchr(cmd, ')', end - cmd)) == NULL)
+	return 1;
+    if (want & PROC_STAT_FIELD(1)) {
+	n = close - cmd - 1;
+	if (n >= PROC_STAT_CMDLEN)
+	    n = PROC_STAT_CMDLEN - 1;
+	memcpy(sp->cmd, cmd + 1, n);
+	sp->cmd[n] = '\0';
+	sp->have |= PROC_STAT_FIELD(1);
+    }
+
+    p = skip_space(close + 1, end);
+    if (p >= end || *p == '\n')
+	return 2;
+    if (want & PROC_STAT_FIELD(2)) {
+	sp->state[0] = *p;
+	sp->have |= PROC_STAT_FIELD(2);
+    }
+    p = skip_field(p, end);
+
+    for (n = 3; n < PROC_STAT_NFIELDS; n++) {
+	p = skip_space(p, end);
+	if (p >= end || *p == '\n')
+	    break;
+	if (want & PROC_STAT_FIELD(n))
+	    p = convert(p, end, &sp->field[n]);
+	p = skip_field(p, end);
+    }
+    return n;
+}
+
+int
+proc_parse_statm(const char *buf, int len, proc_statm_t *sp)
+{
+    const char	*p = buf, *end = buf + len;
+    int		n;
+
+    memset(sp->field, 0, sizeof(sp->field));
+    for (n = 0; n < PROC_STATM_NFIELDS; n++) {
+	p = skip_space(p, end);
+	if (p >= end || *p == '\n')
+	    break;
+	p = convert(p, end, &sp->field[n]);
+	p = skip_field(p, end);
+    }
+    return sp->nfields = n;
+}
+
+#define MATCH(s)	(n == sizeof(s)-1 && memcmp(p, s, sizeof(s)-1) == 0)
+
+/*
+ * Map a status line header (without the colon) to a PROC_STATUS_* line,
+ * dispatching on the first character before comparing any strings.
+ */
+static int
+status_line(const char *p, int n)
+{
+    switch (*p) {
+    case 'U':
+	if (MATCH("Uid"))
+	    return PROC_STATUS_UID;
+	break;
+    case 'G':
+	if (MATCH("Gid"))
+	    return PROC_STATUS_GID;
+	break;
+    case 'V':
+	if (n < 5 || p[1] != 'm')
+	    break;
+	if (MATCH("VmPeak"))
+	    return PROC_STATUS_VMPEAK;
+	if (MATCH("VmSize"))
+	    return PROC_STATUS_VMSIZE;
+	if (MATCH("VmLck"))
+	    return PROC_STATUS_VMLCK;
+	if (MATCH("VmPin"))
+	    return PROC_STATUS_VMPIN;
+	if (MATCH("VmHWM"))
+	    return PROC_STATUS_VMHWM;
+	if (MATCH("VmRSS"))
+	    return PROC_STATUS_VMRSS;
+	if (MATCH("VmData"))
+	    return PROC_STATUS_VMDATA;
+	if (MATCH("VmStk"))
+	    return PROC_STATUS_VMSTK;
+	if (MATCH("VmExe"))
+	    return PROC_STATUS_VMEXE;
+	if (MATCH("VmLib"))
+	    return PROC_STATUS_VMLIB;
+	if (MATCH("VmPTE"))
+	    return PROC_STATUS_VMPTE;
+	if (MATCH("VmSwap"))
+	    return PROC_STATUS_VMSWAP;
+	break;
+    case 'T':
+	if (MATCH("Threads"))
+	    return PROC_STATUS_THREADS;
+	if (MATCH("Tgid"))
+	    return PROC_STATUS_TGID;
+	break;
+    case 'S':
+	if (n != 6 || p[1] != 'i' || p[2] != 'g')
+	    break;
+	if (MATCH("SigPnd"))
+	    return PROC_STATUS_SIGPND;
+	if (MATCH("SigBlk"))
+	    return PROC_STATUS_SIGBLK;
+	if (MATCH("SigIgn"))
+	    return PROC_STATUS_SIGIGN;
+	if (MATCH("SigCgt"))
+	    return PROC_STATUS_SIGCGT;
+	break;
+    case 'v':
+	if (MATCH("voluntary_ctxt_switches"))
+	    return PROC_STATUS_VCTXSW;
+	break;
+    case 'n':
+	if (MATCH("nonvoluntary_ctxt_switches"))
+	    return PROC_STATUS_NVCTXSW;
+	break;
+    case 'N':
+	if (MATCH("Ngid"))
+	    return PROC_STATUS_NGID;
+	if (MATCH("NStgid"))
+	    return PROC_STATUS_NSTGID;
+	if (MATCH("NSpid"))
+	    return PROC_STATUS_NSPID;
+	if (MATCH("NSpgid"))
+	    return PROC_STATUS_NSPGID;
+	if (MATCH("NSsid"))
+	    return PROC_STATUS_NSSID;
+	break;
+    case 'C':
+	if (MATCH("Cpus_allowed_list"))
+	    return PROC_STATUS_CPUSALLOWED;
+	break;
+    case 'e':
+	if (MATCH("envID"))
+	    return PROC_STATUS_ENVID;
+	break;
+    }
+    return -1;
+}
+
+int
+proc_parse_status(const char *buf, int len, unsigned int want, proc_status_t *sp)
+{
+    const char	*p, *q, *colon, *eol, *end = buf + len;
+    __uint32_t	*ids;
+    __uint64_t	value;
+    int		i, line, count = 0;
+
+    sp->have = 0;
+    for (p = buf; p < end; p = eol + 1) {
+	if ((eol = memchr(p, '\n', end - p)) == NULL)
+	    eol = end;
+	if ((colon = memchr(p, ':', eol - p)) == NULL || colon == p)
+	    continue;
+	if ((line = status_line(p, colon - p)) < 0)
+	    continue;
+	if (!(want & PROC_STATUS_LINE(line)))
+	    continue;
+	sp->have |= PROC_STATUS_LINE(line);
+	count++;
+
+	p = skip_space(colon + 1, eol);
+	if (line == PROC_STATUS_UID || line == PROC_STATUS_GID) {
+	    ids = (line == PROC_STATUS_UID) ? sp->uid : sp->gid;
+	    for (i = 0; i < 4; i++) {
+		p = convert(skip_space(p, eol), eol, &value);
+		ids[i] = (__uint32_t)value;
+	    }
+	}
+	else if (line <= PROC_STATUS_ENVID) {
+	    convert(p, eol, &sp->value[line]);
+	}
+	else {
+	    for (q = eol; q > p && (q[-1] == ' ' || q[-1] == '\t'); q--)
+		;
+	    sp->text[line - PROC_STATUS_SIGPND].offset = p - buf;
+	    sp->text[line - PROC_STATUS_SIGPND].length = q - p;
+	}
+    }
+    return count;
+}
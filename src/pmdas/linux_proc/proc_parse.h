@@ -0,0 +1,104 @@
+/*
+ * Field-selective parsers for /proc/<pid> files
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef _PROC_PARSE_H
+#define _PROC_PARSE_H
+
+/*
+ * /proc/<pid>/stat - fields are numbered from zero (pid) in file order,
+ * the same numbering used by PROC_PID_STAT_* for the first 39 fields.
+ */
+#define PROC_STAT_NFIELDS	52
+#define PROC_STAT_CMDLEN	64
+#define PROC_STAT_FIELD(n)	((__uint64_t)1 << (n))
+
+typedef struct {
+    __uint64_t		have;		/* fields converted by the parser */
+    __uint64_t		field[PROC_STAT_NFIELDS]; /* negative values wrap */
+    char		cmd[PROC_STAT_CMDLEN];	/* without the parentheses */
+    char		state[2];	/* single character state name */
+} proc_stat_t;
+
+/* convert wanted stat fields, returns the number of fields in the buffer */
+extern int proc_parse_stat(const char *, int, __uint64_t, proc_stat_t *);
+
+/*
+ * /proc/<pid>/statm - all seven fields, in pages
+ */
+#define PROC_STATM_NFIELDS	7
+
+typedef struct {
+    int			nfields;	/* number of fields found */
+    __uint64_t		field[PROC_STATM_NFIELDS];
+} proc_statm_t;
+
+extern int proc_parse_statm(const char *, int, proc_statm_t *);
+
+/*
+ * /proc/<pid>/status - each line of interest has a bit in the wanted and
+ * found masks.  Lines up to PROC_STATUS_ENVID have numeric values, the
+ * remainder are text which is located (not copied) by the parser.
+ */
+enum {
+    PROC_STATUS_UID = 0,	/* four values, see proc_status_t.uid */
+    PROC_STATUS_GID,		/* four values, see proc_status_t.gid */
+    PROC_STATUS_VMPEAK,
+    PROC_STATUS_VMSIZE,
+    PROC_STATUS_VMLCK,
+    PROC_STATUS_VMPIN,
+    PROC_STATUS_VMHWM,
+    PROC_STATUS_VMRSS,
+    PROC_STATUS_VMDATA,
+    PROC_STATUS_VMSTK,
+    PROC_STATUS_VMEXE,
+    PROC_STATUS_VMLIB,
+    PROC_STATUS_VMPTE,
+    PROC_STATUS_VMSWAP,
+    PROC_STATUS_THREADS,
+    PROC_STATUS_VCTXSW,
+    PROC_STATUS_NVCTXSW,
+    PROC_STATUS_TGID,
+    PROC_STATUS_NGID,
+    PROC_STATUS_ENVID,
+    PROC_STATUS_SIGPND,		/* first text line */
+    PROC_STATUS_SIGBLK,
+    PROC_STATUS_SIGIGN,
+    PROC_STATUS_SIGCGT,
+    PROC_STATUS_CPUSALLOWED,
+    PROC_STATUS_NSTGID,
+    PROC_STATUS_NSPID,
+    PROC_STATUS_NSPGID,
+    PROC_STATUS_NSSID,
+
+    NR_PROC_STATUS_LINES
+};
+#define PROC_STATUS_LINE(n)	(1U << (n))
+#define PROC_STATUS_NTEXT	(NR_PROC_STATUS_LINES - PROC_STATUS_SIGPND)
+
+typedef struct {
+    unsigned int	have;		/* wanted lines found by the parser */
+    __uint32_t		uid[4];		/* real, effective, saved, fs */
+    __uint32_t		gid[4];
+    __uint64_t		value[PROC_STATUS_ENVID + 1];	/* by line */
+    struct {
+	int		offset;		/* start of value in parsed buffer */
+	int		length;		/* up to, excluding, the newline */
+    } text[PROC_STATUS_NTEXT];		/* by line - PROC_STATUS_SIGPND */
+} proc_status_t;
+
+/* convert wanted status lines, returns the number of lines found */
+extern int proc_parse_status(const char *, int, unsigned int, proc_status_t *);
+
+#endif /* _PROC_PARSE_H */
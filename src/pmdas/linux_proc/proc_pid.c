@@ -1,7 +1,7 @@
 /*
  * Linux proc/<pid>/{stat,statm,status,...} Clusters
  *
- * Copyright (c) 2013-2016 Red Hat.
+ * Copyright (c) 2013-2017 Red Hat.
  * Copyright (c) 2000,2004,2006 Silicon Graphics, Inc.  All Rights Reserved.
  * Copyright (c) 2010 Aconex.  All Rights Reserved.
  * 
@@ -30,6 +30,7 @@
 #include "indom.h"
 #include "cgroups.h"
 #include "hotproc.h"
+#include "proc_netlink.h"
 
 static proc_pid_list_t procpids; /* previous pids list that the proc pmda uses */
 static void refresh_proc_pidlist(proc_pid_t *, proc_pid_list_t *);
@@ -43,6 +44,8 @@ static void refresh_proc_pidlist(proc_pid_t *, proc_pid_list_t *);
 static proc_pid_list_t hotpids;
 /* Hold a pointer to this since we need it for the timer */
 static proc_pid_t *hotproc_poss_pid;
+static __uint64_t hotproc_stat_fields;		/* needed by hotproc_eval_procs */
+static unsigned int hotproc_status_lines;
 
 #define INIT_HOTPROC_MAX 200
 
@@ -80,6 +83,32 @@ static double hot_total_inactive;
 
 static unsigned long hot_refresh_count;
 
+/*
+ * Top-K selection (hotproc.control.topk) - when non-zero, the active
+ * list is limited to the K processes with the largest cpuburn or
+ * iodemand over the last interval, kept in a bounded min-heap so an
+ * evaluation costs O(n log K).  Any configured predicate still filters
+ * the candidates.
+ */
+typedef struct {
+    double	score;		/* cpuburn or iodemand */
+    double	cputime;	/* cpu time used over the interval */
+    pid_t	pid;
+} hot_rank_t;
+
+static const char *hot_rank_names[] = { "cpuburn", "iodemand" };
+static unsigned int hotproc_topk;
+static int hotproc_rank = HOTPROC_RANK_CPUBURN;
+static hot_rank_t *hot_heap;
+static unsigned int hot_numheap;
+static unsigned int hot_maxheap;
+
+/* cost of the hotproc evaluations, microseconds */
+static __uint32_t hot_eval_count;
+static __uint64_t hot_eval_time;
+static __uint32_t hot_eval_last;
+static __uint32_t hot_eval_nprocs;
+
 /* index into proc_list etc.. */
 static int current;
 static int previous = 1;
@@ -100,6 +129,15 @@ get_hot_totals(double * ta, double * ti, double * tt, double * tci )
     return 0;
 }
 
+void
+get_hot_eval(__uint32_t *count, __uint64_t *total, __uint32_t *last, __uint32_t *nprocs)
+{
+    *count = hot_eval_count;
+    *total = hot_eval_time;
+    *last = hot_eval_last;
+    *nprocs = hot_eval_nprocs;
+}
+
 static int
 compare_pid(const void *pa, const void *pb)
 {
@@ -171,13 +209,19 @@ refresh_cgroup_pidlist(int want_threads, proc_runq_t *runq_stats, proc_pid_list_
      *
      * Use the "cgroup.procs" or "tasks" file depending on want_threads.
      * Note that both these files are already sorted, ascending numeric.
+     * The unified hierarchy (cgroup v2) names the latter "cgroup.threads".
      */
-    if (want_threads)
-	snprintf(path, sizeof(path), "%s%s/tasks", proc_statspath, cgroup);
-    else
-	snprintf(path, sizeof(path), "%s%s/cgroup.procs", proc_statspath, cgroup);
-
-    if ((fp = fopen(path, "r")) != NULL) {
+    if (snprintf(path, sizeof(path), "%s%s/%s", proc_statspath, cgroup,
+		want_threads ? "tasks" : "cgroup.procs") >= sizeof(path))
+	return 0;	/* no such cgroup, names this long cannot be opened */
+
+    if ((fp = fopen(path, "r")) == NULL && want_threads) {
+	/* no fallback if the longer name does not fit */
+	if (snprintf(path, sizeof(path), "%s%s/cgroup.threads",
+		    proc_statspath, cgroup) < sizeof(path))
+	    fp = fopen(path, "r");
+    }
+    if (fp != NULL) {
 	while (fscanf(fp, "%d\n", &pid) == 1) {
 	    pidlist_append_pid(pid, pids);
 	    if (runq_stats)
@@ -203,6 +247,10 @@ refresh_global_pidlist(int want_threads, proc_runq_t *runq_stats, proc_pid_list_
     struct dirent *dp;
     char path[MAXPATHLEN];
 
+    /* incremental tracking via the proc connector, unless per-pid runq */
+    if (!runq_stats && proc_netlink_pidlist(want_threads, pids) == 0)
+	return 0;
+
     pids->count = 0;
     pids->threads = want_threads;
 
@@ -233,15 +281,14 @@ refresh_global_pidlist(int want_threads, proc_runq_t *runq_stats, proc_pid_list_
     return 0;
 }
 
+/* the active list is kept in ascending pid order */
 static int
 in_hot_active_list(pid_t pid)
 {
-    int i;
-
-    for (i = 0; i < hot_numactive; i++) {
-        if (pid == hot_active_list[i])
-            return 1;
-    }
+    if (hot_numactive > 0 &&
+	bsearch(&pid, hot_active_list, hot_numactive,
+		sizeof(pid_t), compare_pid) != NULL)
+	return 1;
     return 0;
 }
 
@@ -262,8 +309,10 @@ refresh_hotproc_pidlist(proc_pid_list_t *pids)
 {
     DIR *dirp;
     struct dirent *dp;
+    char path[MAXPATHLEN];
 
-    if ((dirp = opendir("/proc")) == NULL)
+    snprintf(path, sizeof(path), "%s/proc", proc_statspath);
+    if ((dirp = opendir(path)) == NULL)
 	return -oserror();
 
     /* note: readdir on /proc ignores threads */
@@ -327,10 +376,14 @@ add_hot_active_list(process_t *node, config_vars *vars)
     return 1;
 }
 
+/*
+ * Process lists are filled in ascending pid order, the same order as
+ * the pid list they are built from, so are never sorted.
+ */
 static int
 compare_pids(const void *n1, const void *n2)
 {
-    return ((process_t*)n2)->pid - ((process_t*)n1)->pid;
+    return ((process_t*)n1)->pid - ((process_t*)n2)->pid;
 }
 
 static process_t *
@@ -386,6 +439,63 @@ get_hotproc_node(pid_t pid, process_t **getnode)
     return 0;
 }
 
+/* restore the min-heap property from the root down */
+static void
+hot_heap_down(unsigned int n)
+{
+    hot_rank_t	entry = hot_heap[0];
+    unsigned int i = 0, child;
+
+    while ((child = 2 * i + 1) < n) {
+	if (child + 1 < n && hot_heap[child + 1].score < hot_heap[child].score)
+	    child++;
+	if (entry.score <= hot_heap[child].score)
+	    break;
+	hot_heap[i] = hot_heap[child];
+	i = child;
+    }
+    hot_heap[i] = entry;
+}
+
+/* restore the min-heap property from entry i up */
+static void
+hot_heap_up(unsigned int i)
+{
+    hot_rank_t	entry = hot_heap[i];
+    unsigned int parent;
+
+    while (i > 0 && hot_heap[(parent = (i - 1) / 2)].score > entry.score) {
+	hot_heap[i] = hot_heap[parent];
+	i = parent;
+    }
+    hot_heap[i] = entry;
+}
+
+/*
+ * Keep the process if the heap is not yet full, or if it ranks above
+ * the least of those kept so far (the root), which it then replaces.
+ * On equal scores the lower pid, seen first, is kept.
+ */
+static void
+hot_heap_offer(double score, double cputime, pid_t pid)
+{
+    hot_rank_t	*entry;
+
+    if (hot_numheap < hotproc_topk) {
+	entry = &hot_heap[hot_numheap];
+	entry->score = score;
+	entry->cputime = cputime;
+	entry->pid = pid;
+	hot_heap_up(hot_numheap++);
+    }
+    else if (score > hot_heap[0].score) {
+	hot_heap[0].score = score;
+	hot_heap[0].cputime = cputime;
+	hot_heap[0].pid = pid;
+	hot_heap_down(hot_numheap);
+    }
+}
+
 /* The idea of this is copied from linux/proc_stat.c */
 static unsigned long long
 get_idle_time(void)
@@ -406,6 +516,56 @@ get_idle_time(void)
     return idle_time;
 }
 
+/* names and ids of a process, for use by the predicate */
+static void
+hotproc_names(config_vars *vars, proc_pid_entry_t *statentry,
+		proc_pid_entry_t *statusentry)
+{
+    struct passwd *pwe;
+    struct group *gre;
+
+    /* Command */
+    if (!(statentry->stat.have & PROC_STAT_FIELD(PROC_PID_STAT_CMD))) {
+	strcpy(vars->fname, "Unknown");
+    }
+    else {
+	strncpy(vars->fname, statentry->stat.cmd, sizeof(vars->fname));
+	vars->fname[sizeof(vars->fname) - 1] = '\0';
+    }
+
+    /* PS Args */
+    strncpy(vars->psargs, statentry->name+7, sizeof(vars->psargs));
+    vars->psargs[sizeof(vars->psargs)-1]='\0';
+
+    /* UID and GID */
+    if (!(statusentry->status.have & PROC_STATUS_LINE(PROC_STATUS_UID)))
+	vars->uid = 0;
+    else
+	vars->uid = statusentry->status.uid[0];
+
+    if (!(statusentry->status.have & PROC_STATUS_LINE(PROC_STATUS_GID)))
+	vars->gid = 0;
+    else
+	vars->gid = statusentry->status.gid[0];
+
+    /* uname and gname */
+    if ((pwe = getpwuid((uid_t)vars->uid)) != NULL) {
+	strncpy(vars->uname, pwe->pw_name, sizeof(vars->uname));
+	vars->uname[sizeof(vars->uname)-1] = '\0';
+    }
+    else {
+	strcpy(vars->uname, "UNKNOWN");
+    }
+
+    if ((gre = getgrgid((gid_t)vars->gid)) != NULL) {
+	strncpy(vars->gname, gre->gr_name, sizeof(vars->gname));
+	vars->gname[sizeof(vars->gname)-1] = '\0';
+    }
+    else {
+	strcpy(vars->gname, "UNKNOWN");
+    }
+}
+
 /*
  * For each pid, compute stats and store in hotpid array
  * (called by the timer)
@@ -414,7 +574,7 @@ static int
 hotproc_eval_procs(void)
 {
     pid_t pid;
-    struct timeval ts;
+    struct timeval start, ts;
     int sts;
     char                *f;
     unsigned long       ul;
@@ -430,7 +590,8 @@ hotproc_eval_procs(void)
     proc_pid_entry_t    *ioentry;
     proc_pid_entry_t    *schedstatentry;
     __pmHashNode *node;
-    int i;
+    int i, prev = 0;
+    double score;
 
     /* Still need to compute some of these */
     static double refresh_time[2];  /* timestamp after refresh */
@@ -451,6 +612,8 @@ hotproc_eval_procs(void)
     double total_activetime = 0;    /* total of cputime_deltas for active processes */
     double total_inactivetime = 0;  /* total of cputime_deltas for inactive processes */
 
+    __pmtimevalNow(&start);
+
     if (num_cpus == 0) {
 	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
     }
@@ -463,12 +626,17 @@ hotproc_eval_procs(void)
     }
 
     init_hot_active_list();
+    hot_numheap = 0;
 
     memset(&vars, 0, sizeof(config_vars));
 
     hotpids.count = 0;
     hotpids.threads = 0;
 
+    /* fields used below, the table is shared with (and reset by) fetches */
+    hotproc_poss_pid->stat_fields = hotproc_stat_fields;
+    hotproc_poss_pid->status_lines = hotproc_status_lines;
+
     /* Whats running right now */
     refresh_global_pidlist(0, NULL, &hotpids);
     refresh_proc_pidlist(hotproc_poss_pid, &hotpids);
@@ -518,34 +686,24 @@ hotproc_eval_procs(void)
 	/* Calc the stats we will need */
 	/* CPU Time is sum of U & S time */
 	
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_UTIME)) == NULL)
-	    newnode->r_cputime = 0;
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	    newnode->r_cputime      = (double)ul / (double)hz;
-	}
-
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_STIME)) == NULL){
-	    /* Nothing */
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	    newnode->r_cputime      += (double)ul / (double)hz;
-	}
+	ul = (__uint32_t)statentry->stat.field[PROC_PID_STAT_UTIME];
+	newnode->r_cputime      = (double)ul / (double)hz;
+	ul = (__uint32_t)statentry->stat.field[PROC_PID_STAT_STIME];
+	newnode->r_cputime      += (double)ul / (double)hz;
 
-	newnode->r_cputimestamp = p_timestamp.tv_sec + p_timestamp.tv_usec / 1000000;
+	newnode->r_cputimestamp = p_timestamp.tv_sec + p_timestamp.tv_usec / 1000000.0;
 
 	/* Context Switches : vol and invol */
 
-        if ((f = _pm_getfield(statusentry->status_lines.vctxsw, 1)) == NULL)
+	if (!(statusentry->status.have & PROC_STATUS_LINE(PROC_STATUS_VCTXSW)))
 	    newnode->r_vctx = 0;
 	else
-	    newnode->r_vctx = (__uint32_t)strtoul(f, &tail, 0);
+	    newnode->r_vctx = (__uint32_t)statusentry->status.value[PROC_STATUS_VCTXSW];
 
-	if ((f = _pm_getfield(statusentry->status_lines.nvctxsw, 1)) == NULL)
+	if (!(statusentry->status.have & PROC_STATUS_LINE(PROC_STATUS_NVCTXSW)))
 	    newnode->r_ictx = 0;
 	else
-	    newnode->r_ictx = (__uint32_t)strtoul(f, &tail, 0);
+	    newnode->r_ictx = (__uint32_t)statusentry->status.value[PROC_STATUS_NVCTXSW];
 
 	/* IO demand */
 	/* Read */
@@ -572,11 +730,7 @@ hotproc_eval_procs(void)
 	
 	/* Block IO wait (delayacct_blkio_ticks) */
 
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_DELAYACCT_BLKIO_TICKS - 3)) == NULL)  /* Note the offset */
-	    ul = 0;
-	else
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-		
+	ul = (__uint32_t)statentry->stat.field[PROC_PID_STAT_DELAYACCT_BLKIO_TICKS - 3];  /* Note the offset */
 	newnode->r_bwtime = (double)ul / hz;
 
 	/* Schedwait (run_delay) */
@@ -590,8 +744,21 @@ hotproc_eval_procs(void)
 	newnode->r_qwtime = ull;
 
 
+	/*
+	 * Both lists are in ascending pid order, so the previous sample
+	 * for this pid (if any) is found by advancing through that list.
+	 */
+	while (prev < hot_numprocs[previous] &&
+	       hotproc_list[previous][prev].pid < pid)
+	    prev++;
+	if (prev < hot_numprocs[previous] &&
+	    hotproc_list[previous][prev].pid == pid)
+	    oldnode = &hotproc_list[previous][prev];
+	else
+	    oldnode = NULL;
+
 	/* This is not the first time through, so we can generate rate stats */
-	if ((oldnode = lookup_node(previous, pid)) != NULL) {
+	if (oldnode != NULL) {
 
 	    /* CPU */
 	    cputime_delta = diff_counter(newnode->r_cputime, oldnode->r_cputime, PM_TYPE_64);
@@ -643,93 +810,38 @@ hotproc_eval_procs(void)
 
         total_cputime += cputime_delta;
 
-	/* Command */
-
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_CMD)) == NULL) {
-	    strcpy(vars.fname, "Unknown");
-	}
-	else {
-	    char *cmd = f + 1;	/* skip enclosing parentheses */
-	    size_t len = strlen(cmd);
-
-	    strncpy(vars.fname, cmd, sizeof(vars.fname));
-	    if (len < sizeof(vars.fname))
-		vars.fname[len-1] = '\0'; /* Skip the closing parenthesis */
-	    vars.fname[sizeof(vars.fname) - 1] = '\0';
-	}
-
-	/* PS Args */
-	strncpy(vars.psargs, statentry->name+7, sizeof(vars.psargs));
-	vars.psargs[sizeof(vars.psargs)-1]='\0';
-
-	/* UID and GID */
-	if ((f = _pm_getfield(statusentry->status_lines.uid, 1)) == NULL) {
-	    ul = 0;
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	}
-	
-	vars.uid = ul;
-
-	if ((f = _pm_getfield(statusentry->status_lines.gid, 1)) == NULL) {
-	    ul = 0;
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	}
-
-	vars.gid = ul;
-
-	/* uname and gname */
-
-	struct passwd *pwe;		
-
-	if ((pwe = getpwuid((uid_t)vars.uid)) != NULL) {
-	    strncpy(vars.uname, pwe->pw_name, sizeof(vars.uname));
-	    vars.uname[sizeof(vars.uname)-1] = '\0';
-	}
-	else {
-	    strcpy(vars.uname, "UNKNOWN");
-	}
-
-	struct group *gre;
-
-	if ((gre = getgrgid((gid_t)vars.gid)) != NULL) {
-	    strncpy(vars.gname, gre->gr_name, sizeof(vars.gname));
-	    vars.gname[sizeof(vars.gname)-1] = '\0';
-	} 
-	else {
-	    strcpy(vars.gname, "UNKNOWN");
-	}
+	/* names are only needed when there is a predicate to evaluate */
+	if (conf_gen)
+	    hotproc_names(&vars, statentry, statusentry);
 
 	/* VSIZE from stat */
 
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_VSIZE)) == NULL) {
-	    ul = 0;
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	    ul /= 1024;
-	}
+	ul = (__uint32_t)statentry->stat.field[PROC_PID_STAT_VSIZE];
+	ul /= 1024;
 
 	vars.preds.virtualsize = ul;
 
 	/* RSS from stat */
 
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_RSS)) == NULL) {
-	    ul = 0;
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	    ul *= getpagesize() / 1024;
-	}
+	ul = (__uint32_t)statentry->stat.field[PROC_PID_STAT_RSS];
+	ul *= getpagesize() / 1024;
 
 	vars.preds.residentsize = ul;
 
 	//  Struct copy.  I think it was a bug before.  Copy should be after rss and vm calcs
 	newnode->preds = vars.preds;
 
+	if (hotproc_topk) {
+	    /* rank only those processes busy over the interval */
+	    if (hotproc_rank == HOTPROC_RANK_IODEMAND)
+		score = vars.preds.iodemand;
+	    else
+		score = vars.cpuburn;
+	    if (score > 0 && (!conf_gen || eval_tree(&vars)))
+		hot_heap_offer(score, cputime_delta, pid);
+	    continue;
+	}
+
 	if ((sts = add_hot_active_list(newnode, &vars)) < 0) {
 	    return sts;
        	}
@@ -743,10 +855,26 @@ hotproc_eval_procs(void)
 
     hot_numprocs[current] = np;
 
+    if (hotproc_topk) {
+	/* the heap holds the selected processes, in no particular order */
+	for (i = 0; i < hot_numheap; i++) {
+	    hot_active_list[i] = hot_heap[i].pid;
+	    total_activetime += hot_heap[i].cputime;
+	}
+	hot_numactive = hot_numheap;
+	qsort(hot_active_list, hot_numactive, sizeof(pid_t), compare_pid);
+	total_inactivetime = total_cputime - total_activetime;
+    }
+
     __pmtimevalNow(&ts);
-    refresh_time[current] = ts.tv_sec + ts.tv_usec / 1000000;
+    refresh_time[current] = ts.tv_sec + ts.tv_usec / 1000000.0;
 
-    double hptime = (ts.tv_sec - p_timestamp.tv_sec) + (ts.tv_usec - p_timestamp.tv_usec)/1000000.0;
+    double hptime = __pmtimevalSub(&ts, &start);
+
+    hot_eval_count++;
+    hot_eval_last = (__uint32_t)(hptime * 1000000);
+    hot_eval_time += hot_eval_last;
+    hot_eval_nprocs = np;
 
     if (pmDebug & DBG_TRACE_LIBPMDA)
 	fprintf(stderr, "Hotproc Update took %f time\n", hptime);
@@ -773,9 +901,6 @@ hotproc_eval_procs(void)
         hot_total_inactive = total_inactivetime / actual_delta;
     }
 
-    qsort(hotproc_list[current], hot_numprocs[current],
-          sizeof(process_t), compare_pids);
-
     return 0;
 }
 
@@ -789,6 +914,16 @@ void
 init_hotproc_pid(proc_pid_t *_hotproc_poss_pid)
 {
     hotproc_poss_pid = _hotproc_poss_pid;
+    hotproc_stat_fields = PROC_STAT_FIELD(PROC_PID_STAT_CMD) |
+	PROC_STAT_FIELD(PROC_PID_STAT_UTIME) |
+	PROC_STAT_FIELD(PROC_PID_STAT_STIME) |
+	PROC_STAT_FIELD(PROC_PID_STAT_VSIZE) |
+	PROC_STAT_FIELD(PROC_PID_STAT_RSS) |
+	PROC_STAT_FIELD(PROC_PID_STAT_DELAYACCT_BLKIO_TICKS - 3);
+    hotproc_status_lines = PROC_STATUS_LINE(PROC_STATUS_UID) |
+	PROC_STATUS_LINE(PROC_STATUS_GID) |
+	PROC_STATUS_LINE(PROC_STATUS_VCTXSW) |
+	PROC_STATUS_LINE(PROC_STATUS_NVCTXSW);
     hotproc_update_interval.tv_sec = 10;
     init_hotproc_list();
     reset_hotproc_timer();
@@ -799,8 +934,8 @@ reset_hotproc_timer(void)
 {
     int	sts;
 
-    /* Only reset/enable timer when a valid configuration is present. */
-    if (!conf_gen)
+    /* Only reset/enable timer when a configuration or top-K is present. */
+    if (!conf_gen && !hotproc_topk)
 	return;
 
     __pmAFunregister(hotproc_timer_id);
@@ -818,11 +953,185 @@ disable_hotproc(void)
 {
     /* Clear out the hotlist */
     init_hot_active_list();
-    /* Disable the timer */
-    __pmAFunregister(hotproc_timer_id);
+    /* Disable the timer, unless still selecting the top-K processes */
+    if (!hotproc_topk)
+	__pmAFunregister(hotproc_timer_id);
     conf_gen = 0;
 }
 
+int
+set_hotproc_topk(unsigned int k)
+{
+    hot_rank_t *heap;
+    pid_t *list;
+    int sts = 0;
+
+    /*
+     * Sized here, so evaluations never need to grow these - and with
+     * the timer held off, as its refresh may be using them right now.
+     */
+    __pmAFblock();
+    if (k > hot_maxheap) {
+	if ((heap = realloc(hot_heap, k * sizeof(hot_rank_t))) == NULL)
+	    sts = -oserror();
+	else {
+	    hot_heap = heap;
+	    hot_maxheap = k;
+	}
+    }
+    if (sts == 0 && k > hot_maxactive) {
+	if ((list = realloc(hot_active_list, k * sizeof(pid_t))) == NULL)
+	    sts = -oserror();
+	else {
+	    hot_active_list = list;
+	    hot_maxactive = k;
+	}
+    }
+    if (sts == 0)
+	hotproc_topk = k;
+    __pmAFunblock();
+    if (sts < 0)
+	return sts;
+
+    if (k)
+	reset_hotproc_timer();
+    else if (!conf_gen)
+	disable_hotproc();
+    return 0;
+}
+
+unsigned int
+get_hotproc_topk(void)
+{
+    return hotproc_topk;
+}
+
+int
+set_hotproc_rank(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(hot_rank_names)/sizeof(hot_rank_names[0]); i++) {
+	if (strcmp(name, hot_rank_names[i]) == 0) {
+	    hotproc_rank = i;
+	    return 0;
+	}
+    }
+    return PM_ERR_BADSTORE;
+}
+
+const char *
+get_hotproc_rank(void)
+{
+    return hot_rank_names[hotproc_rank];
+}
+
+/*
+ * Descriptors for the per-process files read on every sample are kept
+ * open in each entry and re-read from offset zero, avoiding the path
+ * lookup and open/close for long-lived processes.  Entries holding any
+ * descriptors are kept on a least recently used list, and descriptors
+ * of the entry at the tail are closed when the budget is reached.
+ *
+ * Access to a /proc file is checked when it is opened, so descriptors
+ * are only reused for requests made with the same credentials.  Those
+ * of exited processes are closed when the entry is harvested, and if a
+ * pid is reused in between, reads of the stale descriptor fail (ESRCH)
+ * and the file is simply opened again.
+ *
+ * Prefetch workers may read concurrently, so list and budget updates
+ * are made under fdcache_lock, and a descriptor is removed from its
+ * entry while being read so that eviction never closes it underneath
+ * the reader.  Only proc_pid_t tables with fdcache set participate,
+ * which excludes that used by the hotproc timer.
+ */
+static struct {
+    proc_pid_entry_t	*head;		/* most recently used */
+    proc_pid_entry_t	*tail;		/* least recently used */
+    int			count;		/* descriptors held */
+    int			limit;		/* descriptor budget */
+    uid_t		uid;		/* effective credentials of opens */
+    gid_t		gid;
+    int			threads;	/* proc_open path style */
+} fdcache;
+static pthread_mutex_t	fdcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+fdcache_unlink(proc_pid_entry_t *ep)
+{
+    if (ep->fd_prev == NULL && fdcache.head != ep)
+	return;		/* not on the list */
+    if (ep->fd_prev)
+	ep->fd_prev->fd_next = ep->fd_next;
+    else
+	fdcache.head = ep->fd_next;
+    if (ep->fd_next)
+	ep->fd_next->fd_prev = ep->fd_prev;
+    else
+	fdcache.tail = ep->fd_prev;
+    ep->fd_prev = ep->fd_next = NULL;
+}
+
+/* close all cached descriptors of an entry, called with fdcache_lock held */
+static void
+fdcache_close(proc_pid_entry_t *ep)
+{
+    int i;
+
+    fdcache_unlink(ep);
+    for (i = 0; i < NR_PROC_PID_FILES; i++) {
+	if (ep->fds[i] >= 0) {
+	    close(ep->fds[i]);
+	    ep->fds[i] = -1;
+	    fdcache.count--;
+	}
+    }
+}
+
+/* evict least recently used entries until count is below target */
+static void
+fdcache_shrink(int target, proc_pid_entry_t *keep)
+{
+    proc_pid_entry_t *ep, *prev;
+
+    for (ep = fdcache.tail; ep && fdcache.count > target; ep = prev) {
+	prev = ep->fd_prev;
+	if (ep != keep)
+	    fdcache_close(ep);
+    }
+}
+
+/*
+ * Called as each pid list is refreshed, before any files are read:
+ * drop all descriptors if the credentials or path style have changed.
+ */
+static void
+fdcache_validate(void)
+{
+    uid_t	uid = geteuid();
+    gid_t	gid = getegid();
+
+    if (uid == fdcache.uid && gid == fdcache.gid &&
+	procpids.threads == fdcache.threads)
+	return;
+    pthread_mutex_lock(&fdcache_lock);
+    if (fdcache.count > 0) {
+#if PCP_DEBUG
+	if (pmDebug & DBG_TRACE_LIBPMDA)
+	    fprintf(stderr, "fdcache_validate: closing %d descriptors "
+			"(uid %d->%d, gid %d->%d, threads %d->%d)\n",
+			fdcache.count, (int)fdcache.uid, (int)uid,
+			(int)fdcache.gid, (int)gid,
+			fdcache.threads, procpids.threads);
+#endif
+	fdcache_shrink(0, NULL);
+    }
+    fdcache.uid = uid;
+    fdcache.gid = gid;
+    fdcache.threads = procpids.threads;
+    pthread_mutex_unlock(&fdcache_lock);
+}
+
 static void
 refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 {
@@ -842,6 +1151,9 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
     }
     indomp->it_numinst = pids->count;
 
+    if (proc_pid->fdcache)
+	fdcache_validate();
+
     /*
      * invalidate all entries so we can harvest pids that have exited
      */
@@ -865,6 +1177,9 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 	    memset(ep, 0, sizeof(proc_pid_entry_t));
 
 	    ep->id = pids->pids[i];
+	    for (k = 0; k < NR_PROC_PID_FILES; k++)
+		ep->fds[k] = -1;
+	    k = 0;
 
 	    snprintf(buf, sizeof(buf), "%s/proc/%d/cmdline", proc_statspath, pids->pids[i]);
 	    if ((fd = open(buf, O_RDONLY)) >= 0) {
@@ -1003,12 +1318,8 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 	        //fprintf(stderr, "DELETED key=%d name=\"%s\"\n", ep->id, ep->name);
 		if (ep->name != NULL)
 		    free(ep->name);
-		if (ep->stat_buf != NULL)
-		    free(ep->stat_buf);
 		if (ep->status_buf != NULL)
 		    free(ep->status_buf);
-		if (ep->statm_buf != NULL)
-		    free(ep->statm_buf);
 		if (ep->maps_buf != NULL)
 		    free(ep->maps_buf);
 		if (ep->schedstat_buf != NULL)
@@ -1019,6 +1330,11 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 		    free(ep->wchan_buf);
 		if (ep->environ_buf != NULL)
 		    free(ep->environ_buf);
+		if (proc_pid->fdcache) {
+		    pthread_mutex_lock(&fdcache_lock);
+		    fdcache_close(ep);
+		    pthread_mutex_unlock(&fdcache_lock);
+		}
 
 	    	if (prev == NULL)
 		    proc_pid->pidhash.hash[i] = node->next;
@@ -1180,6 +1496,92 @@ proc_opendir(const char *base, proc_pid_entry_t *ep)
     return dir;
 }
 
+static const char *proc_pid_files[NR_PROC_PID_FILES] = {
+    [PROC_PID_FILE_STAT]	= "stat",
+    [PROC_PID_FILE_STATM]	= "statm",
+    [PROC_PID_FILE_SCHEDSTAT]	= "schedstat",
+    [PROC_PID_FILE_IO]		= "io",
+};
+
+/* return a cached descriptor to its entry, or close it if over budget */
+static void
+fdcache_put(proc_pid_entry_t *ep, int file, int fd)
+{
+    pthread_mutex_lock(&fdcache_lock);
+    if (fdcache.count >= fdcache.limit)
+	fdcache_shrink(fdcache.limit - 1, ep);
+    if (fdcache.count >= fdcache.limit) {
+	pthread_mutex_unlock(&fdcache_lock);
+	close(fd);
+	return;
+    }
+    ep->fds[file] = fd;
+    fdcache.count++;
+    if (fdcache.head != ep) {
+	fdcache_unlink(ep);
+	ep->fd_next = fdcache.head;
+	if (fdcache.head)
+	    fdcache.head->fd_prev = ep;
+	else
+	    fdcache.tail = ep;
+	fdcache.head = ep;
+    }
+    pthread_mutex_unlock(&fdcache_lock);
+}
+
+/*
+ * Read the start of one of the PROC_PID_FILE_* files into buf, using
+ * a cached descriptor if one is held.  Returns the number of bytes
+ * read, or -1 with errno set for open or read failures, like read(2).
+ */
+static int
+proc_read(proc_pid_t *proc_pid, proc_pid_entry_t *ep, int file, char *buf, int len)
+{
+    int fd, n, sts;
+
+    if (proc_pid->fdcache && fdcache.limit > 0) {
+	pthread_mutex_lock(&fdcache_lock);
+	if ((fd = ep->fds[file]) >= 0) {
+	    ep->fds[file] = -1;
+	    fdcache.count--;
+	}
+	pthread_mutex_unlock(&fdcache_lock);
+
+	if (fd >= 0) {
+	    if ((n = pread(fd, buf, len, 0)) > 0) {
+		fdcache_put(ep, file, fd);
+		return n;
+	    }
+	    /* exited, or pid reused since opened - try again from scratch */
+	    close(fd);
+	}
+	if ((fd = proc_open(proc_pid_files[file], ep)) < 0 &&
+	    (oserror() == EMFILE || oserror() == ENFILE)) {
+	    pthread_mutex_lock(&fdcache_lock);
+	    if ((n = fdcache.count) > 0)
+		fdcache_shrink(fdcache.count / 2, NULL);
+	    pthread_mutex_unlock(&fdcache_lock);
+	    if (n > 0)
+		fd = proc_open(proc_pid_files[file], ep);
+	}
+	if (fd < 0)
+	    return -1;
+	if ((n = read(fd, buf, len)) > 0) {
+	    fdcache_put(ep, file, fd);
+	    return n;
+	}
+    }
+    else {
+	if ((fd = proc_open(proc_pid_files[file], ep)) < 0)
+	    return -1;
+	n = read(fd, buf, len);
+    }
+    sts = oserror();
+    close(fd);
+    setoserror(sts);
+    return n;
+}
+
 /*
  * error mapping for fetch routines ...
  * EACCESS, EINVAL => no values (don't disclose anything else)
@@ -1230,11 +1632,8 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
     ep = (proc_pid_entry_t *)node->data;
 
     if (!(ep->flags & PROC_PID_FLAG_STAT_FETCHED)) {
-	if (ep->stat_buflen > 0)
-	    ep->stat_buf[0] = '\0';
-	if ((fd = proc_open("stat", ep)) < 0)
-	    *sts = maperr();
-	else if ((n = read(fd, buf, sizeof(buf))) < 0) {
+	ep->stat.have = 0;
+	if ((n = proc_read(proc_pid, ep, PROC_PID_FILE_STAT, buf, sizeof(buf))) < 0) {
 	    *sts = maperr();
 #if PCP_DEBUG
 	    if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
@@ -1256,20 +1655,14 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
 #endif
 	    }
 	    else {
-		if (ep->stat_buflen <= n) {
-		    ep->stat_buflen = n;
-		    ep->stat_buf = (char *)realloc(ep->stat_buf, n);
-		}
-		memcpy(ep->stat_buf, buf, n);
-		ep->stat_buf[n-1] = '\0';
+		proc_parse_stat(buf, n, proc_pid->stat_fields, &ep->stat);
 	    }
 	}
-	if (fd >= 0)
-		close(fd);
 	ep->flags |= PROC_PID_FLAG_STAT_FETCHED;
     }
 
-    if (!(ep->flags & PROC_PID_FLAG_WCHAN_FETCHED)) {
+    if (!(ep->flags & PROC_PID_FLAG_WCHAN_FETCHED) &&
+	(proc_pid->stat_fields & PROC_PID_STAT_WCHAN_FILE)) {
 	if (ep->wchan_buflen > 0)
 	    ep->wchan_buf[0] = '\0';
 	if ((fd = proc_open("wchan", ep)) < 0) {
@@ -1308,7 +1701,8 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
 	ep->flags |= PROC_PID_FLAG_WCHAN_FETCHED;
     }
 
-    if (!(ep->flags & PROC_PID_FLAG_ENVIRON_FETCHED)) {
+    if (!(ep->flags & PROC_PID_FLAG_ENVIRON_FETCHED) &&
+	(proc_pid->stat_fields & PROC_PID_STAT_ENVIRON_FILE)) {
 	if (ep->environ_buflen > 0)
 	    ep->environ_buf[0] = '\0';
 	if ((fd = proc_open("environ", ep)) >= 0) {
@@ -1350,27 +1744,49 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
 }
 
 /*
- * Skip an initial colon-terminated header and whitespace, then comma-separate
- * the remainder of the line by overwriting any whitespace.
+ * Copy the wanted text lines located by proc_parse_status into a buffer
+ * kept with the entry (only grown, never shrunk), so every text value of
+ * a fetch comes from the one read of the file.  Namespace id lists are
+ * made comma-separated on the way through, as expected by the metrics.
  */
-static char *
-commasep(char **buf)
-{
-    char *start, *p = *buf;
-
-    for (; *p && *p != ':'; p++);	/* skip header */
-    if (*p) p++;
-    for (; *p && isspace(*p); p++);	/* skip initial whitespace */
-    start = *buf = p;
-    for (; *p; p++) {
-	if (*p == '\n') {
-	    *p = '\0';	/* replace end of line */
-	    *buf = p + 1;
-	    break;
+static int
+status_text(proc_pid_entry_t *ep, const char *buf)
+{
+    proc_status_t	*sp = &ep->status;
+    char		*p;
+    int			i, length, total = 0;
+
+    for (i = 0; i < PROC_STATUS_NTEXT; i++) {
+	ep->status_text[i] = NULL;
+	if (sp->have & PROC_STATUS_LINE(PROC_STATUS_SIGPND + i))
+	    total += sp->text[i].length + 1;
+    }
+    if (total == 0)
+	return 0;
+    if (ep->status_buflen < total) {
+	if ((p = (char *)realloc(ep->status_buf, total)) == NULL)
+	    return -ENOMEM;
+	ep->status_buf = p;
+	ep->status_buflen = total;
+    }
+
+    for (p = ep->status_buf, i = 0; i < PROC_STATUS_NTEXT; i++) {
+	if (!(sp->have & PROC_STATUS_LINE(PROC_STATUS_SIGPND + i)))
+	    continue;
+	length = sp->text[i].length;
+	memcpy(p, buf + sp->text[i].offset, length);
+	p[length] = '\0';
+	ep->status_text[i] = p;
+	if (PROC_STATUS_SIGPND + i >= PROC_STATUS_NSTGID) {
+	    for (; *p; p++)
+		if (isspace((int)*p))
+		    *p = ',';
+	    p++;
 	}
-	if (isspace(*p)) *p = ',';	/* replace whitespace */
+	else
+	    p += length + 1;
     }
-    return start;
+    return 0;
 }
 
 /*
@@ -1397,11 +1813,9 @@ fetch_proc_pid_status(int id, proc_pid_t *proc_pid, int *sts)
     if (!(ep->flags & PROC_PID_FLAG_STATUS_FETCHED)) {
 	int	fd;
 	int	n;
-	char	buf[1024];
-	char	*curline;
+	char	buf[8192];
 
-	if (ep->status_buflen > 0)
-	    ep->status_buf[0] = '\0';
+	ep->status.have = 0;
 	if ((fd = proc_open("status", ep)) < 0)
 	    *sts = maperr();
 	else if ((n = read(fd, buf, sizeof(buf))) < 0) {
@@ -1414,41 +1828,16 @@ fetch_proc_pid_status(int id, proc_pid_t *proc_pid, int *sts)
 	    }
 #endif
 	}
-	else {
-	    if (n == 0) {
-		*sts = -ENODATA;
+	else if (n == 0) {
+	    *sts = -ENODATA;
 #if PCP_DEBUG
-		if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
-		    char ibuf[1024];
-		    fprintf(stderr, "fetch_proc_pid_status: read EOF?: id=%d, indom=%s\n", id, pmInDomStr_r(proc_pid->indom->it_indom, ibuf, sizeof(ibuf)));
-		}
-#endif
+	    if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
+		char ibuf[1024];
+		fprintf(stderr, "fetch_proc_pid_status: read EOF?: id=%d, indom=%s\n", id, pmInDomStr_r(proc_pid->indom->it_indom, ibuf, sizeof(ibuf)));
 	    }
-	    else {
-		if (ep->status_buflen < n) {
-		    ep->status_buflen = n;
-		    ep->status_buf = (char *)realloc(ep->status_buf, n);
-		}
-
-		if (ep->status_buf == NULL) {
-		    *sts = -ENODATA;
-#if PCP_DEBUG
-		    if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
-			char ibuf[1024];
-			fprintf(stderr, "fetch_proc_pid_status: read EOF?: id=%d, indom=%s\n", id, pmInDomStr_r(proc_pid->indom->it_indom, ibuf, sizeof(ibuf)));
-		    }
 #endif
-		}
-		else {
-		    memcpy(ep->status_buf, buf, n);
-		    ep->status_buf[n-1] = '\0';
-		}
-	    }
 	}
-
-	if (*sts == 0) {
-	    /* assign pointers to individual lines in buffer */
-	    curline = ep->status_buf;
+	else {
 	    /*
 	     * Expecting something like ...
 	     *
@@ -1464,154 +1853,24 @@ fetch_proc_pid_status(int id, proc_pid_t *proc_pid, int *sts)
 	     * Groups:	24 25 27 29 30 44 46 105 110 112 1000 
 	     * VmPeak:	   22388 kB
 	     * VmSize:	   22324 kB
-	     * VmLck:	       0 kB
-	     * VmPin:	       0 kB
-	     * VmHWM:	    5200 kB
-	     * VmRSS:	    5200 kB
-	     * VmData:	    3280 kB
-	     * VmStk:	     136 kB
-	     * VmExe:	     916 kB
-	     * VmLib:	    2024 kB
-	     * VmPTE:	      60 kB
-	     * VmSwap:	       0 kB
+	     * ...
 	     * Threads:	1
 	     * SigQ:	0/47779
 	     * SigPnd:	0000000000000000
-	     * ShdPnd:	0000000000000000
-	     * SigBlk:	0000000000010000
-	     * SigIgn:	0000000000384004
-	     * SigCgt:	000000004b813efb
-	     * CapInh:	0000000000000000
-	     * CapPrm:	0000000000000000
-	     * CapEff:	0000000000000000
-	     * CapBnd:	ffffffffffffffff
-	     * Cpus_allowed:	3
+	     * ...
 	     * Cpus_allowed_list:	0-1
-	     * Mems_allowed:	00000000,00000001
-	     * Mems_allowed_list:	0
+	     * ...
 	     * voluntary_ctxt_switches:	225
 	     * nonvoluntary_ctxt_switches:	56
+	     *
+	     * Only the lines wanted for the current fetch are converted.
 	     */
-	    while (curline) {
-		/* small optimization ... peek at first character */
-		switch (*curline) {
-		    case 'U':
-			if (strncmp(curline, "Uid:", 4) == 0)
-			    ep->status_lines.uid = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-		    case 'G':
-			if (strncmp(curline, "Gid:", 4) == 0)
-			    ep->status_lines.gid = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-		    case 'V':
-			if (strncmp(curline, "VmPeak:", 7) == 0)
-			    ep->status_lines.vmpeak = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmSize:", 7) == 0)
-			    ep->status_lines.vmsize = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmLck:", 6) == 0)
-			    ep->status_lines.vmlck = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmPin:", 6) == 0)
-			    ep->status_lines.vmpin = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmHWM:", 6) == 0)
-			    ep->status_lines.vmhwm = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmRSS:", 6) == 0)
-			    ep->status_lines.vmrss = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmData:", 7) == 0)
-			    ep->status_lines.vmdata = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmStk:", 6) == 0)
-			    ep->status_lines.vmstk = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmExe:", 6) == 0)
-			    ep->status_lines.vmexe = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmLib:", 6) == 0)
-			    ep->status_lines.vmlib = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmPTE:", 6) == 0)
-			    ep->status_lines.vmpte = strsep(&curline, "\n");
-			else if (strncmp(curline, "VmSwap:", 7) == 0)
-			    ep->status_lines.vmswap = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-		    case 'T':
-			if (strncmp(curline, "Threads:", 8) == 0)
-			    ep->status_lines.threads = strsep(&curline, "\n");
-			else if (strncmp(curline, "Tgid:", 5) == 0)
-			    ep->status_lines.tgid = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-		    case 'S':
-			if (strncmp(curline, "SigPnd:", 7) == 0)
-			    ep->status_lines.sigpnd = strsep(&curline, "\n");
-			else if (strncmp(curline, "SigBlk:", 7) == 0)
-			    ep->status_lines.sigblk = strsep(&curline, "\n");
-			else if (strncmp(curline, "SigIgn:", 7) == 0)
-			    ep->status_lines.sigign = strsep(&curline, "\n");
-			else if (strncmp(curline, "SigCgt:", 7) == 0)
-			    ep->status_lines.sigcgt = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-		    case 'v':
-			if (strncmp(curline, "voluntary_ctxt_switches:", 24) == 0)
-			    ep->status_lines.vctxsw = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-		    case 'N':
-			if (strncmp(curline, "Ngid:", 5) == 0)
-			    ep->status_lines.ngid = strsep(&curline, "\n");
-			else if (strncmp(curline, "NStgid:", 7) == 0) {
-			    ep->status_lines.nstgid = commasep(&curline);
-			}
-			else if (strncmp(curline, "NSpid:", 6) == 0) {
-			    ep->status_lines.nspid = commasep(&curline);
-			}
-			else if (strncmp(curline, "NSpgid:", 7) == 0)
-			    ep->status_lines.nspgid = commasep(&curline);
-			else if (strncmp(curline, "NSsid:", 6) == 0)
-			    ep->status_lines.nssid = commasep(&curline);
-			else
-			    goto nomatch;
-			break;
-		    case 'n':
-			if (strncmp(curline, "nonvoluntary_ctxt_switches:", 27) == 0)
-			    ep->status_lines.nvctxsw = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-                    case 'C':
-		        if (strncmp(curline, "Cpus_allowed_list:", 18) == 0)
-		            ep->status_lines.cpusallowed = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-                    case 'e':
-		        if (strncmp(curline, "envID:", 6) == 0)
-		            ep->status_lines.envid = strsep(&curline, "\n");
-			else
-			    goto nomatch;
-			break;
-		    default:
-nomatch:
-#if PCP_DEBUG
-			if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
-			    char	*p;
-			    fprintf(stderr, "fetch_proc_pid_status: skip ");
-			    for (p = curline; *p && *p != '\n'; p++)
-				fputc(*p, stderr);
-			    fputc('\n', stderr);
-			}
-#endif
-			curline = index(curline, '\n');
-			if (curline != NULL) curline++;
-		}
-	    }
-	    ep->flags |= PROC_PID_FLAG_STATUS_FETCHED;
+	    proc_parse_status(buf, n, proc_pid->status_lines, &ep->status);
+	    *sts = status_text(ep, buf);
 	}
+
+	if (*sts == 0)
+	    ep->flags |= PROC_PID_FLAG_STATUS_FETCHED;
 	if (fd >= 0)
 	    close(fd);
     }
@@ -1642,13 +1901,10 @@ fetch_proc_pid_statm(int id, proc_pid_t *proc_pid, int *sts)
 
     if (!(ep->flags & PROC_PID_FLAG_STATM_FETCHED)) {
 	char buf[1024];
-	int fd, n;
+	int n;
 
-	if (ep->statm_buflen > 0)
-	    ep->statm_buf[0] = '\0';
-	if ((fd = proc_open("statm", ep)) < 0)
-	    *sts = maperr();
-	else if ((n = read(fd, buf, sizeof(buf))) < 0) {
+	ep->statm.nfields = 0;
+	if ((n = proc_read(proc_pid, ep, PROC_PID_FILE_STATM, buf, sizeof(buf))) < 0) {
 	    *sts = maperr();
 #if PCP_DEBUG
 	    if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
@@ -1670,17 +1926,9 @@ fetch_proc_pid_statm(int id, proc_pid_t *proc_pid, int *sts)
 #endif
 	    }
 	    else {
-		if (ep->statm_buflen <= n) {
-		    ep->statm_buflen = n;
-		    ep->statm_buf = (char *)realloc(ep->statm_buf, n);
-		}
-		memcpy(ep->statm_buf, buf, n);
-		ep->statm_buf[n-1] = '\0';
+		proc_parse_statm(buf, n, &ep->statm);
 	    }
 	}
-
-	if (fd >= 0)
-	    close(fd);
 	ep->flags |= PROC_PID_FLAG_STATM_FETCHED;
     }
 
@@ -1746,6 +1994,74 @@ fetch_proc_pid_maps(int id, proc_pid_t *proc_pid, int *sts)
     return (*sts < 0) ? NULL : ep;
 }
 
+/*
+ * Batched taskstats for this and the following instances in the proc
+ * indom without schedstat values yet, formatted as /proc/<pid>/schedstat
+ * would be.  Returns zero if ep was filled in, else /proc must be used.
+ */
+static int
+fetch_proc_pid_taskstats(proc_pid_t *proc_pid, proc_pid_entry_t *ep)
+{
+    static proc_taskstats_t list[PROC_TASKSTATS_BATCH];
+    static int cursor;	/* instance beyond the previous batch */
+    pmdaIndom *indomp = proc_pid->indom;
+    __pmHashNode *node;
+    proc_pid_entry_t *entry;
+    char buf[128];
+    int i, n, count, len;
+
+    if (!proc_netlink_taskstats())
+	return -1;
+
+    /* usually found at the cursor, as instances are fetched in order */
+    for (i = cursor; i < indomp->it_numinst; i++)
+	if (indomp->it_set[i].i_inst == ep->id)
+	    break;
+    if (i >= indomp->it_numinst) {
+	for (i = 0; i < indomp->it_numinst; i++)
+	    if (indomp->it_set[i].i_inst == ep->id)
+		break;
+    }
+
+    list[0].id = ep->id;
+    for (count = 1, n = i + 1; n < indomp->it_numinst; n++) {
+	if (count == PROC_TASKSTATS_BATCH)
+	    break;
+	node = __pmHashSearch(indomp->it_set[n].i_inst, &proc_pid->pidhash);
+	if (node == NULL)
+	    continue;
+	entry = (proc_pid_entry_t *)node->data;
+	if (!(entry->flags & PROC_PID_FLAG_SCHEDSTAT_FETCHED))
+	    list[count++].id = entry->id;
+    }
+    cursor = n;
+
+    if (proc_netlink_schedstat(list, count) <= 0)
+	return -1;
+
+    for (i = 0; i < count; i++) {
+	if (!list[i].valid)
+	    continue;
+	if ((node = __pmHashSearch(list[i].id, &proc_pid->pidhash)) == NULL)
+	    continue;
+	entry = (proc_pid_entry_t *)node->data;
+	len = snprintf(buf, sizeof(buf), "%llu %llu %llu",
+			(unsigned long long)list[i].cputime,
+			(unsigned long long)list[i].rundelay,
+			(unsigned long long)list[i].pcount) + 1;
+	if (entry->schedstat_buflen < len) {
+	    if ((entry->schedstat_buf = (char *)realloc(entry->schedstat_buf, len)) == NULL) {
+		entry->schedstat_buflen = 0;
+		continue;
+	    }
+	    entry->schedstat_buflen = len;
+	}
+	memcpy(entry->schedstat_buf, buf, len);
+	entry->flags |= PROC_PID_FLAG_SCHEDSTAT_FETCHED;
+    }
+    return (ep->flags & PROC_PID_FLAG_SCHEDSTAT_FETCHED) ? 0 : -1;
+}
+
 /*
  * fetch a proc/<pid>/schedstat entry for pid
  */
@@ -1767,15 +2083,14 @@ fetch_proc_pid_schedstat(int id, proc_pid_t *proc_pid, int *sts)
     }
     ep = (proc_pid_entry_t *)node->data;
 
-    if (!(ep->flags & PROC_PID_FLAG_SCHEDSTAT_FETCHED)) {
-	int fd, n;
+    if (!(ep->flags & PROC_PID_FLAG_SCHEDSTAT_FETCHED) &&
+	fetch_proc_pid_taskstats(proc_pid, ep) < 0) {
+	int n;
 	char buf[1024];
 
 	if (ep->schedstat_buflen > 0)
 	    ep->schedstat_buf[0] = '\0';
-	if ((fd = proc_open("schedstat", ep)) < 0)
-	    *sts = maperr();
-	else if ((n = read(fd, buf, sizeof(buf))) < 0) {
+	if ((n = proc_read(proc_pid, ep, PROC_PID_FILE_SCHEDSTAT, buf, sizeof(buf))) < 0) {
 	    *sts = maperr();
 #if PCP_DEBUG
 	    if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
@@ -1805,10 +2120,6 @@ fetch_proc_pid_schedstat(int id, proc_pid_t *proc_pid, int *sts)
 		ep->schedstat_buf[n-1] = '\0';
 	    }
 	}
-
-	if (fd >= 0) {
-	    close(fd);
-	}
 	ep->flags |= PROC_PID_FLAG_SCHEDSTAT_FETCHED;
     }
 
@@ -1843,15 +2154,13 @@ fetch_proc_pid_io(int id, proc_pid_t *proc_pid, int *sts)
     ep = (proc_pid_entry_t *)node->data;
 
     if (!(ep->flags & PROC_PID_FLAG_IO_FETCHED)) {
-	int	fd, n;
+	int	n;
 	char	buf[1024];
 	char	*curline;
 
 	if (ep->io_buflen > 0)
 	    ep->io_buf[0] = '\0';
-	if ((fd = proc_open("io", ep)) < 0)
-	    *sts = maperr();
-	else if ((n = read(fd, buf, sizeof(buf))) < 0) {
+	if ((n = proc_read(proc_pid, ep, PROC_PID_FILE_IO, buf, sizeof(buf))) < 0) {
 	    *sts = maperr();
 #if PCP_DEBUG
 	    if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
@@ -1937,8 +2246,6 @@ fetch_proc_pid_io(int id, proc_pid_t *proc_pid, int *sts)
 	    }
 	    ep->flags |= PROC_PID_FLAG_IO_FETCHED;
 	}
-	if (fd >= 0)
-	    close(fd);
     }
 
     return (*sts < 0) ? NULL : ep;
@@ -2135,6 +2442,215 @@ fetch_proc_pid_label(int id, proc_pid_t *proc_pid, int *sts)
     return (*sts < 0) ? NULL : ep;
 }
 
+/*
+ * Parallel prefetch of /proc/<pid> files.
+ *
+ * With many thousands of processes, reading each file in turn from the
+ * fetch callback is dominated by system call latency.  Instead, before
+ * pmdaFetch runs, the instances in the profile are split into chunks
+ * and claimed by a small pool of worker threads (and the caller), which
+ * read the requested files into each proc_pid_entry_t.  The fetch
+ * callback then finds the entries already marked as fetched.
+ *
+ * Each entry is visited by one thread only, and the pid hash table and
+ * instance domain are not modified while the workers run.  On failure,
+ * the fetched flag is cleared so the callback repeats the read and sees
+ * (and reports) the error in the usual way.
+ */
+#define PREFETCH_CHUNK	64
+
+static struct {
+    proc_pid_t		*proc_pid;
+    int			flags;		/* PROC_PID_FLAG_*_FETCHED wanted */
+    int			*ids;		/* instances to be prefetched */
+    int			count;
+    int			size;
+    int			next;		/* first unclaimed slot in ids[] */
+    int			busy;		/* workers yet to finish this batch */
+    unsigned int	batch;		/* incremented for each new batch */
+} prefetch;
+
+static int		nworkers;	/* threads requested */
+static int		nstarted;	/* threads running */
+static pthread_mutex_t	prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	prefetch_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	prefetch_done = PTHREAD_COND_INITIALIZER;
+
+static void
+prefetch_entry(proc_pid_t *proc_pid, int id, int flags)
+{
+    __pmHashNode *node = __pmHashSearch(id, &proc_pid->pidhash);
+    proc_pid_entry_t *ep;
+    int sts;
+
+    if (node == NULL)
+	return;
+    ep = (proc_pid_entry_t *)node->data;
+
+    if ((flags & PROC_PID_FLAG_STAT_FETCHED) &&
+	!(ep->flags & PROC_PID_FLAG_STAT_FETCHED)) {
+	if (fetch_proc_pid_stat(id, proc_pid, &sts) == NULL)
+	    ep->flags &= ~(PROC_PID_FLAG_STAT_FETCHED|PROC_PID_FLAG_WCHAN_FETCHED);
+    }
+    if ((flags & PROC_PID_FLAG_STATM_FETCHED) &&
+	!(ep->flags & PROC_PID_FLAG_STATM_FETCHED)) {
+	if (fetch_proc_pid_statm(id, proc_pid, &sts) == NULL)
+	    ep->flags &= ~PROC_PID_FLAG_STATM_FETCHED;
+    }
+    if ((flags & PROC_PID_FLAG_STATUS_FETCHED) &&
+	!(ep->flags & PROC_PID_FLAG_STATUS_FETCHED))
+	fetch_proc_pid_status(id, proc_pid, &sts);
+    if ((flags & PROC_PID_FLAG_IO_FETCHED) &&
+	!(ep->flags & PROC_PID_FLAG_IO_FETCHED))
+	fetch_proc_pid_io(id, proc_pid, &sts);
+    if ((flags & PROC_PID_FLAG_SCHEDSTAT_FETCHED) &&
+	!(ep->flags & PROC_PID_FLAG_SCHEDSTAT_FETCHED)) {
+	if (fetch_proc_pid_schedstat(id, proc_pid, &sts) == NULL)
+	    ep->flags &= ~PROC_PID_FLAG_SCHEDSTAT_FETCHED;
+    }
+}
+
+/* claim and process chunks of the current batch until none remain */
+static void
+prefetch_run(void)
+{
+    int i, start, end;
+
+    for (;;) {
+	pthread_mutex_lock(&prefetch_lock);
+	start = prefetch.next;
+	if (start < prefetch.count)
+	    prefetch.next += PREFETCH_CHUNK;
+	pthread_mutex_unlock(&prefetch_lock);
+	if (start >= prefetch.count)
+	    break;
+	if ((end = start + PREFETCH_CHUNK) > prefetch.count)
+	    end = prefetch.count;
+	for (i = start; i < end; i++)
+	    prefetch_entry(prefetch.proc_pid, prefetch.ids[i], prefetch.flags);
+    }
+}
+
+static void *
+prefetch_worker(void *arg)
+{
+    unsigned int	batch = (unsigned int)(__psint_t)arg;
+
+    for (;;) {
+	pthread_mutex_lock(&prefetch_lock);
+	while (prefetch.batch == batch)
+	    pthread_cond_wait(&prefetch_work, &prefetch_lock);
+	batch = prefetch.batch;
+	pthread_mutex_unlock(&prefetch_lock);
+
+	prefetch_run();
+
+	pthread_mutex_lock(&prefetch_lock);
+	if (--prefetch.busy == 0)
+	    pthread_cond_signal(&prefetch_done);
+	pthread_mutex_unlock(&prefetch_lock);
+    }
+    return NULL;
+}
+
+static void
+prefetch_start(void)
+{
+    pthread_t	thread;
+    sigset_t	all, saved;
+    int		sts;
+
+    /* workers inherit a fully blocked signal mask, e.g. for hotproc timer */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    while (nstarted < nworkers) {
+	/* wait for the next batch, not the one most recently completed */
+	sts = pthread_create(&thread, NULL, prefetch_worker,
+			(void *)(__psint_t)prefetch.batch);
+	if (sts != 0) {
+	    __pmNotifyErr(LOG_ERR, "proc prefetch: started %d of %d workers: %s",
+			nstarted, nworkers, pmErrStr(-sts));
+	    nworkers = nstarted;
+	    break;
+	}
+	pthread_detach(thread);
+	nstarted++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+void
+proc_pid_workers(int count)
+{
+    if (count >= 0)
+	nworkers = count;
+}
+
+void
+proc_pid_fdcache(int count)
+{
+    pthread_mutex_lock(&fdcache_lock);
+    fdcache.limit = count > 0 ? count : 0;
+    fdcache_shrink(fdcache.limit, NULL);
+    pthread_mutex_unlock(&fdcache_lock);
+}
+
+void
+proc_pid_prefetch(proc_pid_t *proc_pid, int flags, pmdaExt *pmda)
+{
+    pmdaIndom *indomp = proc_pid->indom;
+    int i;
+
+    if (nworkers <= 0 || flags == 0)
+	return;
+
+    /* a batched taskstats request is cheaper than one read per thread */
+    if (proc_netlink_taskstats())
+	flags &= ~PROC_PID_FLAG_SCHEDSTAT_FETCHED;
+
+    prefetch.count = 0;
+    for (i = 0; i < indomp->it_numinst; i++) {
+	if (!__pmInProfile(indomp->it_indom, pmda->e_prof, indomp->it_set[i].i_inst))
+	    continue;
+	if (prefetch.count >= prefetch.size) {
+	    prefetch.size = prefetch.size ? prefetch.size * 2 : 1024;
+	    if ((prefetch.ids = (int *)realloc(prefetch.ids, prefetch.size * sizeof(int))) == NULL) {
+		prefetch.size = prefetch.count = 0;
+		return;	/* callbacks read the files, as usual */
+	    }
+	}
+	prefetch.ids[prefetch.count++] = indomp->it_set[i].i_inst;
+    }
+    /* not worth waking the workers for a few instances */
+    if (prefetch.count <= PREFETCH_CHUNK)
+	return;
+
+    if (nstarted < nworkers)
+	prefetch_start();
+
+    pthread_mutex_lock(&prefetch_lock);
+    prefetch.proc_pid = proc_pid;
+    prefetch.flags = flags;
+    prefetch.next = 0;
+    prefetch.busy = nstarted;
+    prefetch.batch++;
+    pthread_cond_broadcast(&prefetch_work);
+    pthread_mutex_unlock(&prefetch_lock);
+
+    prefetch_run();	/* this thread helps too */
+
+    pthread_mutex_lock(&prefetch_lock);
+    while (prefetch.busy > 0)
+	pthread_cond_wait(&prefetch_done, &prefetch_lock);
+    pthread_mutex_unlock(&prefetch_lock);
+
+#if PCP_DEBUG
+    if (pmDebug & DBG_TRACE_LIBPMDA)
+	fprintf(stderr, "proc_pid_prefetch: %d pids, flags=0x%x, %d workers\n",
+		prefetch.count, flags, nstarted);
+#endif
+}
+
 /*
  * Extract the ith (space separated) field from a char buffer.
  * The first field starts at zero.  There is a special case we
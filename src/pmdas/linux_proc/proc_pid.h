@@ -1,7 +1,7 @@
 /*
  * Linux /proc/<pid>/... Clusters
  *
- * Copyright (c) 2013-2015 Red Hat.
+ * Copyright (c) 2013-2015,2017 Red Hat.
  * Copyright (c) 2000,2004 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -18,6 +18,7 @@
 #define _PROC_PID_H
 
 #include "proc_runq.h"
+#include "proc_parse.h"
 #include "hotproc.h"
 
 
@@ -182,38 +183,6 @@ enum {
     PROC_PID_LABEL = 0,
 };
 
-typedef struct {	/* /proc/<pid>/status */
-    char *ngid;
-    char *tgid;
-    char *envid;
-    char *uid;
-    char *gid;
-    char *nstgid;
-    char *nspid;
-    char *nspgid;
-    char *nssid;
-    char *sigpnd;
-    char *sigblk;
-    char *sigign;
-    char *sigcgt;
-    char *vmpeak;
-    char *vmsize;
-    char *vmlck;
-    char *vmpin;
-    char *vmhwm;
-    char *vmrss;
-    char *vmdata;
-    char *vmstk;
-    char *vmexe;
-    char *vmlib;
-    char *vmpte;
-    char *vmswap;
-    char *threads;
-    char *vctxsw;
-    char *nvctxsw;
-    char *cpusallowed;
-} status_lines_t;
-
 typedef struct {	/* /proc/<pid>/io */
     char *rchar;
     char *wchar;
@@ -239,25 +208,37 @@ enum {
     PROC_PID_FLAG_ENVIRON_FETCHED	= 1<<11,
 };
 
-typedef struct {
+/*
+ * per-process files read on every sample, re-read through a descriptor
+ * kept open in the entry (subject to a budget) rather than re-opened
+ */
+enum {
+    PROC_PID_FILE_STAT = 0,
+    PROC_PID_FILE_STATM,
+    PROC_PID_FILE_SCHEDSTAT,
+    PROC_PID_FILE_IO,
+
+    NR_PROC_PID_FILES
+};
+
+typedef struct proc_pid_entry {
     int			id;	/* pid, hash key and internal instance id */
     int			flags;	/* combinations of PROC_PID_FLAG_* values */
     char		*name;	/* external instance name (<pid> cmdline) */
 
     /* /proc/<pid>/stat cluster */
-    int			stat_buflen;
-    char		*stat_buf;
+    proc_stat_t		stat;
 
     /* /proc/<pid>/statm and /proc/<pid>/maps cluster */
-    int			statm_buflen;
-    char		*statm_buf;
+    proc_statm_t	statm;
     int			maps_buflen;
     char		*maps_buf;
 
     /* /proc/<pid>/status cluster */
+    proc_status_t	status;
     int			status_buflen;
-    char		*status_buf;
-    status_lines_t	status_lines;
+    char		*status_buf;	/* copy of the wanted text lines */
+    char		*status_text[PROC_STATUS_NTEXT]; /* by line - PROC_STATUS_SIGPND */
 
     /* /proc/<pid>/schedstat cluster */
     int			schedstat_buflen;
@@ -286,11 +267,23 @@ typedef struct {
 
     /* /proc/<pid>/attr/current cluster */
     int			label_id;
+
+    /* cached descriptors for PROC_PID_FILE_* files, -1 if not open */
+    int			fds[NR_PROC_PID_FILES];
+    struct proc_pid_entry *fd_prev;	/* least recently used list */
+    struct proc_pid_entry *fd_next;
 } proc_pid_entry_t;
 
+/* proc_pid_t stat_fields bits for the files read along with stat */
+#define PROC_PID_STAT_WCHAN_FILE	PROC_STAT_FIELD(PROC_STAT_NFIELDS)
+#define PROC_PID_STAT_ENVIRON_FILE	PROC_STAT_FIELD(PROC_STAT_NFIELDS+1)
+
 typedef struct {
     __pmHashCtl		pidhash;	/* hash table for current pids */
     pmdaIndom		*indom;		/* instance domain table */
+    __uint64_t		stat_fields;	/* PROC_STAT_FIELD bits to convert */
+    unsigned int	status_lines;	/* PROC_STATUS_LINE bits to convert */
+    int			fdcache;	/* =1 to keep descriptors open */
 } proc_pid_t;
 
 typedef struct {
@@ -318,6 +311,17 @@ extern void reset_hotproc_timer(void);
 /* clear the hotlist and stop the timer */
 extern void disable_hotproc();
 
+/* limit the hotlist to the K busiest processes, zero for no limit */
+extern int set_hotproc_topk(unsigned int);
+extern unsigned int get_hotproc_topk(void);
+
+/* ranking used for the top-K selection, "cpuburn" or "iodemand" */
+extern int set_hotproc_rank(const char *);
+extern const char *get_hotproc_rank(void);
+
+/* return the number, total and last cost (usec) of hotproc evaluations */
+extern void get_hot_eval(__uint32_t *, __uint64_t *, __uint32_t *, __uint32_t *);
+
 /* init the hotproc data structures */
 extern void init_hotproc_pid(proc_pid_t *);
 
@@ -348,6 +352,15 @@ extern proc_pid_entry_t *fetch_proc_pid_cgroup(int, proc_pid_t *, int *);
 /* fetch a proc/<pid>/attr/current entry for pid */
 extern proc_pid_entry_t *fetch_proc_pid_label(int, proc_pid_t *, int *);
 
+/* set the number of threads used to prefetch proc/<pid> files */
+extern void proc_pid_workers(int);
+
+/* read requested proc/<pid> files for all instances in the profile */
+extern void proc_pid_prefetch(proc_pid_t *, int, pmdaExt *);
+
+/* set the number of proc/<pid> file descriptors kept open, 0 disables */
+extern void proc_pid_fdcache(int);
+
 /* extract the ith space separated field from a buffer */
 extern char *_pm_getfield(char *, int);
 
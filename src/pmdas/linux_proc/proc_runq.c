@@ -29,41 +29,38 @@ proc_runq_accounting(const char *path, proc_runq_t *proc_runq)
 {
     int fd, sname;
     ssize_t sz;
-    char *p, buf[4096];
+    char buf[4096];
+    proc_stat_t ps;
     static int unknown_count;
 
     if ((fd = open(path, O_RDONLY)) < 0)
 	return fd;
-    sz = read(fd, buf, sizeof(buf));
+    sz = read(fd, buf, sizeof(buf)-1);
     close(fd);
-    buf[sizeof(buf)-1] = '\0';
+    buf[sz > 0 ? sz : 0] = '\0';
 
-    /* defunct (state name is 'Z') */
-    if (sz <= 0 || (p = _pm_getfield(buf, PROC_PID_STAT_STATE)) == NULL) {
+    if (sz <= 0 || proc_parse_stat(buf, sz,
+		PROC_STAT_FIELD(PROC_PID_STAT_STATE) |
+		PROC_STAT_FIELD(PROC_PID_STAT_VSIZE) |
+		PROC_STAT_FIELD(PROC_PID_STAT_RSS), &ps) <= PROC_PID_STAT_RSS) {
 	proc_runq->unknown++;
 	return 0;
     }
-    if ((sname = *p) == 'Z') {
+
+    /* defunct (state name is 'Z') */
+    if ((sname = ps.state[0]) == 'Z') {
 	proc_runq->defunct++;
 	return 0;
     }
 
     /* kernel process (not defunct and virtual size is zero) */
-    if ((p = _pm_getfield(buf, PROC_PID_STAT_VSIZE)) == NULL) {
-	proc_runq->unknown++;
-	return 0;
-    }
-    if (strcmp(p, "0") == 0) {
+    if (ps.field[PROC_PID_STAT_VSIZE] == 0) {
 	proc_runq->kernel++;
 	return 0;
     }
 
     /* swapped (resident set size is zero) */
-    if ((p = _pm_getfield(buf, PROC_PID_STAT_RSS)) == NULL) {
-	proc_runq->unknown++;
-	return 0;
-    }
-    if (strcmp(p, "0") == 0) {
+    if (ps.field[PROC_PID_STAT_RSS] == 0) {
 	proc_runq->swapped++;
 	return 0;
     }
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Uses the same /proc/<pid> file parsers as pmdaproc, but extracted
+ * here so captured /proc snapshots can be checked and the parsers timed
+ *
+ * Usage: procparse [-v] [-i iterations] root ...
+ *	-v	report the values parsed for each process, do not time
+ *	-i	number of passes over the snapshot when timing (default 1000)
+ *	root	snapshot directory containing proc/<pid>/{stat,statm,status}
+ *		(as for $PROC_STATSPATH), or "" for the live system
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <pmapi.h>
+#include <impl.h>
+#include "proc_parse.h"
+
+typedef struct {
+    int		pid;
+    int		length[3];	/* stat, statm, status */
+    char	*buf[3];
+} snapshot_t;
+
+static const char	*files[] = { "stat", "statm", "status" };
+static snapshot_t	*snap;
+static int		nsnap;
+
+static void
+load(const char *root)
+{
+    char		path[MAXPATHLEN];
+    char		buf[8192];
+    struct dirent	*dp;
+    snapshot_t		*sp;
+    DIR			*dir;
+    int			fd, i, n;
+
+    snprintf(path, sizeof(path), "%s/proc", root);
+    if ((dir = opendir(path)) == NULL) {
+	fprintf(stderr, "procparse: cannot open %s: %s\n", path, strerror(errno));
+	exit(1);
+    }
+    while ((dp = readdir(dir)) != NULL) {
+	if (!isdigit((int)dp->d_name[0]))
+	    continue;
+	if ((snap = realloc(snap, (nsnap + 1) * sizeof(snapshot_t))) == NULL) {
+	    fprintf(stderr, "procparse: out of memory\n");
+	    exit(1);
+	}
+	sp = &snap[nsnap++];
+	memset(sp, 0, sizeof(snapshot_t));
+	sp->pid = atoi(dp->d_name);
+	for (i = 0; i < 3; i++) {
+	    snprintf(path, sizeof(path), "%s/proc/%s/%s", root, dp->d_name, files[i]);
+	    if ((fd = open(path, O_RDONLY)) < 0)
+		continue;
+	    if ((n = read(fd, buf, sizeof(buf))) > 0 &&
+		(sp->buf[i] = malloc(n)) != NULL) {
+		memcpy(sp->buf[i], buf, n);
+		sp->length[i] = n;
+	    }
+	    close(fd);
+	}
+    }
+    closedir(dir);
+}
+
+static int
+compare(const void *a, const void *b)
+{
+    return ((snapshot_t *)a)->pid - ((snapshot_t *)b)->pid;
+}
+
+static void
+report(snapshot_t *sp)
+{
+    static const char	*names[] = {
+	"uid", "gid", "vmpeak", "vmsize", "vmlck", "vmpin", "vmhwm", "vmrss",
+	"vmdata", "vmstk", "vmexe", "vmlib", "vmpte", "vmswap", "threads",
+	"vctxsw", "nvctxsw", "tgid", "ngid", "envid", "sigpnd", "sigblk",
+	"sigign", "sigcgt", "cpusallowed", "nstgid", "nspid", "nspgid", "nssid",
+    };
+    proc_stat_t		stat;
+    proc_statm_t	statm;
+    proc_status_t	status;
+    int			i, n, line;
+
+    if (sp->buf[0]) {
+	n = proc_parse_stat(sp->buf[0], sp->length[0], ~0ULL, &stat);
+	printf("%d stat %d (%s) %s", sp->pid, n, stat.cmd, stat.state);
+	for (i = 3; i < n; i++)
+	    printf(" %llu", (unsigned long long)stat.field[i]);
+	putchar('\n');
+    }
+    if (sp->buf[1]) {
+	n = proc_parse_statm(sp->buf[1], sp->length[1], &statm);
+	printf("%d statm %d", sp->pid, n);
+	for (i = 0; i < n; i++)
+	    printf(" %llu", (unsigned long long)statm.field[i]);
+	putchar('\n');
+    }
+    if (sp->buf[2]) {
+	n = proc_parse_status(sp->buf[2], sp->length[2], ~0U, &status);
+	printf("%d status %d", sp->pid, n);
+	for (line = 0; line < NR_PROC_STATUS_LINES; line++) {
+	    if (!(status.have & PROC_STATUS_LINE(line)))
+		continue;
+	    printf(" %s=", names[line]);
+	    if (line == PROC_STATUS_UID || line == PROC_STATUS_GID) {
+		__uint32_t *ids = line == PROC_STATUS_UID ? status.uid : status.gid;
+		printf("%u,%u,%u,%u", ids[0], ids[1], ids[2], ids[3]);
+	    }
+	    else if (line <= PROC_STATUS_ENVID)
+		printf("%llu", (unsigned long long)status.value[line]);
+	    else {
+		i = line - PROC_STATUS_SIGPND;
+		printf("%.*s", status.text[i].length,
+			sp->buf[2] + status.text[i].offset);
+	    }
+	}
+	putchar('\n');
+    }
+}
+
+/* parse every file of one kind in the snapshot, iterations times */
+static double
+timing(int file, int iterations, __uint64_t fields, unsigned int lines)
+{
+    struct timeval	start, end;
+    proc_stat_t		stat;
+    proc_statm_t	statm;
+    proc_status_t	status;
+    snapshot_t		*sp;
+    int			i, count = 0;
+
+    __pmtimevalNow(&start);
+    while (iterations-- > 0) {
+	for (sp = snap, i = 0; i < nsnap; i++, sp++) {
+	    if (sp->buf[file] == NULL)
+		continue;
+	    count++;
+	    if (file == 0)
+		proc_parse_stat(sp->buf[0], sp->length[0], fields, &stat);
+	    else if (file == 1)
+		proc_parse_statm(sp->buf[1], sp->length[1], &statm);
+	    else
+		proc_parse_status(sp->buf[2], sp->length[2], lines, &status);
+	}
+    }
+    __pmtimevalNow(&end);
+    return count ? __pmtimevalSub(&end, &start) * 1e9 / count : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    /* fields wanted by a typical top(1)-like monitoring tool */
+    __uint64_t		few_fields = PROC_STAT_FIELD(2) |
+		PROC_STAT_FIELD(13) | PROC_STAT_FIELD(14) |
+		PROC_STAT_FIELD(22) | PROC_STAT_FIELD(23);
+    unsigned int	few_lines = PROC_STATUS_LINE(PROC_STATUS_UID) |
+		PROC_STATUS_LINE(PROC_STATUS_VMRSS) |
+		PROC_STATUS_LINE(PROC_STATUS_VCTXSW) |
+		PROC_STATUS_LINE(PROC_STATUS_NVCTXSW);
+    int			c, i, verbose = 0, iterations = 1000;
+    char		*end;
+
+    while ((c = getopt(argc, argv, "i:v")) != EOF) {
+	switch (c) {
+	case 'i':
+	    iterations = (int)strtol(optarg, &end, 10);
+	    if (*end != '\0' || iterations <= 0) {
+		fprintf(stderr, "procparse: bad iterations \"%s\"\n", optarg);
+		exit(1);
+	    }
+	    break;
+	case 'v':
+	    verbose = 1;
+	    break;
+	default:
+	    optind = argc + 1;
+	    break;
+	}
+    }
+    if (optind >= argc) {
+	fprintf(stderr, "Usage: procparse [-v] [-i iterations] root ...\n");
+	exit(1);
+    }
+
+    for (i = optind; i < argc; i++)
+	load(argv[i]);
+    qsort(snap, nsnap, sizeof(snapshot_t), compare);
+
+    if (verbose) {
+	for (i = 0; i < nsnap; i++)
+	    report(&snap[i]);
+	exit(0);
+    }
+
+    printf("%d processes, %d iterations, nsec per file\n", nsnap, iterations);
+    printf("stat:   all fields %8.1f  few fields %8.1f\n",
+	    timing(0, iterations, ~0ULL, 0),
+	    timing(0, iterations, few_fields, 0));
+    printf("statm:  all fields %8.1f\n",
+	    timing(1, iterations, 0, 0));
+    printf("status: all lines  %8.1f  few lines  %8.1f\n",
+	    timing(2, iterations, 0, ~0U),
+	    timing(2, iterations, 0, few_lines));
+    exit(0);
+}
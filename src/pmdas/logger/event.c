@@ -1,7 +1,7 @@
 /*
  * Event support for the Logger PMDA
  *
- * Copyright (c) 2011-2012 Red Hat.
+ * Copyright (c) 2011-2012,2017 Red Hat.
  * Copyright (c) 2011 Nathan Scott.  All rights reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -22,9 +22,82 @@
 #ifdef HAVE_REGEX_H
 #include <regex.h>
 #endif
+#ifdef IS_LINUX
+#include <sys/inotify.h>
+#endif
 
 static int numlogfiles;
 static event_logfile_t *logfiles;
+static int notifyfd = -1;
+static unsigned int appends;	/* events queued, see event_regex_apply */
+
+#ifdef IS_LINUX
+/*
+ * Each log file and the directory containing it are watched with inotify,
+ * so that new lines are read as soon as they are written rather than when
+ * the refresh interval next expires.  The directory watch reports a file
+ * being created, renamed or removed (i.e. log rotation).  Files that are
+ * not watched, and commands piping into the PMDA, are still polled.
+ */
+#define LOGFILE_WATCH	(IN_MODIFY)
+#define LOGDIR_WATCH	(IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR)
+
+static void
+event_watch_file(event_logfile_t *logfile)
+{
+    int i, wd = logfile->filewd;
+
+    /* stop watching any previous (rotated) file, unless shared */
+    logfile->filewd = -1;
+    if (wd >= 0) {
+	for (i = 0; i < numlogfiles; i++)
+	    if (logfiles[i].filewd == wd)
+		break;
+	if (i == numlogfiles)
+	    inotify_rm_watch(notifyfd, wd);
+    }
+    if (logfile->fd < 0)
+	return;
+    logfile->filewd = inotify_add_watch(notifyfd, logfile->pathname,
+					LOGFILE_WATCH);
+    if (logfile->filewd < 0)
+	__pmNotifyErr(LOG_WARNING, "inotify: %s - %s, polling",
+			logfile->pathname, strerror(errno));
+}
+
+static void
+event_watch(event_logfile_t *logfile)
+{
+    char dir[MAXPATHLEN], *p;
+
+    if (notifyfd < 0)
+	return;
+    strncpy(dir, logfile->pathname, sizeof(dir));
+    dir[sizeof(dir)-1] = '\0';
+    if ((p = strrchr(dir, '/')) == NULL) {
+	logfile->filename = logfile->pathname;
+	strcpy(dir, ".");
+    } else {
+	logfile->filename = logfile->pathname + (p - dir) + 1;
+	if (p == dir)		/* file in the root directory */
+	    p++;
+	*p = '\0';
+    }
+    logfile->dirwd = inotify_add_watch(notifyfd, dir, LOGDIR_WATCH);
+    if (logfile->dirwd < 0) {
+	__pmNotifyErr(LOG_WARNING, "inotify: %s - %s, polling %s",
+			dir, strerror(errno), logfile->pathname);
+	return;
+    }
+    event_watch_file(logfile);
+}
+#endif
+
+int
+event_notifyfd(void)
+{
+    return notifyfd;
+}
 
 void
 event_init(pmID pmid)
@@ -32,6 +105,12 @@ event_init(pmID pmid)
     char cmd[MAXPATHLEN];
     int	i, fd;
 
+#ifdef IS_LINUX
+    if ((notifyfd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0)
+	__pmNotifyErr(LOG_WARNING, "inotify_init1: %s, polling log files",
+			strerror(errno));
+#endif
+
     for (i = 0; i < numlogfiles; i++) {
 	size_t pathlen = strlen(logfiles[i].pathname);
 
@@ -54,6 +133,10 @@ event_init(pmID pmid)
 				    logfiles[i].pathname, strerror(errno));
 		lseek(fd, 0, SEEK_END);
 	    }
+	    logfiles[i].fd = fd;
+#ifdef IS_LINUX
+	    event_watch(&logfiles[i]);
+#endif
 	}
 	else {
 	    strncpy(cmd, logfiles[i].pathname, sizeof(cmd));
@@ -84,6 +167,10 @@ event_shutdown(void)
 
     __pmNotifyErr(LOG_INFO, "%s: Shutting down...", __FUNCTION__);
 
+    if (notifyfd >= 0) {
+	close(notifyfd);
+	notifyfd = -1;
+    }
     for (i = 0; i < numlogfiles; i++) {
 	if (logfiles[i].pid != 0) {
 	    stop_cmd(logfiles[i].pid);
@@ -243,6 +330,7 @@ event_config(const char *fname)
 	logfile->pmnsname[sizeof(logfile->pmnsname)-1] = '\0';
 	strncpy(logfile->pathname, ptr, sizeof(logfile->pathname));
 	logfile->pathname[sizeof(logfile->pathname)-1] = '\0';
+	logfile->filewd = logfile->dirwd = -1;
 	/* remaining fields filled in after pmdaInit() is called. */
 	numlogfiles++;
 
@@ -263,11 +351,16 @@ event_config(const char *fname)
     return numlogfiles;
 }
 
+/*
+ * Read new lines from a log file into its event queue.  When the file
+ * is about to be closed (final), a partial last line is queued too, as
+ * it will not be read again.
+ */
 static int
-event_create(event_logfile_t *logfile)
+event_create(event_logfile_t *logfile, int final)
 {
     int j;
-    char *s, *p;
+    char *s, *p, *end;
     size_t offset;
     ssize_t bytes;
     struct timeval timestamp;
@@ -282,7 +375,7 @@ event_create(event_logfile_t *logfile)
      */
     if (!buffer) {
 	int	sts = 0;
-	bufsize = 16 * getpagesize();
+	bufsize = 64 * getpagesize();
 #ifdef HAVE_POSIX_MEMALIGN
 	sts = posix_memalign((void **)&buffer, getpagesize(), bufsize);
 #else
@@ -329,7 +422,8 @@ multiread:
      * good read ... data up to buffer + offset + bytes is all OK
      * so mark end of data
      */
-    buffer[offset+bytes] = '\0';
+    end = buffer + offset + bytes;
+    *end = '\0';
 
     gettimeofday(&timestamp, NULL);
     for (s = p = buffer, j = 0; *s != '\0' && j < bufsize-1; s++, j++) {
@@ -338,8 +432,25 @@ multiread:
 	*s = '\0';
 	bytes = (s+1) - p;
 	pmdaEventQueueAppend(logfile->queueid, p, bytes, &timestamp);
+	appends++;
 	p = s + 1;
     }
+    /*
+     * A regular file read that ends part way through a line (the writer
+     * is buffering, or is yet to complete it) is left to be read again
+     * from the start of that line once more data has been written.
+     */
+    if (s == end && p != end && j < bufsize - 1 && logfile->pid == 0 &&
+	S_ISREG(logfile->pathstat.st_mode)) {
+	if (final) {
+	    bytes = (end+1) - p;
+	    pmdaEventQueueAppend(logfile->queueid, p, bytes, &timestamp);
+	    appends++;
+	} else {
+	    lseek(logfile->fd, p - end, SEEK_CUR);
+	}
+	return 0;
+    }
     /* did we just do a full buffer read? */
     if (p == buffer) {
 	char msg[64];
@@ -353,49 +464,138 @@ multiread:
     return 1;
 }
 
-void
-event_refresh(void)
+/*
+ * Read any new lines from one log file.  A file is reopened if it has
+ * been replaced (rotated), after reading the remainder of the old file
+ * including any partial last line, and read from the start again if it
+ * has been truncated.  A renamed file is kept open until it is replaced,
+ * as the writer may not yet have switched to a new file.
+ */
+static void
+event_refresh_logfile(event_logfile_t *logfile, int notified)
 {
-    struct event_logfile *logfile;
     struct stat pathstat;
-    int i, fd, sts;
-
-    for (i = 0; i < numlogfiles; i++) {
-	logfile = &logfiles[i];
-
-	if (logfile->pid > 0)	/* process pipe */
-	    goto events;
-	if (stat(logfile->pathname, &pathstat) < 0) {
+    int fd, sts;
+
+    if (logfile->pid > 0)	/* process pipe */
+	goto events;
+    if (stat(logfile->pathname, &pathstat) < 0) {
+	if (logfile->fd >= 0) {
+	    if (fstat(logfile->fd, &pathstat) == 0 && pathstat.st_nlink > 0) {
+		while (event_create(logfile, 0) > 0)
+		    ;
+		return;
+	    }
+	    while (event_create(logfile, 1) > 0)
+		;
+	    close(logfile->fd);
+	    logfile->fd = -1;
+	}
+	memset(&logfile->pathstat, 0, sizeof(logfile->pathstat));
+    } else {
+	/* reopen if no descriptor before, or log rotated (new file) */
+	if (logfile->fd < 0 ||
+	    logfile->pathstat.st_ino != pathstat.st_ino ||
+	    logfile->pathstat.st_dev != pathstat.st_dev) {
 	    if (logfile->fd >= 0) {
+		while (event_create(logfile, 1) > 0)
+		    ;
 		close(logfile->fd);
-		logfile->fd = -1;
 	    }
-	    memset(&logfile->pathstat, 0, sizeof(logfile->pathstat));
+	    fd = open(logfile->pathname, O_RDONLY|O_NONBLOCK);
+	    if (fd < 0 && logfile->fd >= 0)	/* log once */
+		__pmNotifyErr(LOG_ERR, "open: %s - %s",
+			    logfile->pathname, strerror(errno));
+	    logfile->fd = fd;
+#ifdef IS_LINUX
+	    if (logfile->dirwd >= 0)
+		event_watch_file(logfile);
+#endif
 	} else {
-	    /* reopen if no descriptor before, or log rotated (new file) */
-	    if (logfile->fd < 0 ||
-	        logfile->pathstat.st_ino != pathstat.st_ino ||
-		logfile->pathstat.st_dev != pathstat.st_dev) {
-		if (logfile->fd >= 0)
-		    close(logfile->fd);
-		fd = open(logfile->pathname, O_RDONLY|O_NONBLOCK);
-		if (fd < 0 && logfile->fd >= 0)	/* log once */
-		    __pmNotifyErr(LOG_ERR, "open: %s - %s",
-				logfile->pathname, strerror(errno));
-		logfile->fd = fd;
-	    } else {
-		if ((S_ISREG(pathstat.st_mode)) &&
-		    (memcmp(&logfile->pathstat.st_mtime, &pathstat.st_mtime,
-			    sizeof(pathstat.st_mtime))) == 0)
-		    continue;
-	    }
-	    logfile->pathstat = pathstat;
+	    if (!notified && (S_ISREG(pathstat.st_mode)) &&
+		(memcmp(&logfile->pathstat.st_mtime, &pathstat.st_mtime,
+			sizeof(pathstat.st_mtime))) == 0)
+		return;
+	    if (S_ISREG(pathstat.st_mode) &&
+		pathstat.st_size < logfile->pathstat.st_size)
+		lseek(logfile->fd, 0, SEEK_SET);
+	}
+	logfile->pathstat = pathstat;
 events:
-	    do {
-		sts = event_create(logfile);
-	    } while (sts != 0);
+	do {
+	    sts = event_create(logfile, 0);
+	} while (sts != 0);
+    }
+}
+
+void
+event_refresh(void)
+{
+    int i;
+
+    for (i = 0; i < numlogfiles; i++) {
+	if (logfiles[i].filewd >= 0)	/* inotify reports changes */
+	    continue;
+	event_refresh_logfile(&logfiles[i], 0);
+    }
+}
+
+/*
+ * Read the pending inotify events, then all log files they reported as
+ * changed, so each file is read once however many events it generated.
+ */
+void
+event_notify(void)
+{
+#ifdef IS_LINUX
+    union {
+	struct inotify_event	event;
+	char			buffer[16 * 1024];
+    } events;
+    struct inotify_event *ep;
+    event_logfile_t *logfile;
+    int bytes, i;
+    char *p;
+
+    while ((bytes = read(notifyfd, &events, sizeof(events))) > 0) {
+	for (p = events.buffer; p < events.buffer + bytes;
+	     p += sizeof(struct inotify_event) + ep->len) {
+	    ep = (struct inotify_event *)p;
+	    for (i = 0; i < numlogfiles; i++) {
+		logfile = &logfiles[i];
+		if (ep->mask & IN_Q_OVERFLOW) {
+		    logfile->notified = 1;
+		} else if (ep->wd == logfile->filewd) {
+		    if (ep->mask & IN_IGNORED)	/* file removed */
+			logfile->filewd = -1;
+		    else
+			logfile->notified = 1;
+		} else if (ep->wd == logfile->dirwd) {
+		    if (ep->mask & IN_IGNORED) {	/* directory removed */
+			__pmNotifyErr(LOG_WARNING, "inotify: directory of "
+				"%s removed, polling", logfile->pathname);
+			logfile->dirwd = -1;
+			logfile->notified = 1;
+		    } else if (ep->len > 0 &&
+			       strcmp(ep->name, logfile->filename) == 0) {
+			logfile->notified = 1;
+		    }
+		}
+	    }
 	}
     }
+
+    for (i = 0; i < numlogfiles; i++) {
+	logfile = &logfiles[i];
+	if (!logfile->notified)
+	    continue;
+	logfile->notified = 0;
+	if (pmDebug & DBG_TRACE_APPL1)
+	    __pmNotifyErr(LOG_DEBUG, "event_notify: %s changed",
+			logfile->pathname);
+	event_refresh_logfile(logfile, 1);
+    }
+#endif
 }
 
 int
@@ -467,33 +667,291 @@ event_decoder(int eventarray, void *buffer, size_t size,
     return 1;	/* simple decoder, added just one event array */
 }
 
+/*
+ * Client filters are shared by all clients storing the same expression,
+ * and the event queues apply all of the filters of a queue to an event
+ * one after another.  The first of those calls matches the event against
+ * every expression at once, and the remaining calls use its results:
+ *
+ * - expressions without any metacharacters are plain substring searches,
+ *   all found in one pass over the event by an Aho-Corasick automaton;
+ * - the other expressions are also compiled as one alternation, so that
+ *   an event matching none of them (the common case) costs one regexec,
+ *   and only events matching at least one are matched against each.
+ *
+ * The results are kept for the last event matched, identified by its
+ * address and size along with the count of events queued so far (the
+ * queue only reuses space for a new event after a later append).
+ */
+typedef struct event_regex {
+    struct event_regex	*next;
+    char		*pattern;
+    int			literal;
+    int			combined;	/* in the combined expression */
+    int			matched;	/* result for the last event */
+    int			refcount;
+    regex_t		regex;
+} event_regex_t;
+
+typedef struct event_acnode {
+    int			next[256];	/* transitions, failures resolved */
+    int			fail;		/* longest proper suffix node */
+    int			dict;		/* next suffix node with a match */
+    event_regex_t	*match;		/* literal ending at this node */
+} event_acnode_t;
+
+static event_regex_t *regexes;
+
+static struct {
+    int			stale;		/* expressions changed since built */
+    event_acnode_t	*nodes;		/* literals automaton, root first */
+    int			nnodes;
+    int			maxnodes;
+    int			ncombined;	/* expressions in combined */
+    regex_t		combined;	/* alternation of expressions */
+    const void		*data;		/* last event matched */
+    size_t		size;
+    unsigned int	appends;
+} matcher = { .stale = 1 };
+
+static int
+event_acnode_new(void)
+{
+    event_acnode_t *nodes;
+    int n;
+
+    if (matcher.nnodes == matcher.maxnodes) {
+	n = matcher.maxnodes ? matcher.maxnodes * 2 : 64;
+	if ((nodes = realloc(matcher.nodes, n * sizeof(*nodes))) == NULL)
+	    return -ENOMEM;
+	matcher.nodes = nodes;
+	matcher.maxnodes = n;
+    }
+    n = matcher.nnodes++;
+    memset(&matcher.nodes[n], 0, sizeof(event_acnode_t));
+    return n;
+}
+
+/*
+ * Build the automaton for the literal expressions, as a trie whose
+ * missing transitions are then filled in from the failure links in
+ * breadth first order (so matching is one lookup per character).
+ */
+static int
+event_acbuild(void)
+{
+    event_regex_t *regex;
+    event_acnode_t *node;
+    const unsigned char *p;
+    int *queue, head, tail;
+    int c, n, next, fail;
+
+    matcher.nnodes = 0;
+    for (regex = regexes; regex; regex = regex->next)
+	if (regex->literal)
+	    break;
+    if (regex == NULL)
+	return 0;	/* no literals, no automaton */
+    if (event_acnode_new() < 0)
+	return -ENOMEM;
+    for (; regex; regex = regex->next) {
+	if (!regex->literal)
+	    continue;
+	for (n = 0, p = (const unsigned char *)regex->pattern; *p; p++) {
+	    if ((next = matcher.nodes[n].next[*p]) == 0) {
+		if ((next = event_acnode_new()) < 0)
+		    return -ENOMEM;
+		matcher.nodes[n].next[*p] = next;
+	    }
+	    n = next;
+	}
+	matcher.nodes[n].match = regex;
+    }
+
+    if ((queue = malloc(matcher.nnodes * sizeof(int))) == NULL)
+	return -ENOMEM;
+    head = tail = 0;
+    for (c = 0; c < 256; c++)
+	if ((next = matcher.nodes[0].next[c]) != 0)
+	    queue[tail++] = next;
+    while (head < tail) {
+	n = queue[head++];
+	node = &matcher.nodes[n];
+	fail = node->fail;
+	node->dict = matcher.nodes[fail].match ? fail : matcher.nodes[fail].dict;
+	for (c = 0; c < 256; c++) {
+	    if ((next = node->next[c]) != 0) {
+		matcher.nodes[next].fail = matcher.nodes[fail].next[c];
+		queue[tail++] = next;
+	    } else {
+		node->next[c] = matcher.nodes[fail].next[c];
+	    }
+	}
+    }
+    free(queue);
+    return 0;
+}
+
+/*
+ * Combine the regular expressions into one alternation.  Expressions
+ * using back-references are left out, as their group numbers change.
+ */
+static void
+event_rebuild(void)
+{
+    event_regex_t *regex;
+    char *pattern, *p;
+    size_t length = 1;
+    int sts;
+
+    if (matcher.ncombined > 0)
+	regfree(&matcher.combined);
+    matcher.ncombined = 0;
+    matcher.data = NULL;
+    matcher.stale = 0;
+
+    if (event_acbuild() < 0) {
+	matcher.nnodes = 0;	/* match literals one by one instead */
+	matcher.stale = 1;
+    }
+
+    for (regex = regexes; regex; regex = regex->next) {
+	regex->combined = 0;
+	if (regex->literal)
+	    continue;
+	for (p = regex->pattern; *p; p++)
+	    if (p[0] == '\\' && isdigit((int)p[1]))
+		break;
+	if (*p)
+	    continue;
+	regex->combined = 1;
+	length += strlen(regex->pattern) + 3;
+	matcher.ncombined++;
+    }
+    if (matcher.ncombined < 2 || (pattern = malloc(length)) == NULL) {
+	matcher.ncombined = 0;
+	return;
+    }
+    for (p = pattern, regex = regexes; regex; regex = regex->next) {
+	if (!regex->combined)
+	    continue;
+	p += sprintf(p, "%s(%s)", p == pattern ? "" : "|", regex->pattern);
+    }
+    if ((sts = regcomp(&matcher.combined, pattern, REG_EXTENDED|REG_NOSUB)) != 0) {
+	if (pmDebug & DBG_TRACE_APPL0)
+	    __pmNotifyErr(LOG_DEBUG, "combined regcomp failed: error=%d", sts);
+	matcher.ncombined = 0;
+    }
+    free(pattern);
+}
+
+/*
+ * Match one event against every expression
+ */
+static void
+event_match(const char *data)
+{
+    event_regex_t *regex;
+    const unsigned char *p;
+    int n, m, any;
+
+    for (regex = regexes; regex; regex = regex->next)
+	regex->matched = 0;
+
+    if (matcher.nnodes > 0) {
+	if ((regex = matcher.nodes[0].match) != NULL)
+	    regex->matched = 1;		/* empty string matches anything */
+	for (n = 0, p = (const unsigned char *)data; *p; p++) {
+	    n = matcher.nodes[n].next[*p];
+	    if (matcher.nodes[n].match)
+		matcher.nodes[n].match->matched = 1;
+	    for (m = matcher.nodes[n].dict; m != 0; m = matcher.nodes[m].dict)
+		matcher.nodes[m].match->matched = 1;
+	}
+    }
+
+    any = matcher.ncombined == 0 ||
+	  regexec(&matcher.combined, data, 0, NULL, 0) == 0;
+    for (regex = regexes; regex; regex = regex->next) {
+	if (regex->literal) {
+	    if (matcher.nnodes == 0)
+		regex->matched = (strstr(data, regex->pattern) != NULL);
+	} else if (any || !regex->combined) {
+	    regex->matched = (regexec(&regex->regex, data, 0, NULL, 0) == 0);
+	}
+    }
+}
+
 int
 event_regex_apply(void *rp, void *data, size_t size)
 {
-    regex_t *regex = (regex_t *)rp;
-    return regexec(regex, data, 0, NULL, 0) == REG_NOMATCH;
+    event_regex_t *regex = (event_regex_t *)rp;
+
+    if (matcher.stale)
+	event_rebuild();
+    if (data != matcher.data || size != matcher.size ||
+	appends != matcher.appends) {
+	event_match(data);
+	matcher.data = data;
+	matcher.size = size;
+	matcher.appends = appends;
+    }
+    return !regex->matched;
 }
 
 void
 event_regex_release(void *rp)
 {
-    regex_t *regex = (regex_t *)rp;
-    regfree(regex);
+    event_regex_t *regex = (event_regex_t *)rp;
+    event_regex_t **rpp;
+
+    if (--regex->refcount > 0)
+	return;
+    for (rpp = &regexes; *rpp; rpp = &(*rpp)->next) {
+	if (*rpp == regex) {
+	    *rpp = regex->next;
+	    break;
+	}
+    }
+    if (!regex->literal)
+	regfree(&regex->regex);
+    free(regex->pattern);
+    free(regex);
+    matcher.stale = 1;
 }
 
 int
 event_regex_alloc(const char *string, void **filter)
 {
-    regex_t *regex = malloc(sizeof(regex_t));
+    event_regex_t *regex;
     int	 sts;
 
-    if (regex == NULL)
+    for (regex = regexes; regex; regex = regex->next) {
+	if (strcmp(regex->pattern, string) == 0) {
+	    regex->refcount++;
+	    *filter = (void *)regex;
+	    return 0;
+	}
+    }
+
+    if ((regex = calloc(1, sizeof(event_regex_t))) == NULL)
+	return -ENOMEM;
+    if ((regex->pattern = strdup(string)) == NULL) {
+	free(regex);
 	return -ENOMEM;
-    if ((sts = regcomp(regex, string, REG_EXTENDED|REG_NOSUB)) != 0) {
+    }
+    regex->literal = (string[strcspn(string, "^$.[]|()*+?{}\\")] == '\0');
+    if (!regex->literal &&
+	(sts = regcomp(&regex->regex, string, REG_EXTENDED|REG_NOSUB)) != 0) {
 	fprintf(stderr, "regcomp(..., \"%s\", ...) failed: error=%d\n", string, sts);
+	free(regex->pattern);
 	free(regex);
 	return PM_ERR_BADSTORE;
     }
+    regex->refcount = 1;
+    regex->next = regexes;
+    regexes = regex;
+    matcher.stale = 1;
     *filter = (void *)regex;
     return 0;
 }
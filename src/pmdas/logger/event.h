@@ -1,7 +1,7 @@
 /*
  * Event support for the Logger PMDA
  *
- * Copyright (c) 2011 Red Hat Inc.
+ * Copyright (c) 2011,2017 Red Hat Inc.
  * Copyright (c) 2011 Nathan Scott.  All rights reversed.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -27,6 +27,10 @@ typedef struct event_logfile {
     pid_t	        pid;
     int			queueid;
     int			noaccess;
+    int			filewd;		/* inotify watch on the file */
+    int			dirwd;		/* inotify watch on its directory */
+    int			notified;	/* change reported by inotify */
+    const char		*filename;	/* last pathname component */
     struct stat		pathstat;
     char		pmnsname[MAXPATHLEN];
     char		pathname[MAXPATHLEN];
@@ -39,6 +43,8 @@ extern long maxmem;
 extern void event_init(pmID pmid);
 extern void event_shutdown(void);
 extern void event_refresh(void);
+extern int event_notifyfd(void);
+extern void event_notify(void);
 extern int event_config(const char *filename);
 
 extern int event_logcount(void);
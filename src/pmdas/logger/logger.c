@@ -1,7 +1,7 @@
 /*
  * Logger, a configurable log file monitoring PMDA
  *
- * Copyright (c) 2011-2012 Red Hat.
+ * Copyright (c) 2011-2012,2017 Red Hat.
  * Copyright (c) 2011 Nathan Scott.  All Rights Reserved.
  * Copyright (c) 1995,2004 Silicon Graphics, Inc.  All Rights Reserved.
  * 
@@ -439,7 +439,7 @@ void
 loggerMain(pmdaInterface *dispatch)
 {
     fd_set		readyfds;
-    int			nready, pmcdfd;
+    int			nready, pmcdfd, notifyfd;
 
     pmcdfd = __pmdaInFd(dispatch);
     if (pmcdfd > maxfd)
@@ -448,6 +448,13 @@ loggerMain(pmdaInterface *dispatch)
     FD_ZERO(&fds);
     FD_SET(pmcdfd, &fds);
 
+    /* log file changes, if inotify is available */
+    if ((notifyfd = event_notifyfd()) >= 0) {
+	if (notifyfd > maxfd)
+	    maxfd = notifyfd;
+	FD_SET(notifyfd, &fds);
+    }
+
     /* arm interval timer */
     if (__pmAFregister(&interval, NULL, logger_timer) < 0) {
 	__pmNotifyErr(LOG_ERR, "registering event interval handler");
@@ -480,6 +487,8 @@ loggerMain(pmdaInterface *dispatch)
 	    if (pmDebug & DBG_TRACE_APPL0)
 		__pmNotifyErr(LOG_DEBUG, "completed pmcd PDU [fd=%d]", pmcdfd);
 	}
+	if (nready > 0 && notifyfd >= 0 && FD_ISSET(notifyfd, &readyfds))
+	    event_notify();
 	if (interval_expired) {
 	    interval_expired = 0;
 	    event_refresh();
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2013,2016 Red Hat.
+ * Copyright (C) 2013,2016,2017 Red Hat.
  * Copyright (C) 2009 Aconex.  All Rights Reserved.
  * Copyright (C) 2001 Silicon Graphics, Inc.  All Rights Reserved.
  *
@@ -182,6 +182,9 @@ metrictype(int mtype)
     case MMV_TYPE_ELAPSED:
 	type = "elapsed";
 	break;
+    case MMV_TYPE_HISTOGRAM:
+	type = "histogram";
+	break;
     default:
 	type = "?";
 	break;
@@ -348,6 +351,65 @@ dump_metrics(void *addr, size_t size, int idx, long base, __uint64_t offset, __i
     return dump_metrics2(addr, size, idx, base, offset, count);
 }
 
+static int
+stripe_count(void *addr)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+    mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
+			((char *)addr + sizeof(mmv_disk_header_t));
+    int i;
+
+    for (i = 0; i < hdr->tocs; i++)
+	if (toc[i].type == MMV_TOC_STRIPES)
+	    return toc[i].count;
+    return 0;
+}
+
+/* bucket indom of a histogram value, or NULL if out of bounds */
+static mmv_disk_indom_t *
+histogram_indom(void *addr, size_t size, mmv_disk_value_t *v)
+{
+    mmv_disk_instance2_t *instance;
+    mmv_disk_indom_t *indom;
+
+    if (size < v->instance + sizeof(mmv_disk_instance2_t))
+	return NULL;
+    instance = (mmv_disk_instance2_t *)((char *)addr + v->instance);
+    if (size < instance->indom + sizeof(mmv_disk_indom_t))
+	return NULL;
+    indom = (mmv_disk_indom_t *)((char *)addr + instance->indom);
+    if (size < v->extra +
+	    MMV_HISTOGRAM_SIZE(indom->count, stripe_count(addr)))
+	return NULL;
+    return indom;
+}
+
+int
+dump_histogram(void *addr, size_t size, mmv_disk_value_t *v, int i, int toc)
+{
+    mmv_disk_indom_t *indom;
+    __uint64_t *counts, stride, sum;
+    int j, k, stripes;
+
+    if ((indom = histogram_indom(addr, size, v)) == NULL) {
+	printf(" = ?\n");
+	printf("Bad file size: toc[%d] histogram value[%d] buckets\n", toc, i);
+	return 1;
+    }
+    stripes = stripe_count(addr) + 1;	/* and the shared counts */
+    stride = MMV_BUCKETS_SIZE(indom->count);
+    printf(" =");
+    for (k = 0; k < indom->count; k++) {
+	counts = (__uint64_t *)((char *)addr + v->extra + stride);
+	for (j = 0, sum = 0; j < stripes; j++) {
+	    sum += counts[k];
+	    counts = (__uint64_t *)((char *)counts + stride);
+	}
+	printf(" %"PRIu64, sum);
+    }
+    return 0;
+}
+
 int
 dump_value(void *addr, size_t size, mmv_disk_value_t *vals, int i, int toc, int type)
 {
@@ -395,6 +457,10 @@ dump_value(void *addr, size_t size, mmv_disk_value_t *vals, int i, int toc, int
 	    printf("Bad (positive) ELAPSED 'extra' value found!");
 	}
 	break;
+    case MMV_TYPE_HISTOGRAM:
+	if (dump_histogram(addr, size, &vals[i], i, toc))
+	    return 1;
+	break;
     default:
 	printf("Unknown type %d", type);
     }
@@ -474,7 +540,8 @@ dump_values2(void *addr, size_t size, int idx, long base, __uint64_t offset, __i
 	memcpy(buf, string->payload, sizeof(buf));
 	buf[sizeof(buf)-1] = '\0';
 	printf("  [%u/%"PRIu64"] %s", metric->item, off, buf);
-	if (metric->indom && metric->indom != PM_IN_NULL) {
+	if (metric->indom && metric->indom != PM_IN_NULL &&
+	    metric->type != MMV_TYPE_HISTOGRAM) {	/* one for all buckets */
 	    off = vals[i].instance;
 	    if (size < off + sizeof(mmv_disk_instance2_t)) {
 		printf("\n");
@@ -534,6 +601,86 @@ dump_strings(void *addr, size_t size, int idx, long base, __uint64_t offset, __i
     return 0;
 }
 
+int
+dump_stripes(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count)
+{
+    int i, j, used, nvalues = 0;
+    __uint64_t stride, off;
+    pmAtomValue *slot;
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+    mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
+			((char *)addr + sizeof(mmv_disk_header_t));
+
+    printf("\nTOC[%d]: offset %ld, stripes offset %"PRIu64" (%d entries)\n",
+		idx, base, offset, count);
+
+    for (i = 0; i < hdr->tocs; i++)
+	if (toc[i].type == MMV_TOC_VALUES)
+	    nvalues = toc[i].count;
+    stride = MMV_STRIPE_SIZE(nvalues);
+
+    for (i = 0; i < count; i++) {
+	off = offset + i * stride;
+	if (size < off + stride) {
+	    printf("Bad file size: toc[%d] stripe[%d]\n", idx, i);
+	    return 1;
+	}
+	slot = (pmAtomValue *)((char *)addr + off);
+	for (j = used = 0; j < nvalues; j++)
+	    if (slot[j].ull != 0)
+		used++;
+	printf("  [%u/%"PRIu64"] %d of %d slots in use\n",
+		i, off, used, nvalues);
+    }
+    return 0;
+}
+
+int
+dump_buckets(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count)
+{
+    int i, j, k, n = 0;
+    __int64_t *bounds;
+    mmv_disk_indom_t *indom;
+    mmv_disk_metric2_t *metric;
+    mmv_disk_value_t *vals;
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+    mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
+			((char *)addr + sizeof(mmv_disk_header_t));
+
+    printf("\nTOC[%d]: offset %ld, buckets offset %"PRIu64" (%d entries)\n",
+		idx, base, offset, count);
+
+    for (i = 0; i < hdr->tocs; i++) {
+	if (toc[i].type != MMV_TOC_VALUES)
+	    continue;
+	vals = (mmv_disk_value_t *)((char *)addr + toc[i].offset);
+	for (k = 0; k < toc[i].count; k++) {
+	    if (size < vals[k].metric + sizeof(mmv_disk_metric2_t))
+		continue;
+	    metric = (mmv_disk_metric2_t *)((char *)addr + vals[k].metric);
+	    if (metric->type != MMV_TYPE_HISTOGRAM)
+		continue;
+	    if ((indom = histogram_indom(addr, size, &vals[k])) == NULL) {
+		printf("Bad file size: toc[%d] histogram[%d]\n", idx, n);
+		return 1;
+	    }
+	    bounds = (__int64_t *)((char *)addr + vals[k].extra);
+	    printf("  [%u/%"PRIu64"] %d buckets, bounds",
+		    metric->item, vals[k].extra, indom->count);
+	    for (j = 0; j < indom->count; j++)
+		printf(" %"PRIi64, bounds[j]);
+	    putchar('\n');
+	    n++;
+	}
+	break;
+    }
+    if (n != count) {
+	printf("Bad TOC[%d]: %d histograms in values\n", idx, n);
+	return 1;
+    }
+    return 0;
+}
+
 static char *
 flagstr(int flags)
 {
@@ -586,7 +733,8 @@ dump(const char *file, void *addr, size_t size)
 	return 1;
     }
     version = hdr->version;
-    if (version != MMV_VERSION1 && version != MMV_VERSION2) {
+    if (version != MMV_VERSION1 && version != MMV_VERSION2 &&
+	version != MMV_VERSION3) {
 	printf("Version %d not supported\n", version);
 	return 1;
     }
@@ -653,6 +801,14 @@ dump(const char *file, void *addr, size_t size)
 	    if (dump_strings(addr, size, i, base, offset, count))
 		sts = 1;
 	    break;
+	case MMV_TOC_STRIPES:
+	    if (dump_stripes(addr, size, i, base, offset, count))
+		sts = 1;
+	    break;
+	case MMV_TOC_BUCKETS:
+	    if (dump_buckets(addr, size, i, base, offset, count))
+		sts = 1;
+	    break;
 	default:
 	    printf("Unrecognised TOC[%d] type: 0x%x\n", i, type);
 	    sts = 1;
@@ -68,24 +68,54 @@ static char * pcppmdasdir;		/* probably /var/pcp/pmdas */
 static char pmnsdir[MAXPATHLEN];	/* pcpvardir/pmns */
 static char statsdir[MAXPATHLEN];	/* pcptmpdir/<prefix> */
 
+/*
+ * Lookup entry for one value of a client, found by metric item and
+ * instance through the per-client hash.  Each metric also has an entry
+ * with a PM_IN_NULL instance, for its first value (help text lookups,
+ * and the only value of metrics without an instance domain).
+ */
+typedef struct {
+    mmv_disk_value_t *	value;		/* value in mmap */
+    __uint32_t		item;		/* metric item identifier */
+    unsigned int	inst;		/* internal instance identifier */
+    int			singular;	/* metric has no instance domain */
+    mmv_metric_type_t	type;		/* metric value type */
+    int			bucket;		/* histogram bucket of instance */
+    int			nbuckets;	/* histogram bucket count */
+    __uint64_t		shorttext;	/* offset of short help text */
+    __uint64_t		helptext;	/* offset of long help text */
+} value_t;
+
 typedef struct {
     char *	name;			/* strdup client name */
     void *	addr;			/* mmap */
     mmv_disk_value_t * values;		/* values in mmap */
-    mmv_disk_metric_t * metrics1;	/* v1 metric descs in mmap */
-    mmv_disk_metric2_t * metrics2;	/* v2 metric descs in mmap */
     int		vcnt;			/* number of values */
-    int		mcnt1;			/* number of metrics */
-    int		mcnt2;			/* number of v2 metrics */
-    int		version;		/* v1/v2 version number */
+    pmAtomValue * stripes;		/* per-thread value stripes (v3) */
+    int		nstripes;		/* number of value stripes */
+    __uint64_t	stride;			/* bytes from one stripe to the next */
+    value_t *	vlist;			/* value lookup entries */
+    int		vlcnt;			/* number of lookup entries */
+    __pmHashCtl	vhash;			/* lookup entries by item/instance */
+    pmdaMetric * metrics;		/* metrics exported from this file */
+    char **	mnames;			/* names of these metrics */
+    char *	exported;		/* metric names added to the pmns */
+    int		mcnt;			/* number of metrics */
+    pmdaIndom *	indoms;			/* indoms exported from this file */
+    int		icnt;			/* number of indoms */
+    int		version;		/* v1/v2/v3 version number */
     int		cluster;		/* cluster identifier */
+    int		seen;			/* found in directory this reload */
     pid_t	pid;			/* process identifier */
+    dev_t	dev;			/* device of the mapped file */
+    ino_t	ino;			/* inode of the mapped file */
     __int64_t	len;			/* mmap region len */
     __uint64_t	gen;			/* generation number on open */
 } stats_t;
 
 static stats_t * slist;
 static int scnt;
+static __pmHashCtl clusters;		/* slist entries by cluster */
 
 #define MAX_MMV_COUNT 10000		/* enforce reasonable limits */
 #define MAX_MMV_CLUSTER ((1<<12)-1)
@@ -139,8 +169,9 @@ choose_cluster(int requested, const char *path)
 }
 
 static int
-create_client_stat(const char *client, const char *path, size_t size)
+create_client_stat(const char *client, const char *path, struct stat *sbuf)
 {
+    size_t size = sbuf->st_size;
     int fd;
 
     if (pmDebug & DBG_TRACE_APPL0)
@@ -165,7 +196,8 @@ create_client_stat(const char *client, const char *path, size_t size)
 	    }
 
 	    if (header.version != MMV_VERSION1 &&
-		header.version != MMV_VERSION2) {
+		header.version != MMV_VERSION2 &&
+		header.version != MMV_VERSION3) {
 		if (pmDebug & DBG_TRACE_APPL0)
 		    __pmNotifyErr(LOG_ERR,
 			"%s: %s client version %d unsupported (current is %d)",
@@ -219,6 +251,9 @@ create_client_stat(const char *client, const char *path, size_t size)
 		slist[scnt].cluster = cluster;
 		slist[scnt].gen = header.g1;
 		slist[scnt].len = size;
+		slist[scnt].dev = sbuf->st_dev;
+		slist[scnt].ino = sbuf->st_ino;
+		slist[scnt].seen = 1;
 		scnt++;
 	    } else {
 		__pmNotifyErr(LOG_ERR, "%s: client \"%s\" out of memory - %s",
@@ -237,12 +272,11 @@ create_client_stat(const char *client, const char *path, size_t size)
     return 0;
 }
 
-/* check validity of client metric name, return non-zero if bad or duplicate */
+/* check validity of client metric name, return non-zero if bad */
 static int
 verify_metric_name(const char *name, int pos, stats_t *s)
 {
     const char *p = name;
-    pmID pmid;
 
     if (pmDebug & DBG_TRACE_APPL0)
 	__pmNotifyErr(LOG_DEBUG, "MMV: verify_metric_name: %s", name);
@@ -259,8 +293,6 @@ verify_metric_name(const char *name, int pos, stats_t *s)
 			    pos, s->name, *p);
 	return -EINVAL;
     }
-    if (pmdaTreePMID(pmns, name, &pmid) == 0)
-	return -EEXIST;
     return 0;
 }
 
@@ -283,45 +315,68 @@ static int
 create_metric(pmdaExt *pmda, stats_t *s, char *name, pmID pmid, unsigned indom,
 	mmv_metric_type_t type, mmv_metric_sem_t semantics, pmUnits units)
 {
+    pmdaMetric *mp;
+    char **np, *ep;
+
     if (pmDebug & DBG_TRACE_APPL0)
 	__pmNotifyErr(LOG_DEBUG, "MMV: create_metric: %s - %s", name, pmIDStr(pmid));
 
-    metrics = realloc(metrics, sizeof(pmdaMetric) * (mtot + 1));
-    if (metrics == NULL)  {
+    mp = realloc(s->metrics, sizeof(pmdaMetric) * (s->mcnt + 1));
+    if (mp == NULL)  {
 	__pmNotifyErr(LOG_ERR, "cannot grow MMV metric list: %s", s->name);
 	return -ENOMEM;
     }
+    s->metrics = mp;
+    np = realloc(s->mnames, sizeof(char *) * (s->mcnt + 1));
+    if (np == NULL || (np[s->mcnt] = strdup(name)) == NULL) {
+	if (np)
+	    s->mnames = np;
+	__pmNotifyErr(LOG_ERR, "cannot grow MMV metric names: %s", s->name);
+	return -ENOMEM;
+    }
+    s->mnames = np;
+    if ((ep = realloc(s->exported, s->mcnt + 1)) == NULL) {
+	free(np[s->mcnt]);
+	__pmNotifyErr(LOG_ERR, "cannot grow MMV metric names: %s", s->name);
+	return -ENOMEM;
+    }
+    s->exported = ep;
+    ep[s->mcnt] = 0;
+    mp += s->mcnt;
 
-    metrics[mtot].m_user = NULL;
-    metrics[mtot].m_desc.pmid = pmid;
+    mp->m_user = NULL;
+    mp->m_desc.pmid = pmid;
 
     if (type == MMV_TYPE_ELAPSED) {
 	pmUnits unit = PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0);
-	metrics[mtot].m_desc.sem = PM_SEM_COUNTER;
-	metrics[mtot].m_desc.type = MMV_TYPE_I64;
-	metrics[mtot].m_desc.units = unit;
+	mp->m_desc.sem = PM_SEM_COUNTER;
+	mp->m_desc.type = MMV_TYPE_I64;
+	mp->m_desc.units = unit;
+    } else if (type == MMV_TYPE_HISTOGRAM) {
+	/* bucket counts, one instance for each bucket */
+	mp->m_desc.sem = PM_SEM_COUNTER;
+	mp->m_desc.type = MMV_TYPE_U64;
+	memcpy(&mp->m_desc.units, &units, sizeof(pmUnits));
     } else {
 	if (semantics)
-	    metrics[mtot].m_desc.sem = semantics;
+	    mp->m_desc.sem = semantics;
 	else
-	    metrics[mtot].m_desc.sem = PM_SEM_COUNTER;
-	metrics[mtot].m_desc.type = type;
-	memcpy(&metrics[mtot].m_desc.units, &units, sizeof(pmUnits));
+	    mp->m_desc.sem = PM_SEM_COUNTER;
+	mp->m_desc.type = type;
+	memcpy(&mp->m_desc.units, &units, sizeof(pmUnits));
     }
     if (!indom || indom == PM_INDOM_NULL)
-	metrics[mtot].m_desc.indom = PM_INDOM_NULL;
+	mp->m_desc.indom = PM_INDOM_NULL;
     else
-	metrics[mtot].m_desc.indom = 
+	mp->m_desc.indom = 
 		pmInDom_build(pmda->e_domain, (s->cluster << 11) | indom);
 
     if (pmDebug & DBG_TRACE_APPL0)
 	__pmNotifyErr(LOG_DEBUG,
 			"MMV: map_stats adding metric[%d] %s %s from %s\n",
-			mtot, name, pmIDStr(pmid), s->name);
-
-    mtot++;
-    __pmAddPMNSNode(pmns, pmid, name);
+			s->mcnt, name, pmIDStr(pmid), s->name);
 
+    s->mcnt++;
     return 0;
 }
 
@@ -341,9 +396,9 @@ verify_indom_serial(pmdaExt *pmda, int serial, stats_t *s, pmInDom *p, pmdaIndom
     }
 
     *p = pmInDom_build(pmda->e_domain, (s->cluster << 11) | serial);
-    for (index = 0; index < intot; index++) {
-	*i = &indoms[index];
-	if (indoms[index].it_indom == *p)
+    for (index = 0; index < s->icnt; index++) {
+	*i = &s->indoms[index];
+	if (s->indoms[index].it_indom == *p)
 	    return -EEXIST;
     }
     *i = NULL;
@@ -368,17 +423,17 @@ update_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
 	for (i = 0; i < count; i++) {
 	    for (j = 0; j < ip->it_numinst; j++) {
 		if (ip->it_set[j].i_inst == in1[i].internal)
-		    continue;
+		    break;
 	    }
 	    if (j == ip->it_numinst)
 		newinsts++;
 	}
-    } else if (s->version == MMV_VERSION2) {
+    } else if (s->version >= MMV_VERSION2) {
 	in2 = (mmv_disk_instance2_t *)((char *)s->addr + offset);
 	for (i = 0; i < count; i++) {
 	    for (j = 0; j < ip->it_numinst; j++) {
 		if (ip->it_set[j].i_inst == in2[i].internal)
-		    continue;
+		    break;
 	    }
 	    if (j == ip->it_numinst)
 		newinsts++;
@@ -401,18 +456,18 @@ update_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
 	for (i = 0; i < count; i++) {
 	    for (j = 0; j < ip->it_numinst; j++)
 		if (ip->it_set[j].i_inst == in1[i].internal)
-		    continue;
+		    break;
 	    if (j == ip->it_numinst) {
 		ip->it_set[j].i_inst = in1[i].internal;
 		ip->it_set[j].i_name = in1[i].external;
 		ip->it_numinst++;
 	    }
 	}
-    } else if (s->version == MMV_VERSION2) {
+    } else if (s->version >= MMV_VERSION2) {
 	for (i = 0; i < count; i++) {
 	    for (j = 0; j < ip->it_numinst; j++)
 		if (ip->it_set[j].i_inst == in2[i].internal)
-		    continue;
+		    break;
 	    if (j == ip->it_numinst) {
 		string = (mmv_disk_string_t *)
 				((char *)s->addr + in2[i].external);
@@ -438,13 +493,14 @@ create_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
     if (pmDebug & DBG_TRACE_APPL0)
 	__pmNotifyErr(LOG_DEBUG, "MMV: create_indom: %u", id->serial);
 
-    indoms = realloc(indoms, sizeof(pmdaIndom) * (intot + 1));
-    if (indoms == NULL) {
+    ip = realloc(s->indoms, sizeof(pmdaIndom) * (s->icnt + 1));
+    if (ip == NULL) {
 	__pmNotifyErr(LOG_ERR, "%s: cannot grow indom list in %s",
 			pmProgname, s->name);
 	return -ENOMEM;
     }
-    ip = &indoms[intot++];
+    s->indoms = ip;
+    ip = &s->indoms[s->icnt++];
     ip->it_indom = indom;
     ip->it_set = (pmdaInstid *)calloc(count, sizeof(pmdaInstid));
     if (ip->it_set == NULL) {
@@ -461,7 +517,7 @@ create_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
 	    ip->it_set[i].i_inst = in1[i].internal;
 	    ip->it_set[i].i_name = in1[i].external;
 	}
-    } else if (s->version == MMV_VERSION2) {
+    } else if (s->version >= MMV_VERSION2) {
 	in2 = (mmv_disk_instance2_t *)((char *)s->addr + offset);
 	ip->it_numinst = count;
 	for (i = 0; i < count; i++) {
@@ -474,401 +530,829 @@ create_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
     return 0;
 }
 
-static void
-map_stats(pmdaExt *pmda)
+static unsigned int
+value_key(__uint32_t item, unsigned int inst)
 {
-    struct dirent **files;
-    char name[64];
-    int need_reload = 0;
-    int i, j, k, sts, num;
-
-    if (pmns)
-	__pmFreePMNS(pmns);
+    return (item * 2654435761U) ^ inst;
+}
 
-    if ((sts = __pmNewPMNS(&pmns)) < 0) {
-	__pmNotifyErr(LOG_ERR, "%s: failed to create new pmns: %s\n",
-			pmProgname, pmErrStr(sts));
-	pmns = NULL;
-	return;
+static value_t *
+value_search(stats_t *s, __uint32_t item, unsigned int inst)
+{
+    unsigned int key = value_key(item, inst);
+    __pmHashNode *node;
+    value_t *vp;
+
+    for (node = __pmHashSearch(key, &s->vhash); node; node = node->next) {
+	vp = (value_t *)node->data;
+	if (node->key == key && vp->item == item && vp->inst == inst)
+	    return vp;
     }
+    return NULL;
+}
 
-    /* hard-coded metrics (not from mmap'd files) */
-    snprintf(name, sizeof(name), "%s.control.reload", prefix);
-    __pmAddPMNSNode(pmns, pmid_build(pmda->e_domain, 0, 0), name);
-    snprintf(name, sizeof(name), "%s.control.debug", prefix);
-    __pmAddPMNSNode(pmns, pmid_build(pmda->e_domain, 0, 1), name);
-    snprintf(name, sizeof(name), "%s.control.files", prefix);
-    __pmAddPMNSNode(pmns, pmid_build(pmda->e_domain, 0, 2), name);
-    mtot = 3;
+static value_t *
+value_add(stats_t *s, mmv_disk_value_t *v, __uint32_t item, unsigned int inst,
+	int singular, mmv_metric_type_t type, __uint64_t st, __uint64_t ht)
+{
+    value_t *vp;
+
+    if (value_search(s, item, inst) != NULL)
+	return NULL;	/* first value wins, as for any duplicate */
+    vp = &s->vlist[s->vlcnt];
+    vp->value = v;
+    vp->item = item;
+    vp->inst = inst;
+    vp->singular = singular;
+    vp->type = type;
+    vp->shorttext = st;
+    vp->helptext = ht;
+    if (__pmHashAdd(value_key(item, inst), vp, &s->vhash) < 0)
+	return NULL;
+    s->vlcnt++;
+    return vp;
+}
 
-    if (indoms != NULL) {
-	for (i = 0; i < intot; i++)
-	    free(indoms[i].it_set);
-	free(indoms);
-	indoms = NULL;
-	intot = 0;
-    }
+/*
+ * Find the bucket instances of a (v3) histogram value, checking that
+ * they and the bounds and counts of its buckets lie within the file;
+ * returns the number of buckets, or zero for a malformed histogram.
+ */
+static int
+value_buckets(stats_t *s, mmv_disk_value_t *v, mmv_disk_instance2_t **insts)
+{
+    mmv_disk_instance2_t *ip;
+    mmv_disk_indom_t *id;
+    __uint32_t count;
 
-    if (slist != NULL) {
-	for (i = 0; i < scnt; i++) {
-	    free(slist[i].name);
-	    __pmMemoryUnmap(slist[i].addr, slist[i].len);
+    if (s->version < MMV_VERSION3 ||
+	s->len < v->instance + sizeof(mmv_disk_instance2_t))
+	return 0;
+    ip = (mmv_disk_instance2_t *)((char *)s->addr + v->instance);
+    if (s->len < ip->indom + sizeof(mmv_disk_indom_t))
+	return 0;
+    id = (mmv_disk_indom_t *)((char *)s->addr + ip->indom);
+    count = id->count;
+    if (count == 0 || count > MAX_MMV_COUNT ||
+	s->len < id->offset + count * sizeof(mmv_disk_instance2_t) ||
+	s->len < v->extra + MMV_HISTOGRAM_SIZE(count, s->nstripes)) {
+	if (pmDebug & DBG_TRACE_APPL0) {
+	    __pmNotifyErr(LOG_ERR, "MMV: %s - bad histogram at %"PRIu64,
+			    s->name, v->extra);
 	}
-	free(slist);
-	slist = NULL;
-	scnt = 0;
+	return 0;
     }
+    *insts = (mmv_disk_instance2_t *)((char *)s->addr + id->offset);
+    return count;
+}
 
-    num = scandir(statsdir, &files, NULL, NULL);
-    for (i = 0; i < num; i++) {
-	struct stat statbuf;
-	char path[MAXPATHLEN];
-	char *client;
+/*
+ * Build the hash of values by metric item and instance for a client,
+ * replacing searches through all metrics and values on every fetch.
+ */
+static void
+map_values(stats_t *s)
+{
+    mmv_disk_instance2_t *insts;
+    mmv_disk_value_t *v;
+    mmv_metric_type_t type;
+    value_t *vp;
+    __uint64_t st, ht;
+    __uint32_t item;
+    __int32_t indom, inst;
+    int i, k, n, nvalues;
+
+    if (s->vcnt == 0)
+	return;
 
-	if (files[i]->d_name[0] == '.')
+    /* histograms have an entry for every bucket, as well as their own */
+    nvalues = s->vcnt * 2;
+    if (s->version >= MMV_VERSION3) {
+	for (i = 0; i < s->vcnt; i++) {
+	    v = &s->values[i];
+	    if (s->len < v->metric + sizeof(mmv_disk_metric2_t) ||
+		((mmv_disk_metric2_t *)((char *)s->addr + v->metric))->type
+			!= MMV_TYPE_HISTOGRAM)
+		continue;
+	    nvalues += value_buckets(s, v, &insts);
+	}
+    }
+    if ((s->vlist = calloc(nvalues, sizeof(value_t))) == NULL) {
+	__pmNotifyErr(LOG_ERR, "%s: cannot get memory for values in %s",
+			pmProgname, s->name);
+	return;
+    }
+    __pmHashPreAlloc(nvalues | 1, &s->vhash);
+
+    for (i = 0; i < s->vcnt; i++) {
+	v = &s->values[i];
+	if (s->version == MMV_VERSION1) {
+	    mmv_disk_metric_t *mp;
+
+	    if (s->len < v->metric + sizeof(mmv_disk_metric_t))
+		continue;
+	    mp = (mmv_disk_metric_t *)((char *)s->addr + v->metric);
+	    item = mp->item;
+	    type = mp->type;
+	    indom = mp->indom;
+	    st = mp->shorttext;
+	    ht = mp->helptext;
+	} else {
+	    mmv_disk_metric2_t *mp;
+
+	    if (s->len < v->metric + sizeof(mmv_disk_metric2_t))
+		continue;
+	    mp = (mmv_disk_metric2_t *)((char *)s->addr + v->metric);
+	    item = mp->item;
+	    type = mp->type;
+	    indom = mp->indom;
+	    st = mp->shorttext;
+	    ht = mp->helptext;
+	}
+
+	if (indom == PM_INDOM_NULL || indom == 0) {
+	    value_add(s, v, item, PM_IN_NULL, 1, type, st, ht);
+	    continue;
+	}
+	if (type == MMV_TYPE_HISTOGRAM) {
+	    if ((n = value_buckets(s, v, &insts)) == 0)
+		continue;
+	    for (k = 0; k < n; k++) {
+		if ((vp = value_add(s, v, item, insts[k].internal,
+				    0, type, st, ht)) != NULL) {
+		    vp->bucket = k;
+		    vp->nbuckets = n;
+		}
+	    }
+	    if ((vp = value_add(s, v, item, PM_IN_NULL, 0, type, st, ht)))
+		vp->nbuckets = n;
 	    continue;
+	}
+	if (s->version == MMV_VERSION1) {
+	    if (s->len < v->instance + sizeof(mmv_disk_instance_t))
+		continue;
+	    inst = ((mmv_disk_instance_t *)
+			((char *)s->addr + v->instance))->internal;
+	} else {
+	    if (s->len < v->instance + sizeof(mmv_disk_instance2_t))
+		continue;
+	    inst = ((mmv_disk_instance2_t *)
+			((char *)s->addr + v->instance))->internal;
+	}
+	value_add(s, v, item, inst, 0, type, st, ht);
+	value_add(s, v, item, PM_IN_NULL, 0, type, st, ht);
+    }
+}
 
-	client = files[i]->d_name;
-	sprintf(path, "%s%c%s", statsdir, __pmPathSeparator(), client);
+/*
+ * Parse the metrics, indoms and values of a newly mapped client file;
+ * these are kept with the client until its file is unmapped, and are
+ * spliced into the PMDA tables after each reload.
+ */
+static void
+map_client(pmdaExt *pmda, stats_t *s)
+{
+    mmv_disk_indom_t *id;
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)s->addr;
+    mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
+		    ((char *)s->addr + sizeof(mmv_disk_header_t));
+    __uint64_t stripes = 0;
+    int j, k, nstripes = 0;
+
+    for (j = 0; j < hdr->tocs; j++) {
+	__uint64_t offset = toc[j].offset;
+	__uint32_t count = toc[j].count;
+	__uint32_t type = toc[j].type;
+
+	switch (type) {
+	case MMV_TOC_METRICS:
+	    if (count > MAX_MMV_COUNT) {
+		if (pmDebug & DBG_TRACE_APPL0) {
+		    __pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "metrics count: %d > %d",
+				    s->name, count, MAX_MMV_COUNT);
+		}
+		continue;
+	    }
+	    if (s->version == MMV_VERSION1) {
+		mmv_disk_metric_t *ml = (mmv_disk_metric_t *)
+				    ((char *)s->addr + offset);
 
-	if (stat(path, &statbuf) >= 0 && S_ISREG(statbuf.st_mode))
-	    if (create_client_stat(client, path, statbuf.st_size) == -EAGAIN)
-		need_reload = 1;
-    }
+		offset += (count * sizeof(mmv_disk_metric_t));
+		if (s->len < offset) {
+		    if (pmDebug & DBG_TRACE_APPL0) {
+			__pmNotifyErr(LOG_INFO, "MMV: %s - "
+				    "metrics offset: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, (int64_t)offset);
+		    }
+		    continue;
+		}
 
-    for (i = 0; i < num; i++)
-	free(files[i]);
-    if (num > 0)
-	free(files);
+		for (k = 0; k < count; k++) {
+		    mmv_disk_metric_t *mp = &ml[k];
+		    char name[MAXPATHLEN];
+		    pmID pmid;
 
-    for (i = 0; slist && i < scnt; i++) {
-	stats_t *s = slist + i;
-	mmv_disk_indom_t *id;
-	mmv_disk_header_t *hdr = (mmv_disk_header_t *)s->addr;
-	mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
-			((char *)s->addr + sizeof(mmv_disk_header_t));
+		    /* build name, check its legitimate and unique */
+		    if (hdr->flags & MMV_FLAG_NOPREFIX)
+			sprintf(name, "%s.", prefix);
+		    else
+			sprintf(name, "%s.%s.", prefix, s->name);
+		    strcat(name, mp->name);
+		    if (verify_metric_name(name, k, s) != 0)
+			continue;
+		    if (verify_metric_item(mp->item, name, s) != 0)
+			continue;
 
-	for (j = 0; j < hdr->tocs; j++) {
-	    __uint64_t offset = toc[j].offset;
-	    __uint32_t count = toc[j].count;
-	    __uint32_t type = toc[j].type;
+		    pmid = pmid_build(pmda->e_domain, s->cluster, mp->item);
+		    create_metric(pmda, s, name, pmid, mp->indom,
+				    mp->type, mp->semantics, mp->dimension);
+		}
+	    }
+	    else if (s->version >= MMV_VERSION2) {
+		mmv_disk_metric2_t *ml = (mmv_disk_metric2_t *)
+				    ((char *)s->addr + offset);
 
-	    switch (type) {
-	    case MMV_TOC_METRICS:
-		if (count > MAX_MMV_COUNT) {
+		offset += (count * sizeof(mmv_disk_metric2_t));
+		if (s->len < offset) {
 		    if (pmDebug & DBG_TRACE_APPL0) {
-			__pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"metrics count: %d > %d",
-					s->name, count, MAX_MMV_COUNT);
+			__pmNotifyErr(LOG_INFO, "MMV: %s - "
+				    "metrics offset: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, (int64_t)offset);
 		    }
 		    continue;
 		}
-		if (s->version == MMV_VERSION1) {
-		    mmv_disk_metric_t *ml = (mmv_disk_metric_t *)
-					((char *)s->addr + offset);
 
-		    offset += (count * sizeof(mmv_disk_metric_t));
-		    if (s->len < offset) {
+		for (k = 0; k < count; k++) {
+		    mmv_disk_metric2_t *mp = &ml[k];
+		    mmv_disk_string_t *string;
+		    char buf[MMV_STRINGMAX];
+		    char name[MAXPATHLEN];
+		    __uint64_t mname;
+		    pmID pmid;
+
+		    mname = mp->name;
+		    if (s->len < mname + sizeof(mmv_disk_string_t)) {
 			if (pmDebug & DBG_TRACE_APPL0) {
 			    __pmNotifyErr(LOG_INFO, "MMV: %s - "
-					"metrics offset: %"PRIu64" < %"PRIu64,
-					s->name, s->len, (int64_t)offset);
+				    "metrics2 name: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, mname);
 			}
 			continue;
 		    }
+		    string = (mmv_disk_string_t *)((char *)s->addr + mname);
+		    memcpy(buf, string->payload, sizeof(buf));
+		    buf[sizeof(buf)-1] = '\0';
 
-		    s->metrics1 = ml;
-		    s->mcnt1 = count;
-
-		    for (k = 0; k < count; k++) {
-			mmv_disk_metric_t *mp = &ml[k];
-			char name[MAXPATHLEN];
-			pmID pmid;
-
-			/* build name, check its legitimate and unique */
-			if (hdr->flags & MMV_FLAG_NOPREFIX)
-			    sprintf(name, "%s.", prefix);
-			else
-			    sprintf(name, "%s.%s.", prefix, s->name);
-			strcat(name, mp->name);
-			if (verify_metric_name(name, k, s) != 0)
-			    continue;
-			if (verify_metric_item(mp->item, name, s) != 0)
-			    continue;
-
-			pmid = pmid_build(pmda->e_domain, s->cluster, mp->item);
-			create_metric(pmda, s, name, pmid, mp->indom,
-					mp->type, mp->semantics, mp->dimension);
-		    }
-		}
-		else if (s->version == MMV_VERSION2) {
-		    mmv_disk_metric2_t *ml = (mmv_disk_metric2_t *)
-					((char *)s->addr + offset);
+		    /* build name, check its legitimate and unique */
+		    if (hdr->flags & MMV_FLAG_NOPREFIX)
+			sprintf(name, "%s.", prefix);
+		    else
+			sprintf(name, "%s.%s.", prefix, s->name);
+		    strcat(name, buf);
 
-		    offset += (count * sizeof(mmv_disk_metric2_t));
-		    if (s->len < offset) {
-			if (pmDebug & DBG_TRACE_APPL0) {
-			    __pmNotifyErr(LOG_INFO, "MMV: %s - "
-					"metrics offset: %"PRIu64" < %"PRIu64,
-					s->name, s->len, (int64_t)offset);
-			}
+		    if (verify_metric_name(name, k, s) != 0)
+			continue;
+		    if (verify_metric_item(mp->item, name, s) != 0)
 			continue;
-		    }
 
-		    s->metrics2 = ml;
-		    s->mcnt2 = count;
-
-		    for (k = 0; k < count; k++) {
-			mmv_disk_metric2_t *mp = &ml[k];
-			mmv_disk_string_t *string;
-			char buf[MMV_STRINGMAX];
-			char name[MAXPATHLEN];
-			__uint64_t mname;
-			pmID pmid;
-
-			mname = mp->name;
-			if (s->len < mname + sizeof(mmv_disk_string_t)) {
-			    if (pmDebug & DBG_TRACE_APPL0) {
-				__pmNotifyErr(LOG_INFO, "MMV: %s - "
-					"metrics2 name: %"PRIu64" < %"PRIu64,
-					s->name, s->len, mname);
-			    }
-			    continue;
-			}
-			string = (mmv_disk_string_t *)((char *)s->addr + mname);
-			memcpy(buf, string->payload, sizeof(buf));
-			buf[sizeof(buf)-1] = '\0';
-
-			/* build name, check its legitimate and unique */
-			if (hdr->flags & MMV_FLAG_NOPREFIX)
-			    sprintf(name, "%s.", prefix);
-			else
-			    sprintf(name, "%s.%s.", prefix, s->name);
-			strcat(name, buf);
-
-			if (verify_metric_name(name, k, s) != 0)
-			    continue;
-			if (verify_metric_item(mp->item, name, s) != 0)
-			    continue;
-
-			pmid = pmid_build(pmda->e_domain, s->cluster, mp->item);
-			create_metric(pmda, s, name, pmid, mp->indom,
-					mp->type, mp->semantics, mp->dimension);
-		    }
+		    pmid = pmid_build(pmda->e_domain, s->cluster, mp->item);
+		    create_metric(pmda, s, name, pmid, mp->indom,
+				    mp->type, mp->semantics, mp->dimension);
 		}
-		break;
+	    }
+	    break;
 
-	    case MMV_TOC_INDOMS:
-		if (count > MAX_MMV_COUNT) {
-		    if (pmDebug & DBG_TRACE_APPL0) {
-			__pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indoms count: %d > %d",
-					s->name, count, MAX_MMV_COUNT);
-		    }
-		    continue;
+	case MMV_TOC_INDOMS:
+	    if (count > MAX_MMV_COUNT) {
+		if (pmDebug & DBG_TRACE_APPL0) {
+		    __pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "indoms count: %d > %d",
+				    s->name, count, MAX_MMV_COUNT);
 		}
-		id = (mmv_disk_indom_t *)((char *)s->addr + offset);
+		continue;
+	    }
+	    id = (mmv_disk_indom_t *)((char *)s->addr + offset);
 
-		offset += (count * sizeof(mmv_disk_indom_t));
-		if (s->len < offset) {
+	    offset += (count * sizeof(mmv_disk_indom_t));
+	    if (s->len < offset) {
+		if (pmDebug & DBG_TRACE_APPL0) {
+		    __pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "indoms offset: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, offset);
+		}
+		continue;
+	    }
+
+	    for (k = 0; k < count; k++) {
+		int sts, serial = id[k].serial;
+		pmInDom pmindom;
+		pmdaIndom *ip;
+
+		offset = id[k].offset;
+		count = id[k].count;
+
+		if (count > MAX_MMV_COUNT) {
 		    if (pmDebug & DBG_TRACE_APPL0) {
 			__pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indoms offset: %"PRIu64" < %"PRIu64,
-					s->name, s->len, offset);
+				    "indom[%d] count: %d > %d",
+				    s->name, k, count, MAX_MMV_COUNT);
 		    }
 		    continue;
 		}
 
-		for (k = 0; k < count; k++) {
-		    int sts, serial = id[k].serial;
-		    pmInDom pmindom;
-		    pmdaIndom *ip;
-
-		    offset = id[k].offset;
-		    count = id[k].count;
-
-		    if (count > MAX_MMV_COUNT) {
+		if (s->version == MMV_VERSION1) {
+		    offset += (count * sizeof(mmv_disk_instance_t));
+		    if (s->len < offset) {
 			if (pmDebug & DBG_TRACE_APPL0) {
 			    __pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indom[%d] count: %d > %d",
-					s->name, k, count, MAX_MMV_COUNT);
+				    "indom[%d] offset: %"PRIu64" < %"PRIu64,
+				    s->name, k, s->len, offset);
 			}
 			continue;
 		    }
-
-		    if (s->version == MMV_VERSION1) {
-			offset += (count * sizeof(mmv_disk_instance_t));
-			if (s->len < offset) {
-			    if (pmDebug & DBG_TRACE_APPL0) {
-				__pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indom[%d] offset: %"PRIu64" < %"PRIu64,
-					s->name, k, s->len, offset);
-			    }
-			    continue;
-			}
-			offset -= (count * sizeof(mmv_disk_instance_t));
-		    } else {
-			offset += (count * sizeof(mmv_disk_instance2_t));
-			if (s->len < offset) {
-			    if (pmDebug & DBG_TRACE_APPL0) {
-				__pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indom[%d] offset: %"PRIu64" < %"PRIu64,
-					s->name, k, s->len, offset);
-			    }
-			    continue;
+		    offset -= (count * sizeof(mmv_disk_instance_t));
+		} else {
+		    offset += (count * sizeof(mmv_disk_instance2_t));
+		    if (s->len < offset) {
+			if (pmDebug & DBG_TRACE_APPL0) {
+			    __pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "indom[%d] offset: %"PRIu64" < %"PRIu64,
+				    s->name, k, s->len, offset);
 			}
-		        offset -= (count * sizeof(mmv_disk_instance2_t));
-		    }
-		    sts = verify_indom_serial(pmda, serial, s, &pmindom, &ip);
-		    if (sts == -EINVAL)
 			continue;
-		    else if (sts == -EEXIST)
-			/* see if we have new instances to add here */
-			update_indom(pmda, s, offset, count, &id[k], ip);
-		    else
-			/* first time we've observed this indom */
-			create_indom(pmda, s, offset, count, &id[k], pmindom);
-		}
-		break;
-
-	    case MMV_TOC_VALUES:
-		if (count > MAX_MMV_COUNT) {
-		    if (pmDebug & DBG_TRACE_APPL0) {
-			__pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"values count: %d > %d",
-					s->name, count, MAX_MMV_COUNT);
 		    }
-		    continue;
+		    offset -= (count * sizeof(mmv_disk_instance2_t));
 		}
-		offset += (count * sizeof(mmv_disk_value_t));
-		if (s->len < offset) {
-		    if (pmDebug & DBG_TRACE_APPL0) {
-			__pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"values offset: %"PRIu64" < %"PRIu64,
-					s->name, s->len, offset);
-		    }
+		sts = verify_indom_serial(pmda, serial, s, &pmindom, &ip);
+		if (sts == -EINVAL)
 		    continue;
+		else if (sts == -EEXIST)
+		    /* see if we have new instances to add here */
+		    update_indom(pmda, s, offset, count, &id[k], ip);
+		else
+		    /* first time we've observed this indom */
+		    create_indom(pmda, s, offset, count, &id[k], pmindom);
+	    }
+	    break;
+
+	case MMV_TOC_VALUES:
+	    if (count > MAX_MMV_COUNT) {
+		if (pmDebug & DBG_TRACE_APPL0) {
+		    __pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "values count: %d > %d",
+				    s->name, count, MAX_MMV_COUNT);
+		}
+		continue;
+	    }
+	    offset += (count * sizeof(mmv_disk_value_t));
+	    if (s->len < offset) {
+		if (pmDebug & DBG_TRACE_APPL0) {
+		    __pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "values offset: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, offset);
 		}
-		offset -= (count * sizeof(mmv_disk_value_t));
+		continue;
+	    }
+	    offset -= (count * sizeof(mmv_disk_value_t));
 
-		s->vcnt = count;
-		s->values = (mmv_disk_value_t *)((char *)s->addr + offset);
-		break;
+	    s->vcnt = count;
+	    s->values = (mmv_disk_value_t *)((char *)s->addr + offset);
+	    break;
 
-	    default:
+	case MMV_TOC_STRIPES:
+	    if (count > MMV_STRIPEMAX) {
 		if (pmDebug & DBG_TRACE_APPL0) {
-		    __pmNotifyErr(LOG_DEBUG, "MMV: %s - bad TOC type (%x)",
-				    s->name, type);
+		    __pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "stripes count: %d > %d",
+				    s->name, count, MMV_STRIPEMAX);
 		}
-		break;
+		continue;
 	    }
+	    nstripes = count;
+	    stripes = offset;
+	    break;
+
+	case MMV_TOC_BUCKETS:
+	    /* histogram buckets are located through their values */
+	    break;
+
+	default:
+	    if (pmDebug & DBG_TRACE_APPL0) {
+		__pmNotifyErr(LOG_DEBUG, "MMV: %s - bad TOC type (%x)",
+				s->name, type);
+	    }
+	    break;
 	}
     }
 
-    pmdaTreeRebuildHash(pmns, mtot);	/* for reverse (pmid->name) lookups */
-    reload = need_reload;
+    /* stripes are sized by the values section, wherever it appears */
+    if (nstripes > 0 && s->version >= MMV_VERSION3) {
+	__uint64_t stride = MMV_STRIPE_SIZE(s->vcnt);
+
+	if (s->len < stripes + nstripes * stride) {
+	    if (pmDebug & DBG_TRACE_APPL0) {
+		__pmNotifyErr(LOG_ERR, "MMV: %s - "
+				"stripes offset: %"PRIu64" < %"PRIu64,
+				s->name, s->len, stripes + nstripes * stride);
+	    }
+	} else {
+	    s->stripes = (pmAtomValue *)((char *)s->addr + stripes);
+	    s->nstripes = nstripes;
+	    s->stride = stride;
+	}
+    }
+    map_values(s);
 }
 
+static __pmHashWalkState
+node_delete(const __pmHashNode *tp, void *cp)
+{
+    (void)tp;
+    (void)cp;
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+static void
+hash_delete(__pmHashCtl *hashp)
+{
+    __pmHashWalkCB(node_delete, NULL, hashp);
+    __pmHashClear(hashp);
+    hashp->nodes = 0;
+}
+
+/*
+ * Remove a metric name from the namespace, along with any of its
+ * parents left without children.
+ */
+static void
+remove_name(__pmnsTree *tree, const char *name)
+{
+    __pmnsNode *np, *parent, **npp;
+    const char *tail;
+    size_t len;
+
+    if (tree == NULL)
+	return;
+    for (np = tree->root; *name != '\0'; name = *tail ? tail + 1 : tail) {
+	for (tail = name; *tail && *tail != '.'; tail++)
+	    ;
+	len = tail - name;
+	for (np = np->first; np != NULL; np = np->next)
+	    if (strncmp(np->name, name, len) == 0 && np->name[len] == '\0')
+		break;
+	if (np == NULL)
+	    return;
+    }
+    while (np != tree->root && np->first == NULL) {
+	parent = np->parent;
+	for (npp = &parent->first; *npp != np; npp = &(*npp)->next)
+	    ;
+	*npp = np->next;
+	free(np->name);
+	free(np);
+	np = parent;
+    }
+}
+
+/*
+ * Unmap a client file and release everything parsed from it
+ */
+static void
+free_client(int i)
+{
+    stats_t *s = &slist[i];
+    int k;
+
+    if (pmDebug & DBG_TRACE_APPL0)
+	__pmNotifyErr(LOG_DEBUG, "MMV: unloading %s client: %d \"%s\"",
+			prefix, s->cluster, s->name);
+
+    for (k = 0; k < s->mcnt; k++) {
+	if (s->exported[k])
+	    remove_name(pmns, s->mnames[k]);
+	free(s->mnames[k]);
+    }
+    free(s->mnames);
+    free(s->exported);
+    free(s->metrics);
+    for (k = 0; k < s->icnt; k++)
+	free(s->indoms[k].it_set);
+    free(s->indoms);
+    hash_delete(&s->vhash);
+    free(s->vlist);
+    free(s->name);
+    __pmMemoryUnmap(s->addr, s->len);
+
+    scnt--;
+    memmove(s, s + 1, (scnt - i) * sizeof(stats_t));
+}
+
+/*
+ * A mapped client is kept across a reload unless its file has been
+ * replaced or has changed size, its generation number has changed,
+ * or the process that created it has exited.
+ */
 static int
-mmv_lookup_item1(int item, unsigned int inst,
-	stats_t *s, mmv_disk_value_t **value,
-	__uint64_t *shorttext, __uint64_t *helptext)
+client_unchanged(stats_t *s, struct stat *sbuf)
 {
-    mmv_disk_metric_t *m1 = s->metrics1;
-    mmv_disk_value_t *v = s->values;
-    int mi, vi, sts = PM_ERR_PMID;
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)s->addr;
 
-    for (mi = 0; mi < s->mcnt1; mi++) {
-	if (m1[mi].item != item)
-	    continue;
+    if (s->dev != sbuf->st_dev || s->ino != sbuf->st_ino ||
+	s->len != sbuf->st_size)
+	return 0;
+    if (hdr->g1 != s->gen || hdr->g2 != s->gen)
+	return 0;
+    if (s->pid && !__pmProcessExists(s->pid))
+	return 0;
+    return 1;
+}
 
-	sts = PM_ERR_INST;
-	for (vi = 0; vi < s->vcnt; vi++) {
-	    mmv_disk_metric_t *mt = (mmv_disk_metric_t *)
-			((char *)s->addr + v[vi].metric);
-	    mmv_disk_instance_t *is = (mmv_disk_instance_t *)
-			((char *)s->addr + v[vi].instance);
-
-	    if ((mt == &m1[mi]) &&
-		(mt->indom == PM_INDOM_NULL || mt->indom == 0 ||
-		inst == PM_IN_NULL || is->internal == inst)) {
-		if (shorttext)
-		    *shorttext = m1[mi].shorttext;
-		if (helptext)
-		    *helptext = m1[mi].helptext;
-		*value = &v[vi];
-		return m1[mi].type;
+/*
+ * Add the instances of a client indom to the PMDA indom table,
+ * merging them with any from another client using the same cluster.
+ */
+static void
+splice_indom(pmdaIndom *cp)
+{
+    pmdaIndom *ip = NULL;
+    int i, j, size;
+
+    for (i = 0; i < intot; i++) {
+	if (indoms[i].it_indom == cp->it_indom) {
+	    ip = &indoms[i];
+	    break;
+	}
+    }
+    if (ip == NULL) {
+	if ((ip = realloc(indoms, sizeof(pmdaIndom) * (intot + 1))) == NULL) {
+	    __pmNotifyErr(LOG_ERR, "%s: cannot grow indom list", pmProgname);
+	    return;
+	}
+	indoms = ip;
+	ip = &indoms[intot++];
+	ip->it_indom = cp->it_indom;
+	ip->it_numinst = 0;
+	ip->it_set = NULL;
+    }
+
+    size = sizeof(pmdaInstid) * (ip->it_numinst + cp->it_numinst);
+    if (size == 0 || (ip->it_set = realloc(ip->it_set, size)) == NULL) {
+	ip->it_numinst = 0;
+	return;
+    }
+    for (i = 0; i < cp->it_numinst; i++) {
+	for (j = 0; j < ip->it_numinst; j++)
+	    if (ip->it_set[j].i_inst == cp->it_set[i].i_inst)
+		break;
+	if (j == ip->it_numinst)
+	    ip->it_set[ip->it_numinst++] = cp->it_set[i];
+    }
+}
+
+/*
+ * Rebuild the PMDA metric and indom tables from the metrics and indoms
+ * already parsed from each mapped client.  Names of unmapped clients
+ * have been removed from the namespace, and names of new clients are
+ * added here.  Metric names are unique - the first client (in the order
+ * files were mapped) to use a name keeps it.
+ */
+static void
+splice_stats(pmdaExt *pmda)
+{
+    pmdaMetric *mp;
+    char name[64];
+    pmID pmid;
+    int i, k, sts, total = 3;
+
+    if (pmns == NULL) {
+	if ((sts = __pmNewPMNS(&pmns)) < 0) {
+	    __pmNotifyErr(LOG_ERR, "%s: failed to create new pmns: %s\n",
+			    pmProgname, pmErrStr(sts));
+	    pmns = NULL;
+	    return;
+	}
+
+	/* hard-coded metrics (not from mmap'd files) */
+	snprintf(name, sizeof(name), "%s.control.reload", prefix);
+	__pmAddPMNSNode(pmns, pmid_build(pmda->e_domain, 0, 0), name);
+	snprintf(name, sizeof(name), "%s.control.debug", prefix);
+	__pmAddPMNSNode(pmns, pmid_build(pmda->e_domain, 0, 1), name);
+	snprintf(name, sizeof(name), "%s.control.files", prefix);
+	__pmAddPMNSNode(pmns, pmid_build(pmda->e_domain, 0, 2), name);
+    }
+    mtot = 3;
+
+    if (indoms != NULL) {
+	for (i = 0; i < intot; i++)
+	    free(indoms[i].it_set);
+	free(indoms);
+	indoms = NULL;
+	intot = 0;
+    }
+    hash_delete(&clusters);
+
+    for (i = 0; i < scnt; i++)
+	total += slist[i].mcnt;
+    if ((mp = realloc(metrics, sizeof(pmdaMetric) * total)) == NULL) {
+	__pmNotifyErr(LOG_ERR, "cannot grow MMV metric list");
+	return;
+    }
+    metrics = mp;
+
+    for (i = 0; i < scnt; i++) {
+	stats_t *s = &slist[i];
+
+	__pmHashAdd(s->cluster, s, &clusters);
+	for (k = 0; k < s->mcnt; k++) {
+	    if (!s->exported[k]) {
+		if (pmdaTreePMID(pmns, s->mnames[k], &pmid) == 0)
+		    continue;	/* duplicate name */
+		if (__pmAddPMNSNode(pmns, s->metrics[k].m_desc.pmid,
+				    s->mnames[k]) < 0)
+		    continue;
+		s->exported[k] = 1;
 	    }
+	    metrics[mtot++] = s->metrics[k];
 	}
+	for (k = 0; k < s->icnt; k++)
+	    splice_indom(&s->indoms[k]);
     }
-    return sts;
+
+    pmdaTreeRebuildHash(pmns, mtot);	/* for reverse (pmid->name) lookups */
 }
 
-static int
-mmv_lookup_item2(int item, unsigned int inst,
-	stats_t *s, mmv_disk_value_t **value,
-	__uint64_t *shorttext, __uint64_t *helptext)
+/*
+ * Scan the stats directory, mapping new client files and remapping
+ * changed ones, while unchanged clients keep their existing mapping.
+ */
+static void
+map_stats(pmdaExt *pmda)
 {
-    mmv_disk_metric2_t *m2 = s->metrics2;
-    mmv_disk_value_t *v = s->values;
-    int mi, vi, sts = PM_ERR_PMID;
+    struct dirent **files;
+    stats_t moved;
+    int need_reload = 0;
+    int i, k, slot, num, mapped = 0;
+
+    for (k = 0; k < scnt; k++)
+	slist[k].seen = 0;
+
+    num = scandir(statsdir, &files, NULL, NULL);
+    for (i = 0; i < num; i++) {
+	struct stat statbuf;
+	char path[MAXPATHLEN];
+	char *client;
 
-    for (mi = 0; mi < s->mcnt2; mi++) {
-	if (m2[mi].item != item)
+	if (files[i]->d_name[0] == '.')
 	    continue;
 
-	sts = PM_ERR_INST;
-	for (vi = 0; vi < s->vcnt; vi++) {
-	    mmv_disk_metric2_t *mt = (mmv_disk_metric2_t *)
-			((char *)s->addr + v[vi].metric);
-	    mmv_disk_instance2_t *is = (mmv_disk_instance2_t *)
-			((char *)s->addr + v[vi].instance);
-
-	    if ((mt == &m2[mi]) &&
-		(mt->indom == PM_INDOM_NULL || mt->indom == 0 ||
-		inst == PM_IN_NULL || is->internal == inst)) {
-		if (shorttext)
-		    *shorttext = m2[mi].shorttext;
-		if (helptext)
-		    *helptext = m2[mi].helptext;
-		*value = &v[vi];
-		return m2[mi].type;
+	client = files[i]->d_name;
+	sprintf(path, "%s%c%s", statsdir, __pmPathSeparator(), client);
+
+	if (stat(path, &statbuf) < 0 || !S_ISREG(statbuf.st_mode))
+	    continue;
+
+	for (k = 0; k < scnt; k++)
+	    if (strcmp(slist[k].name, client) == 0)
+		break;
+	slot = k;
+	if (k < scnt) {
+	    if (client_unchanged(&slist[k], &statbuf)) {
+		slist[k].seen = 1;
+		continue;
 	    }
+	    free_client(k);
+	}
+
+	k = scnt;
+	if (create_client_stat(client, path, &statbuf) == -EAGAIN)
+	    need_reload = 1;
+	if (scnt > k) {
+	    /* a rewritten file keeps its place, which decides duplicates */
+	    if (slot < k) {
+		moved = slist[k];
+		memmove(&slist[slot + 1], &slist[slot],
+			(k - slot) * sizeof(stats_t));
+		slist[slot] = moved;
+		k = slot;
+	    }
+	    map_client(pmda, &slist[k]);
+	    mapped++;
 	}
     }
-    return sts;
+
+    for (i = 0; i < num; i++)
+	free(files[i]);
+    if (num > 0)
+	free(files);
+
+    /* files removed (or no longer accessible) since the last reload */
+    for (k = scnt - 1; k >= 0; k--)
+	if (!slist[k].seen)
+	    free_client(k);
+
+    if (pmDebug & DBG_TRACE_APPL0)
+	__pmNotifyErr(LOG_DEBUG, "MMV: %s: mapped %d of %d clients",
+			pmProgname, mapped, scnt);
+
+    splice_stats(pmda);
+    reload = need_reload;
 }
 
+/*
+ * Find the value of a metric instance, by cluster then by item and
+ * instance; a metric without an instance domain matches any instance.
+ * Where clients share a cluster, the first client in slist with the
+ * value wins (as for duplicate names) - the order of the hash chain
+ * is not that order, so every client in the cluster is checked.
+ */
 static int
 mmv_lookup_stat_metric(pmID pmid, unsigned int inst,
-	stats_t **stats, mmv_disk_value_t **value,
-	__uint64_t *shorttext, __uint64_t *helptext)
+	stats_t **stats, value_t **entry)
 {
     __pmID_int *id = (__pmID_int *)&pmid;
-    int si, sts = PM_ERR_PMID;
+    __pmHashNode *node;
+    stats_t *first = NULL;
+    value_t *vp, *fvp = NULL;
+    int sts = PM_ERR_PMID;
 
-    for (si = 0; si < scnt; si++) {
-	stats_t *s = &slist[si];
+    for (node = __pmHashSearch(id->cluster, &clusters); node;
+	 node = node->next) {
+	stats_t *s = (stats_t *)node->data;
 
-	if (s->cluster != id->cluster)
+	if (node->key != id->cluster)
 	    continue;
 
-	sts = (s->version == MMV_VERSION1) ?
-	    mmv_lookup_item1(id->item, inst, s, value, shorttext, helptext):
-	    mmv_lookup_item2(id->item, inst, s, value, shorttext, helptext);
-	if (sts >= 0) {
-	    *stats = s;
+	sts = PM_ERR_INST;
+	if (first != NULL && first < s)
+	    continue;
+	if ((vp = value_search(s, id->item, inst)) == NULL &&
+	    (vp = value_search(s, id->item, PM_IN_NULL)) != NULL &&
+	    !vp->singular && inst != PM_IN_NULL)
+	    vp = NULL;
+	if (vp == NULL)
+	    continue;
+
+	first = s;
+	fvp = vp;
+    }
+    if (first == NULL)
+	return sts;
+    *entry = fvp;
+    *stats = first;
+    return fvp->type;
+}
+
+/*
+ * Add the per-thread stripe slots of a (v3) client value to its total.
+ */
+static void
+mmv_stripes_sum(stats_t *s, mmv_disk_value_t *v, int type, pmAtomValue *atom)
+{
+    pmAtomValue *slot;
+    int i;
+
+    slot = &s->stripes[v - s->values];
+    for (i = 0; i < s->nstripes; i++) {
+	switch (type) {
+	case MMV_TYPE_I32:
+	    atom->l += slot->l;
+	    break;
+	case MMV_TYPE_U32:
+	    atom->ul += slot->ul;
+	    break;
+	case MMV_TYPE_I64:
+	    atom->ll += slot->ll;
+	    break;
+	case MMV_TYPE_U64:
+	    atom->ull += slot->ull;
+	    break;
+	case MMV_TYPE_FLOAT:
+	    atom->f += slot->f;
+	    break;
+	case MMV_TYPE_DOUBLE:
+	    atom->d += slot->d;
 	    break;
 	}
+	slot = (pmAtomValue *)((char *)slot + s->stride);
     }
-    return sts;
 }
 
-static int
-mmv_lookup_stat_metric_value(pmID pmid, unsigned int inst,
-	stats_t **stats, mmv_disk_value_t **value)
+/*
+ * Add up the shared counts of one histogram bucket and its stripes.
+ */
+static __uint64_t
+mmv_bucket_sum(stats_t *s, value_t *vp)
 {
-    return mmv_lookup_stat_metric(pmid, inst, stats, value, NULL, NULL);
+    __uint64_t *counts, stride = MMV_BUCKETS_SIZE(vp->nbuckets), sum = 0;
+    int i, stripes = s->nstripes + 1;
+
+    counts = (__uint64_t *)((char *)s->addr + vp->value->extra + stride);
+    for (i = 0; i < stripes; i++) {
+	sum += counts[vp->bucket];
+	counts = (__uint64_t *)((char *)counts + stride);
+    }
+    return sum;
 }
 
 /*
@@ -895,12 +1379,14 @@ mmv_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	mmv_disk_string_t *str;
 	mmv_disk_value_t *v;
 	__uint64_t offset;
+	value_t *vp;
 	stats_t *s;
 	int rv, fl;
 
-	rv = mmv_lookup_stat_metric_value(mdesc->m_desc.pmid, inst, &s, &v);
+	rv = mmv_lookup_stat_metric(mdesc->m_desc.pmid, inst, &s, &vp);
 	if (rv < 0)
 	    return rv;
+	v = vp->value;
 	fl = ((mmv_disk_header_t *)s->addr)->flags;
 
 	if (!setup) {
@@ -919,16 +1405,22 @@ mmv_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		if ((fl & MMV_FLAG_SENTINEL) &&
 		    (memcmp(atom, &aNaN, sizeof(*atom)) == 0))
 		    return 0;
+		if (s->nstripes)
+		    mmv_stripes_sum(s, v, rv, atom);
 		break;
 	    case MMV_TYPE_FLOAT:
 		memcpy(atom, &v->value, sizeof(pmAtomValue));
 		if ((fl & MMV_FLAG_SENTINEL) && atom->f == fNaN)
 		    return 0;
+		if (s->nstripes)
+		    mmv_stripes_sum(s, v, rv, atom);
 		break;
 	    case MMV_TYPE_DOUBLE:
 		memcpy(atom, &v->value, sizeof(pmAtomValue));
 		if ((fl & MMV_FLAG_SENTINEL) && atom->d == dNaN)
 		    return 0;
+		if (s->nstripes)
+		    mmv_stripes_sum(s, v, rv, atom);
 		break;
 	    case MMV_TYPE_ELAPSED: {
 		atom->ll = v->value.ll;
@@ -960,6 +1452,11 @@ mmv_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		atom->cp = buffer;
 		break;
 	    }
+	    case MMV_TYPE_HISTOGRAM:
+		if (inst == PM_IN_NULL)
+		    return PM_ERR_INST;
+		atom->ull = mmv_bucket_sum(s, vp);
+		break;
 	    case MMV_TYPE_NOSUPPORT:
 		return PM_ERR_APPVERSION;
 	}
@@ -1039,13 +1536,15 @@ mmv_lookup_metric_helptext(pmID pmid, int type, char **text)
 {
     static char string[MMV_STRINGMAX];
     mmv_disk_string_t *str;
-    mmv_disk_value_t *v;
     __uint64_t st, lt;
     size_t offset;
+    value_t *vp;
     stats_t *s;
 
-    if (mmv_lookup_stat_metric(pmid, PM_IN_NULL, &s, &v, &st, &lt) < 0)
+    if (mmv_lookup_stat_metric(pmid, PM_IN_NULL, &s, &vp) < 0)
 	return PM_ERR_PMID;
+    st = vp->shorttext;
+    lt = vp->helptext;
 
     if ((type & PM_TEXT_ONELINE) && st) {
 	offset = st + sizeof(mmv_disk_string_t);
@@ -1,7 +1,7 @@
 /*
  * Mounts PMDA, info on current tracked filesystem mounts
  *
- * Copyright (c) 2012,2015-2016 Red Hat.
+ * Copyright (c) 2012,2015-2017 Red Hat.
  * Copyright (c) 2001,2003,2004 Silicon Graphics, Inc.  All Rights Reserved.
  * Copyright (c) 2001 Alan Bailey (bailey@mcs.anl.gov or abailey@ncsa.uiuc.edu) 
  * All rights reserved. 
@@ -39,6 +39,7 @@ enum {	/* instance domain identifiers */
 };
 enum {	/* metric cluster identifiers */
     MOUNTS_CLUSTER = 0,
+    SNAPSHOT_CLUSTER = 1,
 };
 enum {	/* metric item identifiers */
     MOUNTS_DEVICE = 0,
@@ -57,13 +58,18 @@ enum {	/* metric item identifiers */
     MOUNTS_AVAILFILES,
     MOUNTS_READONLY,
 };
+enum {	/* snapshot metric item identifiers */
+    SNAPSHOT_AGE = 0,
+};
 enum {	/* internal mount states */
     MOUNTS_FLAG_UP	= 0x1,
     MOUNTS_FLAG_RO	= 0x2,
     MOUNTS_FLAG_STAT	= 0x4,
 };
 
-static pmdaInstid *mounts;
+static pmdaInstid *mounts;	/* configured mount points */
+static int nmounts;
+static int generation;		/* bumped when mounts.conf changes */
 
 static pmdaIndom indomtab[] = {
   { MOUNTS_INDOM, 0, NULL }
@@ -134,6 +140,10 @@ static pmdaMetric metrictab[] = {
       { PMDA_PMID(MOUNTS_CLUSTER, MOUNTS_READONLY),
 	PM_TYPE_U32, MOUNTS_INDOM, PM_SEM_INSTANT,
 	PMDA_PMUNITS(0,0,0,0,0,0) }, },
+    { NULL,	/* mounts.snapshot.age */
+      { PMDA_PMID(SNAPSHOT_CLUSTER, SNAPSHOT_AGE),
+	PM_TYPE_DOUBLE, PM_INDOM_NULL, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,1,0,0,PM_TIME_SEC,0) }, },
 };
 
 typedef struct mountinfo {
@@ -150,7 +160,22 @@ typedef struct mountinfo {
     __uint64_t	favail;
 } mountinfo;
 
-static mountinfo *mount_list;
+/*
+ * Everything a fetch needs, refreshed by the libpcp_pmda sampler so
+ * that a hung filesystem (statvfs on a dead NFS server, say) does not
+ * stall requests from pmcd.  Each snapshot owns its own copy of the
+ * instance names, as mounts.conf may change between snapshots.
+ */
+typedef struct snapshot {
+    int		generation;	/* config generation of insts[] */
+    int		ninst;
+    pmdaInstid	*insts;
+    mountinfo	*mount_list;
+} snapshot_t;
+
+static snapshot_t *current;	/* snapshot used for this PDU */
+static double current_age;
+static struct timeval interval;	/* daemon sampling interval */
 static struct stat file_change;
 static int isDSO = 1;
 static char mypath[MAXPATHLEN];
@@ -159,7 +184,7 @@ static char *username;
 static void mounts_clear_config_info(void);
 static void mounts_grab_config_info(void);
 static void mounts_config_file_check(void);
-static void mounts_refresh_mounts(void);
+static void mounts_refresh_mounts(snapshot_t *);
 
 static void
 mounts_config_file_check(void)
@@ -201,7 +226,7 @@ mounts_clear_config_info(void)
     int i;
 
     /* Free the memory holding the mount name */
-    for (i = 0; i < indomtab[MOUNTS_INDOM].it_numinst; i++) {
+    for (i = 0; i < nmounts; i++) {
 	free(mounts[i].i_name);
 	mounts[i].i_name = NULL;
     }
@@ -210,22 +235,15 @@ mounts_clear_config_info(void)
     if (mounts)
 	free(mounts);
 
-    /* Free the mount_list structure */
-    if (mount_list)
-	free(mount_list);
-
-    mount_list = NULL;
-    indomtab[MOUNTS_INDOM].it_set = mounts = NULL;
-    indomtab[MOUNTS_INDOM].it_numinst = 0;
+    mounts = NULL;
+    nmounts = 0;
 }
 
 /* 
  * This routine opens the config file and stores the information in the
  * mounts structure.  The mounts structure must be reallocated as
- * necessary, and also the num_procs structure needs to be reallocated
- * as we define new mounts.  When all of that is done, we fill in the
- * values in the indomtab structure, those being the number of instances
- * and the pointer to the mounts structure.
+ * necessary as we define new mounts.  When all of that is done, the
+ * generation is bumped so the next snapshot picks up the new instances.
  */
 static void
 mounts_grab_config_info(void)
@@ -274,13 +292,41 @@ mounts_grab_config_info(void)
 done:
     if (mounts == NULL)
 	__pmNotifyErr(LOG_WARNING, "\"mounts\" instance domain is empty");
-    indomtab[MOUNTS_INDOM].it_set = mounts;
-    indomtab[MOUNTS_INDOM].it_numinst = mount_number;
-    mount_list = realloc(mount_list, (mount_number)*sizeof(mountinfo));
+    nmounts = mount_number;
+    generation++;
+}
+
+/*
+ * Bring the instances of a snapshot up to date with mounts.conf
+ */
+static void
+mounts_refresh_instances(snapshot_t *sp)
+{
+    size_t size;
+    int i;
+
+    for (i = 0; i < sp->ninst; i++)
+	free(sp->insts[i].i_name);
+    sp->ninst = 0;
+
+    size = nmounts * sizeof(pmdaInstid);
+    if ((sp->insts = realloc(sp->insts, size)) == NULL && size)
+	__pmNoMem("mounts instances", size, PM_FATAL_ERR);
+    size = nmounts * sizeof(mountinfo);
+    if ((sp->mount_list = realloc(sp->mount_list, size)) == NULL && size)
+	__pmNoMem("mounts list", size, PM_FATAL_ERR);
+    for (i = 0; i < nmounts; i++) {
+	sp->insts[i].i_inst = mounts[i].i_inst;
+	if ((sp->insts[i].i_name = strdup(mounts[i].i_name)) == NULL)
+	    __pmNoMem("mounts instance", strlen(mounts[i].i_name) + 1,
+			PM_FATAL_ERR);
+    }
+    sp->ninst = nmounts;
+    sp->generation = generation;
 }
 
 static void
-mounts_refresh_mounts(void)
+mounts_refresh_mounts(snapshot_t *sp)
 {
     FILE *fp;
     struct statvfs vfs;
@@ -289,9 +335,12 @@ mounts_refresh_mounts(void)
     char buf[BUFSIZ];
     int item;
 
+    if (sp->generation != generation || sp->insts == NULL)
+	mounts_refresh_instances(sp);
+
     /* Reset all mount structures */
-    for (item = 0; item < indomtab[MOUNTS_INDOM].it_numinst; item++) {
-	mp = &mount_list[item];
+    for (item = 0; item < sp->ninst; item++) {
+	mp = &sp->mount_list[item];
 	memset(mp, 0, sizeof(*mp));
 	strcpy(mp->device, "none");
 	strcpy(mp->type, "none");
@@ -318,9 +367,9 @@ mounts_refresh_mounts(void)
 	if ((options = strtok(NULL, " ")) == NULL)
 	    continue;
 
-	for (item = 0; item < indomtab[MOUNTS_INDOM].it_numinst; item++) {
-	    mp = &mount_list[item];
-	    if (strcmp(path, mounts[item].i_name) != 0)
+	for (item = 0; item < sp->ninst; item++) {
+	    mp = &sp->mount_list[item];
+	    if (strcmp(path, sp->insts[item].i_name) != 0)
 		continue;
 	    strncpy(mp->type, type, MAXFSTYPE-1);
 	    /* don't resolve dm symlinks - we want the persistent device name, not the dm-* name */
@@ -345,20 +394,57 @@ mounts_refresh_mounts(void)
     fclose(fp);
 }
 
+/*
+ * Sampler callback - runs in the libpcp_pmda sampler thread for the
+ * daemon PMDA, and so is the only code touching the configured mounts.
+ */
+static int
+mounts_sample(void *next, const void *previous)
+{
+    (void)previous;
+    mounts_config_file_check();
+    mounts_refresh_mounts((snapshot_t *)next);
+    return 0;
+}
+
+/*
+ * Switch the instance domain over to the latest snapshot.  This is the
+ * only state shared with the PDU callbacks, and it cannot change until
+ * the current PDU has been answered.
+ */
+static void
+mounts_snapshot(pmdaExt *pmda)
+{
+    current = (snapshot_t *)pmdaSamplerSnapshot(pmda, &current_age);
+    if (current) {
+	indomtab[MOUNTS_INDOM].it_set = current->insts;
+	indomtab[MOUNTS_INDOM].it_numinst = current->ninst;
+    } else {
+	indomtab[MOUNTS_INDOM].it_set = NULL;
+	indomtab[MOUNTS_INDOM].it_numinst = 0;
+    }
+}
+
 /*
  * This is the wrapper over the pmdaFetch routine, to handle the problem
- * of varying instance domains.  All this does is delete the previous
- * mount list, and then get the current one, by calling
- * mounts_refresh_mounts.
+ * of varying instance domains.  All this does is pick up the latest
+ * snapshot of the mount list, as refreshed by mounts_sample.
  */
 static int
 mounts_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 {
-    mounts_config_file_check();
-    mounts_refresh_mounts();
+    mounts_snapshot(pmda);
     return pmdaFetch(numpmid, pmidlist, resp, pmda);
 }
 
+static int
+mounts_instance(pmInDom indom, int inst, char *name, __pmInResult **result,
+		pmdaExt *pmda)
+{
+    mounts_snapshot(pmda);
+    return pmdaInstance(indom, inst, name, result, pmda);
+}
+
 /*
  * callback provided to pmdaFetch
  */
@@ -369,11 +455,19 @@ mounts_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
     __uint64_t	ull, used;
     mountinfo	*mp;
 
+    if (idp->cluster == SNAPSHOT_CLUSTER) {
+	if (idp->item != SNAPSHOT_AGE)
+	    return PM_ERR_PMID;
+	if (current == NULL)
+	    return PM_ERR_AGAIN;
+	atom->d = current_age;
+	return 0;
+    }
     if (idp->cluster != MOUNTS_CLUSTER)
 	return PM_ERR_PMID;
-    if (inst >= indomtab[MOUNTS_INDOM].it_numinst)
+    if (current == NULL || inst >= current->ninst)
 	return PM_ERR_INST;
-    mp = &mount_list[inst];
+    mp = &current->mount_list[inst];
 
     switch (idp->item) {
     case MOUNTS_DEVICE:
@@ -471,13 +565,20 @@ mounts_init(pmdaInterface *dp)
         return;
 
     dp->version.two.fetch = mounts_fetch;
+    dp->version.two.instance = mounts_instance;
     pmdaSetFetchCallBack(dp, mounts_fetchCallBack);
+    /* DSO refreshes on every fetch, as before; daemon on its own schedule */
+    pmdaSetSamplerCallBack(dp, mounts_sample, sizeof(snapshot_t), &interval);
 
     pmdaInit(dp, indomtab, sizeof(indomtab)/sizeof(indomtab[0]), 
 	     metrictab, sizeof(metrictab)/sizeof(metrictab[0]));
 
-    /* Let's grab the info right away just to make sure it's there. */
-    mounts_grab_config_info();
+    /*
+     * Let's grab the info right away just to make sure it's there,
+     * with the first snapshot taken before the sampler thread starts.
+     */
+    if (dp->status == 0)
+	pmdaSamplerSnapshot(dp->version.two.ext, NULL);
 }
 
 static pmLongOptions	longopts[] = {
@@ -485,13 +586,14 @@ static pmLongOptions	longopts[] = {
     PMOPT_DEBUG,
     PMDAOPT_DOMAIN,
     PMDAOPT_LOGFILE,
+    { "interval", 1, 't', "TIME", "sampling interval for mount points [default 1 second]" },
     PMDAOPT_USERNAME,
     PMOPT_HELP,
     PMDA_OPTIONS_END
 };
 
 static pmdaOptions	opts = {
-    .short_options = "D:d:l:U:?",
+    .short_options = "D:d:l:t:U:?",
     .long_options = longopts,
 };
 
@@ -501,7 +603,8 @@ static pmdaOptions	opts = {
 int
 main(int argc, char **argv)
 {
-    int			sep = __pmPathSeparator();
+    int			c, sep = __pmPathSeparator();
+    char		*endnum;
     pmdaInterface	desc;
 
     isDSO = 0;
@@ -513,7 +616,19 @@ main(int argc, char **argv)
     pmdaDaemon(&desc, PMDA_INTERFACE_2, pmProgname, MOUNTS,
 		"mounts.log", mypath);
 
-    pmdaGetOptions(argc, argv, &opts, &desc);
+    interval.tv_sec = 1;
+    while ((c = pmdaGetOptions(argc, argv, &opts, &desc)) != EOF) {
+	switch (c) {
+	case 't':
+	    if (pmParseInterval(opts.optarg, &interval, &endnum) < 0) {
+		fprintf(stderr, "%s: -t requires a time interval: %s\n",
+			pmProgname, endnum);
+		free(endnum);
+		opts.errors++;
+	    }
+	    break;
+	}
+    }
     if (opts.errors) {
 	pmdaUsageMessage(&opts);
 	exit(1);
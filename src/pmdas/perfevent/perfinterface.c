@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sched.h>
 
 #define SYSFS_DEVICES "/sys/bus/event_source/devices"
 #define BUF_SIZE 1024
@@ -102,6 +103,20 @@ static void free_perfdata(perfdata_t *del)
         free_event(&del->events[i]);
     }
     free(del->events);
+    for ( i = 0; i < del->ngroups; ++i )
+    {
+        free(del->groups[i].members);
+        free(del->groups[i].values);
+    }
+    free(del->groups);
+    if (del->snapshot)
+    {
+        for ( i = 0; i < del->nevents; ++i )
+        {
+            free(del->snapshot[i].data);
+        }
+        free(del->snapshot);
+    }
     free_architecture(del->archinfo);
     free(del->archinfo);
     free(del);
@@ -527,6 +542,68 @@ static int perf_setup_derived_event(perfdata_t *inst, pmcderived_t *derived_pmc)
     return 0;
 }
 
+/*
+ * Open the counter for an event on one cpu, joining the most recent group of
+ * counters of the same PMU on that cpu when it has room, so that a single
+ * read of the group leader returns the values of every member.  The kernel
+ * refuses members that the PMU could never schedule together with the rest
+ * of the group, in which case this event leads a new group.
+ *
+ * Only group leaders are opened disabled.  Members are opened enabled, and
+ * so count whenever their leader does - see perf_counter_enable().
+ */
+static int perf_group_open(perfdata_t *inst, eventcpuinfo_t *info)
+{
+    perf_group_t *group = NULL, *groups;
+    int i;
+
+    info->hw.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    for (i = inst->ngroups - 1; i >= 0; i--) {
+        if (inst->groups[i].cpu == info->cpu && inst->groups[i].type == info->hw.type) {
+            group = &inst->groups[i];
+            break;
+        }
+    }
+    if (group && group->nmembers < inst->groupsize) {
+        info->hw.disabled = 0;
+        info->fd = perf_event_open(&info->hw, -1, info->cpu, group->fd, 0);
+        if (info->fd != -1) {
+            group->members[group->nmembers++] = info;
+            return 0;
+        }
+    }
+
+    groups = realloc(inst->groups, (inst->ngroups + 1) * sizeof(*groups));
+    if (NULL == groups) {
+        return -1;
+    }
+    inst->groups = groups;
+    group = &groups[inst->ngroups];
+    memset(group, 0, sizeof(*group));
+    group->members = malloc(inst->groupsize * sizeof(*group->members));
+    group->values = malloc((3 + inst->groupsize) * sizeof(*group->values));
+    if (NULL == group->members || NULL == group->values) {
+        free(group->members);
+        free(group->values);
+        return -1;
+    }
+
+    info->hw.disabled = 1;
+    info->fd = perf_event_open(&info->hw, -1, info->cpu, -1, 0);
+    if (info->fd == -1) {
+        free(group->members);
+        free(group->values);
+        return -1;
+    }
+    group->fd = info->fd;
+    group->cpu = info->cpu;
+    group->type = info->hw.type;
+    group->members[group->nmembers++] = info;
+    ++inst->ngroups;
+    return 0;
+}
+
 
 /* Setup an event
  */
@@ -638,9 +715,7 @@ static int perf_setup_event(perfdata_t *inst, const char *eventname, const int c
             info->idx = arg.idx;
 
             info->hw.disabled = 1;
-            info->hw.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
-            info->fd = perf_event_open(&info->hw, -1, info->cpu, -1, 0);
-            if(info->fd == -1)
+            if(perf_group_open(inst, info) == -1)
             {
                 fprintf(stderr, "perf_event_open failed on cpu%d for \"%s\": %s\n", 
                         info->cpu, curr->name, strerror(errno) );
@@ -750,10 +825,8 @@ static int perf_setup_dynamic_events(perfdata_t *inst,
                 info->hw.config1 = event_ptr->config1;
                 info->hw.config2 = event_ptr->config2;
                 info->hw.disabled = 1;
-                info->hw.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
 
-                info->fd = perf_event_open(&info->hw, -1, info->cpu, -1, 0);
-                if(info->fd == -1) {
+                if(perf_group_open(inst, info) == -1) {
                     fprintf(stderr, "perf_event_open failed on cpu%d for \"%s\": %s\n",
                             info->cpu, curr->name, strerror(errno) );
                     free_eventcpuinfo(info);
@@ -957,37 +1030,37 @@ void perf_event_destroy(perfhandle_t *inst)
     rapl_destroy();
 }
 
+/*
+ * Enable or disable every counter.  Only the group leaders are switched,
+ * since a group member that is switched separately stops counting; the
+ * members count whenever their leader does.
+ */
 int perf_counter_enable(perfhandle_t *inst, int enable)
 {
-    int idx, cpuidx, ret;
+    int i, idx, ret;
     int n = 0;
+    int request = (enable == PERF_COUNTER_ENABLE) ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE;
     perfdata_t *pdata = (perfdata_t *)inst;
 
     for(idx = 0; idx < pdata->nevents; ++idx)
     {
-        event_t *event = &pdata->events[idx];
-	if (event->disable_event) {
+	if (pdata->events[idx].disable_event) {
 	    ++n;
-	    continue;
 	}
+    }
 
-        for(cpuidx = 0; cpuidx < event->ncpus; ++cpuidx)
-        {
-            eventcpuinfo_t *info = &event->info[cpuidx];
+    for(i = 0; i < pdata->ngroups; ++i)
+    {
+        perf_group_t *group = &pdata->groups[i];
 
-            if( info->type == EVENT_TYPE_PERF && info->fd >= 0 ) 
-            {
-                int request = (enable == PERF_COUNTER_ENABLE) ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE;
-                ret = ioctl(info->fd, request, 0);
-                if( ret == -1 )
-                {
-                    fprintf(stderr, "ioctl failed for cpu%d for \"%s\": %s\n", info->cpu, event->name, strerror(errno) );
-                }
-                else
-                {
-                    ++n;
-                }
-            }
+        ret = ioctl(group->fd, request, 0);
+        if( ret == -1 )
+        {
+            fprintf(stderr, "ioctl failed for cpu%d for a group of %d events: %s\n", group->cpu, group->nmembers, strerror(errno) );
+        }
+        else
+        {
+            n += group->nmembers;
         }
     }
 
@@ -1089,10 +1162,130 @@ static int perf_derived_get(perf_derived_counter **derived_counters,
     return 0;
 }
 
+/*
+ * Read every group of counters, and the RAPL counters, into the
+ * values of each eventcpuinfo_t taking part in this sample.
+ */
+static void perf_read(perfdata_t *pdata)
+{
+    int i, j, idx, cpuidx, ret;
+    ssize_t len;
+
+    for(i = 0; i < pdata->ngroups; ++i)
+    {
+        perf_group_t *group = &pdata->groups[i];
+
+        len = (3 + group->nmembers) * sizeof *group->values;
+        if (read(group->fd, group->values, len) != len) {
+            fprintf(stderr, "cannot read group of %d events on cpu %d: %s\n", group->nmembers, group->cpu, strerror(errno));
+            continue;
+        }
+        for(j = 0; j < group->nmembers && j < group->values[0]; ++j)
+        {
+            eventcpuinfo_t *info = group->members[j];
+
+            info->values[RAW_VALUE] = group->values[3 + j];
+            info->values[TIME_ENABLED] = group->values[1];
+            info->values[TIME_RUNNING] = group->values[2];
+            info->sampled = 1;
+        }
+    }
+
+    for(idx = 0; idx < pdata->nevents; ++idx)
+    {
+        event_t *event = &pdata->events[idx];
+
+	if (event->disable_event) {
+	    continue;
+	}
+        for(cpuidx = 0; cpuidx < event->ncpus; ++cpuidx)
+        {
+            eventcpuinfo_t *info = &event->info[cpuidx];
+
+            if( info->type != EVENT_TYPE_RAPL ) {
+                continue;
+            }
+            ret = rapl_read( &info->rapldata, &info->values[0] );
+            if ( ret != 0 ) {
+                fprintf(stderr, "cannot read event %s on cpu %d:%d\n", event->name, info->cpu, ret);
+                continue;
+            }
+            info->sampled = 1;
+        }
+    }
+}
+
+/*
+ * Take a sample of all counters, and publish the values for perf_get().
+ * The counters are read before the snapshot is updated, so a concurrent
+ * perf_get() only retries (never waits) for the brief update itself.
+ * Untrusted samples (after the counters were disabled) report zero
+ * events read, as do perf_get() calls until the next sample.
+ */
+int perf_sample(perfhandle_t *inst, int trusted)
+{
+    int cpuidx, idx, events_read;
+
+    if(NULL == inst)
+    {
+        return -E_PERFEVENT_LOGIC;
+    }
+
+    perfdata_t *pdata = (perfdata_t *)inst;
+
+    perf_read(pdata);
+
+    pdata->seq++;
+    __sync_synchronize();
+
+    events_read = 0;
+    for(idx = 0; idx < pdata->nevents; ++idx)
+    {
+        event_t *event = &pdata->events[idx];
+        perf_data *data = pdata->snapshot[idx].data;
+
+	if (event->disable_event) {
+	    continue;
+	}
+
+        for(cpuidx = 0; cpuidx < event->ncpus; ++cpuidx)
+        {
+            eventcpuinfo_t *info = &event->info[cpuidx];
+
+            if (!info->sampled) {
+                continue;
+            }
+            info->sampled = 0;
+
+            if( info->type == EVENT_TYPE_PERF ) {
+                ++events_read;
+                data[cpuidx].value += scaled_value_delta(info);
+                data[cpuidx].time_enabled = info->values[TIME_ENABLED];
+                data[cpuidx].time_running = info->values[TIME_RUNNING];
+            } else {
+                data[cpuidx].value = info->values[0];
+                data[cpuidx].time_enabled = 1;
+                data[cpuidx].time_running = 1;
+            }
+        }
+    }
+    pdata->nread = trusted ? events_read : 0;
+
+    __sync_synchronize();
+    pdata->seq++;
+
+    return events_read;
+}
+
+/*
+ * Copy the values of the latest sample (see perf_sample()) to the
+ * caller's counters, retrying if a sample was published meanwhile.
+ */
 int perf_get(perfhandle_t *inst, perf_counter **counters, int *size,
              perf_derived_counter **derived_counters, int *derived_size)
 {
-    int cpuidx, idx, events_read;
+    int idx, events_read;
+    unsigned int seq;
 
     if(NULL == inst)
     {
@@ -1115,7 +1308,6 @@ int perf_get(perfhandle_t *inst, perf_counter **counters, int *size,
         ncounters = pdata->nevents;
     }
 
-    events_read = 0;
     for(idx = 0; idx < pdata->nevents; ++idx)
     {
         event_t *event = &pdata->events[idx];
@@ -1132,46 +1324,27 @@ int perf_get(perfhandle_t *inst, perf_counter **counters, int *size,
             memset(pcounter[idx].data, 0, event->ncpus * sizeof *pcounter[idx].data);
             pcounter[idx].ninstances = event->ncpus;
         }
+    }
 
-        for(cpuidx = 0; cpuidx < event->ncpus; ++cpuidx)
+    do {
+        while ((seq = pdata->seq) & 1)
         {
-            eventcpuinfo_t *info = &event->info[cpuidx];
-
-            int ret;
-
-            if( info->type == EVENT_TYPE_PERF ) {
-                ret = read(info->fd, info->values, sizeof(info->values));
-                if (ret != sizeof(info->values)) {
-                    if (ret == -1)
-                        fprintf(stderr, "cannot read event %s on cpu %d:%d\n", event->name, info->cpu, ret);
-                    else
-                        fprintf(stderr, "could not read event %s on cpu %d\n", event->name, info->cpu);
-                    continue;
-                }
-                else
-                {
-                    ++events_read;
-                }
-
-                pcounter[idx].data[cpuidx].value += scaled_value_delta(info);
-                pcounter[idx].data[cpuidx].time_enabled = info->values[TIME_ENABLED];
-                pcounter[idx].data[cpuidx].time_running = info->values[TIME_RUNNING];
-                pcounter[idx].data[cpuidx].id = info->cpu;
-            } else {
-
-                ret = rapl_read( &info->rapldata, &info->values[0] );
-                if ( ret != 0 ) {
-                    fprintf(stderr, "cannot read event %s on cpu %d:%d\n", event->name, info->cpu, ret);
-                    continue;
-                }
+            sched_yield();
+        }
+        __sync_synchronize();
 
-                pcounter[idx].data[cpuidx].value = info->values[0];
-                pcounter[idx].data[cpuidx].time_enabled = 1;
-                pcounter[idx].data[cpuidx].time_running = 1;
-                pcounter[idx].data[cpuidx].id = info->cpu;
+        for(idx = 0; idx < pdata->nevents; ++idx)
+        {
+            if (pcounter[idx].counter_disabled) {
+                continue;
             }
+            memcpy(pcounter[idx].data, pdata->snapshot[idx].data,
+                   pcounter[idx].ninstances * sizeof *pcounter[idx].data);
         }
-    }
+        events_read = pdata->nread;
+
+        __sync_synchronize();
+    } while (seq != pdata->seq);
 
     *counters = pcounter;
     *size = ncounters;
@@ -1182,7 +1355,43 @@ int perf_get(perfhandle_t *inst, perf_counter **counters, int *size,
     return events_read;
 }
 
-perfhandle_t *perf_event_create(const char *config_file)
+/*
+ * Allocate the published copy of the counter values, see perf_sample()
+ */
+static int perf_snapshot_create(perfdata_t *inst)
+{
+    int idx, cpuidx;
+
+    inst->snapshot = calloc(inst->nevents, sizeof *inst->snapshot);
+    if (NULL == inst->snapshot) {
+        return -E_PERFEVENT_REALLOC;
+    }
+
+    for(idx = 0; idx < inst->nevents; ++idx)
+    {
+        event_t *event = &inst->events[idx];
+        perf_counter *counter = &inst->snapshot[idx];
+
+        counter->name = event->name;
+        counter->counter_disabled = event->disable_event;
+        if (event->disable_event) {
+            continue;
+        }
+        counter->data = calloc(event->ncpus, sizeof *counter->data);
+        if (NULL == counter->data) {
+            return -E_PERFEVENT_REALLOC;
+        }
+        counter->ninstances = event->ncpus;
+        for(cpuidx = 0; cpuidx < event->ncpus; ++cpuidx)
+        {
+            counter->data[cpuidx].id = event->info[cpuidx].cpu;
+        }
+    }
+
+    return 0;
+}
+
+perfhandle_t *perf_event_create(const char *config_file, int groupsize)
 {
     int ret, i;
     perfdata_t *inst = 0;
@@ -1204,6 +1413,7 @@ perfhandle_t *perf_event_create(const char *config_file)
         return 0;
     }
     memset(inst, 0, sizeof *inst);
+    inst->groupsize = groupsize > 0 ? groupsize : 1;
 
     rapl_init();
 
@@ -1254,7 +1464,7 @@ perfhandle_t *perf_event_create(const char *config_file)
 
 out:
 
-    if(0 == inst->nevents)
+    if(0 == inst->nevents || perf_snapshot_create(inst) < 0)
     {
         free_perfdata(inst);
         rapl_destroy();
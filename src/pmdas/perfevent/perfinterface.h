@@ -67,8 +67,19 @@ typedef struct eventcpuinfo_t_ {
     char *fstr; /* fstr from library, must be freed */
     rapl_data_t rapldata;
     int cpu;
+    int sampled; /* values are from the current sample */
 } eventcpuinfo_t;
 
+/* Counters of one PMU on one cpu, read together with PERF_FORMAT_GROUP */
+typedef struct perf_group_t_ {
+    int fd; /* group leader */
+    int cpu;
+    uint32_t type;
+    int nmembers;
+    eventcpuinfo_t **members; /* in the order of the values read */
+    uint64_t *values; /* nr, time_enabled, time_running, value[nr] */
+} perf_group_t;
+
 typedef struct event_t_ {
     char *name;
     int disable_event;
@@ -108,11 +119,21 @@ typedef struct perfdata_t_
      * robin' mode */
     int roundrobin_cpu_idx;
     int roundrobin_nodecpu_idx;
+
+    /* groups of counters, at most groupsize events in each */
+    int ngroups;
+    perf_group_t *groups;
+    int groupsize;
+
+    /* values of the latest sample, see perf_sample() and perf_get() */
+    perf_counter *snapshot;
+    int nread;
+    volatile unsigned int seq; /* odd while a sample is being published */
 } perfdata_t;
 
 typedef intptr_t perfhandle_t;
 
-perfhandle_t *perf_event_create(const char *configfile);
+perfhandle_t *perf_event_create(const char *configfile, int groupsize);
 
 void perf_counter_destroy(perf_counter *data, int size, perf_derived_counter *derived_counter, int derived_size);
 
@@ -122,6 +143,8 @@ void perf_event_destroy(perfhandle_t *inst);
 #define PERF_COUNTER_DISABLE 1
 int perf_counter_enable(perfhandle_t *inst, int enable);
 
+int perf_sample(perfhandle_t *inst, int trusted);
+
 int perf_get(perfhandle_t *inst, perf_counter **data, int *size, perf_derived_counter **derived_counter, int *derived_size);
 
 #define E_PERFEVENT_LOGIC 1
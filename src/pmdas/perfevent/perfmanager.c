@@ -31,17 +31,23 @@
 
 #define WAIT_TIME_NS (100 * 1000 * 1000 )
 
+/*
+ * The monitor thread checks the lock file and samples the counters, every
+ * sample_ticks waits of WAIT_TIME_NS.  It is the only thread using the
+ * counter file descriptors after setup; perf_get_r() copies the values of
+ * the latest sample without waiting for it (see perf_sample()).
+ */
 typedef struct monitor {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     int running;
 
-    pthread_mutex_t counter_mutex;
-    int counter_state;
+    volatile int counter_state;
     int lockfp;
 
     int has_been_disabled;
-    int first_time;
+    int sample_ticks;
+    int ticks;
 
     perfhandle_t *perf;
 } monitor_t;
@@ -91,7 +97,7 @@ static void increment_ns(struct timespec *ts, int value_ns)
     }
 }
 
-static monitor_t *monitor_init(int lockfp, perfhandle_t *perf)
+static monitor_t *monitor_init(int lockfp, perfhandle_t *perf, int interval_ms)
 {
     monitor_t *m;
 
@@ -104,11 +110,15 @@ static monitor_t *monitor_init(int lockfp, perfhandle_t *perf)
     pthread_mutex_init(&m->mutex, NULL);
     pthread_cond_init(&m->cond, NULL);
     m->running = 1;
-    pthread_mutex_init(&m->counter_mutex, NULL);
     m->counter_state = PERF_COUNTER_DISABLE;
     m->lockfp = lockfp;
-    m->first_time = 1;
+    /* never enabled yet, so the first sample spans a disabled period */
     m->has_been_disabled = 1;
+    m->sample_ticks = ((long long)interval_ms * 1000 * 1000) / WAIT_TIME_NS;
+    if (m->sample_ticks < 1) {
+        m->sample_ticks = 1;
+    }
+    m->ticks = 0;
     m->perf = perf;
 
     return m;
@@ -119,7 +129,6 @@ static void monitor_destroy(monitor_t *del)
     if(del->lockfp != -1) {
         close(del->lockfp);
     }
-    pthread_mutex_destroy(&del->counter_mutex);
     pthread_cond_destroy(&del->cond);
     pthread_mutex_destroy(&del->mutex);
 
@@ -129,41 +138,22 @@ static void monitor_destroy(monitor_t *del)
 int perf_get_r(perfmanagerhandle_t *inst, perf_counter **data, int *size, perf_derived_counter **derived_counter, int *derived_size)
 {
     monitor_t *m = ((manager_t *)inst)->monitor;
-    int res = 0;
-   
-    pthread_mutex_lock( &m->counter_mutex );
-    /* Read the performance counters if they are enabled or if this
-     * is the first call (since the counter data is populated on the 
-     * first call regardless of the enable/disable state */
-    if(m->counter_state == PERF_COUNTER_ENABLE || m->first_time) 
-    {
-        res = perf_get(m->perf, data, size, derived_counter, derived_size);
-        m->first_time = 0;
+    int res;
 
-        if(m->has_been_disabled)
-        {
-            /* The counters were disabled at some point between the last call
-             * and this call. Reset the flag, and inform the caller that
-             * the counter values can't be trusted
-             */
-            m->has_been_disabled = 0;
-            res = 0;
-        }
+    /* The values are those of the latest sample, taken while enabled */
+    res = perf_get(m->perf, data, size, derived_counter, derived_size);
+    if(res > 0 && m->counter_state != PERF_COUNTER_ENABLE)
+    {
+        res = 0;
     }
-    pthread_mutex_unlock( &m->counter_mutex );
     return res;
 }
 
 int perf_enabled(perfmanagerhandle_t *inst)
 {
     manager_t *mgr = (manager_t *)inst;
-    int res;
-   
-    pthread_mutex_lock( &mgr->monitor->counter_mutex );
-    res = mgr->monitor->counter_state == PERF_COUNTER_ENABLE;
-    pthread_mutex_unlock( &mgr->monitor->counter_mutex );
 
-    return res;
+    return mgr->monitor->counter_state == PERF_COUNTER_ENABLE;
 }
 
 static void *runner(void *data)
@@ -186,7 +176,6 @@ static void *runner(void *data)
             /* Check the lock file */
             res = checkfile( this->lockfp );
             if ( res != -1 ) {
-                pthread_mutex_lock(&this->counter_mutex);
                 if ( this->counter_state != res ) {
                     perf_counter_enable( this->perf, res );
                     if( res == PERF_COUNTER_DISABLE) 
@@ -195,12 +184,21 @@ static void *runner(void *data)
                     }
                     this->counter_state = res;
                 }
-                pthread_mutex_unlock(&this->counter_mutex);
             }
             else {
                 fprintf(stderr, "TODO");
                 // Handle error
             }
+
+            /* Sample the counters, unless disabled */
+            if ( ++this->ticks >= this->sample_ticks ) {
+                this->ticks = 0;
+                if ( this->counter_state == PERF_COUNTER_ENABLE ) {
+                    /* values spanning a disabled period can't be trusted */
+                    perf_sample( this->perf, !this->has_been_disabled );
+                    this->has_been_disabled = 0;
+                }
+            }
         }
 
     }
@@ -214,7 +212,7 @@ static void *runner(void *data)
     return data;
 }
 
-perfmanagerhandle_t *manager_init(const char *configfilename)
+perfmanagerhandle_t *manager_init(const char *configfilename, int groupsize, int interval_ms)
 {
     int res;
     int fp;
@@ -233,7 +231,7 @@ perfmanagerhandle_t *manager_init(const char *configfilename)
 		return 0;
 	}
 
-    perfhandle_t *perf = perf_event_create(configfilename);
+    perfhandle_t *perf = perf_event_create(configfilename, groupsize);
 
     if( 0 == perf) {
         free(mgr);
@@ -241,7 +239,7 @@ perfmanagerhandle_t *manager_init(const char *configfilename)
         return 0;
     }
 
-    mgr->monitor = monitor_init(fp, perf);
+    mgr->monitor = monitor_init(fp, perf, interval_ms);
     if( 0 == mgr->monitor)
     {
         free(mgr);
@@ -249,6 +247,9 @@ perfmanagerhandle_t *manager_init(const char *configfilename)
         return 0;
     }
 
+    /* The initial (disabled) values, to populate the counters */
+    perf_sample(perf, 0);
+
     res = pthread_create(&mgr->thread, NULL, runner, mgr->monitor);
     if(res != 0 ) {
         mgr->thread = 0;
@@ -22,7 +22,7 @@
 
 typedef intptr_t perfmanagerhandle_t;
 
-perfmanagerhandle_t *manager_init(const char *configfilename);
+perfmanagerhandle_t *manager_init(const char *configfilename, int groupsize, int interval_ms);
 
 void manager_destroy(perfmanagerhandle_t *mgr);
 
@@ -179,6 +179,8 @@ static char mypath[MAXPATHLEN];
 static int	isDSO = 1;		/* =0 I am a daemon */
 static char	*username;
 static int	compat_names = 0;
+static int	groupsize = 4;		/* events read together, per cpu */
+static int	interval_ms = 1000;	/* counter sampling interval */
 
 /*
  * \brief callback function that retrieves the metric value.
@@ -393,7 +395,7 @@ static int setup_perfevents()
     int	sep = __pmPathSeparator();
     snprintf(buffer, sizeof(buffer), "%s%c" PMDANAME "%c" PMDANAME ".conf", pmGetConfig("PCP_PMDAS_DIR"), sep, sep);
 
-    perfif = manager_init(buffer);
+    perfif = manager_init(buffer, groupsize, interval_ms);
     if( 0 == perfif )
     {
         __pmNotifyErr(LOG_ERR, "Unable to create perf instance\n");
@@ -676,7 +678,9 @@ static void usage(void)
     fputs("Options:\n"
           "  -C           maintain compatibility to (possibly) nonconforming metric names\n"
           "  -d domain    use domain (numeric) for metrics domain of PMDA\n"
+          "  -g count     read up to count events of each cpu together (default 4)\n"
           "  -l logfile   write log into logfile rather than using default log name\n"
+          "  -t interval  sample the counters at this interval (default 1 second)\n"
           "  -U username  user account to run under (default \"pcp\")\n"
           "\nExactly one of the following options may appear:\n"
           "  -i port      expect PMCD to connect on given inet port (number or name)\n"
@@ -695,6 +699,8 @@ int main(int argc, char **argv)
     int			c, err = 0;
     int			sep = __pmPathSeparator();
     pmdaInterface	dispatch;
+    struct timeval	interval;
+    char		*endnum;
 
     isDSO = 0;
     __pmSetProgname(argv[0]);
@@ -705,13 +711,30 @@ int main(int argc, char **argv)
     pmdaDaemon(&dispatch, PMDA_INTERFACE_5, pmProgname, PERFEVENT,
                "perfevent.log", mypath);
 
-    while ((c = pmdaGetOpt(argc, argv, "CD:d:i:l:pu:U:6:?", &dispatch, &err)) != EOF)
+    while ((c = pmdaGetOpt(argc, argv, "CD:d:g:i:l:pt:u:U:6:?", &dispatch, &err)) != EOF)
     {
         switch(c)
         {
         case 'C':
             compat_names = 1;
             break;
+        case 'g':
+            groupsize = (int)strtol(optarg, &endnum, 10);
+            if (*endnum != '\0' || groupsize < 1) {
+                fprintf(stderr, "%s: -g requires a positive count\n", pmProgname);
+                err++;
+            }
+            break;
+        case 't':
+            if (pmParseInterval(optarg, &interval, &endnum) < 0) {
+                fprintf(stderr, "%s: -t requires a time interval: %s\n",
+                        pmProgname, endnum);
+                free(endnum);
+                err++;
+            } else {
+                interval_ms = interval.tv_sec * 1000 + interval.tv_usec / 1000;
+            }
+            break;
         case 'U':
             username = optarg;
             break;
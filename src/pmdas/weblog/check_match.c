@@ -20,15 +20,40 @@
  *	configfile	regex spec file as used by pmdaweblog
  *	pat_name	use only this names regex from configfile
  *	input		test input to try and match, defaults to stdin
+ *
+ * Lines for the default CERN and NS_PROXY patterns are also matched with
+ * the tokenizer pmdaweblog uses for them, and any difference between the
+ * tokenizer and regexec() is reported.
  */
 
 #include <ctype.h>
-#include <pmapi.h>
+#include "weblog.h"
 #if defined(HAVE_REGEX_H)
 #include <regex.h>
 #endif
 #include <sys/types.h>
 
+#ifdef HAVE_REGEXEC
+/*
+ * Does the CLF tokenizer disagree with regexec() about this line?
+ */
+static int
+clf_differs(int clf, int sts, const char *line, size_t nmatch, regmatch_t *pmatch)
+{
+    regmatch_t	cmatch[5];
+    int		i;
+
+    if (wl_clfMatch(clf, line, nmatch, cmatch) != sts)
+	return 1;
+    for (i = 0; sts == 0 && i < nmatch; i++) {
+	if (pmatch[i].rm_so != cmatch[i].rm_so ||
+	    pmatch[i].rm_eo != cmatch[i].rm_eo)
+	    return 1;
+    }
+    return 0;
+}
+#endif
+
 int
 main(int argc, char *argv[])
 {
@@ -55,6 +80,9 @@ main(int argc, char *argv[])
     regex_t	re = {0};
     regmatch_t	pmatch[5];
     size_t	nmatch = 5;
+    int		clf = wl_clfNone;
+    int		sts;
+    long	mismatches = 0;
 #endif    
 
 
@@ -172,6 +200,9 @@ main(int argc, char *argv[])
 #ifdef HAVE_REGCOMP
 		fprintf(stderr, "%s[%d]: regex_posix: %s\n", argv[1], lno, q);
 		fclose(fc);
+		if ((clf = wl_clfType(q)) != wl_clfNone)
+		    fprintf(stderr, "CLF tokenizer: %s\n",
+			    clf == wl_clfProxy ? "NS_PROXY" : "CERN");
 		if(regcomp(&re, q, REG_EXTENDED) != 0 ) {
 		    fprintf(stderr, "Error: bad regular expression\n");
 		    exit(1);
@@ -213,7 +244,12 @@ main(int argc, char *argv[])
 	lno++;
 	if(regex_posix) {
 #ifdef HAVE_REGEXEC
-	    if(regexec(&re, buf, nmatch, pmatch, 0) == 0) {
+	    sts = regexec(&re, buf, nmatch, pmatch, 0);
+	    if (clf != wl_clfNone && clf_differs(clf, sts, buf, nmatch, pmatch)) {
+		fprintf(stderr, "[%d] CLF mismatch: %s", lno, buf);
+		mismatches++;
+	    }
+	    if(sts == 0) {
 		buf[pmatch[methodpos].rm_eo] = '\0';
 		buf[pmatch[sizepos].rm_eo] = '\0';
                 if(common_extended_format || squid_format) {
@@ -373,6 +409,12 @@ main(int argc, char *argv[])
 	}
     }
 
+#ifdef HAVE_REGEXEC
+    if (clf != wl_clfNone)
+	fprintf(stderr, "CLF tokenizer: %ld mismatches in %d lines\n",
+		mismatches, lno);
+#endif
+
     if(common_extended_format || squid_format) {
 	fprintf(stderr,"Proxy Cache Summary Report\n\n");
 
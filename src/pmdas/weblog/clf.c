@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ * 
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "weblog.h"
+
+/*
+ * The default CERN (common log format) and NS_PROXY (extended log format)
+ * regexes from the Install script are recognised when the configuration
+ * file is parsed, and lines in these formats are then split up by
+ * wl_clfMatch() rather than regexec().  The CERN pattern is listed twice
+ * as echo in some shells collapses the doubled backslash in Install.
+ * check_match uses this code too, and reports any line where it differs
+ * from regexec().
+ */
+
+static const struct {
+    const char	*pattern;
+    int		type;
+} clfPatterns[] = {
+    { "][ \\\\]+\"([A-Za-z][-A-Za-z]+) [^\"]*\" [-0-9]+ ([-0-9]+)",
+	wl_clfCommon },
+    { "][ \\]+\"([A-Za-z][-A-Za-z]+) [^\"]*\" [-0-9]+ ([-0-9]+)",
+	wl_clfCommon },
+    { "][ ]+\"([A-Za-z][-A-Za-z]+) [^\"]*\" ([-0-9]+) ([-0-9]+) ([-0-9]+)",
+	wl_clfProxy },
+};
+
+int
+wl_clfType(const char *pattern)
+{
+    int		i;
+
+    for (i = 0; i < sizeof(clfPatterns) / sizeof(clfPatterns[0]); i++)
+	if (strcmp(pattern, clfPatterns[i].pattern) == 0)
+	    return clfPatterns[i].type;
+    return wl_clfNone;
+}
+
+#define clf_alpha(c)	(((c) >= 'A' && (c) <= 'Z') || ((c) >= 'a' && (c) <= 'z'))
+#define clf_digit(c)	(((c) >= '0' && (c) <= '9') || (c) == '-')
+
+/*
+ * Match a line as regexec() would for the CERN or NS_PROXY regex, and
+ * fill in pmatch[] the same way.  Every part of these patterns is fixed
+ * by the character that follows it (no backtracking is possible), so
+ * trying each ']' in the line in turn finds the same leftmost match.
+ */
+
+int
+wl_clfMatch(int type, const char *line, size_t nmatch, regmatch_t *pmatch)
+{
+    regmatch_t	match[5];
+    const char	*start;
+    const char	*p;
+    const char	*q;
+    int		fields = (type == wl_clfProxy) ? 3 : 2;
+    int		f;
+    int		g;
+    int		i;
+
+    for (start = strchr(line, ']'); start; start = strchr(start + 1, ']')) {
+
+	/* ][ ]+" or ][ \\]+" */
+	for (p = start + 1; *p == ' ' || (*p == '\\' && type == wl_clfCommon); p++)
+	    ;
+	if (p == start + 1 || *p != '"')
+	    continue;
+
+	/* ([A-Za-z][-A-Za-z]+) [^"]*" */
+	q = ++p;
+	if (!clf_alpha(*q))
+	    continue;
+	for (q++; clf_alpha(*q) || *q == '-'; q++)
+	    ;
+	if (q - p < 2 || *q != ' ')
+	    continue;
+	match[1].rm_so = p - line;
+	match[1].rm_eo = q - line;
+	if ((q = strchr(q + 1, '"')) == NULL)
+	    continue;
+
+	/* status and size fields, each " [-0-9]+" */
+	g = 2;
+	for (f = 0, p = q + 1; f < fields; f++, p = q) {
+	    if (*p++ != ' ' || !clf_digit(*p))
+		break;
+	    for (q = p + 1; clf_digit(*q); q++)
+		;
+	    if (type == wl_clfProxy || f == 1) {
+		match[g].rm_so = p - line;
+		match[g].rm_eo = q - line;
+		g++;
+	    }
+	}
+	if (f < fields)
+	    continue;
+
+	match[0].rm_so = start - line;
+	match[0].rm_eo = q - line;
+	for (i = 0; i < nmatch; i++) {
+	    if (i < g)
+		pmatch[i] = match[i];
+	    else
+		pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+	}
+	return 0;
+    }
+    return REG_NOMATCH;
+}
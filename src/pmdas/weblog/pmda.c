@@ -1,7 +1,7 @@
 /*
  * Web PMDA, based on generic driver for a daemon-based PMDA
  *
- * Copyright (c) 2012 Red Hat.
+ * Copyright (c) 2012,2017 Red Hat.
  * Copyright (c) 2000-2003 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -64,6 +64,9 @@ __uint32_t	wl_sprocThresh = 80;
 /* number of sprocs spawned */
 __uint32_t	wl_numSprocs = 0;
 
+/* maximum number of log parsing sprocs, overrides wl_sprocThresh */
+static __uint32_t	wl_numWorkers = 0;
+
 /* number of regex parsed */
 __uint32_t	wl_numRegex = 0;
 
@@ -111,6 +114,8 @@ Options\n\
   -t delay	maximum number of seconds between reading weblog files\n\
   -u socket	expect PMCD to connect on given unix domain socket\n\
   -U username   user account to run under (default \"pcp\")\n\
+  -w num	share the web server logs evenly between at most num\n\
+		processes (overrides -S)\n\
   -6 port	expect PMCD to connect on given ipv6 port (number or name)\n\
 \n\
 If none of the -i, -p or -u options are given, the configuration file is\n\
@@ -484,7 +489,7 @@ main(int argc, char **argv)
     pmdaDaemon(&desc, PMDA_INTERFACE_2, pmProgname, WEBSERVER,
 		wl_logFile, wl_helpFile);
 
-    while ((n = pmdaGetOpt(argc, argv, "CD:d:h:i:l:n:pS:t:u:U:6:?", 
+    while ((n = pmdaGetOpt(argc, argv, "CD:d:h:i:l:n:pS:t:u:U:w:6:?", 
 			   &desc, &err)) != EOF) {
 	switch (n) {
 
@@ -531,6 +536,15 @@ main(int argc, char **argv)
 	    wl_username = optarg;
 	    break;
 
+	case 'w':
+	    wl_numWorkers = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || wl_numWorkers == 0) {
+		fprintf(stderr, "%s: -w requires a positive numeric argument\n",
+			pmProgname);
+		err++;
+	    }
+	    break;
+
 	default:
 	    fprintf(stderr, "%s: Unknown option \"-%c\"", pmProgname, (char)n);
 	    err++;
@@ -730,11 +744,14 @@ main(int argc, char **argv)
 		yyerror("unable to compile regex");
 		continue;
 	    }
+	    wl_regexTable[wl_numRegex].pattern = strdup(buf1);
+	    wl_regexTable[wl_numRegex].clf = wl_clfType(buf1);
 
 #ifdef PCP_DEBUG
 	    if (pmDebug & DBG_TRACE_APPL0)
-	    	logmessage(LOG_DEBUG, "%d regex %s: %s\n", 
-			wl_numRegex, wl_regexTable[wl_numRegex].name, buf1);
+	    	logmessage(LOG_DEBUG, "%d regex %s: %s%s\n", 
+			wl_numRegex, wl_regexTable[wl_numRegex].name, buf1,
+			wl_regexTable[wl_numRegex].clf ? " (CLF)" : "");
 #endif
 
 	    wl_regexTable[wl_numRegex].posix_regexp = 1;
@@ -821,6 +838,8 @@ main(int argc, char **argv)
 #endif
 
 	    wl_regexTable[wl_numRegex].posix_regexp = 0;
+	    wl_regexTable[wl_numRegex].pattern = (char *)0;
+	    wl_regexTable[wl_numRegex].clf = wl_clfNone;
 	    wl_numRegex++;
 	}
 #endif
@@ -1057,6 +1076,10 @@ main(int argc, char **argv)
 
     /* fire off all the sprocs that we need */
 
+    if (wl_numWorkers > wl_numServers)
+	wl_numWorkers = wl_numServers;
+    if (wl_numWorkers)
+	wl_sprocThresh = (wl_numServers + wl_numWorkers - 1) / wl_numWorkers;
     wl_numSprocs = (wl_numServers-1) / wl_sprocThresh;
     wl_sproc = (WebSproc*)malloc((wl_numSprocs+1) * sizeof(WebSproc));
     if (wl_sproc == NULL) {
@@ -1079,6 +1102,8 @@ main(int argc, char **argv)
 	    proc->c_statusStr = (char *)0;
 	    proc->s_statusStr = (char *)0;
 	    proc->strLength = 0;
+	    proc->regex = (regex_t *)0;
+	    proc->lines = 0;
 	}
 
     if (wl_numSprocs) {
@@ -1154,8 +1179,9 @@ main(int argc, char **argv)
 	    }
 #endif
 
-	    /* close off unwanted pipes */
+	    /* close off unwanted pipes, unless shared with a thread */
 
+#if !defined(HAVE_PTHREAD_H)
 	    if(close(proc->inFD[0]) < 0) {
 		logmessage(LOG_WARNING,
 			   "main: pipe close(fd=%d) failed: %s\n",
@@ -1166,6 +1192,7 @@ main(int argc, char **argv)
 			   "main: pipe close(fd=%d) failed: %s\n",
 			   proc->outFD[1], osstrerror());
 	    }
+#endif
 	}
     }
 
@@ -1,6 +1,7 @@
 /*
  * Web PMDA, based on generic driver for a daemon-based PMDA
  *
+ * Copyright (c) 2017 Red Hat.
  * Copyright (c) 2000,2004 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -27,13 +28,17 @@
 #endif
 
 #if defined(HAVE_PTHREAD_H)
-static pthread_t sproc_thread;
-
 int sproc (void (*entry) (void *), int flags, void *arg)
 {
-    int	retval;
+    pthread_t	sproc_thread;
+    int		sts;
 
-    retval = pthread_create(&sproc_thread, NULL, (void (*))entry, NULL);
-    return retval;
+    sts = pthread_create(&sproc_thread, NULL, (void *(*)(void *))entry, arg);
+    if (sts != 0) {
+	setoserror(sts);
+	return -1;
+    }
+    pthread_detach(sproc_thread);
+    return 0;
 }
 #endif
@@ -1,4 +1,5 @@
 /*
+ * Copyright (c) 2017 Red Hat.
  * Copyright (c) 2000,2004 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -35,7 +36,7 @@ enum MetaType {
     wl_serverAggregate, wl_requestMethod, wl_bytesMethod,
     wl_requestSize, wl_requestCachedSize, wl_requestUncachedSize,
     wl_bytesSize, wl_bytesCachedSize, wl_bytesUncachedSize,
-    wl_watched, wl_numAlive, wl_nosupport, wl_numMetaTypes
+    wl_watched, wl_numAlive, wl_numLines, wl_nosupport, wl_numMetaTypes
 };
 
 /*
@@ -384,6 +385,8 @@ WebMetric wl_metricInfo[] =
     { wl_bytesUncachedSize, (__psint_t)wl_gt3m },
 /* perserver.logidletime */
     { wl_offset32, (__psint_t)&dummyCount.modTime },
+/* allservers.lines */
+    { wl_numLines, (__psint_t)0 },
 };
 
 /*
@@ -1182,6 +1185,15 @@ static pmdaMetric    wl_metrics[] = {
     { PMDA_PMID(2,68), PM_TYPE_U32, WEBLOG_INDOM, PM_SEM_DISCRETE, 
     	PMDA_PMUNITS(0, 1, 0, 0, PM_TIME_SEC, 0) } },
 
+/*
+ * Added in PCP 3.12.1
+ */
+
+/* allservers.lines */
+{ (void *)0,
+    { PMDA_PMID(1,81), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, 
+    	PMDA_PMUNITS(0, 0, 1, 0, 0, PM_COUNT_ONE) } },
+
 };
 
 /* number of metrics */
@@ -1214,7 +1226,7 @@ long wl_sizes[] = {
 
 static pmdaExt		*extp;		/* set in web_init() */
 
-#ifdef HAVE_SIGHUP
+#if defined(HAVE_SIGHUP) && !defined(HAVE_PTHREAD_H)
 /*
  * Signal handler for an sproc receiving TERM (probably from parent)
  */
@@ -1285,6 +1297,25 @@ more:
     goto more;
 }
 
+/*
+ * Match a line against the regex for a log format, using the sproc's
+ * own copy of the regex where it has one - regexec() serialises the
+ * callers sharing a compiled regex.
+ */
+
+static int
+wl_match(WebSproc *proc, u_int format, const char *line,
+	 size_t nmatch, regmatch_t *pmatch)
+{
+    WebRegex	*wr = &wl_regexTable[format];
+
+    if (wr->clf != wl_clfNone)
+	return wl_clfMatch(wr->clf, line, nmatch, pmatch);
+    if (proc->regex != NULL)
+	return regexec(&proc->regex[format], line, nmatch, pmatch, 0);
+    return regexec(wr->regex, line, nmatch, pmatch, 0);
+}
+
 /*
  * Open a log file and seek to the end
  */
@@ -1563,6 +1594,11 @@ sprocMain(void *sprocNum)
     /* Pause a sec' so the output log doesn't get mucked up */
     sleep(1);
 
+#if !defined(HAVE_PTHREAD_H)
+/*
+ * sprocs are separate processes - threads share signal handlers and file
+ * descriptors with the main process, which is still using them
+ */
 #ifdef HAVE_SIGHUP
     /* SIGHUP when the parent dies */
     signal(SIGHUP, onhup);
@@ -1600,6 +1636,29 @@ sprocMain(void *sprocNum)
     	logmessage(LOG_ERR, "sprocMain[%d]: pipe close(fd=%d) failed: %s\n",
 		   mySprocNum, sprocData->outFD[0], osstrerror());
     }
+#endif
+
+/* compile private copies of the regexs not handled by wl_clfMatch */
+
+    sprocData->regex = (regex_t *)calloc(wl_numRegex, sizeof(regex_t));
+    for (i = 0; sprocData->regex && i < wl_numRegex; i++) {
+	if (!wl_regexTable[i].posix_regexp ||
+	    wl_regexTable[i].clf != wl_clfNone)
+	    continue;
+	if (regcomp(&sprocData->regex[i], wl_regexTable[i].pattern,
+		    REG_EXTENDED) != 0) {
+	    logmessage(LOG_WARNING, "sprocMain[%d]: regcomp %s failed, "
+		       "sharing regex with main process\n",
+		       mySprocNum, wl_regexTable[i].name);
+	    while (--i >= 0) {
+		if (wl_regexTable[i].posix_regexp &&
+		    wl_regexTable[i].clf == wl_clfNone)
+		    regfree(&sprocData->regex[i]);
+	    }
+	    free(sprocData->regex);
+	    sprocData->regex = NULL;
+	}
+    }
     
 /* open up all file descriptors */
 
@@ -1733,6 +1792,7 @@ refresh(WebSproc* proc)
 		    }
 
 		    accessFile->fileStat.st_size += sts;
+		    proc->lines++;
 
 		    if (proc->strLength == 0 || proc->strLength <= sts)
 			newLength = sts > 255 ? ((sts / 256) + 1) * 256 : 256;
@@ -1783,8 +1843,8 @@ refresh(WebSproc* proc)
                     ok = 0;
 
                     if (wl_regexTable[accessFile->format].posix_regexp) {
-                        if (regexec(wl_regexTable[accessFile->format].regex,
-                            line, nmatch, pmatch, 0) == 0) {
+                        if (wl_match(proc, accessFile->format,
+                            line, nmatch, pmatch) == 0) {
             
                             if(pmatch[1].rm_so < 0 || pmatch[2].rm_so < 0) {
                                 logmessage(LOG_ERR,
@@ -2200,10 +2260,11 @@ refresh(WebSproc* proc)
                     }
 
                     errorFile->fileStat.st_size += sts;
+                    proc->lines++;
 
                     if(wl_regexTable[errorFile->format].posix_regexp) {
-			if (regexec(wl_regexTable[errorFile->format].regex,
-			      line, nmatch, pmatch, 0) == 0) {
+			if (wl_match(proc, errorFile->format,
+			      line, nmatch, pmatch) == 0) {
 			    server->counts.errors++;
 			}
 #ifdef NON_POSIX_REGEX
@@ -2989,6 +3050,14 @@ web_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *ext)
                 atom.ul = tmp32;
                 break;
 
+            case wl_numLines:
+                /* sum of the counts kept privately by each sproc */
+                tmp64 = 0;
+                for (s = 0; s <= wl_numSprocs; s++)
+                    tmp64 += wl_sproc[s].lines;
+                atom.ull = tmp64;
+                break;
+
             case wl_nosupport:
                 haveValue = 0;
                 break;
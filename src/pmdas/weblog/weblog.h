@@ -1,5 +1,6 @@
 
 /*
+ * Copyright (c) 2017 Red Hat.
  * Copyright (c) 2000 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -91,14 +92,25 @@ typedef struct {
     char        *c_statusStr;
     char        *s_statusStr;
     int		strLength;
+    regex_t	*regex;		/* private copies of wl_regexTable regex */
+    __uint64_t	lines;		/* log lines read by this sproc */
 } WebSproc;
 
+/*
+ * Common log formats matched without regexec, see wl_clfMatch()
+ */
+enum CLF_Types {
+    wl_clfNone, wl_clfCommon, wl_clfProxy
+};
+
 typedef struct {
     char*	name;
 #ifdef NON_POSIX_REGEX
     char        *np_regex;
 #endif
     regex_t* 	regex;
+    char	*pattern;	/* source of regex, for per-sproc copies */
+    int		clf;		/* CLF_Types, wl_clfNone to use regex */
     int		methodPos;
     int		sizePos;
     int         c_statusPos;
@@ -128,6 +140,8 @@ extern char		wl_helpFile[];
 extern int		wl_isDSO;
 
 int openLogFile(FileInfo*);
+int wl_clfType(const char *);
+int wl_clfMatch(int, const char *, size_t, regmatch_t *);
 void probe(void);
 void refresh(WebSproc*);
 void refreshAll(void);